@@ -0,0 +1,27 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#include <stddef.h>
+#include "bench.h"
+
+volatile uint32_t bench_sink;
+
+uint8_t Bench_get_case_count(void)
+{
+    return bench_driver_case_count + bench_scheduler_case_count;
+}
+
+const bench_case_t * Bench_get_case(uint8_t index)
+{
+    if (index < bench_driver_case_count)
+    {
+        return &bench_driver_cases[index];
+    }
+    index -= bench_driver_case_count;
+    if (index < bench_scheduler_case_count)
+    {
+        return &bench_scheduler_cases[index];
+    }
+    return NULL;
+}
@@ -0,0 +1,51 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+/**
+ * \brief   Maximum number of input sizes of a benchmark case
+ */
+#define BENCH_MAX_SIZES (4)
+
+/**
+ * \brief   Benchmark of one hot path routine over a set of input sizes
+ */
+typedef struct
+{
+    const char * name;                  /* routine benchmarked */
+    const char * unit;                  /* what the size counts: bytes, regs, coils, tasks */
+    uint16_t sizes[BENCH_MAX_SIZES];    /* 0 terminated if less than BENCH_MAX_SIZES */
+    void (*prepare)(uint16_t size);     /* builds the input, not timed */
+    void (*run)(uint32_t iterations);   /* timed */
+} bench_case_t;
+
+/**
+ * \brief   Result of a routine, written by the benchmarks so they are not optimised out
+ */
+extern volatile uint32_t bench_sink;
+
+extern const bench_case_t bench_driver_cases[];
+extern const uint8_t bench_driver_case_count;
+extern const bench_case_t bench_scheduler_cases[];
+extern const uint8_t bench_scheduler_case_count;
+
+/**
+ * \brief   All the benchmark cases, driver first
+ */
+uint8_t Bench_get_case_count(void);
+const bench_case_t * Bench_get_case(uint8_t index);
+
+#ifdef MODBUS_BENCH
+/**
+ * \brief   App scheduler task of the benchmark image: runs one case per call and
+ *          sends its result on DEBUG_EP (bench_target_record_t)
+ */
+uint32_t Bench_target_task(void);
+#endif
+
+#endif //BENCH_H
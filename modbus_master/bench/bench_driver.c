@@ -0,0 +1,171 @@
+//
+// Created by Maverick on 18/10/26.
+//
+// Driver hot paths. The driver is built inside this unit to reach its static routines.
+// Frames are built but not put on the line: the UART, the RS485 turnaround delay and
+// the reply timeout task are left out so only the cpu work is timed.
+//
+
+#include "../../../../mcu/hal_api/usart.h"
+#include "../../../../libraries/scheduler/app_scheduler.h"
+#include "../../iws_libraries/utils/iws_defines.h"
+
+#undef DELAY_IN_MS
+#define DELAY_IN_MS(ms)
+#define Usart_sendBuffer(buffer, length) (length)
+#define App_Scheduler_addTask_execTime(cb, delay_ms, exec_time_us) bench_add_task(cb)
+
+static app_scheduler_res_e bench_add_task(task_cb_f cb)
+{
+    (void) cb;
+    return APP_SCHEDULER_RES_OK;
+}
+
+#include "../driver/modbus_lib.c"
+
+#include "bench.h"
+
+static uint8_t m_frame[255];
+static uint16_t m_regs[MODBUS_MAX_REGISTER_SIZE];
+static MODBUS_MASTER_QUERY m_query;
+
+/** Builds a FC3 reply of size registers in the driver rx buffer, with a valid CRC */
+static void prepare_fc3_reply(uint16_t size)
+{
+    MODBUS_HANDLER *modH = &modbusHandler;
+
+    modH->au8Buffer[ID] = 1;
+    modH->au8Buffer[FUNC] = MB_FC_READ_HOLDING_REGISTER;
+    modH->au8Buffer[2] = (uint8_t) (size * 2);
+    for (uint16_t i = 0; i < size * 2; i++)
+    {
+        modH->au8Buffer[3 + i] = (uint8_t) (i * 31);
+    }
+    modH->u8BufferSize = (uint8_t) (3 + size * 2);
+    uint16_t u16crc = calcCRC(modH->au8Buffer, modH->u8BufferSize);
+    modH->au8Buffer[modH->u8BufferSize++] = u16crc >> 8;
+    modH->au8Buffer[modH->u8BufferSize++] = u16crc & 0x00ff;
+    modH->au16regs = m_regs;
+}
+
+static void prepare_crc(uint16_t size)
+{
+    for (uint16_t i = 0; i < sizeof(m_frame); i++)
+    {
+        m_frame[i] = (uint8_t) (i * 7 + 3);
+    }
+    m_query.u16CoilsNo = size;
+}
+
+static void run_crc(uint32_t iterations)
+{
+    uint8_t length = (uint8_t) m_query.u16CoilsNo;
+    while (iterations--)
+    {
+        bench_sink += calcCRC(m_frame, length);
+    }
+}
+
+static void prepare_transmit(uint8_t fct, uint16_t size)
+{
+    memset(&m_query, 0, sizeof(m_query));
+    m_query.queryId = 1;
+    m_query.u8id = 1;
+    m_query.u8fct = fct;
+    m_query.u16RegAdd = 100;
+    m_query.u16CoilsNo = size;
+    m_query.au16reg = m_regs;
+    for (uint16_t i = 0; i < MODBUS_MAX_REGISTER_SIZE; i++)
+    {
+        m_regs[i] = (uint16_t) (i * 257);
+    }
+    modbusHandler.u8id = 0;
+}
+
+static void prepare_transmit_fc3(uint16_t size)
+{
+    prepare_transmit(MB_FC_READ_HOLDING_REGISTER, size);
+}
+
+static void prepare_transmit_fc16(uint16_t size)
+{
+    prepare_transmit(MB_FC_WRITE_MULTIPLE_REGISTERS, size);
+}
+
+static void run_transmit(uint32_t iterations)
+{
+    while (iterations--)
+    {
+        modbusHandler.i8state = COM_IDLE;
+        bench_sink += (uint32_t) transmitMasterQuery(&modbusHandler, &m_query);
+    }
+}
+
+static void run_validate_answer(uint32_t iterations)
+{
+    while (iterations--)
+    {
+        bench_sink += (uint32_t) validateAnswer(&modbusHandler);
+    }
+}
+
+static void prepare_fc1(uint16_t size)
+{
+    MODBUS_HANDLER *modH = &modbusHandler;
+
+    modH->au8Buffer[ID] = 1;
+    modH->au8Buffer[FUNC] = MB_FC_READ_COILS;
+    modH->au8Buffer[2] = (uint8_t) ((size + 7) / 8);
+    for (uint16_t i = 0; i < modH->au8Buffer[2]; i++)
+    {
+        modH->au8Buffer[3 + i] = (uint8_t) (i * 13);
+    }
+    modH->au16regs = m_regs;
+}
+
+static void run_fc1(uint32_t iterations)
+{
+    while (iterations--)
+    {
+        get_FC1(&modbusHandler);
+        bench_sink += m_regs[0];
+    }
+}
+
+static void run_fc3(uint32_t iterations)
+{
+    while (iterations--)
+    {
+        get_FC3(&modbusHandler);
+        bench_sink += m_regs[0];
+    }
+}
+
+static void prepare_byte_count(uint16_t size)
+{
+    modbusHandler.au8Buffer[FUNC] = MB_FC_READ_HOLDING_REGISTER;
+    modbusMasterQuery.u16CoilsNo = size;
+}
+
+static void run_byte_count(uint32_t iterations)
+{
+    while (iterations--)
+    {
+        byte_Count(&modbusHandler);
+        bench_sink += modbus_TLV_Data.byte_No;
+    }
+}
+
+/* Sizes are bounded by the driver buffers: MAX_SIZE_COMMS_BUFFER bytes per frame
+ * (29 registers per read, 27 per FC16 write) */
+const bench_case_t bench_driver_cases[] = {
+        {"calcCRC", "bytes", {8, 16, 64, 255}, prepare_crc, run_crc},
+        {"transmitMasterQuery_fc3", "regs", {1, 29}, prepare_transmit_fc3, run_transmit},
+        {"transmitMasterQuery_fc16", "regs", {1, 8, 16, 27}, prepare_transmit_fc16, run_transmit},
+        {"validateAnswer", "regs", {1, 8, 16, 29}, prepare_fc3_reply, run_validate_answer},
+        {"get_FC1", "coils", {8, 64, 256, 456}, prepare_fc1, run_fc1},
+        {"get_FC3", "regs", {1, 8, 16, 29}, prepare_fc3_reply, run_fc3},
+        {"byte_Count", "regs", {1, 29}, prepare_byte_count, run_byte_count},
+};
+
+const uint8_t bench_driver_case_count = sizeof(bench_driver_cases) / sizeof(bench_driver_cases[0]);
@@ -0,0 +1,80 @@
+//
+// Created by Maverick on 18/10/26.
+//
+// Scheduler hot paths. The scheduler is built inside this unit to reach its static routines.
+//
+
+#include "../query_scheduler/query_scheduler.c"
+
+#include "bench.h"
+
+/** size tasks with hp timestamps spread over the next minute */
+static void prepare_next_task(uint16_t size)
+{
+    m_max_time_ms = lib_time->getMaxHpDelay() / 1000;
+    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++)
+    {
+        memset(&m_tasks[i], 0, sizeof(task_t));
+        memset(&m_tasks[i].modbus_query, 0xFF, sizeof(query_hot_t));
+    }
+    for (uint16_t i = 0; i < size && i < QUERY_SCHEDULER_MAX_TASKS; i++)
+    {
+        // Every other slot used, as after queries were removed
+        task_t * task = &m_tasks[(i * 2) % QUERY_SCHEDULER_MAX_TASKS + (i * 2) / QUERY_SCHEDULER_MAX_TASKS];
+        task->modbus_query.queryId = (uint8_t) i;
+        get_timestamp(&task->next_ts, (i * 7919) % 60000);
+    }
+}
+
+/** size tasks, every other one on an hour period (coarse timestamp) */
+static void prepare_next_task_mixed(uint16_t size)
+{
+    prepare_next_task(size);
+    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i += 4)
+    {
+        if (m_tasks[i].modbus_query.queryId != 0xFF)
+        {
+            get_timestamp(&m_tasks[i].next_ts, 3600000UL + i * 1000UL);
+        }
+    }
+}
+
+static void run_next_task(uint32_t iterations)
+{
+    while (iterations--)
+    {
+        bench_sink += (uint32_t) (uintptr_t) get_next_task_locked();
+    }
+}
+
+static uint8_t m_report[MODBUS_MAX_REGISTER_SIZE * 2];
+static uint8_t m_report_length;
+
+/** Reply identical to the last reported one, query in the last slot: full scan */
+static void prepare_report(uint16_t size)
+{
+    prepare_next_task(QUERY_SCHEDULER_MAX_TASKS / 2);
+    m_tasks[QUERY_SCHEDULER_MAX_TASKS - 1].modbus_query.queryId = QUERY_SCHEDULER_MAX_TASKS;
+    for (uint16_t i = 0; i < sizeof(m_report); i++)
+    {
+        m_report[i] = (uint8_t) (i * 5);
+    }
+    m_report_length = (uint8_t) size;
+    Query_Scheduler_isReportRepeated(QUERY_SCHEDULER_MAX_TASKS, m_report, m_report_length);
+}
+
+static void run_report(uint32_t iterations)
+{
+    while (iterations--)
+    {
+        bench_sink += Query_Scheduler_isReportRepeated(QUERY_SCHEDULER_MAX_TASKS, m_report, m_report_length);
+    }
+}
+
+const bench_case_t bench_scheduler_cases[] = {
+        {"get_next_task_locked", "tasks", {1, 15, 30, 60}, prepare_next_task, run_next_task},
+        {"get_next_task_mixed", "tasks", {1, 15, 30, 60}, prepare_next_task_mixed, run_next_task},
+        {"isReportRepeated", "bytes", {2, 16, 32, 56}, prepare_report, run_report},
+};
+
+const uint8_t bench_scheduler_case_count = sizeof(bench_scheduler_cases) / sizeof(bench_scheduler_cases[0]);
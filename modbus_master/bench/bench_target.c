@@ -0,0 +1,82 @@
+//
+// Created by Maverick on 18/10/26.
+//
+// On target run of the benchmarks, cycles counted by the Cortex-M DWT cycle counter.
+// Built only in the benchmark image (MODBUS_BENCH=yes).
+//
+
+#include <stdint.h>
+#include "api.h"
+#include "../../../../libraries/scheduler/app_scheduler.h"
+#include "../../iws_libraries/utils/iws_defines.h"
+#include "../../iws_libraries/utils/iws.h"
+#include "bench.h"
+
+#define BENCH_TARGET_ITERATIONS 1000
+#define BENCH_TARGET_PERIOD_MS  200         // leaves the stack time to send the record
+#define BENCH_TARGET_CPU_HZ     64000000    // nRF52 core clock
+
+#define DEMCR       (*(volatile uint32_t *) 0xE000EDFC)
+#define DWT_CTRL    (*(volatile uint32_t *) 0xE0001000)
+#define DWT_CYCCNT  (*(volatile uint32_t *) 0xE0001004)
+
+#define DEMCR_TRCENA        (1UL << 24)
+#define DWT_CTRL_CYCCNTENA  (1UL << 0)
+
+/**
+ * \brief   Result of one case and size, sent on DEBUG_EP
+ */
+typedef struct __attribute__((packed))
+{
+    uint8_t caseIndex;      // index in Bench_get_case()
+    uint8_t sizeIndex;      // index in the sizes of the case
+    uint16_t size;
+    uint32_t iterations;
+    uint32_t cycles;        // for all the iterations
+    uint32_t cpuHz;
+} bench_target_record_t;
+
+static uint8_t m_case;
+static uint8_t m_size;
+
+uint32_t Bench_target_task(void)
+{
+    const bench_case_t * bench = Bench_get_case(m_case);
+
+    if (bench == NULL)
+    {
+        // All done
+        return APP_SCHEDULER_STOP_TASK;
+    }
+
+    uint16_t size = bench->sizes[m_size];
+    bench->prepare(size);
+
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+
+    Sys_enterCriticalSection();
+    uint32_t start = DWT_CYCCNT;
+    bench->run(BENCH_TARGET_ITERATIONS);
+    uint32_t cycles = DWT_CYCCNT - start;
+    Sys_exitCriticalSection();
+
+    bench_target_record_t record = {
+            .caseIndex = m_case,
+            .sizeIndex = m_size,
+            .size = size,
+            .iterations = BENCH_TARGET_ITERATIONS,
+            .cycles = cycles,
+            .cpuHz = BENCH_TARGET_CPU_HZ,
+    };
+    _send_data((uint8_t *) &record, sizeof(record), APP_ADDR_ANYSINK, DEBUG_EP, DEBUG_EP);
+
+    m_size++;
+    if (m_size == BENCH_MAX_SIZES || bench->sizes[m_size] == 0)
+    {
+        m_size = 0;
+        m_case++;
+    }
+    return BENCH_TARGET_PERIOD_MS;
+}
@@ -15,4 +15,12 @@
 #define MODBUS_QUERY_REMOVE                 0x6200 //Modbus all query remove attribute
 #define HEARTBEAT_ATTR_ID  	                0x01    // Heartbeat Attribute
 #define MODBUS_TLV_ATTR_ID                0x5500 // Modbus attribute
+#define UPLINK_BUDGET_ATTR_ID               0xA100 // Radio uplink budget rates (saved) and usage
+#define MODBUS_RULES_ATTR_ID                0xA200 // Local rules (query condition -> write)
+#define QUERY_STATS_ATTR_ID                 0xA300 // Per query and per slave counters (read only, paged)
+#define BUS_ADMISSION_ATTR_ID               0xA400 // Bus load ceiling of the periodic queries and current load
+#define MASK_WRITE_ATTR_ID                  0xA500 // One time FC22 mask write of a slave register (write only)
+#define WRITE_COMBINING_ATTR_ID             0xA600 // Window merging one time FC5/FC6 writes in FC15/FC16 frames
+#define BUS_SCAN_ATTR_ID                    0xA700 // Slave discovery: write starts a scan, read gets the responders (paged)
+#define BLOCK_LIMIT_ATTR_ID                 0xA800 // Largest read per frame of the slaves, probed or set
 #endif // CONFIG_H
@@ -0,0 +1,229 @@
+/**
+ * @file modbus_decode.c
+ *
+ * @brief Typed decoding and scaling of MODBUS register replies
+ *
+ * The descriptor is resolved once per reply into a small plan (words per value, signedness,
+ * scaling factor, saturation limits) so the per value loop only does shifts, one multiply or
+ * divide and a clamp. The arithmetic stays on 32 bits, the Cortex-M4 has no 64 bit divide:
+ * each step saturates instead of overflowing.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "modbus_decode.h"
+
+#define DECODE_MAX_SCALE    (9)
+
+static const int32_t m_pow10[DECODE_MAX_SCALE + 1] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+/* Decode plan resolved from a descriptor */
+typedef struct {
+    uint8_t words;      /* Registers per value */
+    uint8_t width;      /* Reported bytes per value */
+    bool isSigned;
+    bool isFloat;
+    bool wordSwap;
+    bool byteSwap;
+    uint32_t fieldMask; /* 0 when no bit field */
+    uint8_t fieldPos;
+    int32_t mul;        /* One of mul or div is 1 */
+    int32_t div;
+    float fscale;
+    int32_t min;        /* Signed values */
+    int32_t max;
+    uint32_t umax;      /* Unsigned values, from 0 */
+} decode_plan_t;
+
+static bool buildPlan(const modbus_decode_t *decode, decode_plan_t *plan) {
+    uint8_t naturalWidth;
+
+    switch (decode->dataType) {
+        case DECODE_UINT16:
+        case DECODE_INT16:
+            plan->words = 1;
+            naturalWidth = 2;
+            break;
+        case DECODE_UINT32:
+        case DECODE_INT32:
+        case DECODE_FLOAT32:
+            plan->words = 2;
+            naturalWidth = 4;
+            break;
+        default:
+            return false;
+    }
+
+    plan->isFloat = (decode->dataType == DECODE_FLOAT32);
+    plan->isSigned = (decode->dataType == DECODE_INT16) || (decode->dataType == DECODE_INT32) || plan->isFloat;
+    plan->wordSwap = (decode->order & DECODE_WORD_SWAP) != 0;
+    plan->byteSwap = (decode->order & DECODE_BYTE_SWAP) != 0;
+
+    plan->fieldMask = 0;
+    plan->fieldPos = 0;
+    if ((decode->bitLen > 0) && !plan->isFloat && (decode->bitPos < plan->words * 16)) {
+        plan->fieldPos = decode->bitPos;
+        plan->fieldMask = (decode->bitLen >= 32) ? 0xFFFFFFFF : ((1UL << decode->bitLen) - 1);
+        plan->isSigned = false;
+    }
+
+    plan->width = (decode->width == 1 || decode->width == 2 || decode->width == 4) ? decode->width : naturalWidth;
+
+    int8_t scale = decode->scale;
+    if (scale > DECODE_MAX_SCALE) scale = DECODE_MAX_SCALE;
+    if (scale < -DECODE_MAX_SCALE) scale = -DECODE_MAX_SCALE;
+    plan->mul = (scale > 0) ? m_pow10[scale] : 1;
+    plan->div = (scale < 0) ? m_pow10[-scale] : 1;
+    plan->fscale = (float) plan->mul / (float) plan->div;
+
+    plan->max = (plan->width == 4) ? INT32_MAX : (int32_t) ((1UL << (plan->width * 8 - 1)) - 1);
+    plan->min = -plan->max - 1;
+    plan->umax = (plan->width == 4) ? UINT32_MAX : (1UL << (plan->width * 8)) - 1;
+    return true;
+}
+
+static int32_t scaleSigned(const decode_plan_t *plan, int32_t value, int16_t offset) {
+    if (plan->mul != 1) {
+        // Out of any width once scaled, the offset can't bring it back
+        if (value > INT32_MAX / plan->mul) {
+            return plan->max;
+        } else if (value < INT32_MIN / plan->mul) {
+            return plan->min;
+        }
+        value *= plan->mul;
+    } else if (plan->div != 1) {
+        // Round half away from zero
+        int32_t rest = value % plan->div;
+        value /= plan->div;
+        if (rest >= plan->div - rest) {
+            value++;
+        } else if (-rest >= plan->div + rest) {
+            value--;
+        }
+    }
+
+    if (offset > 0 && value > INT32_MAX - offset) {
+        value = INT32_MAX;
+    } else if (offset < 0 && value < INT32_MIN - offset) {
+        value = INT32_MIN;
+    } else {
+        value += offset;
+    }
+
+    if (value > plan->max) value = plan->max;
+    if (value < plan->min) value = plan->min;
+    return value;
+}
+
+static uint32_t scaleUnsigned(const decode_plan_t *plan, uint32_t value, int16_t offset) {
+    if (plan->mul != 1) {
+        if (value > UINT32_MAX / (uint32_t) plan->mul) {
+            return plan->umax;
+        }
+        value *= (uint32_t) plan->mul;
+    } else if (plan->div != 1) {
+        // Round half up
+        uint32_t rest = value % (uint32_t) plan->div;
+        value /= (uint32_t) plan->div;
+        if (rest >= (uint32_t) plan->div - rest) {
+            value++;
+        }
+    }
+
+    if (offset >= 0) {
+        value = (value > UINT32_MAX - (uint32_t) offset) ? UINT32_MAX : value + (uint32_t) offset;
+    } else {
+        value = (value < (uint32_t) -offset) ? 0 : value - (uint32_t) -offset;
+    }
+
+    return (value > plan->umax) ? plan->umax : value;
+}
+
+bool Modbus_decode_isActive(const modbus_decode_t *decode) {
+    return (decode->dataType >= DECODE_UINT16) && (decode->dataType <= DECODE_FLOAT32);
+}
+
+uint8_t Modbus_decode(const modbus_decode_t *decode, const uint16_t *regs, uint8_t regCount,
+                      uint8_t *out, uint8_t outSize) {
+    decode_plan_t plan;
+    uint8_t written = 0;
+
+    if (!buildPlan(decode, &plan)) {
+        return 0;
+    }
+
+    for (uint8_t i = 0; i + plan.words <= regCount; i += plan.words) {
+        uint16_t hi = regs[i];
+        uint16_t lo = (plan.words == 2) ? regs[i + 1] : 0;
+        uint32_t raw;
+        uint32_t value;
+
+        if (written + plan.width > outSize) {
+            break;
+        }
+
+        if (plan.byteSwap) {
+            hi = (uint16_t) ((hi << 8) | (hi >> 8));
+            lo = (uint16_t) ((lo << 8) | (lo >> 8));
+        }
+        if (plan.words == 1) {
+            raw = hi;
+        } else if (plan.wordSwap) {
+            raw = ((uint32_t) lo << 16) | hi;
+        } else {
+            raw = ((uint32_t) hi << 16) | lo;
+        }
+
+        if (plan.isFloat) {
+            float f;
+            memcpy(&f, &raw, sizeof(f));
+            f = f * plan.fscale + (float) decode->offset;
+            // Round half away from zero, NaN ends up as 0
+            if (f != f) {
+                value = 0;
+            } else if (f >= (float) plan.max) {
+                value = (uint32_t) plan.max;
+            } else if (f <= (float) plan.min) {
+                value = (uint32_t) plan.min;
+            } else {
+                value = (uint32_t) (int32_t) ((f < 0) ? (f - 0.5f) : (f + 0.5f));
+            }
+        } else if (plan.fieldMask != 0) {
+            value = scaleUnsigned(&plan, (raw >> plan.fieldPos) & plan.fieldMask, decode->offset);
+        } else if (plan.isSigned) {
+            value = (uint32_t) scaleSigned(&plan, (plan.words == 1) ? (int16_t) raw : (int32_t) raw, decode->offset);
+        } else {
+            value = scaleUnsigned(&plan, raw, decode->offset);
+        }
+
+        // Little-endian, same byte order as the raw register report
+        for (uint8_t b = 0; b < plan.width; b++) {
+            out[written++] = (uint8_t) (value >> (8 * b));
+        }
+    }
+
+    return written;
+}
+
+bool Modbus_select_isActive(uint32_t mask) {
+    return (mask != 0) && (mask != 0xFFFFFFFF);
+}
+
+uint8_t Modbus_select_registers(uint32_t mask, const uint16_t *regs, uint8_t regCount, uint16_t *selected) {
+    uint8_t count = 0;
+
+    if (regCount > MODBUS_SELECT_MAX_REGS) {
+        regCount = MODBUS_SELECT_MAX_REGS;
+    }
+
+    for (uint8_t i = 0; (i < regCount) && (mask != 0); i++, mask >>= 1) {
+        if (mask & 1) {
+            selected[count++] = regs[i];
+        }
+    }
+    return count;
+}
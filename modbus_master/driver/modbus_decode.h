@@ -0,0 +1,115 @@
+/**
+ * @file modbus_decode.h
+ *
+ * @brief Typed decoding and scaling of MODBUS register replies
+ *
+ * A decode descriptor is attached to each read query. It turns the raw register words of a
+ * FC3/FC4 reply into typed, scaled values reported in their natural compact width.
+ * A selection mask can reduce the reply to the registers of interest before decoding.
+ */
+
+#ifndef MODBUS_DECODE_H
+#define MODBUS_DECODE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @enum MODBUS_DATA_TYPE
+ * @brief Type of the values held in the registers of a reply.
+ */
+typedef enum {
+    DECODE_RAW     = 0, /*!< No decoding, registers are reported as read */
+    DECODE_UINT16  = 1, /*!< One register, unsigned */
+    DECODE_INT16   = 2, /*!< One register, signed */
+    DECODE_UINT32  = 3, /*!< Two registers, unsigned */
+    DECODE_INT32   = 4, /*!< Two registers, signed */
+    DECODE_FLOAT32 = 5  /*!< Two registers, IEEE-754 single precision */
+} MODBUS_DATA_TYPE;
+
+#define DECODE_WORD_SWAP    (1 << 0) /*!< 32 bit values have their low word first */
+#define DECODE_BYTE_SWAP    (1 << 1) /*!< Registers have their low byte first */
+
+/**
+ * @struct modbus_decode_t
+ * @brief Per query decode descriptor.
+ *
+ * value = ((raw >> bitPos) & (2^bitLen - 1)) * 10^scale + offset
+ * Bit field extraction is skipped when bitLen is 0 and makes the value unsigned.
+ * The result is saturated to the reported width.
+ * A descriptor left erased (0xFF) decodes as DECODE_RAW.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t dataType;   /*!< MODBUS_DATA_TYPE */
+    uint8_t order;      /*!< DECODE_WORD_SWAP | DECODE_BYTE_SWAP */
+    uint8_t width;      /*!< Reported width in bytes: 1, 2 or 4. Other values use the width of the type */
+    int8_t scale;       /*!< Decimal exponent applied to the value (-9..9) */
+    int16_t offset;     /*!< Added to the value after scaling */
+    uint8_t bitPos;     /*!< First bit of the bit field */
+    uint8_t bitLen;     /*!< Length of the bit field, 0 to disable */
+} modbus_decode_t;
+
+/**
+ * @brief Tells if a descriptor requires decoding.
+ *
+ * @param decode descriptor
+ *
+ * @return true if the reply has to go through Modbus_decode()
+ */
+bool Modbus_decode_isActive(const modbus_decode_t *decode);
+
+/**
+ * @brief Decodes a block of registers.
+ *
+ * Values are written little-endian, one after the other, in the reported width.
+ * Registers left over at the end of the block (odd count for 32 bit types) are ignored.
+ *
+ * @param decode descriptor
+ * @param regs register words as read from the slave
+ * @param regCount number of registers in regs
+ * @param out destination buffer
+ * @param outSize size of the destination buffer
+ *
+ * @return number of bytes written in out
+ */
+uint8_t Modbus_decode(const modbus_decode_t *decode, const uint16_t *regs, uint8_t regCount,
+                      uint8_t *out, uint8_t outSize);
+
+/**
+ * @brief Number of registers a selection mask can address.
+ * Registers after the first MODBUS_SELECT_MAX_REGS of a read are never selected.
+ */
+#define MODBUS_SELECT_MAX_REGS  (32)
+
+/**
+ * @brief Tells if a query selection mask reduces the reported registers.
+ *
+ * @param mask bitmap over the read range, bit 0 is the first register read.
+ *             0 and 0xFFFFFFFF (erased) mean every register.
+ *
+ * @return true if the reply has to go through Modbus_select_registers()
+ */
+bool Modbus_select_isActive(uint32_t mask);
+
+/**
+ * @brief Keeps only the selected registers of a block.
+ *
+ * @param mask bitmap over the read range, bit 0 is the first register read
+ * @param regs register words as read from the slave
+ * @param regCount number of registers in regs
+ * @param selected destination, at least MODBUS_SELECT_MAX_REGS registers
+ *
+ * @return number of registers written in selected
+ */
+uint8_t Modbus_select_registers(uint32_t mask, const uint16_t *regs, uint8_t regCount, uint16_t *selected);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MODBUS_DECODE_H */
@@ -0,0 +1,182 @@
+/**
+ * @file modbus_edge.c
+ *
+ * @brief Edge detection on coil and discrete input bitmaps (FC1/FC2)
+ *
+ * Inputs are handled 32 at a time on packed words. Each input has a 3 bit counter of
+ * consecutive polls where it differs from its stable level. The counters are stored as
+ * bit planes (vertical counters) so a whole word of inputs is counted, compared and reset
+ * with a handful of XOR/AND operations, whatever the number of changes.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "api.h"
+#include "modbus_edge.h"
+
+#define EDGE_WORDS  (EDGE_MAX_INPUTS / 32)
+
+typedef struct {
+    uint8_t queryId;                /* 0xFF when free */
+    uint32_t stable[EDGE_WORDS];    /* Debounced level of the inputs */
+    uint32_t c0[EDGE_WORDS];        /* Counter bit planes */
+    uint32_t c1[EDGE_WORDS];
+    uint32_t c2[EDGE_WORDS];
+    app_lib_time_timestamp_coarse_t samples[EDGE_MAX_DEBOUNCE]; /* Time of the last samples, the edge age */
+    uint8_t polls;                  /* Samples since the last bitmap report */
+} edge_state_t;
+
+static edge_state_t m_edges[EDGE_MAX_QUERIES];
+static bool m_initialized = false;
+
+static void edge_init(void) {
+    memset(m_edges, 0, sizeof(m_edges));
+    for (uint8_t i = 0; i < EDGE_MAX_QUERIES; i++) {
+        m_edges[i].queryId = 0xFF;
+    }
+    m_initialized = true;
+}
+
+static uint32_t load_word(const uint8_t *bitmap, uint16_t inputs, uint8_t word) {
+    uint32_t value = 0;
+    uint8_t firstByte = word * 4;
+    uint8_t bytes = (inputs + 7) / 8;
+
+    for (uint8_t b = 0; b < 4 && (firstByte + b) < bytes; b++) {
+        value |= (uint32_t) bitmap[firstByte + b] << (8 * b);
+    }
+    // Mask out padding bits of the last byte
+    if (inputs < (word + 1) * 32) {
+        value &= (inputs > word * 32) ? ((1UL << (inputs - word * 32)) - 1) : 0;
+    }
+    return value;
+}
+
+bool Modbus_edge_isActive(uint8_t debounce) {
+    return (debounce >= 1) && (debounce <= EDGE_MAX_DEBOUNCE);
+}
+
+int8_t Modbus_edge_process(uint8_t queryId, uint8_t debounce,
+                           const uint8_t *bitmap, uint16_t inputs, uint8_t *events, uint8_t eventsSize) {
+    edge_state_t *state = NULL;
+    edge_state_t *free = NULL;
+    uint8_t written = 0;
+    app_lib_time_timestamp_coarse_t now = lib_time->getTimestampCoarse();
+
+    if (!m_initialized) {
+        edge_init();
+    }
+    if (inputs > EDGE_MAX_INPUTS) {
+        inputs = EDGE_MAX_INPUTS;
+    }
+
+    for (uint8_t i = 0; i < EDGE_MAX_QUERIES; i++) {
+        if (m_edges[i].queryId == queryId) {
+            state = &m_edges[i];
+            break;
+        }
+        if (free == NULL && m_edges[i].queryId == 0xFF) {
+            free = &m_edges[i];
+        }
+    }
+
+    if (state == NULL) {
+        if (free != NULL) {
+            // First sample is the baseline, reported as a bitmap
+            memset(free, 0, sizeof(edge_state_t));
+            free->queryId = queryId;
+            for (uint8_t w = 0; w < EDGE_WORDS; w++) {
+                free->stable[w] = load_word(bitmap, inputs, w);
+            }
+            free->samples[0] = now;
+            free->polls = 1;
+        }
+        return -1;
+    }
+
+    // Age of a reported edge: it was first seen debounce - 1 polls ago, at the
+    // time of that poll whatever the period was stretched to
+    state->samples[state->polls % EDGE_MAX_DEBOUNCE] = now;
+    uint32_t ticks = now - state->samples[(state->polls + EDGE_MAX_DEBOUNCE - (debounce - 1)) % EDGE_MAX_DEBOUNCE];
+    // 1000 / 128 ms per coarse tick, applied as * 125 / 16
+    uint32_t age = (ticks > (uint32_t) UINT16_MAX * 16 / 125) ? UINT16_MAX : ticks * 125 / 16;
+    // Bitmap again now and then, a lost report does not stay wrong on the backend
+    bool refresh = ++state->polls >= EDGE_REFRESH_POLLS;
+
+    // All ones in the planes where the target count has a one
+    uint32_t n0 = (debounce & 1) ? 0xFFFFFFFF : 0;
+    uint32_t n1 = (debounce & 2) ? 0xFFFFFFFF : 0;
+    uint32_t n2 = (debounce & 4) ? 0xFFFFFFFF : 0;
+
+    uint32_t sample[EDGE_WORDS];
+    uint32_t changed[EDGE_WORDS];
+    uint8_t count = 0;
+
+    for (uint8_t w = 0; w < EDGE_WORDS; w++) {
+        sample[w] = load_word(bitmap, inputs, w);
+        uint32_t delta = sample[w] ^ state->stable[w];
+
+        // Inputs back to their stable level restart from 0, the others count one more poll
+        uint32_t c0 = state->c0[w] & delta;
+        uint32_t c1 = state->c1[w] & delta;
+        uint32_t c2 = state->c2[w] & delta;
+        uint32_t carry1 = c0 & delta;
+        uint32_t carry2 = c1 & carry1;
+        c0 ^= delta;
+        c1 ^= carry1;
+        c2 ^= carry2;
+
+        // Inputs that stayed changed long enough
+        changed[w] = delta & ~(c0 ^ n0) & ~(c1 ^ n1) & ~(c2 ^ n2);
+
+        state->stable[w] ^= changed[w];
+        state->c0[w] = c0 & ~changed[w];
+        state->c1[w] = c1 & ~changed[w];
+        state->c2[w] = c2 & ~changed[w];
+        count += (uint8_t) __builtin_popcount(changed[w]);
+    }
+
+    if (refresh || (count * sizeof(modbus_edge_event_t) > eventsSize)) {
+        // Time for the bitmap, or too many edges at once and the bitmap is
+        // cheaper: report it as a new baseline
+        for (uint8_t w = 0; w < EDGE_WORDS; w++) {
+            state->stable[w] = sample[w];
+            state->c0[w] = state->c1[w] = state->c2[w] = 0;
+        }
+        state->samples[0] = now;
+        state->polls = 1;
+        return -1;
+    }
+
+    for (uint8_t w = 0; w < EDGE_WORDS; w++) {
+        while (changed[w] != 0) {
+            uint8_t bit = (uint8_t) __builtin_ctz(changed[w]);
+            modbus_edge_event_t event = {
+                    .input = (uint8_t) ((w * 32 + bit) | (((state->stable[w] >> bit) & 1) << 7)),
+                    .ageMs = (uint16_t) age,
+            };
+
+            memcpy(&events[written], &event, sizeof(event));
+            written += sizeof(event);
+            changed[w] &= changed[w] - 1;
+        }
+    }
+
+    return (int8_t) written;
+}
+
+void Modbus_edge_reset(uint8_t queryId) {
+    if (!m_initialized) {
+        edge_init();
+    }
+
+    Sys_enterCriticalSection();
+    for (uint8_t i = 0; i < EDGE_MAX_QUERIES; i++) {
+        if (m_edges[i].queryId == queryId) {
+            m_edges[i].queryId = 0xFF;
+        }
+    }
+    Sys_exitCriticalSection();
+}
@@ -0,0 +1,77 @@
+/**
+ * @file modbus_edge.h
+ *
+ * @brief Edge detection on coil and discrete input bitmaps (FC1/FC2)
+ *
+ * Instead of resending the whole bitmap when any input flips, each input is debounced over
+ * a configurable number of polls and only the inputs that changed are reported.
+ */
+
+#ifndef MODBUS_EDGE_H
+#define MODBUS_EDGE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define EDGE_MAX_QUERIES    (8)     //!< Queries that can run in edge mode at the same time
+#define EDGE_MAX_INPUTS     (64)    //!< Inputs tracked per query, following ones are ignored
+#define EDGE_MAX_DEBOUNCE   (7)     //!< Polls an input must stay changed before being reported
+#ifndef EDGE_REFRESH_POLLS
+#define EDGE_REFRESH_POLLS  (60)    //!< Polls between two bitmap reports, the backend recovers from a lost report
+#endif
+
+/**
+ * @brief TLV status of a report carrying edge events instead of a bitmap
+ */
+#define MODBUS_TLV_STATUS_EDGES (16)
+
+/**
+ * @struct modbus_edge_event_t
+ * @brief One input edge as reported in the TLV data.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t input;      /*!< bits 0-6: input index in the read range, bit 7: new level */
+    uint16_t ageMs;     /*!< Time between the edge and the report, due to debouncing */
+} modbus_edge_event_t;
+
+/**
+ * @brief Tells if a query runs in edge mode.
+ *
+ * @param debounce query debounce setting, 1..EDGE_MAX_DEBOUNCE polls. 0 and 0xFF (erased) keep bitmap reports.
+ */
+bool Modbus_edge_isActive(uint8_t debounce);
+
+/**
+ * @brief Runs a new sample of a query through the debouncer.
+ *
+ * @param queryId query the sample belongs to
+ * @param debounce number of polls an input must stay changed
+ * @param bitmap inputs as received, bit 0 of byte 0 is the first input
+ * @param inputs number of inputs in the bitmap
+ * @param events destination of the modbus_edge_event_t records
+ * @param eventsSize size of events in bytes
+ *
+ * @return bytes of events written (0 if nothing changed), or -1 when the bitmap has to be
+ *         reported: query not tracked yet (first sample or no free slot), too many edges at
+ *         once, or every EDGE_REFRESH_POLLS polls.
+ */
+int8_t Modbus_edge_process(uint8_t queryId, uint8_t debounce,
+                           const uint8_t *bitmap, uint16_t inputs, uint8_t *events, uint8_t eventsSize);
+
+/**
+ * @brief Forgets the state of a query, next sample will be a new baseline.
+ *
+ * Also called when a report could not be sent, the next poll reports the bitmap again.
+ */
+void Modbus_edge_reset(uint8_t queryId);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MODBUS_EDGE_H */
@@ -35,6 +35,14 @@ Copyright (c) ** NEED TO ADD COPYRIGHT NOTE HERE **. All rights reserved.
 #include "hal_api.h"
 #include "api.h"
 #include "modbus_lib.h"
+#include "modbus_edge.h"
+#include "modbus_trace.h"
+#include "../query_scheduler/query_stats.h"
+#include "../query_scheduler/query_scheduler.h"
+#include "../query_scheduler/query_cost.h"
+#include "../query_scheduler/query_scan.h"
+#include "../query_scheduler/query_block.h"
+#include "../log/modbus_log.h"
 #include "../../../../mcu/hal_api/usart.h"
 //#include "../../../../mcu/hal_api/"
 #include "../../../../libraries/scheduler/app_scheduler.h"
@@ -43,6 +51,8 @@ Copyright (c) ** NEED TO ADD COPYRIGHT NOTE HERE **. All rights reserved.
 #include "board.h"
 #include "../settings/settings.h"
 #include "../settings/modbus_settings/modbus_settings.h"
+#include "../iws/uplink_budget/uplink_budget.h"
+#include "../rules/rule_engine.h"
 // *****************************************************************************************************************
 // *****************************************************************************************************************
 // Section: Pre-processor/Macro Definitions
@@ -50,16 +60,9 @@ Copyright (c) ** NEED TO ADD COPYRIGHT NOTE HERE **. All rights reserved.
 // *****************************************************************************************************************
 #define MODBUS_RTU_FRAME_SIZE           (8)
 #define MODBUS_MASTER_REPLY_TIMEOUT     (1000) //1 sec
-#define QUERY_SIZE 60
 // *****************************************************************************************************************
 // *****************************************************************************************************************
 
-/* Struct to ensure no repetitions. */
-typedef struct {
-    uint8_t queryID;
-    uint8_t Arr[MODBUS_MAX_REGISTER_SIZE];
-} CheckData;
-
 // Section: Static / Global Variables
 // *****************************************************************************************************************
 // *****************************************************************************************************************
@@ -72,38 +75,35 @@ static MODBUS_MASTER_QUERY modbusMasterQuery;
 /* Time out Period */
 //static uint16_t ModbusMasterReplyTimeout;
 /* MODBUS Frame Flags */
+#ifdef MODBUS_SLAVE_MODE
 static bool modbusRtuSlaveModeValidFrameReceived = false;
+#endif
 static bool modbusRtuMasterModeValidFrameReceived = true;
 static bool modbusRtuMasterReplyTimeoutActive = true;
 static uint8_t modbusRtuMasterReplyActualSize = 0;
 static uint8_t modbusMasterReplyCalculatedLength = 0;
 static uint32_t mRxBufferIdx;
+#ifdef MODBUS_SLAVE_MODE
 static bool rxSlaveStatus = true;
+#endif
 static bool timeOutFirstRun = true;
-static bool sendDataTLV = false;
+/* A posted query is on the line until its reply, error or timeout */
+static bool transactionOpen = false;
+/* Time the line stays silent after the transaction, on top of the bus idle time */
+static uint32_t busHoldUs = 0;
+/* Split FC3/FC4 read: first register of the frame on the line, registers in it, next frame to send */
+static uint16_t blockOffset = 0;
+static uint16_t frameRegs = 0;
+static bool blockPending = false;
 write_configure_t configSetting;
+#ifdef MODBUS_SLAVE_MODE
 /* MODBUS RX Frame Buffer */
 static uint8_t modbusSlaveRxFrameBuffer[MODBUS_RTU_FRAME_SIZE] = {0};
+#endif
 /* Modbus_TLV_Data*/
 Modbus_TLV_Data_t  modbus_TLV_Data;
 
 
-/* Temp array to eliminate repetitive data on TLV*/
-static CheckData dataRepeated[QUERY_SIZE];
-
-/* MODBUS supported function list */
-const unsigned char modbusFunctions[] =
-        {
-                MB_FC_READ_COILS,
-                MB_FC_READ_DISCRETE_INPUT,
-                MB_FC_READ_HOLDING_REGISTER,
-                MB_FC_READ_INPUT_REGISTER,
-                MB_FC_WRITE_COIL,
-                MB_FC_WRITE_REGISTER,
-                MB_FC_WRITE_MULTIPLE_COILS,
-                MB_FC_WRITE_MULTIPLE_REGISTERS
-        };
-
 // *****************************************************************************************************************
 
 // *****************************************************************************************************************
@@ -112,28 +112,38 @@ const unsigned char modbusFunctions[] =
 // *****************************************************************************************************************
 static void modbus_rtu_uart_callback(uint8_t *chars, size_t n);
 static uint32_t modbusMasterReplyTimeoutCallBack();
-static uint8_t getModbusRxBuffer(MODBUS_HANDLER *modH);
+static uint32_t modbusMasterNextFrame();
 static bool sendTxBuffer(MODBUS_HANDLER *modH);
-static void buildException(uint8_t u8exception, MODBUS_HANDLER *modH);
-static uint8_t validateRequest(MODBUS_HANDLER *modH);
 static int8_t transmitMasterQuery(MODBUS_HANDLER *modH, MODBUS_MASTER_QUERY *f_masterQuery);
 static int8_t validateAnswer(MODBUS_HANDLER *modH);
 static uint16_t word(uint8_t H, uint8_t l);
 static uint16_t calcCRC(uint8_t *Buffer, uint8_t u8length);
 static void calculateModbusMasterReplyLength(MODBUS_MASTER_QUERY *f_masterQuery);
+#ifdef MODBUS_SLAVE_MODE
+static uint8_t getModbusRxBuffer(MODBUS_HANDLER *modH);
+static void buildException(uint8_t u8exception, MODBUS_HANDLER *modH);
+static uint8_t validateRequest(MODBUS_HANDLER *modH);
 static int8_t process_FC1(MODBUS_HANDLER *modH);
 static int8_t process_FC3(MODBUS_HANDLER *modH);
 static int8_t process_FC5(MODBUS_HANDLER *modH);
 static int8_t process_FC6(MODBUS_HANDLER *modH);
 static int8_t process_FC15(MODBUS_HANDLER *modH);
 static int8_t process_FC16(MODBUS_HANDLER *modH);
+#endif
 static void get_FC1(MODBUS_HANDLER *modH);
 static void get_FC3(MODBUS_HANDLER *modH);
 static void get_FC5(MODBUS_HANDLER *modH);
+static bool isMaskWriteEcho(MODBUS_HANDLER *modH);
 static void byte_Count(MODBUS_HANDLER *modH);
-static bool compareData(uint8_t queryNum);
+static void endTransaction(int8_t result);
+static bool isProbe(void);
+static void sendQueryTlv(uint8_t length);
+static void fillRegisterReport(MODBUS_HANDLER *modH);
+static void reportInputEdges(void);
 __STATIC_INLINE void writeRxMasterBuffer(uint8_t ch);
+#ifdef MODBUS_SLAVE_MODE
 __STATIC_INLINE void writeRxSlaveBuffer(uint8_t ch);
+#endif
 
 // *****************************************************************************************************************
 // *****************************************************************************************************************
@@ -155,19 +165,10 @@ __STATIC_INLINE void writeRxSlaveBuffer(uint8_t ch);
  */
 void modbusRtuInitialize(MODBUS_HANDLER *f_modbusHandler) {
     bool status = true;
-    DEBUG_SEND(Is_debug(), "modbus RtuInitialize ");
     write_configure_t configure = getConfiguration();
-    memset(&dataRepeated[0], '\0', sizeof(dataRepeated));
-    DEBUG_SEND(Is_debug(), "timeout is");
-    DEBUG_SEND(Is_debug(), timeoutDelayTlv.timeoutPeriod);
-    DEBUG_SEND(Is_debug(), "Delay is ");
-    DEBUG_SEND(Is_debug(), timeoutDelayTlv.delay);
-    if (timeoutDelayTlv.continuousOnTlv){
-        DEBUG_SEND(Is_debug(), "continuous data on TLV");
-    }
-    else {
-        DEBUG_SEND(Is_debug(), "changed data on TLV");
-    }
+    MODBUS_LOG_INFO(LOG_INIT_UART, configure.baudrate, configure.parity);
+    MODBUS_LOG_INFO(LOG_INIT_TIMING, timeoutDelayTlv.timeoutPeriod, timeoutDelayTlv.delay);
+    MODBUS_LOG_INFO(LOG_INIT_TLV, timeoutDelayTlv.continuousOnTlv, 0);
 
     /* Initialize the UART peripheral */
     switch(configure.baudrate) {
@@ -187,7 +188,7 @@ void modbusRtuInitialize(MODBUS_HANDLER *f_modbusHandler) {
             f_modbusHandler->baudRate = 115200;
             break;
         default:
-            DEBUG_SEND(Is_debug(), "default baud");
+            MODBUS_LOG_WARN(LOG_INIT_BAD_BAUD, configure.baudrate, f_modbusHandler->baudRate / 100);
             break;
     }
 
@@ -223,10 +224,15 @@ static uint32_t modbusMasterReplyTimeoutCallBack() {
     MODBUS_HANDLER *modH = &modbusHandler;
     if (timeOutFirstRun) {
         timeOutFirstRun = false;
+        // A probe waits just for its frames and a short turnaround
+        if (modbusMasterQuery.queryId == QUERY_SCAN_PROBE_ID)
+            return Query_scan_timeout_ms();
+        if (modbusMasterQuery.queryId == QUERY_BLOCK_PROBE_ID)
+            return Query_block_timeout_ms();
         return (uint32_t) (timeoutDelayTlv.timeoutPeriod);
     }
 
-    DEBUG_SEND(Is_debug(), "Timeout achieved");
+    MODBUS_LOG_INFO(LOG_REPLY_TIMEOUT, modbusMasterQuery.u8id, modbusMasterQuery.u8fct);
     modbusRtuMasterReplyTimeoutActive = true;
     modH->i8state = COM_IDLE;
     modH->i8lastError = NO_REPLY;
@@ -234,15 +240,67 @@ static uint32_t modbusMasterReplyTimeoutCallBack() {
     modH->masterQueryActive = false;
     modbusRtuMasterModeValidFrameReceived = false;
     modbusMasterReplyCalculatedLength = 0;
+    // drop the bytes of an incomplete reply, next one starts a new frame
+    mRxBufferIdx = 0;
+    endTransaction(NO_REPLY);
 
-    if(modbusRtuMasterReplyTimeoutActive){
+    if(modbusRtuMasterReplyTimeoutActive && !isProbe()){
         modbus_TLV_Data.detail.status = ERR_TIME_OUT;
-    _send_data((uint8_t *) &modbus_TLV_Data, 6, APP_ADDR_ANYSINK, MODBUS_TLV_EP, MODBUS_TLV_EP);
+        sendQueryTlv(6);
 
     }
     return APP_SCHEDULER_STOP_TASK;
 }
 
+/**
+ * @brief Sends the next frame of a split read.
+ *
+ * The reply of the previous frame is in, the transaction is still open.
+ */
+static uint32_t modbusMasterNextFrame() {
+    modbusHandler.masterQueryActive = true;
+    RunModbusMasterTask();
+    return APP_SCHEDULER_STOP_TASK;
+}
+
+/**
+ * @brief Bus scan and read size probes are only checked, neither reported nor acknowledged.
+ */
+static bool isProbe(void) {
+    return (modbusMasterQuery.queryId == QUERY_SCAN_PROBE_ID) || (modbusMasterQuery.queryId == QUERY_BLOCK_PROBE_ID);
+}
+
+/**
+ * @brief Closes the trace record and counts the outcome of the query on the line.
+ *
+ * @param result i8lastError of the driver
+ */
+static void endTransaction(int8_t result) {
+    uint32_t latencyUs = Modbus_trace_end(result);
+    Query_stats_result(result, latencyUs);
+    if (transactionOpen) {
+        transactionOpen = false;
+        if (modbusMasterQuery.queryId == QUERY_SCAN_PROBE_ID) {
+            Query_scan_result(modbusMasterQuery.u8id, result, modbusHandler.au8Buffer[2], latencyUs);
+        } else if (modbusMasterQuery.queryId == QUERY_BLOCK_PROBE_ID) {
+            Query_block_result(result, modbusHandler.au8Buffer[2]);
+        }
+        Query_Scheduler_busReleased(busHoldUs);
+        busHoldUs = 0;
+    }
+}
+
+/**
+ * @brief Sends the TLV of the query on the line, one per write for a combined write frame.
+ *
+ * @param length TLV length
+ */
+static void sendQueryTlv(uint8_t length) {
+    if (!Query_Scheduler_fanOutAck(&modbus_TLV_Data, length)) {
+        Uplink_budget_send((uint8_t *) &modbus_TLV_Data, length, APP_ADDR_ANYSINK, MODBUS_TLV_EP, MODBUS_TLV_EP);
+    }
+}
+
 /**
  * @brief UART peripheral call back function.
  * 
@@ -260,11 +318,10 @@ static void modbus_rtu_uart_callback(uint8_t *chars, size_t n) {
     if (n == 0 || n >= UART_RX_BUF_SIZE)
         return;
 
-    while (n--) {
-        ch = *(chars++);
-
-        if (modbusHandler.uiModbusType == MODBUS_SLAVE_RTU) {
-            writeRxSlaveBuffer(ch);
+#ifdef MODBUS_SLAVE_MODE
+    if (modbusHandler.uiModbusType == MODBUS_SLAVE_RTU) {
+        while (n--) {
+            writeRxSlaveBuffer(*(chars++));
             /* UART RX buffer has some data ready to be read */
             if ((modbusRtuSlaveModeValidFrameReceived == false) && (mRxBufferIdx >= MODBUS_RTU_FRAME_SIZE)) {
                 if (rxSlaveStatus != false) {
@@ -274,193 +331,210 @@ static void modbus_rtu_uart_callback(uint8_t *chars, size_t n) {
                 }
                 mRxBufferIdx = 0;
             }
-        } else if (modbusHandler.uiModbusType == MODBUS_MASTER_RTU) {
-            writeRxMasterBuffer(ch);
-            /* UART RX buffer has some data ready to be read */
+        }
+        return;
+    }
+#endif
 
-            if ((modbusRtuMasterModeValidFrameReceived == false) &&//should not be true every time for write
-                (mRxBufferIdx >= modbusMasterReplyCalculatedLength)) {
+    Modbus_trace_rx((uint8_t) n);
 
-                modbusRtuMasterReplyActualSize = mRxBufferIdx;
-                modbusRtuMasterModeValidFrameReceived = (modbusRtuMasterReplyActualSize > 0) ? true : false;
-                mRxBufferIdx = 0;
-            }
-        } else {
-            /* No need to handle any other events other than above */
+    while (n--) {
+        ch = *(chars++);
+
+        writeRxMasterBuffer(ch);
+        /* UART RX buffer has some data ready to be read */
+        /* An exception reply (id, fct | 0x80, code, crc) is shorter than the expected answer */
+        bool exceptionReply = (mRxBufferIdx == 5) && ((modbusHandler.au8Buffer[FUNC] & 0x80) != 0);
+
+        if ((modbusRtuMasterModeValidFrameReceived == false) &&//should not be true every time for write
+            ((mRxBufferIdx >= modbusMasterReplyCalculatedLength) || exceptionReply)) {
+
+            modbusRtuMasterReplyActualSize = mRxBufferIdx;
+            modbusRtuMasterModeValidFrameReceived = (modbusRtuMasterReplyActualSize > 0) ? true : false;
+            mRxBufferIdx = 0;
         }
     }
 
-    if (modbusHandler.uiModbusType == MODBUS_MASTER_RTU) {
-        if (((modbusRtuMasterReplyActualSize > 0) && (modbusRtuMasterModeValidFrameReceived != false)) ||
-            (modbusRtuMasterReplyTimeoutActive != false)) {
-            App_Scheduler_cancelTask(modbusMasterReplyTimeoutCallBack);
-            if (modbusRtuMasterReplyTimeoutActive != false) {
+    if (((modbusRtuMasterReplyActualSize > 0) && (modbusRtuMasterModeValidFrameReceived != false)) ||
+        (modbusRtuMasterReplyTimeoutActive != false)) {
+        App_Scheduler_cancelTask(modbusMasterReplyTimeoutCallBack);
+        if (modbusRtuMasterReplyTimeoutActive != false) {
+            modH->i8state = COM_IDLE;
+            modH->i8lastError = NO_REPLY;
+            modH->u16errCnt++;
+            modH->masterQueryActive = false;
+            modbus_TLV_Data.detail.status = NO_REPLY;
+        } else {
+            modH->u8BufferSize = modbusRtuMasterReplyActualSize;
+            modH->u16InCnt++;
+            if (isProbe()) {
+                // Bus scan or read size probe: the answer is only checked, nothing is reported
+                bool exceptionReply = (modH->u8BufferSize == 5) && ((modH->au8Buffer[FUNC] & 0x80) != 0);
+                modH->i8state = COM_IDLE;
+                modH->i8lastError = exceptionReply ? ERR_EXCEPTION
+                                                   : (modH->u8BufferSize < 6) ? ERR_BAD_SIZE : validateAnswer(modH);
+                modH->masterQueryActive = false;
+            } else if (modH->u8BufferSize < 6) {
+                // A 5 byte exception reply is complete, anything else shorter than a frame is not
+                bool exceptionReply = (modH->u8BufferSize == 5) && ((modH->au8Buffer[FUNC] & 0x80) != 0);
                 modH->i8state = COM_IDLE;
-                modH->i8lastError = NO_REPLY;
+                modH->i8lastError = exceptionReply ? ERR_EXCEPTION : ERR_BAD_SIZE;
+                if (exceptionReply) {
+                    MODBUS_LOG_INFO(LOG_REPLY_EXCEPTION, modH->au8Buffer[ID], modH->au8Buffer[FUNC]);
+                }
                 modH->u16errCnt++;
                 modH->masterQueryActive = false;
-                modbus_TLV_Data.detail.status = NO_REPLY;
-            } else {
-                modH->u8BufferSize = modbusRtuMasterReplyActualSize;
-                if (modH->u8BufferSize < 6) {
-                    modH->i8state = COM_IDLE;
-                    modH->i8lastError = ERR_BAD_SIZE;
-                    modH->u16errCnt++;
-                    modH->masterQueryActive = false;
-
-                    modbus_TLV_Data.detail.status = ERR_BAD_SIZE;
-                    _send_data((uint8_t *) &modbus_TLV_Data, send_Bytes, APP_ADDR_ANYSINK, MODBUS_TLV_EP, MODBUS_TLV_EP);
-                } else  {
-                    // validate message: id, CRC, FCT, exception
-
-                    int8_t u8exception = validateAnswer(modH);
-                    if (u8exception != 0) {
-                        modH->i8state = COM_IDLE;
-                        modH->i8lastError = u8exception;
-                    }
 
+                modbus_TLV_Data.detail.status = modH->i8lastError;
+                sendQueryTlv(send_Bytes);
+            } else  {
+                // validate message: id, CRC, FCT, exception
+
+                int8_t u8exception = validateAnswer(modH);
+                if (u8exception != 0) {
+                    modH->i8state = COM_IDLE;
                     modH->i8lastError = u8exception;
-                    //uint8_t u8byte = modH->au8Buffer[2];
+                }
+
+                modH->i8lastError = u8exception;
+                //uint8_t u8byte = modH->au8Buffer[2];
 
-                    // process answer
+                // process answer
 
-                    switch (modH->au8Buffer[FUNC]) {
-                        case MB_FC_READ_COILS:
-                        case MB_FC_READ_DISCRETE_INPUT: {
-                            //call get_FC1 to transfer the incoming message to au16regs buffer
-                            get_FC1(modH);
-                            if (u8exception != 0) {
-                                modbus_TLV_Data.detail.status = ERR_EXCEPTION;
-                            } else {
-                                modbus_TLV_Data.detail.status = ERR_OK;
-                            }
-                            byte_Count(&modbusHandler);
-                            memcpy(modbus_TLV_Data.arrData, modH->au16regs, modbus_TLV_Data.byte_No);
-                            send_Bytes += modbus_TLV_Data.byte_No;
-                            if (timeoutDelayTlv.continuousOnTlv) {
-                                _send_data((uint8_t * ) & modbus_TLV_Data, send_Bytes, APP_ADDR_ANYSINK, MODBUS_TLV_EP,
-                                           MODBUS_TLV_EP);
+                switch (modH->au8Buffer[FUNC]) {
+                    case MB_FC_READ_COILS:
+                    case MB_FC_READ_DISCRETE_INPUT: {
+                        //call get_FC1 to transfer the incoming message to au16regs buffer
+                        get_FC1(modH);
+                        if (u8exception == 0) {
+                            Rule_engine_evaluate(modbusMasterQuery.queryId, modbusMasterQuery.u8fct,
+                                                 modH->au16regs, modbusMasterQuery.u16CoilsNo);
+                        }
+                        if (u8exception != 0) {
+                            modbus_TLV_Data.detail.status = ERR_EXCEPTION;
+                        } else {
+                            modbus_TLV_Data.detail.status = ERR_OK;
+                        }
+                        byte_Count(&modbusHandler);
+                        memcpy(modbus_TLV_Data.arrData, modH->au16regs, modbus_TLV_Data.byte_No);
+                        send_Bytes += modbus_TLV_Data.byte_No;
+                        if ((u8exception == 0) && Modbus_edge_isActive(modbusMasterQuery.debounce)) {
+                            reportInputEdges();
+                        }
+                        else if (timeoutDelayTlv.continuousOnTlv) {
+                            Uplink_budget_send((uint8_t * ) & modbus_TLV_Data, send_Bytes, APP_ADDR_ANYSINK, MODBUS_TLV_EP,
+                                       MODBUS_TLV_EP);
+                        }
+                        else {
+                            if (modbusMasterQuery.oneTime) {
+                                Uplink_budget_send((uint8_t * ) & modbus_TLV_Data, send_Bytes, APP_ADDR_ANYSINK, MODBUS_TLV_EP,
+                                       MODBUS_TLV_EP);
                             }
                             else {
-                                if (modbusMasterQuery.oneTime) {
-                                    _send_data((uint8_t * ) & modbus_TLV_Data, send_Bytes, APP_ADDR_ANYSINK, MODBUS_TLV_EP,
+                                // Unchanged replies are not reported again
+                                if (!Query_Scheduler_isReportRepeated(modbusMasterQuery.queryId,
+                                                                      modbus_TLV_Data.arrData, modbus_TLV_Data.byte_No))
+                                    Uplink_budget_send((uint8_t * ) & modbus_TLV_Data, send_Bytes, APP_ADDR_ANYSINK,
+                                           MODBUS_TLV_EP,
                                            MODBUS_TLV_EP);
-                                }
-                                else {
-                                    for (uint8_t indx = 0; indx < QUERY_SIZE; indx++) {
-                                        if (dataRepeated[indx].queryID == modbusMasterQuery.queryId) {
-                                            sendDataTLV = compareData(modbusMasterQuery.queryId);
-                                            break;
-                                        }
-                                        else if ((dataRepeated[indx].queryID != modbusMasterQuery.queryId) &&
-                                               (dataRepeated[indx].queryID == 0x00)) {
-                                            dataRepeated[indx].queryID = modbusMasterQuery.queryId;
-                                            memcpy(&dataRepeated[indx].Arr, &modbus_TLV_Data.arrData,modbus_TLV_Data.byte_No);
-                                            sendDataTLV = false;
-                                            break;
-                                        }
-                                    }
-                                    if (sendDataTLV == false)
-                                        _send_data((uint8_t * ) & modbus_TLV_Data, send_Bytes, APP_ADDR_ANYSINK,
-                                               MODBUS_TLV_EP,
-                                               MODBUS_TLV_EP);
-                                }
                             }
                         }
-                        break;
+                    }
+                    break;
 
-                        case MB_FC_READ_INPUT_REGISTER:
-                        case MB_FC_READ_HOLDING_REGISTER: {
-                            // call get_FC3 to transfer the incoming message to au16regs buffer
-                            get_FC3(modH);
-                            if (u8exception != 0) {
-                                modbus_TLV_Data.detail.status = ERR_EXCEPTION;
-                            } else
-                                modbus_TLV_Data.detail.status = ERR_OK;
-                            byte_Count(&modbusHandler);
+                    case MB_FC_READ_INPUT_REGISTER:
+                    case MB_FC_READ_HOLDING_REGISTER:
+                    case MB_FC_READ_WRITE_MULTIPLE_REGISTERS: {
+                        // call get_FC3 to transfer the incoming message to au16regs buffer
+                        get_FC3(modH);
+                        if ((u8exception == 0) && (blockOffset + frameRegs < modbusMasterQuery.u16CoilsNo)) {
+                            // Split read, reported once the last frame is in
+                            blockOffset += frameRegs;
+                            blockPending = true;
+                            break;
+                        }
+                        if (u8exception == 0) {
+                            Rule_engine_evaluate(modbusMasterQuery.queryId, modbusMasterQuery.u8fct,
+                                                 modH->au16regs, modbusMasterQuery.u16CoilsNo);
+                        }
+                        if (u8exception != 0) {
+                            modbus_TLV_Data.detail.status = ERR_EXCEPTION;
+                        } else
+                            modbus_TLV_Data.detail.status = ERR_OK;
+                        byte_Count(&modbusHandler);
+                        if (u8exception == 0) {
+                            fillRegisterReport(modH);
+                        } else {
                             memcpy(modbus_TLV_Data.arrData, modH->au16regs, modbus_TLV_Data.byte_No);
-                            send_Bytes += modbus_TLV_Data.byte_No;
-                            if (timeoutDelayTlv.continuousOnTlv) {
-                                _send_data((uint8_t * ) & modbus_TLV_Data, send_Bytes, APP_ADDR_ANYSINK, MODBUS_TLV_EP,
+                        }
+                        send_Bytes += modbus_TLV_Data.byte_No;
+                        if (timeoutDelayTlv.continuousOnTlv) {
+                            Uplink_budget_send((uint8_t * ) & modbus_TLV_Data, send_Bytes, APP_ADDR_ANYSINK, MODBUS_TLV_EP,
+                                       MODBUS_TLV_EP);
+                        } else {
+                            if (modbusMasterQuery.oneTime) {
+                                Uplink_budget_send((uint8_t * ) & modbus_TLV_Data, send_Bytes, APP_ADDR_ANYSINK,
+                                           MODBUS_TLV_EP,
                                            MODBUS_TLV_EP);
                             } else {
-                                if (modbusMasterQuery.oneTime) {
-                                    _send_data((uint8_t * ) & modbus_TLV_Data, send_Bytes, APP_ADDR_ANYSINK,
+                                // Unchanged replies are not reported again
+                                if (!Query_Scheduler_isReportRepeated(modbusMasterQuery.queryId,
+                                                                      modbus_TLV_Data.arrData, modbus_TLV_Data.byte_No)) {
+                                    Uplink_budget_send((uint8_t * ) & modbus_TLV_Data, send_Bytes, APP_ADDR_ANYSINK,
                                                MODBUS_TLV_EP,
                                                MODBUS_TLV_EP);
-                                } else {
-                                    for (uint8_t indx = 0; indx < QUERY_SIZE; indx++) {
-                                        if (dataRepeated[indx].queryID == modbusMasterQuery.queryId) {
-                                            sendDataTLV = compareData(modbusMasterQuery.queryId);
-                                            break;
-                                        }
-                                        else if (dataRepeated[indx].queryID == 0) {
-                                            dataRepeated[indx].queryID = modbusMasterQuery.queryId;
-                                            memcpy(&dataRepeated[indx].Arr, &modbus_TLV_Data.arrData,
-                                                   modbus_TLV_Data.byte_No);
-                                            sendDataTLV = false;
-                                            break;
-                                        }
-                                    }
-                                    if (sendDataTLV == false) {
-                                        _send_data((uint8_t * ) & modbus_TLV_Data, send_Bytes, APP_ADDR_ANYSINK,
-                                                   MODBUS_TLV_EP,
-                                                   MODBUS_TLV_EP);
-                                    }
                                 }
                             }
                         }
-                        break;
-
-                        case MB_FC_WRITE_COIL:
-                        case MB_FC_WRITE_REGISTER:
-                        case MB_FC_WRITE_MULTIPLE_REGISTERS:
-                        case MB_FC_WRITE_MULTIPLE_COILS: {
-                            // call get_FC5 to transfer the incoming message to au16regs buffer.
-                            get_FC5(modH);
-                            if(u8exception != 0){
-                                modbus_TLV_Data.detail.status = ERR_EXCEPTION;
-                            }
-                            else
-                                modbus_TLV_Data.detail.status = ERR_OK;
+                    }
+                    break;
 
-                            byte_Count(&modbusHandler);
-                            memcpy(modbus_TLV_Data.arrData,modH->au16regs,modbus_TLV_Data.byte_No);
-                            send_Bytes += modbus_TLV_Data.byte_No;
-                            _send_data((uint8_t * ) & modbus_TLV_Data, send_Bytes, APP_ADDR_ANYSINK, MODBUS_TLV_EP,
-                                           MODBUS_TLV_EP);
-                            // as the data flow is from master to slave.
+                    case MB_FC_WRITE_COIL:
+                    case MB_FC_WRITE_REGISTER:
+                    case MB_FC_WRITE_MULTIPLE_REGISTERS:
+                    case MB_FC_WRITE_MULTIPLE_COILS:
+                    case MB_FC_MASK_WRITE_REGISTER: {
+                        if ((u8exception == 0) && (modH->au8Buffer[FUNC] == MB_FC_MASK_WRITE_REGISTER)
+                            && !isMaskWriteEcho(modH)) {
+                            u8exception = ERR_BAD_ADDRESS;
+                            modH->i8lastError = ERR_BAD_ADDRESS;
+                            modH->u16errCnt++;
                         }
-                        break;
-
-                        default:
-                            break;
+                        // call get_FC5 to transfer the incoming message to au16regs buffer.
+                        get_FC5(modH);
+                        if(u8exception != 0){
+                            modbus_TLV_Data.detail.status = (u8exception == ERR_BAD_ADDRESS) ? ERR_BAD_ADDRESS : ERR_EXCEPTION;
+                        }
+                        else
+                            modbus_TLV_Data.detail.status = ERR_OK;
+
+                        byte_Count(&modbusHandler);
+                        memcpy(modbus_TLV_Data.arrData,modH->au16regs,modbus_TLV_Data.byte_No);
+                        send_Bytes += modbus_TLV_Data.byte_No;
+                        sendQueryTlv(send_Bytes);
+                        // as the data flow is from master to slave.
                     }
-                    modH->i8state = COM_IDLE;
-                    modH->masterQueryActive = false;
+                    break;
+
+                    default:
+                        break;
                 }
+                modH->i8state = COM_IDLE;
+                modH->masterQueryActive = false;
             }
-            modbusRtuMasterModeValidFrameReceived = false;
         }
+        if (blockPending) {
+            // Next frame after the bus idle time, the transaction stays open
+            blockPending = false;
+            App_Scheduler_addTask_execTime(modbusMasterNextFrame, timeoutDelayTlv.delay, 500);
+        } else {
+            endTransaction(modH->i8lastError);
+        }
+        modbusRtuMasterModeValidFrameReceived = false;
     }
 }
 
 
-/**
- * @brief Updates MODBUS frame data to internal buffers
- * 
- * @param None
- * 
- * @return No.of bytes copied to MODBUS internal buffers;
- */
-static uint8_t getModbusRxBuffer(MODBUS_HANDLER *modH) {
-    modH->u8BufferSize = MODBUS_RTU_FRAME_SIZE;
-    uint8_t *modBusRxPacket = modbusSlaveRxFrameBuffer;
-    memcpy(modH->au8Buffer, modBusRxPacket, modH->u8BufferSize);
-    modH->u16InCnt++;
-    return modH->u8BufferSize;
-}
-
 /**
  * @brief MODBUS Master Round Robin Task
  * 
@@ -483,6 +557,22 @@ void RunModbusMasterTask(void) {
     }
 }
 
+#ifdef MODBUS_SLAVE_MODE
+/**
+ * @brief Updates MODBUS frame data to internal buffers
+ * 
+ * @param None
+ * 
+ * @return No.of bytes copied to MODBUS internal buffers;
+ */
+static uint8_t getModbusRxBuffer(MODBUS_HANDLER *modH) {
+    modH->u8BufferSize = MODBUS_RTU_FRAME_SIZE;
+    uint8_t *modBusRxPacket = modbusSlaveRxFrameBuffer;
+    memcpy(modH->au8Buffer, modBusRxPacket, modH->u8BufferSize);
+    modH->u16InCnt++;
+    return modH->u8BufferSize;
+}
+
 /**
  * @brief MODBUS Slave Round Robin Task
  * 
@@ -579,14 +669,7 @@ static uint8_t validateRequest(MODBUS_HANDLER *modH) {
     }
 
     // check fct code
-    bool isSupported = false;
-    for (uint8_t i = 0; i < sizeof(modbusFunctions); i++) {
-        if (modbusFunctions[i] == modH->au8Buffer[FUNC]) {
-            isSupported = 1;
-            break;
-        }
-    }
-    if (!isSupported) {
+    if (!MODBUS_FC_SUPPORTED(modH->au8Buffer[FUNC])) {
         modH->u16errCnt++;
         return EXC_FUNC_CODE;
     }
@@ -621,6 +704,8 @@ static uint8_t validateRequest(MODBUS_HANDLER *modH) {
     return 0; // OK, no exception code thrown
 }
 
+#endif
+
 /**
  * @brief
  * This method creates a word from 2 bytes
@@ -668,22 +753,6 @@ static uint16_t calcCRC(uint8_t *Buffer, uint8_t u8length) {
 }
 
 
-/**
- * @brief
- * This method builds an exception message
- *
- * @ingroup u8exception exception number
- * @ingroup modH modbus handler
- */
-void buildException(uint8_t u8exception, MODBUS_HANDLER *modH) {
-    uint8_t u8func = modH->au8Buffer[FUNC];  // get the original FUNC code
-
-    modH->au8Buffer[ID] = modH->u8id;
-    modH->au8Buffer[FUNC] = u8func + 0x80;
-    modH->au8Buffer[2] = u8exception;
-    modH->u8BufferSize = EXCEPTION_SIZE;
-}
-
 /**
  * @brief
  * This method transmits au8Buffer to Serial line.
@@ -702,19 +771,16 @@ static bool sendTxBuffer(MODBUS_HANDLER *modH) {
     modH->au8Buffer[modH->u8BufferSize] = u16crc & 0x00ff;
     modH->u8BufferSize++;
 
-    uint8_t arr[modH->u8BufferSize];
-    memcpy(arr, modH->au8Buffer, modH->u8BufferSize);
-    DEBUG_SEND(Is_debug(), "Query being sent");
-    DEBUG_SEND(Is_debug(), arr);
-
     nrf_gpio_pin_clear(BOARD_USART_RD_PIN);
     DELAY_IN_MS(25);
 
+    // A split read is traced and timed from its first frame
+    if (blockOffset == 0)
+        Modbus_trace_tx(modH->u8BufferSize);
     ret = Usart_sendBuffer((void *) modH->au8Buffer, modH->u8BufferSize);
 
     if (ret != modH->u8BufferSize) {
         status = false;
-        DEBUG_SEND(Is_debug(), "data was not sent through usart");
     }
     modH->u8BufferSize = 0;
     // increase message counter
@@ -722,6 +788,23 @@ static bool sendTxBuffer(MODBUS_HANDLER *modH) {
     return status;
 }
 
+#ifdef MODBUS_SLAVE_MODE
+/**
+ * @brief
+ * This method builds an exception message
+ *
+ * @ingroup u8exception exception number
+ * @ingroup modH modbus handler
+ */
+void buildException(uint8_t u8exception, MODBUS_HANDLER *modH) {
+    uint8_t u8func = modH->au8Buffer[FUNC];  // get the original FUNC code
+
+    modH->au8Buffer[ID] = modH->u8id;
+    modH->au8Buffer[FUNC] = u8func + 0x80;
+    modH->au8Buffer[2] = u8exception;
+    modH->u8BufferSize = EXCEPTION_SIZE;
+}
+
 /**
  * @brief
  * This method processes functions 1 & 2
@@ -933,6 +1016,8 @@ static int8_t process_FC16(MODBUS_HANDLER *modH) {
     return u8CopyBufferSize;
 }
 
+#endif
+
 /**
  * @brief
  * This method initiates a MODBUS master query
@@ -953,12 +1038,23 @@ bool postModbusMasterQuery(MODBUS_MASTER_QUERY *f_masterQuery) {
         modH->masterQueryActive = true;
         memset(&modbusMasterQuery, 0, sizeof(modbusMasterQuery));
         memcpy(&modbusMasterQuery, f_masterQuery, sizeof(modbusMasterQuery));
+        blockOffset = 0;
+        Modbus_trace_begin(f_masterQuery->queryId, f_masterQuery->u8id, f_masterQuery->u8fct);
+        transactionOpen = true;
         status = true;
     }
 
     return status;
 }
 
+bool isModbusMasterBusy(void) {
+    return transactionOpen;
+}
+
+uint32_t getModbusMasterBaudrate(void) {
+    return modbusHandler.baudRate;
+}
+
 /**
  * @brief
  * *** Only Modbus Master ***
@@ -978,11 +1074,16 @@ static int8_t transmitMasterQuery(MODBUS_HANDLER *modH, MODBUS_MASTER_QUERY *f_m
         error = ERR_NOT_MASTER;
     if (modH->i8state != COM_IDLE)
         error = ERR_POLLING;
-    if ((f_masterQuery->u8id == 0) || (f_masterQuery->u8id > 247))
+    if ((f_masterQuery->u8id == MODBUS_BROADCAST_ADDRESS) ? !MODBUS_BROADCAST_FC(f_masterQuery->u8fct)
+                                                          : (f_masterQuery->u8id > 247))
         error = ERR_BAD_SLAVE_ID;
+    if (((f_masterQuery->u8fct == MB_FC_READ_WRITE_MULTIPLE_REGISTERS) || (f_masterQuery->u8fct == MB_FC_MASK_WRITE_REGISTER))
+        && (f_masterQuery->dataLength < 4))
+        error = ERR_BAD_SIZE;
 
     if (error) {
         modH->i8lastError = error;
+        endTransaction(error);
         return error;
     }
 
@@ -993,12 +1094,23 @@ static int8_t transmitMasterQuery(MODBUS_HANDLER *modH, MODBUS_MASTER_QUERY *f_m
     modH->au8Buffer[FUNC] = f_masterQuery->u8fct;
     modH->au8Buffer[ADD_HI] = IWS_U16_HI8(f_masterQuery->u16RegAdd);
     modH->au8Buffer[ADD_LO] = IWS_U16_LO8(f_masterQuery->u16RegAdd);
+    frameRegs = f_masterQuery->u16CoilsNo;
 
     switch (f_masterQuery->u8fct) {
-        case MB_FC_READ_COILS:
-        case MB_FC_READ_DISCRETE_INPUT:
         case MB_FC_READ_HOLDING_REGISTER:
         case MB_FC_READ_INPUT_REGISTER:
+            // Above the limit of the slave the read goes in several frames
+            frameRegs = f_masterQuery->u16CoilsNo - blockOffset;
+            if ((f_masterQuery->maxRegsPerFrame != 0) && (frameRegs > f_masterQuery->maxRegsPerFrame))
+                frameRegs = f_masterQuery->maxRegsPerFrame;
+            modH->au8Buffer[ADD_HI] = IWS_U16_HI8(f_masterQuery->u16RegAdd + blockOffset);
+            modH->au8Buffer[ADD_LO] = IWS_U16_LO8(f_masterQuery->u16RegAdd + blockOffset);
+            modH->au8Buffer[NB_HI] = IWS_U16_HI8(frameRegs);
+            modH->au8Buffer[NB_LO] = IWS_U16_LO8(frameRegs);
+            modH->u8BufferSize = 6;
+            break;
+        case MB_FC_READ_COILS:
+        case MB_FC_READ_DISCRETE_INPUT:
             modH->au8Buffer[NB_HI] = IWS_U16_HI8(f_masterQuery->u16CoilsNo);
             modH->au8Buffer[NB_LO] = IWS_U16_LO8(f_masterQuery->u16CoilsNo);
             modH->u8BufferSize = 6;
@@ -1014,12 +1126,8 @@ static int8_t transmitMasterQuery(MODBUS_HANDLER *modH, MODBUS_MASTER_QUERY *f_m
             modH->u8BufferSize = 6;
             break;
         case MB_FC_WRITE_MULTIPLE_COILS:
-            u8regsno = f_masterQuery->u16CoilsNo / 16;
-            u8bytesno = u8regsno * 2;
-            if ((f_masterQuery->u16CoilsNo % 16) != 0) {
-                u8bytesno++;
-                u8regsno++;
-            }
+            // 8 coils per byte, the bytes of au16reg sent high first
+            u8bytesno = (uint8_t) ((f_masterQuery->u16CoilsNo + 7) / 8);
             modH->au8Buffer[NB_HI] = IWS_U16_HI8(f_masterQuery->u16CoilsNo);
             modH->au8Buffer[NB_LO] = IWS_U16_LO8(f_masterQuery->u16CoilsNo);
             modH->au8Buffer[BYTE_CNT] = u8bytesno;
@@ -1049,11 +1157,54 @@ static int8_t transmitMasterQuery(MODBUS_HANDLER *modH, MODBUS_MASTER_QUERY *f_m
                 modH->u8BufferSize++;
             }
             break;
+
+        case MB_FC_MASK_WRITE_REGISTER:
+            // au16reg: AND mask, OR mask
+            modH->au8Buffer[NB_HI] = IWS_U16_HI8(f_masterQuery->au16reg[0]);
+            modH->au8Buffer[NB_LO] = IWS_U16_LO8(f_masterQuery->au16reg[0]);
+            modH->au8Buffer[BYTE_CNT] = IWS_U16_HI8(f_masterQuery->au16reg[1]);
+            modH->au8Buffer[BYTE_CNT + 1] = IWS_U16_LO8(f_masterQuery->au16reg[1]);
+            modH->u8BufferSize = 8;
+            break;
+
+        case MB_FC_READ_WRITE_MULTIPLE_REGISTERS:
+            // au16reg: write address, then the values written before the read
+            u8regsno = (f_masterQuery->dataLength / 2) - 1;
+            modH->au8Buffer[NB_HI] = IWS_U16_HI8(f_masterQuery->u16CoilsNo);
+            modH->au8Buffer[NB_LO] = IWS_U16_LO8(f_masterQuery->u16CoilsNo);
+            modH->au8Buffer[BYTE_CNT] = IWS_U16_HI8(f_masterQuery->au16reg[0]);
+            modH->au8Buffer[BYTE_CNT + 1] = IWS_U16_LO8(f_masterQuery->au16reg[0]);
+            modH->au8Buffer[BYTE_CNT + 2] = 0;
+            modH->au8Buffer[BYTE_CNT + 3] = u8regsno;
+            modH->au8Buffer[BYTE_CNT + 4] = u8regsno * 2;
+            modH->u8BufferSize = 11;
+
+            for (uint16_t i = 1; i <= u8regsno; i++) {
+                modH->au8Buffer[modH->u8BufferSize] = IWS_U16_HI8(f_masterQuery->au16reg[i]);
+                modH->u8BufferSize++;
+
+                modH->au8Buffer[modH->u8BufferSize] = IWS_U16_LO8(f_masterQuery->au16reg[i]);
+                modH->u8BufferSize++;
+            }
+            break;
     }
-    sendTxBuffer(modH);
+    // CRC appended on sending
+    uint8_t frameBytes = modH->u8BufferSize + 2;
+    bool sent = sendTxBuffer(modH);
 
-    if (f_masterQuery->u8fct == MB_FC_WRITE_COIL || f_masterQuery->u8fct == MB_FC_WRITE_REGISTER
-    || f_masterQuery->u8fct == MB_FC_WRITE_MULTIPLE_COILS || f_masterQuery->u8fct == MB_FC_WRITE_MULTIPLE_REGISTERS) {
+    if (f_masterQuery->u8id == MODBUS_BROADCAST_ADDRESS) {
+        // No reply to wait for: the line is free once the frame is out and the slaves
+        // had the turnaround delay. One acknowledge for the whole bus.
+        modH->i8state = COM_IDLE;
+        modH->i8lastError = sent ? ERR_OK : NO_REPLY;
+        modH->masterQueryActive = false;
+        busHoldUs = Query_cost_frame_us(frameBytes) + (uint32_t) MODBUS_BROADCAST_TURNAROUND_MS * 1000;
+        modbus_TLV_Data.detail.status = sent ? ERR_OK : ERR_TIME_OUT;
+        sendQueryTlv(6);
+        endTransaction(modH->i8lastError);
+    } else if (f_masterQuery->u8fct == MB_FC_WRITE_COIL || f_masterQuery->u8fct == MB_FC_WRITE_REGISTER
+    || f_masterQuery->u8fct == MB_FC_WRITE_MULTIPLE_COILS || f_masterQuery->u8fct == MB_FC_WRITE_MULTIPLE_REGISTERS
+    || f_masterQuery->u8fct == MB_FC_MASK_WRITE_REGISTER) {
 
         calculateModbusMasterReplyLength(f_masterQuery);
         modH->i8state = COM_IDLE;
@@ -1069,6 +1220,10 @@ static int8_t transmitMasterQuery(MODBUS_HANDLER *modH, MODBUS_MASTER_QUERY *f_m
         timeOutFirstRun = true;
         App_Scheduler_addTask_execTime(modbusMasterReplyTimeoutCallBack, APP_SCHEDULER_SCHEDULE_ASAP, 500);
     }
+    if (!sent) {
+        // Logged once the frame is out of the way, the reply timeout handles the rest
+        MODBUS_LOG_ERROR(LOG_TX_FAILED, f_masterQuery->queryId, f_masterQuery->u8id);
+    }
 
     return error;
 }
@@ -1088,26 +1243,19 @@ static int8_t validateAnswer(MODBUS_HANDLER *modH) {
     if (calcCRC(modH->au8Buffer, modH->u8BufferSize - 2) != u16MsgCRC) {
         modH->u16errCnt++;
         errCode = ERR_BAD_CRC;
-        DEBUG_SEND(Is_debug(), "bad CRC");
+        MODBUS_LOG_WARN(LOG_REPLY_BAD_CRC, modH->au8Buffer[ID], modH->au8Buffer[FUNC]);
     }
     // check exception
     if ((modH->au8Buffer[FUNC] & 0x80) != 0) {
         modH->u16errCnt++;
         errCode = ERR_EXCEPTION;
-        DEBUG_SEND(Is_debug(), "error Fn Code");
+        MODBUS_LOG_INFO(LOG_REPLY_EXCEPTION, modH->au8Buffer[ID], modH->au8Buffer[FUNC]);
     }
     // check fct code
-    bool isSupported = false;
-    for (uint8_t i = 0; i < sizeof(modbusFunctions); i++) {
-        if (modbusFunctions[i] == modH->au8Buffer[FUNC]) {
-            isSupported = 1;
-            break;
-        }
-    }
-    if (!isSupported) {
+    if (!MODBUS_FC_SUPPORTED(modH->au8Buffer[FUNC])) {
         modH->u16errCnt++;
         errCode = EXC_FUNC_CODE;
-        DEBUG_SEND(Is_debug(), "wrong fun code");
+        MODBUS_LOG_DEBUG(LOG_REPLY_BAD_FCT, modH->au8Buffer[FUNC], modH->au8Buffer[ID]);
     }
 
     return errCode;
@@ -1143,8 +1291,8 @@ static void get_FC3(MODBUS_HANDLER *modH) {
     uint8_t u8byte, i;
     u8byte = 3;
 
-    for (i = 0; i < modH->au8Buffer[2] / 2; i++) {
-        modH->au16regs[i] = word(modH->au8Buffer[u8byte], modH->au8Buffer[u8byte + 1]);
+    for (i = 0; (i < modH->au8Buffer[2] / 2) && (i < frameRegs) && (blockOffset + i < modH->u16regsize); i++) {
+        modH->au16regs[blockOffset + i] = word(modH->au8Buffer[u8byte], modH->au8Buffer[u8byte + 1]);
         u8byte += 2;
     }
 }
@@ -1168,6 +1316,21 @@ static void get_FC5(MODBUS_HANDLER *modH) {
 }
 
 
+/**
+ * This method checks the reply of a mask write (FC22), an echo of the request
+ *
+ * @param MODBUS_HANDLER
+ * @return true if the address and the masks match the query
+ */
+static bool isMaskWriteEcho(MODBUS_HANDLER *modH) {
+    uint16_t masks[2];
+
+    memcpy(masks, modbusMasterQuery.writeData, sizeof(masks));
+    return (word(modH->au8Buffer[ADD_HI], modH->au8Buffer[ADD_LO]) == modbusMasterQuery.u16RegAdd)
+           && (word(modH->au8Buffer[NB_HI], modH->au8Buffer[NB_LO]) == masks[0])
+           && (word(modH->au8Buffer[BYTE_CNT], modH->au8Buffer[BYTE_CNT + 1]) == masks[1]);
+}
+
 /**
  * This method calculates the MODBUS master reply length
  *  
@@ -1188,8 +1351,9 @@ static void calculateModbusMasterReplyLength(MODBUS_MASTER_QUERY *f_masterQuery)
             break;
 
         case MB_FC_READ_HOLDING_REGISTER:
-        case MB_FC_READ_INPUT_REGISTER: {
-            modbusMasterReplyCalculatedLength = (5 + (f_masterQuery->u16CoilsNo * 2));
+        case MB_FC_READ_INPUT_REGISTER:
+        case MB_FC_READ_WRITE_MULTIPLE_REGISTERS: {
+            modbusMasterReplyCalculatedLength = (5 + (frameRegs * 2));
         }
             break;
 
@@ -1201,6 +1365,12 @@ static void calculateModbusMasterReplyLength(MODBUS_MASTER_QUERY *f_masterQuery)
         }
             break;
 
+        case MB_FC_MASK_WRITE_REGISTER: {
+            // Echo of the request: id, fct, address, AND mask, OR mask, crc
+            modbusMasterReplyCalculatedLength = 10;
+        }
+            break;
+
         default:
             break;
     }
@@ -1212,6 +1382,7 @@ __STATIC_INLINE void writeRxMasterBuffer(uint8_t ch) {
     }
 }
 
+#ifdef MODBUS_SLAVE_MODE
 __STATIC_INLINE void writeRxSlaveBuffer(uint8_t ch) {
     if (mRxBufferIdx < MODBUS_RTU_FRAME_SIZE) {
         modbusSlaveRxFrameBuffer[mRxBufferIdx++] = ch;
@@ -1220,6 +1391,7 @@ __STATIC_INLINE void writeRxSlaveBuffer(uint8_t ch) {
         rxSlaveStatus = false;
     }
 }
+#endif
 
 void byte_Count(MODBUS_HANDLER *modH)
 {
@@ -1239,41 +1411,91 @@ void byte_Count(MODBUS_HANDLER *modH)
         }
             break;
         case MB_FC_READ_HOLDING_REGISTER:
-        case MB_FC_READ_INPUT_REGISTER: {
+        case MB_FC_READ_INPUT_REGISTER:
+        case MB_FC_READ_WRITE_MULTIPLE_REGISTERS: {
             modbus_TLV_Data.byte_No = num*2;
         }
         break;
         case MB_FC_WRITE_COIL:
         case MB_FC_WRITE_REGISTER:
         case MB_FC_WRITE_MULTIPLE_COILS:
-        case MB_FC_WRITE_MULTIPLE_REGISTERS: {
+        case MB_FC_WRITE_MULTIPLE_REGISTERS:
+        case MB_FC_MASK_WRITE_REGISTER: {
             modbus_TLV_Data.byte_No = 7;
         }
     }
+    // Reads longer than a TLV are refused when the query is written, saved
+    // queries of older builds are cut
+    if (modbus_TLV_Data.byte_No > sizeof(modbus_TLV_Data.arrData)) {
+        modbus_TLV_Data.byte_No = sizeof(modbus_TLV_Data.arrData);
+    }
 }
 
-static bool compareData(uint8_t queryNum) {
-    bool flag = false;
-    for(uint8_t indx=0;indx<QUERY_SIZE;indx++) {
-        if(dataRepeated[indx].queryID == queryNum) {
-            for(uint8_t index=0;index<modbus_TLV_Data.byte_No;index++) {
-                if(modbus_TLV_Data.arrData[index] == dataRepeated[indx].Arr[index]) {
-                    if(index == (modbus_TLV_Data.byte_No - 1)) {
-                        flag = true;
+/**
+ * This method fills the TLV data of a register read reply (FC3/FC4).
+ * Registers are reduced to the selection mask of the query, which is reported first,
+ * then decoded to typed values if the query has a decode descriptor.
+ *
+ * @param MODBUS_HANDLER
+ */
+static void fillRegisterReport(MODBUS_HANDLER *modH) {
+    uint16_t selected[MODBUS_SELECT_MAX_REGS];
+    uint16_t *regs = modH->au16regs;
+    uint8_t regCount = modbus_TLV_Data.byte_No / 2;
+    uint8_t idx = 0;
+
+    if (Modbus_select_isActive(modbusMasterQuery.registerMask)) {
+        uint32_t mask = modbusMasterQuery.registerMask;
+        if (regCount < MODBUS_SELECT_MAX_REGS) {
+            mask &= (1UL << regCount) - 1;
+        }
+        memcpy(&modbus_TLV_Data.arrData[idx], &mask, sizeof(mask));
+        idx += sizeof(mask);
+        regCount = Modbus_select_registers(mask, regs, regCount, selected);
+        regs = selected;
+    }
 
-                    }
-                }
-                else {
-                    dataRepeated[indx].queryID = queryNum;
-                    memcpy(&dataRepeated[indx].Arr,&modbus_TLV_Data.arrData,modbus_TLV_Data.byte_No);
-                    flag = false;
-                    break;
-                }
-            }
-            break;
+    if (Modbus_decode_isActive(&modbusMasterQuery.decode)) {
+        // report typed values in their compact width instead of the register words
+        idx += Modbus_decode(&modbusMasterQuery.decode, regs, regCount,
+                             &modbus_TLV_Data.arrData[idx], sizeof(modbus_TLV_Data.arrData) - idx);
+    } else {
+        if (regCount * 2 > sizeof(modbus_TLV_Data.arrData) - idx) {
+            regCount = (sizeof(modbus_TLV_Data.arrData) - idx) / 2;
         }
+        memcpy(&modbus_TLV_Data.arrData[idx], regs, regCount * 2);
+        idx += regCount * 2;
     }
-    return flag;
+    modbus_TLV_Data.byte_No = idx;
 }
 
+/**
+ * This method reports the input edges of a coil / discrete input reply (FC1/FC2)
+ * for a query in edge mode, or the bitmap as their new baseline. modbus_TLV_Data
+ * must hold the received bitmap.
+ */
+static void reportInputEdges(void) {
+    uint8_t events[sizeof(modbus_TLV_Data.arrData)];
+    bool sent = true;
+    int8_t length = Modbus_edge_process(modbusMasterQuery.queryId, modbusMasterQuery.debounce,
+                                        modbus_TLV_Data.arrData, modbusMasterQuery.u16CoilsNo,
+                                        events, sizeof(events));
+    if (length < 0) {
+        // Baseline, sent even when the bitmap did not change
+        sent = Uplink_budget_send((uint8_t *) &modbus_TLV_Data, 6 + modbus_TLV_Data.byte_No, APP_ADDR_ANYSINK,
+                                  MODBUS_TLV_EP, MODBUS_TLV_EP);
+    } else if (length > 0) {
+        memcpy(modbus_TLV_Data.arrData, events, length);
+        modbus_TLV_Data.byte_No = length;
+        modbus_TLV_Data.detail.status = MODBUS_TLV_STATUS_EDGES;
+        sent = Uplink_budget_send((uint8_t *) &modbus_TLV_Data, 6 + length, APP_ADDR_ANYSINK, MODBUS_TLV_EP,
+                                  MODBUS_TLV_EP);
+    }
+    if (!sent) {
+        // The backend missed a report, the next poll sends the bitmap again
+        Modbus_edge_reset(modbusMasterQuery.queryId);
+    }
+}
+
+
 
@@ -14,6 +14,7 @@ extern "C"
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "modbus_decode.h"
 //#include <../query_scheduler/query_scheduler.h>
 // *****************************************************************************
 // *****************************************************************************
@@ -60,16 +61,20 @@ typedef struct {
     uint8_t queryId;                   /*!< Modbus Query Id for the scheduler */
     uint8_t u8id;                      /*!< Slave address between 1 and 247. 0 means broadcast */
     device_detail_t deviceDetail;      /*!< IWS Internal Device Id to identify device types */
-    uint8_t u8fct;                     /*!< Function code: 1, 2, 3, 4, 5, 6, 15 or 16 */
-    uint16_t u16RegAdd;                /*!< Address of the first register to access at slave/s */
-    uint16_t u16CoilsNo;               /*!< Number of coils or registers to access */
+    uint8_t u8fct;                     /*!< Function code: 1, 2, 3, 4, 5, 6, 15, 16, 22 or 23 */
+    uint16_t u16RegAdd;                /*!< Address of the first register to access at slave/s, read address for FC23 */
+    uint16_t u16CoilsNo;               /*!< Number of coils or registers to access, read count for FC23 */
     uint16_t *au16reg;                 /*!< Pointer to memory image in master */
-    uint16_t interval;                 /*!< Polling interval for the query */
+    uint32_t intervalMs;               /*!< Polling interval for the query in ms */
     bool oneTime;                      /*!< Write query */
-    //uint8_t dataType;                  /*!< Data type of the response */
+    modbus_decode_t decode;            /*!< Data type and scaling of the response */
+    uint32_t registerMask;             /*!< Registers of the read range to report, bit 0 is the first one */
+    uint8_t debounce;                  /*!< FC1/FC2 edge reporting: polls an input must stay changed, 0 for bitmaps */
+    uint8_t priority;                  /*!< Stretching order of the period on an overloaded bus */
+    uint8_t maxRegsPerFrame;           /*!< FC3/FC4 reads above it are sent in several frames, 0 for one frame */
     bool writeOps;
     uint8_t dataLength;
-    uint8_t writeData[MAX_WRITE_DATA_BUFFER];    /*!< Write data for write operation */
+    uint8_t writeData[MAX_WRITE_DATA_BUFFER];    /*!< Write data for write operation, FC22: AND then OR mask, FC23: write address then values */
 } MODBUS_MASTER_QUERY;
 
 /**
@@ -134,9 +139,41 @@ typedef enum {
     MB_FC_WRITE_COIL               = 5,  /*!< FCT=5  -> write single coil or output */
     MB_FC_WRITE_REGISTER           = 6,  /*!< FCT=6  -> write single register */
     MB_FC_WRITE_MULTIPLE_COILS     = 15, /*!< FCT=15 -> write multiple coils or outputs */
-    MB_FC_WRITE_MULTIPLE_REGISTERS = 16  /*!< FCT=16 -> write multiple registers */
+    MB_FC_WRITE_MULTIPLE_REGISTERS = 16, /*!< FCT=16 -> write multiple registers */
+    MB_FC_MASK_WRITE_REGISTER      = 22, /*!< FCT=22 -> AND / OR mask write of a register */
+    MB_FC_READ_WRITE_MULTIPLE_REGISTERS = 23 /*!< FCT=23 -> write multiple registers, then read multiple registers */
 } MODBUS_FUNCTION_CODE;
 
+/**
+ * Function codes built in, bit n for function code n (build option modbus_fc_mask).
+ * Queries of other function codes are refused, replies to them are errors.
+ */
+#ifndef MODBUS_FC_MASK
+#define MODBUS_FC_MASK ((1UL << MB_FC_READ_COILS) | (1UL << MB_FC_READ_DISCRETE_INPUT) \
+                        | (1UL << MB_FC_READ_HOLDING_REGISTER) | (1UL << MB_FC_READ_INPUT_REGISTER) \
+                        | (1UL << MB_FC_WRITE_COIL) | (1UL << MB_FC_WRITE_REGISTER) \
+                        | (1UL << MB_FC_WRITE_MULTIPLE_COILS) | (1UL << MB_FC_WRITE_MULTIPLE_REGISTERS) \
+                        | (1UL << MB_FC_MASK_WRITE_REGISTER) | (1UL << MB_FC_READ_WRITE_MULTIPLE_REGISTERS))
+#endif
+
+#define MODBUS_FC_SUPPORTED(fct) (((fct) < 32) && (((MODBUS_FC_MASK) >> (fct)) & 1UL))
+
+/**
+ * Slave address of a broadcast, applied by every slave and answered by none.
+ * Only the single and multiple coil and register writes can be broadcast.
+ */
+#define MODBUS_BROADCAST_ADDRESS (0)
+
+#define MODBUS_BROADCAST_FC(fct) (((fct) == MB_FC_WRITE_COIL) || ((fct) == MB_FC_WRITE_REGISTER) \
+                                  || ((fct) == MB_FC_WRITE_MULTIPLE_COILS) || ((fct) == MB_FC_WRITE_MULTIPLE_REGISTERS))
+
+/**
+ * Turnaround delay after a broadcast, the slaves act on the request before the next one goes out.
+ */
+#ifndef MODBUS_BROADCAST_TURNAROUND_MS
+#define MODBUS_BROADCAST_TURNAROUND_MS (100)
+#endif
+
 typedef enum {
     COM_IDLE = 0,
     COM_WAITING = 1
@@ -217,15 +254,38 @@ void processModbusRoundRobinTask(void);
 bool postModbusMasterQuery(MODBUS_MASTER_QUERY *f_masterQuery);
 
 void RunModbusMasterTask(void);
+
+/**
+ * @brief
+ * This method tells if a master query is on the line, from post until its
+ * reply, error or timeout. Write acknowledges are included.
+ *
+ * @return bool true while the bus is in use
+ */
+bool isModbusMasterBusy(void);
+
+/**
+ * @brief
+ * This method returns the baudrate the UART was initialized with.
+ *
+ * @return uint32_t baudrate
+ */
+uint32_t getModbusMasterBaudrate(void);
+#ifdef MODBUS_SLAVE_MODE
 void RunModbusSlaveTask(void);
+#endif
 
 /****************************Modbus_TLV_Data Structure**********************/// added by ram.
+#define MODBUS_TLV_DATA_SIZE (58)
+/** Longest register read reported in one TLV, coils take a bit each */
+#define MODBUS_TLV_MAX_REGS (MODBUS_TLV_DATA_SIZE / 2)
+
 typedef struct __attribute__((packed))
 {
     uint8_t slaveID;
     device_detail_t detail;
     uint8_t byte_No;
-    uint8_t arrData[58];
+    uint8_t arrData[MODBUS_TLV_DATA_SIZE];
 } Modbus_TLV_Data_t;
 
 /**
@@ -246,7 +306,7 @@ typedef struct {
  */
 typedef struct {
     uint16_t timeoutPeriod; // default 1000ms.
-    uint16_t delay; // default preset 400ms.
+    uint16_t delay; // minimum bus idle time between two queries in ms, default 0.
     bool continuousOnTlv; //1 for continuous 0 for changed status default preset 0.
 } configure_DelayTlv_t;
 
@@ -0,0 +1,110 @@
+/**
+ * @file modbus_trace.c
+ *
+ * @brief Binary trace of the master transactions
+ *
+ * The record is written in place in the ring when the query is posted, the following events
+ * only fill its fields. Delays are measured on the hp timestamp and stored in 16 bits, the
+ * absolute time on the coarse one.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "api.h"
+#include "modbus_trace.h"
+
+static modbus_trace_record_t m_ring[MODBUS_TRACE_SIZE];
+static uint32_t m_written;                      /* Records written since boot */
+static modbus_trace_record_t * m_open_p;        /* Record of the running transaction */
+static app_lib_time_timestamp_hp_t m_post_ts;
+static app_lib_time_timestamp_hp_t m_tx_ts;
+
+static uint16_t delay_since(app_lib_time_timestamp_hp_t from) {
+    uint32_t units = lib_time->getTimeDiffUs(from, lib_time->getTimestampHp()) / MODBUS_TRACE_UNIT_US;
+    return (units >= MODBUS_TRACE_NONE) ? (MODBUS_TRACE_NONE - 1) : (uint16_t) units;
+}
+
+void Modbus_trace_begin(uint8_t queryId, uint8_t slave, uint8_t fct) {
+    modbus_trace_record_t *record = &m_ring[m_written % MODBUS_TRACE_SIZE];
+
+    m_post_ts = lib_time->getTimestampHp();
+    record->timestamp = lib_time->getTimestampCoarse();
+    record->txStart = MODBUS_TRACE_NONE;
+    record->rxFirst = MODBUS_TRACE_NONE;
+    record->rxEnd = MODBUS_TRACE_NONE;
+    record->queryId = queryId;
+    record->slave = slave;
+    record->fct = fct;
+    record->result = MODBUS_TRACE_PENDING;
+    record->txBytes = 0;
+    record->rxBytes = 0;
+
+    m_written++;
+    m_open_p = record;
+}
+
+void Modbus_trace_tx(uint8_t txBytes) {
+    if (m_open_p != NULL) {
+        m_tx_ts = lib_time->getTimestampHp();
+        m_open_p->txStart = delay_since(m_post_ts);
+        m_open_p->txBytes = txBytes;
+    }
+}
+
+void Modbus_trace_rx(uint8_t rxBytes) {
+    if (m_open_p != NULL) {
+        if (m_open_p->rxBytes == 0) {
+            m_open_p->rxFirst = delay_since(m_tx_ts);
+        }
+        m_open_p->rxBytes += rxBytes;
+    }
+}
+
+uint32_t Modbus_trace_end(int8_t result) {
+    uint32_t us = 0;
+
+    if (m_open_p != NULL) {
+        if (m_open_p->txStart != MODBUS_TRACE_NONE) {
+            us = lib_time->getTimeDiffUs(m_tx_ts, lib_time->getTimestampHp());
+            m_open_p->rxEnd = delay_since(m_tx_ts);
+        }
+        m_open_p->result = result;
+        m_open_p = NULL;
+    }
+    return us;
+}
+
+uint8_t Modbus_trace_read_page(uint8_t page, uint8_t *buffer, uint8_t size) {
+    modbus_trace_page_t header;
+
+    if (size < sizeof(header)) {
+        return 0;
+    }
+    uint8_t perPage = (size - sizeof(header)) / sizeof(modbus_trace_record_t);
+    if (perPage > MODBUS_TRACE_RECORDS_PER_PAGE) {
+        perPage = MODBUS_TRACE_RECORDS_PER_PAGE;
+    }
+
+    // The driver writes from the UART callback, the page is copied in one go
+    Sys_enterCriticalSection();
+    uint32_t available = (m_written < MODBUS_TRACE_SIZE) ? m_written : MODBUS_TRACE_SIZE;
+    uint32_t oldest = m_written - available;
+    uint32_t first = oldest + (uint32_t) page * perPage;
+
+    header.type = MEMORY_DATA_TRACE;
+    header.page = page;
+    header.firstSeq = (uint16_t) first;
+    header.count = 0;
+    header.pages = (uint8_t) ((available + perPage - 1) / perPage);
+    for (uint32_t seq = first; (seq < m_written) && (header.count < perPage); seq++) {
+        memcpy(&buffer[sizeof(header) + header.count * sizeof(modbus_trace_record_t)],
+               &m_ring[seq % MODBUS_TRACE_SIZE], sizeof(modbus_trace_record_t));
+        header.count++;
+    }
+    Sys_exitCriticalSection();
+
+    memcpy(buffer, &header, sizeof(header));
+    return (uint8_t) (sizeof(header) + header.count * sizeof(modbus_trace_record_t));
+}
@@ -0,0 +1,108 @@
+/**
+ * @file modbus_trace.h
+ *
+ * @brief Binary trace of the master transactions
+ *
+ * Every query posted to the driver gets a record in a RAM ring: when it was posted, when its
+ * first byte went on the line, when the first reply byte came back, when it completed and how.
+ * Records are written in place by the driver at a few cycles per event and nothing is sent by
+ * the node on its own, so tracing does not change the timing it measures. The ring is read in
+ * pages through the MEMORY_DATA endpoint.
+ */
+
+#ifndef MODBUS_TRACE_H
+#define MODBUS_TRACE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MODBUS_TRACE_SIZE               (32)    //!< Records kept, the oldest ones are overwritten
+#define MODBUS_TRACE_RECORDS_PER_PAGE   (5)     //!< Records per MEMORY_DATA response
+#define MODBUS_TRACE_UNIT_US            (100)   //!< Unit of the record delays
+#define MODBUS_TRACE_NONE               (0xFFFF)//!< Delay of an event that did not happen
+#define MODBUS_TRACE_PENDING            (0x7F)  //!< Result of a transaction not completed yet
+
+/**
+ * @brief MEMORY_DATA request types, first byte of the request payload.
+ */
+typedef enum {
+    MEMORY_DATA_STORAGE = 0,    /*!< Persistent storage, 96 bytes per page */
+    MEMORY_DATA_TRACE   = 1     /*!< Transaction trace, MODBUS_TRACE_RECORDS_PER_PAGE records per page */
+} memory_data_type_e;
+
+/**
+ * @struct modbus_trace_record_t
+ * @brief One master transaction. Delays are in MODBUS_TRACE_UNIT_US, saturated at 0xFFFE.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t timestamp;     /*!< Coarse time (1/128 s) when the query was posted */
+    uint16_t txStart;       /*!< From post to the first byte of the request on the line */
+    uint16_t rxFirst;       /*!< From TX start to the first reply byte */
+    uint16_t rxEnd;         /*!< From TX start to the reply processed or the timeout */
+    uint8_t queryId;
+    uint8_t slave;
+    uint8_t fct;
+    int8_t result;          /*!< i8lastError of the driver, MODBUS_TRACE_PENDING while running */
+    uint8_t txBytes;        /*!< Request length, CRC included */
+    uint8_t rxBytes;        /*!< Reply bytes received */
+} modbus_trace_record_t;
+
+/**
+ * @struct modbus_trace_page_t
+ * @brief Header of a MEMORY_DATA_TRACE response, followed by count records.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t type;           /*!< MEMORY_DATA_TRACE */
+    uint8_t page;           /*!< Page requested, 0 holds the oldest records */
+    uint16_t firstSeq;      /*!< Sequence number of the first record of the page */
+    uint8_t count;          /*!< Records in this page */
+    uint8_t pages;          /*!< Pages available */
+} modbus_trace_page_t;
+
+/**
+ * @brief Opens the record of a query posted to the driver.
+ */
+void Modbus_trace_begin(uint8_t queryId, uint8_t slave, uint8_t fct);
+
+/**
+ * @brief Request going on the line.
+ *
+ * @param txBytes request length, CRC included
+ */
+void Modbus_trace_tx(uint8_t txBytes);
+
+/**
+ * @brief Reply bytes received, called from the UART callback.
+ */
+void Modbus_trace_rx(uint8_t rxBytes);
+
+/**
+ * @brief Closes the open record.
+ *
+ * @param result i8lastError of the driver
+ *
+ * @return time from TX start to the end in us, 0 if the request did not go on the line
+ */
+uint32_t Modbus_trace_end(int8_t result);
+
+/**
+ * @brief Copies a page of the trace.
+ *
+ * @param page page number, 0 holds the oldest records
+ * @param buffer destination, a modbus_trace_page_t header followed by the records
+ * @param size size of buffer
+ *
+ * @return bytes written in buffer
+ */
+uint8_t Modbus_trace_read_page(uint8_t page, uint8_t *buffer, uint8_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MODBUS_TRACE_H */
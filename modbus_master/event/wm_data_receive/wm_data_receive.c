@@ -8,6 +8,28 @@
 #include "board.h"
 #include "../../../iws_libraries/utils/iws.h"
 #include "../../../iws_libraries/utils/iws_defines.h"
+#include "../../driver/modbus_trace.h"
+
+/**
+ * \brief   Paged memory dump: [type, page] in the request, memory_data_type_e.
+ *          An empty request reads the first page of the storage.
+ */
+static void _memory_data(const app_lib_data_received_t *data) {
+    uint8_t type = (data->num_bytes > 0) ? data->bytes[0] : MEMORY_DATA_STORAGE;
+    uint8_t page = (data->num_bytes > 1) ? data->bytes[1] : 0;
+    uint8_t buffer[96];
+
+    if (type == MEMORY_DATA_TRACE) {
+        uint8_t length = Modbus_trace_read_page(page, buffer, sizeof(buffer));
+        _send_data(buffer, length, APP_ADDR_ANYSINK, MEMORY_DATA, MEMORY_DATA);
+    } else if (type == MEMORY_DATA_STORAGE) {
+        uint32_t offset = (uint32_t) page * sizeof(buffer);
+        if (offset + sizeof(buffer) <= STORAGE_AREA) {
+            Iws_storage_read(buffer, offset, sizeof(buffer));
+            _send_data(buffer, sizeof(buffer), APP_ADDR_ANYSINK, MEMORY_DATA, MEMORY_DATA);
+        }
+    }
+}
 
 app_lib_data_receive_res_e Data_received_cb(const app_lib_data_received_t *data) {
     if (data->dest_endpoint == LIST_ATTR) {
@@ -26,13 +48,7 @@ app_lib_data_receive_res_e Data_received_cb(const app_lib_data_received_t *data)
     } else if (data->dest_endpoint == DISABLE_ATTR) {
         _disable_particular_attr(data);
     } else if (data->dest_endpoint == MEMORY_DATA) {
-        DEBUG_SEND(true, "In memory read");
-        if (STORAGE_AREA > 96) {
-            DEBUG_SEND(true, "Storage greater than 96 bytes");
-            uint8_t buffer[96];
-            Iws_storage_read(buffer, 0, 96);
-            _send_data(buffer, sizeof(buffer), APP_ADDR_ANYSINK, MEMORY_DATA, MEMORY_DATA);
-        }
+        _memory_data(data);
     } else { ;
     }
 
@@ -0,0 +1,218 @@
+//
+// Created by Maverick on 18/10/26.
+//
+// Host runner of the driver and scheduler microbenchmarks (../bench).
+// One JSON object per case and size on stdout, or a table with -t:
+//
+//   {"bench":"calcCRC","unit":"bytes","size":64,"iterations":...,"ns_per_op":...,"cycles_per_op":...}
+//
+// cycles_per_op is read from the time stamp counter on x86 hosts and is null elsewhere.
+// With -b a previous output is used as baseline: a case slower than the baseline by more
+// than the threshold (-T, percent) is reported on stderr and the exit status is 2.
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#endif
+
+#include "host.h"
+#include "bench.h"
+
+#define MIN_RUN_NS      (20 * 1000 * 1000ULL)
+#define REPEATS         5
+#define MAX_BASELINE    128
+
+typedef struct
+{
+    char name[48];
+    uint16_t size;
+    double nsPerOp;
+} baseline_t;
+
+static baseline_t m_baseline[MAX_BASELINE];
+static uint16_t m_baseline_count;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void)
+{
+#ifdef HAVE_CYCLES
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/** Iterations needed for a run to last MIN_RUN_NS */
+static uint32_t calibrate(const bench_case_t * bench)
+{
+    uint32_t iterations = 16;
+
+    for (;;)
+    {
+        uint64_t start = now_ns();
+        bench->run(iterations);
+        uint64_t elapsed = now_ns() - start;
+        if (elapsed >= MIN_RUN_NS / 4 || iterations >= (1U << 30))
+        {
+            double factor = elapsed ? (double) MIN_RUN_NS / (double) elapsed : 64.0;
+            double scaled = iterations * (factor > 64.0 ? 64.0 : factor);
+            return scaled < 1.0 ? 1 : (uint32_t) scaled;
+        }
+        iterations *= 4;
+    }
+}
+
+static void load_baseline(const char * path)
+{
+    FILE * file = fopen(path, "r");
+    char line[512];
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), file) && m_baseline_count < MAX_BASELINE)
+    {
+        baseline_t * entry = &m_baseline[m_baseline_count];
+        unsigned size;
+        const char * ns = strstr(line, "\"ns_per_op\":");
+        const char * sz = strstr(line, "\"size\":");
+        if (sscanf(line, " {\"bench\":\"%47[^\"]\"", entry->name) != 1 || ns == NULL || sz == NULL)
+        {
+            continue;
+        }
+        sscanf(sz, "\"size\":%u", &size);
+        sscanf(ns, "\"ns_per_op\":%lf", &entry->nsPerOp);
+        entry->size = (uint16_t) size;
+        m_baseline_count++;
+    }
+    fclose(file);
+}
+
+static const baseline_t * find_baseline(const char * name, uint16_t size)
+{
+    for (uint16_t i = 0; i < m_baseline_count; i++)
+    {
+        if (m_baseline[i].size == size && strcmp(m_baseline[i].name, name) == 0)
+        {
+            return &m_baseline[i];
+        }
+    }
+    return NULL;
+}
+
+static void usage(const char * name)
+{
+    printf("usage: %s [options]\n"
+           "  -f name   only the cases whose name contains name\n"
+           "  -t        table instead of JSON lines\n"
+           "  -b file   baseline, a previous JSON output\n"
+           "  -T pct    regression threshold against the baseline (default 10)\n",
+           name);
+}
+
+int main(int argc, char ** argv)
+{
+    const char * filter = NULL;
+    const char * baseline = NULL;
+    double threshold = 10.0;
+    bool table = false;
+    int regressions = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:tb:T:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f': filter = optarg; break;
+            case 't': table = true; break;
+            case 'b': baseline = optarg; break;
+            case 'T': threshold = atof(optarg); break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (baseline)
+    {
+        load_baseline(baseline);
+    }
+
+    // Settings and scheduler globals as after boot, no query running
+    Host_init(1, NULL);
+    Host_boot();
+
+    if (table)
+    {
+        printf("%-26s %-6s %6s %12s %12s\n", "bench", "unit", "size", "ns/op", "cycles/op");
+    }
+
+    for (uint8_t c = 0; c < Bench_get_case_count(); c++)
+    {
+        const bench_case_t * bench = Bench_get_case(c);
+
+        if (filter && strstr(bench->name, filter) == NULL)
+        {
+            continue;
+        }
+        for (uint8_t s = 0; s < BENCH_MAX_SIZES && bench->sizes[s]; s++)
+        {
+            uint16_t size = bench->sizes[s];
+            double bestNs = 0, bestCycles = 0;
+
+            bench->prepare(size);
+            uint32_t iterations = calibrate(bench);
+            for (uint8_t r = 0; r < REPEATS; r++)
+            {
+                bench->prepare(size);
+                uint64_t cycles = now_cycles();
+                uint64_t start = now_ns();
+                bench->run(iterations);
+                double ns = (double) (now_ns() - start) / iterations;
+                double cy = (double) (now_cycles() - cycles) / iterations;
+                if (r == 0 || ns < bestNs)
+                {
+                    bestNs = ns;
+                    bestCycles = cy;
+                }
+            }
+
+            if (table)
+            {
+                printf("%-26s %-6s %6u %12.2f %12.1f\n", bench->name, bench->unit, size, bestNs, bestCycles);
+            }
+            else
+            {
+                printf("{\"bench\":\"%s\",\"unit\":\"%s\",\"size\":%u,\"iterations\":%u,\"ns_per_op\":%.3f,",
+                       bench->name, bench->unit, size, iterations, bestNs);
+#ifdef HAVE_CYCLES
+                printf("\"cycles_per_op\":%.1f}\n", bestCycles);
+#else
+                printf("\"cycles_per_op\":null}\n");
+#endif
+            }
+
+            const baseline_t * base = find_baseline(bench->name, size);
+            if (base && base->nsPerOp > 0 && bestNs > base->nsPerOp * (1.0 + threshold / 100.0))
+            {
+                fprintf(stderr, "regression: %s size %u %.2f ns/op, baseline %.2f ns/op (+%.0f%%)\n",
+                        bench->name, size, bestNs, base->nsPerOp, (bestNs / base->nsPerOp - 1.0) * 100.0);
+                regressions++;
+            }
+        }
+    }
+    return regressions ? 2 : 0;
+}
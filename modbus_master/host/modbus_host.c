@@ -0,0 +1,542 @@
+//
+// Created by Maverick on 18/10/26.
+//
+// Runs the modbus master app on the host against a simulated RS485 bus and slave farm.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include "host.h"
+#include "config.h"
+#include "iws_defines.h"
+#include "modbus_lib.h"
+#include "modbus_settings.h"
+#include "modbus_trace.h"
+#include "query_stats.h"
+#include "query_scan.h"
+#include "modbus_log.h"
+
+#define OPERATOR_QUERY_ID 0xD0
+
+static bool m_verbose;
+static uint32_t m_tlv_status[256];
+static uint32_t m_write_failures;
+static uint8_t m_memory_data[128];
+static uint8_t m_memory_data_length;
+static uint8_t m_read_attr[128];
+static uint8_t m_read_attr_length;
+
+static void print_frame(const char * prefix, const uint8_t * bytes, uint16_t n, uint64_t atUs)
+{
+    printf("%10.3f ms %s", atUs / 1000.0, prefix);
+    for (uint16_t i = 0; i < n; i++)
+    {
+        printf(" %02X", bytes[i]);
+    }
+    printf("\n");
+}
+
+static void on_frame(bool fromMaster, const uint8_t * bytes, uint16_t n, uint64_t atUs)
+{
+    if (m_verbose)
+    {
+        print_frame(fromMaster ? "TX " : "RX ", bytes, n, atUs);
+    }
+}
+
+#define MODBUS_LOG_FORMAT(id, format) format,
+static const char * const m_log_formats[] = {MODBUS_LOG_MESSAGES(MODBUS_LOG_FORMAT)};
+#undef MODBUS_LOG_FORMAT
+
+/** Prints the messages of a DEBUG_EP log packet */
+static void print_log(const uint8_t * bytes, uint8_t n)
+{
+    static const char * const levels[] = {"", "ERROR", "WARN", "INFO", "DEBUG"};
+    modbus_log_packet_t header;
+
+    memcpy(&header, bytes, sizeof(header));
+    if (header.dropped)
+    {
+        printf("%13s log: %u messages dropped\n", "", header.dropped);
+    }
+    for (uint8_t i = sizeof(header); i + sizeof(modbus_log_record_t) <= n; i += sizeof(modbus_log_record_t))
+    {
+        modbus_log_record_t record;
+        memcpy(&record, &bytes[i], sizeof(record));
+        printf("%10.3f s  %-5s ", record.timestamp / 128.0, record.level <= MODBUS_LOG_LEVEL_DEBUG ? levels[record.level] : "?");
+        if (record.id < LOG_MESSAGE_COUNT)
+        {
+            printf(m_log_formats[record.id], record.args[0], record.args[1]);
+        }
+        else
+        {
+            printf("message %u (%u, %u)", record.id, record.args[0], record.args[1]);
+        }
+        printf("\n");
+    }
+}
+
+static void on_uplink(const uint8_t * bytes, uint8_t n, uint8_t srcEp, uint8_t dstEp, uint64_t atUs)
+{
+    if (dstEp == MODBUS_TLV_EP && n >= 3)
+    {
+        // slaveID, deviceId, status...
+        m_tlv_status[bytes[2]]++;
+    }
+    else if (dstEp == WRITE_ATTR_RES && n >= 3 && bytes[2] != STATUS_RES_SUCCESS)
+    {
+        m_write_failures++;
+    }
+    else if (dstEp == READ_ATTR_RES && n <= sizeof(m_read_attr))
+    {
+        memcpy(m_read_attr, bytes, n);
+        m_read_attr_length = n;
+    }
+    else if (dstEp == MEMORY_DATA && n <= sizeof(m_memory_data))
+    {
+        memcpy(m_memory_data, bytes, n);
+        m_memory_data_length = n;
+    }
+    if (m_verbose && dstEp == DEBUG_EP && n >= sizeof(modbus_log_packet_t) && bytes[0] == MODBUS_LOG_VERSION)
+    {
+        print_log(bytes, n);
+    }
+    else if (m_verbose)
+    {
+        char prefix[16];
+        snprintf(prefix, sizeof(prefix), "UP%-3u", dstEp);
+        print_frame(prefix, bytes, n, atUs);
+    }
+    (void) srcEp;
+}
+
+/** Reads the transaction trace page by page over MEMORY_DATA, one hex line per page */
+static void dump_trace(const char * path)
+{
+    FILE * file = fopen(path, "w");
+    uint8_t pages = 1;
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+        return;
+    }
+    for (uint8_t page = 0; page < pages; page++)
+    {
+        uint8_t request[2] = {MEMORY_DATA_TRACE, page};
+        m_memory_data_length = 0;
+        Host_radio_downlink(SINK_EP_INFERRIX, MEMORY_DATA, request, sizeof(request));
+        if (m_memory_data_length < sizeof(modbus_trace_page_t))
+        {
+            break;
+        }
+        pages = ((modbus_trace_page_t *) m_memory_data)->pages;
+        for (uint8_t i = 0; i < m_memory_data_length; i++)
+        {
+            fprintf(file, "%02X", m_memory_data[i]);
+        }
+        fprintf(file, "\n");
+    }
+    fclose(file);
+}
+
+/** Reads the query and slave counters page by page through QUERY_STATS_ATTR_ID */
+static void print_stats(void)
+{
+    read_attr_query_stats_t * response = (read_attr_query_stats_t *) m_read_attr;
+
+    printf("%-9s %5s %5s %5s %5s %5s %5s %5s %8s %8s %8s %9s %9s\n", "query", "polls", "ok", "tmo", "crc",
+           "exc", "size", "other", "lat min", "lat avg", "lat max", "interval", "achieved");
+    for (uint8_t kind = QUERY_STATS_QUERIES; kind <= QUERY_STATS_SLAVES; kind++)
+    {
+        uint8_t pages = 1;
+        for (uint8_t page = 0; page < pages; page++)
+        {
+            uint8_t request[2] = {kind, page};
+            m_read_attr_length = 0;
+            Host_read_attr(QUERY_STATS_ATTR_ID, request, sizeof(request));
+            if (m_read_attr_length < offsetof(read_attr_query_stats_t, queries))
+            {
+                break;
+            }
+            pages = response->pages;
+            for (uint8_t i = 0; i < response->count; i++)
+            {
+                const query_stats_counters_t * c;
+                char name[16];
+                if (kind == QUERY_STATS_QUERIES)
+                {
+                    snprintf(name, sizeof(name), "%u@%u", response->queries[i].queryId, response->queries[i].slaveId);
+                    c = &response->queries[i].counters;
+                }
+                else
+                {
+                    snprintf(name, sizeof(name), "slave %u", response->slaves[i].slaveId);
+                    c = &response->slaves[i].counters;
+                }
+                printf("%-9s %5u %5u %5u %5u %5u %5u %5u %8.1f %8.1f %8.1f", name, c->polls, c->ok, c->timeouts,
+                       c->crcErrors, c->exceptions, c->badSizes, c->otherErrors,
+                       c->latencyMin * QUERY_STATS_LATENCY_UNIT_US / 1000.0,
+                       c->latencyAvg * QUERY_STATS_LATENCY_UNIT_US / 1000.0,
+                       c->latencyMax * QUERY_STATS_LATENCY_UNIT_US / 1000.0);
+                if (kind == QUERY_STATS_QUERIES)
+                {
+                    printf(" %9u %9u", response->queries[i].configuredMs, response->queries[i].achievedMs);
+                }
+                printf("\n");
+            }
+        }
+    }
+
+    uint8_t request[2] = {QUERY_STATS_LANES, 0};
+    static const char * const lanes[] = {"urgent", "on demand", "periodic"};
+    m_read_attr_length = 0;
+    Host_read_attr(QUERY_STATS_ATTR_ID, request, sizeof(request));
+    if (m_read_attr_length >= offsetof(read_attr_query_stats_t, lanes))
+    {
+        printf("\n%-9s %7s %7s %8s %8s %8s %8s\n", "lane", "served", "late", "target", "wait min", "wait avg", "wait max");
+        for (uint8_t i = 0; i < response->count; i++)
+        {
+            const query_stats_lane_t * lane = &response->lanes[i];
+            printf("%-9s %7u %7u %8u %8u %8u %8u\n", lane->lane < 3 ? lanes[lane->lane] : "?", lane->served,
+                   lane->overTarget, lane->targetMs, lane->waitMinMs, lane->waitAvgMs, lane->waitMaxMs);
+        }
+    }
+
+    // Periodic queries stretched by the overload planner, if any
+    uint8_t pages = 1;
+    for (uint8_t page = 0; page < pages; page++)
+    {
+        request[0] = QUERY_STATS_DEGRADED;
+        request[1] = page;
+        m_read_attr_length = 0;
+        Host_read_attr(QUERY_STATS_ATTR_ID, request, sizeof(request));
+        if (m_read_attr_length < offsetof(read_attr_query_stats_t, plans) || response->count == 0)
+        {
+            break;
+        }
+        if (page == 0)
+        {
+            printf("\n%-9s %8s %9s %9s\n", "degraded", "cost", "interval", "planned");
+        }
+        pages = response->pages;
+        for (uint8_t i = 0; i < response->count; i++)
+        {
+            const query_stats_plan_t * plan = &response->plans[i];
+            char name[16];
+            snprintf(name, sizeof(name), "%u@%u", plan->queryId, plan->slaveId);
+            printf("%-9s %8.1f %9u %9u\n", name, plan->cost * QUERY_STATS_LATENCY_UNIT_US / 1000.0,
+                   plan->configuredMs, plan->plannedMs);
+        }
+    }
+}
+
+/** Reads the bus scan report through BUS_SCAN_ATTR_ID: bitmap, then the responders page by page */
+static void print_scan(void)
+{
+    read_attr_query_scan_t * response = (read_attr_query_scan_t *) m_read_attr;
+    static const char * const states[] = {"idle", "running", "done"};
+    uint8_t pages = 1;
+
+    for (uint8_t page = 0; page < pages; page++)
+    {
+        m_read_attr_length = 0;
+        Host_read_attr(BUS_SCAN_ATTR_ID, &page, sizeof(page));
+        if (m_read_attr_length < offsetof(read_attr_query_scan_t, entries))
+        {
+            break;
+        }
+        if (page == 0)
+        {
+            printf("\nbus scan %u..%u     %s, %.3f s\nresponders         ", response->first, response->last,
+                   response->state < 3 ? states[response->state] : "?", response->durationMs / 1e3);
+            for (uint16_t address = 0; address < 256; address++)
+            {
+                if (response->responders[address / 8] & (1 << (address % 8)))
+                {
+                    printf(" %u", address);
+                }
+            }
+            printf("\n%-9s %9s %8s\n", "address", "exception", "latency");
+        }
+        pages = response->pages;
+        for (uint8_t i = 0; i < response->count; i++)
+        {
+            const query_scan_entry_t * entry = &response->entries[i];
+            printf("%-9u %9u %8.1f\n", entry->address, entry->exception,
+                   entry->latency * QUERY_STATS_LATENCY_UNIT_US / 1000.0);
+        }
+    }
+}
+
+/** Reads the read limit of the slaves through BLOCK_LIMIT_ATTR_ID, probed or set */
+static void print_block_limits(void)
+{
+    read_attr_block_limits_t * response = (read_attr_block_limits_t *) m_read_attr;
+
+    m_read_attr_length = 0;
+    Host_read_attr(BLOCK_LIMIT_ATTR_ID, NULL, 0);
+    if (m_read_attr_length < sizeof(read_attr_block_limits_t))
+    {
+        return;
+    }
+    printf("\n%-9s %8s %5s\n", "slave", "max regs", "flags");
+    for (uint8_t i = 0; i < MODBUS_MAX_BLOCK_LIMITS; i++)
+    {
+        const modbus_block_limit_t * limit = &response->limits[i];
+        if (limit->slaveId != 0xFF)
+        {
+            printf("%-9u %8u %5u\n", limit->slaveId, limit->maxRegs, limit->flags);
+        }
+    }
+}
+
+/** Operator command: one time write to a register or coil of a slave, FC5, FC6,
+ *  FC22 (low byte, through MASK_WRITE_ATTR_ID) or FC23 with a read back of
+ *  registers 0 and 1. Each target has its own query id. */
+static void send_operator_write(uint8_t slave, uint8_t fct, uint16_t value, uint8_t target)
+{
+    if (fct == MB_FC_MASK_WRITE_REGISTER)
+    {
+        write_mask_t mask = {.queryId = OPERATOR_QUERY_ID, .slaveId = slave, .deviceId = OPERATOR_QUERY_ID,
+                             .regAddr = 0, .andMask = 0xFF00, .orMask = (uint16_t) (value & 0x00FF)};
+        Host_write_attr(MASK_WRITE_ATTR_ID, &mask, sizeof(mask));
+        return;
+    }
+
+    modbus_query_data_t query;
+    memset(&query, 0xFF, sizeof(query));
+    query.queryId = OPERATOR_QUERY_ID + target;
+    query.slaveId = slave;
+    query.deviceDetails.deviceId = query.queryId;
+    query.deviceDetails.status = 0;
+    query.deviceDetails.attrId = MODBUS_TLV_ATTR_ID;
+    query.functionCode = fct;
+    query.startAddr = target;
+    query.length = 1;
+    query.interval = 0;
+    query.oneTime = true;
+    query.isEnable = true;
+    query.writeOps = true;
+    query.dataLength = sizeof(value);
+    memcpy(query.writeData, &value, sizeof(value));
+    if (fct == MB_FC_WRITE_COIL)
+    {
+        uint16_t coil = (value & 1) ? 0xFF00 : 0x0000;
+        memcpy(query.writeData, &coil, sizeof(coil));
+    }
+    if (fct == MB_FC_READ_WRITE_MULTIPLE_REGISTERS)
+    {
+        uint16_t address = 0;
+        query.length = 2;
+        memcpy(query.writeData, &address, sizeof(address));
+        memcpy(&query.writeData[sizeof(address)], &value, sizeof(value));
+        query.dataLength = sizeof(address) + sizeof(value);
+    }
+    Host_write_attr(MODBUS_SETTINGS_ATTR_ID, &query, sizeof(query));
+}
+
+static void usage(const char * name)
+{
+    printf("usage: %s [options]\n"
+           "  -s slaves        number of slaves, addresses 1..n (4)\n"
+           "  -q queries       FC3 queries per slave (2)\n"
+           "  -r registers     registers per query (10)\n"
+           "  -i interval      query interval in ms (5000)\n"
+           "  -b baud          baudrate index, 0:9600 .. 4:115200 (0)\n"
+           "  -w delay         bus idle time between queries in ms (0)\n"
+           "  -o timeout       reply timeout in ms (1000)\n"
+           "  -l latency       slave turnaround in ms (5)\n"
+           "  -d dropout       unanswered requests per mille (0)\n"
+           "  -e exception     slave 1 answers with this exception (0)\n"
+           "  -m max           slave 1 refuses reads above max registers, print the probed limits at the end (0, none)\n"
+           "  -c chunk         bytes per uart rx callback, 0 for whole frames (0)\n"
+           "  -t time          virtual run time in s (60)\n"
+           "  -W period        operator FC6 write to slave 1 every period ms, urgent lane (0, none)\n"
+           "  -F fct           function of the operator write, 5, 6, 22 (mask write) or 23 (write and read back) (6)\n"
+           "  -B burst         FC5/FC6 operator writes per command, to targets 0..burst-1 (1)\n"
+           "  -C window        write combining window in ms, WRITE_COMBINING_ATTR_ID (0, off)\n"
+           "  -A               broadcast the operator writes (address 0) instead of writing to slave 1\n"
+           "  -D               scan the bus for slaves (BUS_SCAN_ATTR_ID) while polling, print the report at the end\n"
+           "  -T file          dump the transaction trace to file at the end, see trace_decode\n"
+           "  -S               print the query and slave counters (QUERY_STATS_ATTR_ID) at the end\n"
+           "  -v               print bus frames, uplink packets and the log (debug sink on)\n", name);
+}
+
+int main(int argc, char * argv[])
+{
+    uint8_t slaves = 4, queries = 2, registers = 10, baud = 0, exception = 0, chunk = 0, max_regs = 0;
+    uint8_t write_fct = MB_FC_WRITE_REGISTER, burst = 1, write_slave = 1;
+    uint16_t delay = 0, timeout = 1000, dropout = 0, window = 0;
+    uint32_t interval_ms = 5000, latency_ms = 5, run_s = 60, write_period_ms = 0;
+    const char * trace = NULL;
+    bool counters = false, scan = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:q:r:i:b:w:o:l:d:e:m:c:t:W:F:B:C:ADT:Svh")) != -1)
+    {
+        switch (opt)
+        {
+            case 's': slaves = (uint8_t) atoi(optarg); break;
+            case 'q': queries = (uint8_t) atoi(optarg); break;
+            case 'r': registers = (uint8_t) atoi(optarg); break;
+            case 'i': interval_ms = (uint32_t) atoi(optarg); break;
+            case 'b': baud = (uint8_t) atoi(optarg); break;
+            case 'w': delay = (uint16_t) atoi(optarg); break;
+            case 'o': timeout = (uint16_t) atoi(optarg); break;
+            case 'l': latency_ms = (uint32_t) atoi(optarg); break;
+            case 'd': dropout = (uint16_t) atoi(optarg); break;
+            case 'e': exception = (uint8_t) atoi(optarg); break;
+            case 'm': max_regs = (uint8_t) atoi(optarg); break;
+            case 'c': chunk = (uint8_t) atoi(optarg); break;
+            case 't': run_s = (uint32_t) atoi(optarg); break;
+            case 'W': write_period_ms = (uint32_t) atoi(optarg); break;
+            case 'F': write_fct = (uint8_t) atoi(optarg); break;
+            case 'B': burst = (uint8_t) atoi(optarg); break;
+            case 'C': window = (uint16_t) atoi(optarg); break;
+            case 'A': write_slave = MODBUS_BROADCAST_ADDRESS; break;
+            case 'D': scan = true; break;
+            case 'T': trace = optarg; break;
+            case 'S': counters = true; break;
+            case 'v': m_verbose = true; break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (slaves == 0 || slaves > HOST_SLAVES_MAX || (uint16_t) slaves * queries > QUERY_SCHEDULER_MAX_TASKS
+        || registers == 0 || registers > MODBUS_MAX_REGISTER_SIZE || registers > MODBUS_TLV_MAX_REGS
+        || burst == 0 || OPERATOR_QUERY_ID + burst > QUERY_ID_INTERNAL_FIRST)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    host_bus_config_t bus = {.bitsPerChar = 10, .rxChunk = chunk};
+    Host_init(1, &bus);
+    Host_bus_set_monitor(on_frame);
+    Host_radio_set_uplink_hook(on_uplink);
+    for (uint8_t s = 1; s <= slaves; s++)
+    {
+        host_slave_t * slave = Host_slaves_add(s);
+        slave->latencyUs = latency_ms * 1000;
+        slave->dropoutPermille = dropout;
+    }
+    Host_slaves_get(1)->forcedException = exception;
+    Host_slaves_get(1)->maxRegsPerRead = max_regs;
+
+    // Line and timing settings are read when the modbus part starts
+    App_init(NULL);
+    write_configure_t uart = {.baudrate = baud, .parity = 0};
+    configure_DelayTlv_t timing = {.timeoutPeriod = timeout, .delay = delay, .continuousOnTlv = true};
+    Host_write_attr(MODBUS_UART_CONFIGURATIONS, &uart, sizeof(uart));
+    Host_write_attr(MODBUS_DELAY_TLV_CONFIGURATIONS, &timing, 5);
+    if (window != 0)
+    {
+        Host_write_attr(WRITE_COMBINING_ATTR_ID, &window, sizeof(window));
+    }
+    if (m_verbose)
+    {
+        uint8_t on = 1;
+        Host_write_attr(DEBUG_SINK_MESSAGE, &on, sizeof(on));
+    }
+    Host_scheduler_run_for_ms(HOST_BOOT_TIME_MS);
+
+    for (uint8_t s = 1; s <= slaves; s++)
+    {
+        for (uint8_t q = 0; q < queries; q++)
+        {
+            modbus_query_data_t query;
+            memset(&query, 0xFF, sizeof(query));
+            query.queryId = (uint8_t) ((s - 1) * queries + q);
+            query.slaveId = s;
+            query.deviceDetails.deviceId = query.queryId;
+            query.deviceDetails.status = 0;
+            query.deviceDetails.attrId = MODBUS_TLV_ATTR_ID;
+            query.functionCode = MB_FC_READ_HOLDING_REGISTER;
+            query.startAddr = (uint16_t) (q * registers);
+            query.length = registers;
+            Modbus_query_set_interval_ms(&query, interval_ms);
+            query.oneTime = false;
+            query.isEnable = true;
+            query.writeOps = false;
+            query.dataLength = 0;
+            Host_write_attr(MODBUS_SETTINGS_ATTR_ID, &query, sizeof(query));
+        }
+    }
+
+    Host_bus_reset_stats();
+    uint64_t start_us = Host_clock_now_us();
+    if (scan)
+    {
+        // Whole unicast range, default probe
+        query_scan_request_t request;
+        memset(&request, 0xFF, sizeof(request));
+        Host_write_attr(BUS_SCAN_ATTR_ID, &request, sizeof(request));
+    }
+    if (write_period_ms == 0)
+    {
+        Host_scheduler_run_for_ms(run_s * 1000);
+    }
+    for (uint32_t at_ms = 0; write_period_ms != 0 && at_ms < run_s * 1000; at_ms += write_period_ms)
+    {
+        // A burst of FC5/FC6 writes, one per target
+        for (uint8_t target = 0; target < burst; target++)
+        {
+            send_operator_write(write_slave, write_fct, (uint16_t) (at_ms / write_period_ms), target);
+            if (write_fct != MB_FC_WRITE_COIL && write_fct != MB_FC_WRITE_REGISTER)
+            {
+                break;
+            }
+        }
+        Host_scheduler_run_for_ms(write_period_ms);
+    }
+    uint64_t elapsed_us = Host_clock_now_us() - start_us;
+
+    host_bus_stats_t stats;
+    host_radio_stats_t radio;
+    Host_bus_get_stats(&stats);
+    Host_radio_get_stats(&radio);
+
+    printf("baudrate            %u\n", Host_bus_get_baudrate());
+    printf("virtual time        %.3f s\n", elapsed_us / 1e6);
+    printf("requests            %u (%u bytes)\n", stats.txFrames, stats.txBytes);
+    printf("replies             %u (%u bytes)\n", stats.rxFrames, stats.rxBytes);
+    printf("unanswered          %u\n", stats.unanswered);
+    printf("collisions          %u\n", stats.collisions);
+    printf("bus utilisation     %.2f %%\n", elapsed_us ? 100.0 * stats.busyUs / elapsed_us : 0.0);
+    printf("uplink              %u packets, %u bytes\n", radio.packets, radio.bytes);
+    printf("write failures      %u\n", m_write_failures);
+    printf("tlv ok              %u\n", m_tlv_status[ERR_OK]);
+    for (uint16_t i = 1; i < 256; i++)
+    {
+        if (m_tlv_status[i] != 0)
+        {
+            printf("tlv status %-8d %u\n", (int8_t) i, m_tlv_status[i]);
+        }
+    }
+    for (uint8_t s = 1; s <= slaves; s++)
+    {
+        host_slave_t * slave = Host_slaves_get(s);
+        printf("slave %-3u           %u requests, %u replies, %u dropped, %u exceptions\n", s,
+               slave->stats.requests, slave->stats.replies, slave->stats.dropped, slave->stats.exceptions);
+    }
+    if (trace)
+    {
+        dump_trace(trace);
+    }
+    if (counters)
+    {
+        print_stats();
+    }
+    if (scan)
+    {
+        print_scan();
+    }
+    if (max_regs != 0)
+    {
+        print_block_limits();
+    }
+    return 0;
+}
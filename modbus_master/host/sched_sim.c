@@ -0,0 +1,359 @@
+//
+// Created by Maverick on 18/10/26.
+//
+// Discrete-event simulation of the query scheduler: the app runs unmodified on the
+// virtual clock, so days of polling take seconds. Polls are observed on the bus.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "host.h"
+#include "config.h"
+#include "iws_defines.h"
+#include "modbus_lib.h"
+#include "modbus_settings.h"
+
+#define SIM_MAX_QUERIES     QUERY_SCHEDULER_MAX_TASKS
+#define SIM_MAX_INTERVALS   16
+
+typedef struct
+{
+    uint8_t slaveId;
+    uint8_t functionCode;
+    uint16_t startAddr;
+    uint8_t length;
+    uint32_t intervalMs;
+    /* Observed on the bus */
+    uint32_t polls;
+    uint64_t lastUs;
+    double gapSum;              /* s */
+    double gapSquareSum;
+    double gapMin;
+    double gapMax;
+    uint32_t missed;            /* gaps longer than interval + tolerance */
+    uint32_t timeouts;
+    uint32_t exceptions;
+    bool refused;               /* not admitted, bus load above the ceiling */
+} sim_query_t;
+
+static sim_query_t m_queries[SIM_MAX_QUERIES];
+static uint8_t m_query_count;
+static double m_tolerance = 0.1;
+static bool m_measuring;
+static write_attr_query_res_t m_write_res;
+
+static int find_query(const uint8_t * frame, uint16_t n)
+{
+    if (n < 6)
+    {
+        return -1;
+    }
+    uint16_t addr = (uint16_t) ((frame[2] << 8) | frame[3]);
+    for (uint8_t i = 0; i < m_query_count; i++)
+    {
+        if (m_queries[i].slaveId == frame[0] && m_queries[i].functionCode == frame[1]
+            && m_queries[i].startAddr == addr)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void on_frame(bool fromMaster, const uint8_t * bytes, uint16_t n, uint64_t atUs)
+{
+    int index = fromMaster ? find_query(bytes, n) : -1;
+    if (index < 0 || !m_measuring)
+    {
+        return;
+    }
+
+    sim_query_t * query = &m_queries[index];
+    if (query->polls > 0)
+    {
+        double gap = (atUs - query->lastUs) / 1e6;
+        query->gapSum += gap;
+        query->gapSquareSum += gap * gap;
+        if (query->polls == 1 || gap < query->gapMin)
+        {
+            query->gapMin = gap;
+        }
+        if (gap > query->gapMax)
+        {
+            query->gapMax = gap;
+        }
+        if (gap > query->intervalMs / 1000.0 * (1.0 + m_tolerance))
+        {
+            query->missed++;
+        }
+    }
+    query->polls++;
+    query->lastUs = atUs;
+}
+
+static void on_uplink(const uint8_t * bytes, uint8_t n, uint8_t srcEp, uint8_t dstEp, uint64_t atUs)
+{
+    if (dstEp == WRITE_ATTR_RES && n == sizeof(m_write_res))
+    {
+        memcpy(&m_write_res, bytes, n);
+        return;
+    }
+    // slaveID, deviceId (query index), status...
+    if (!m_measuring || dstEp != MODBUS_TLV_EP || n < 3 || bytes[1] >= m_query_count)
+    {
+        return;
+    }
+    if ((int8_t) bytes[2] == ERR_TIME_OUT)
+    {
+        m_queries[bytes[1]].timeouts++;
+    }
+    else if ((int8_t) bytes[2] == ERR_EXCEPTION)
+    {
+        m_queries[bytes[1]].exceptions++;
+    }
+    (void) srcEp;
+    (void) atUs;
+}
+
+/** Reads "slave fct addr count interval" lines, interval in s with an optional fraction */
+static bool load_scenario(const char * path)
+{
+    FILE * file = fopen(path, "r");
+    char line[128];
+    if (file == NULL)
+    {
+        return false;
+    }
+    while (fgets(line, sizeof(line), file) != NULL && m_query_count < SIM_MAX_QUERIES)
+    {
+        unsigned slave, fct, addr, count;
+        double interval;
+        if (line[0] == '#' || sscanf(line, "%u %u %u %u %lf", &slave, &fct, &addr, &count, &interval) != 5)
+        {
+            continue;
+        }
+        m_queries[m_query_count++] = (sim_query_t) {
+                .slaveId = (uint8_t) slave,
+                .functionCode = (uint8_t) fct,
+                .startAddr = (uint16_t) addr,
+                .length = (uint8_t) count,
+                .intervalMs = (uint32_t) (interval * 1000 + 0.5),
+        };
+    }
+    fclose(file);
+    return m_query_count > 0;
+}
+
+static void generate_scenario(uint8_t count, uint8_t slaves, uint8_t registers,
+                              const uint32_t * intervals, uint8_t interval_count)
+{
+    for (uint8_t i = 0; i < count; i++)
+    {
+        m_queries[i] = (sim_query_t) {
+                .slaveId = (uint8_t) (1 + i % slaves),
+                .functionCode = MB_FC_READ_HOLDING_REGISTER,
+                .startAddr = (uint16_t) ((i / slaves) * registers),
+                .length = registers,
+                .intervalMs = intervals[i % interval_count],
+        };
+    }
+    m_query_count = count;
+}
+
+static void usage(const char * name)
+{
+    printf("usage: %s [options]\n"
+           "  -n queries       number of generated FC3 queries (60)\n"
+           "  -s slaves        slaves the queries are spread on (10)\n"
+           "  -r registers     registers per generated query (10)\n"
+           "  -i intervals     comma separated intervals in s, assigned in turn (5,10,30,60,300), 0.1 for 100 ms\n"
+           "  -f file          scenario file, lines of \"slave fct addr count interval\"\n"
+           "  -b baud          baudrate index, 0:9600 .. 4:115200 (0)\n"
+           "  -w delay         bus idle time between queries in ms (0)\n"
+           "  -o timeout       reply timeout in ms (1000)\n"
+           "  -l latency       slave turnaround in ms (5)\n"
+           "  -j jitter        extra random slave turnaround in ms (0)\n"
+           "  -d dropout       unanswered requests per mille (0)\n"
+           "  -t time          simulated time in s (86400)\n"
+           "  -k tolerance     late poll tolerance in %% of the interval (10)\n"
+           "  -a ceiling       refuse the queries taking the bus load above ceiling permille (flag at 950)\n"
+           "  -C               report every reply to the uplink (continuousOnTlv)\n"
+           "  -x               csv output\n", name);
+}
+
+int main(int argc, char * argv[])
+{
+    uint8_t count = 60, slaves = 10, registers = 10, baud = 0;
+    uint16_t delay = 0, timeout = 1000, dropout = 0;
+    uint32_t intervals[SIM_MAX_INTERVALS] = {5000, 10000, 30000, 60000, 300000};
+    uint8_t interval_count = 5;
+    uint32_t latency_ms = 5, jitter_ms = 0, run_s = 86400;
+    const char * scenario = NULL;
+    bool continuous = false, csv = false;
+    modbus_admission_t admission = {.ceiling = QUERY_ADMISSION_DEFAULT_CEILING, .mode = QUERY_ADMISSION_FLAG};
+    uint8_t over_ceiling = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:r:i:f:b:w:o:l:j:d:t:k:a:Cxh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': count = (uint8_t) atoi(optarg); break;
+            case 's': slaves = (uint8_t) atoi(optarg); break;
+            case 'r': registers = (uint8_t) atoi(optarg); break;
+            case 'i':
+                interval_count = 0;
+                for (char * token = strtok(optarg, ","); token != NULL && interval_count < SIM_MAX_INTERVALS;
+                     token = strtok(NULL, ","))
+                {
+                    intervals[interval_count++] = (uint32_t) (atof(token) * 1000 + 0.5);
+                }
+                break;
+            case 'f': scenario = optarg; break;
+            case 'b': baud = (uint8_t) atoi(optarg); break;
+            case 'w': delay = (uint16_t) atoi(optarg); break;
+            case 'o': timeout = (uint16_t) atoi(optarg); break;
+            case 'l': latency_ms = (uint32_t) atoi(optarg); break;
+            case 'j': jitter_ms = (uint32_t) atoi(optarg); break;
+            case 'd': dropout = (uint16_t) atoi(optarg); break;
+            case 't': run_s = (uint32_t) atoi(optarg); break;
+            case 'k': m_tolerance = atoi(optarg) / 100.0; break;
+            case 'a':
+                admission.ceiling = (uint16_t) atoi(optarg);
+                admission.mode = QUERY_ADMISSION_REJECT;
+                break;
+            case 'C': continuous = true; break;
+            case 'x': csv = true; break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (scenario != NULL)
+    {
+        if (!load_scenario(scenario))
+        {
+            fprintf(stderr, "cannot load %s\n", scenario);
+            return 1;
+        }
+    }
+    else
+    {
+        if (count == 0 || count > SIM_MAX_QUERIES || slaves == 0 || slaves > HOST_SLAVES_MAX
+            || interval_count == 0 || registers == 0 || registers > MODBUS_MAX_REGISTER_SIZE
+            || registers > MODBUS_TLV_MAX_REGS
+            || (uint32_t) ((count + slaves - 1) / slaves) * registers > HOST_SLAVE_MAX_REGS)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        generate_scenario(count, slaves, registers, intervals, interval_count);
+    }
+
+    Host_init(1, NULL);
+    Host_bus_set_monitor(on_frame);
+    Host_radio_set_uplink_hook(on_uplink);
+    for (uint8_t i = 0; i < m_query_count; i++)
+    {
+        host_slave_t * slave = Host_slaves_get(m_queries[i].slaveId);
+        if (slave == NULL)
+        {
+            slave = Host_slaves_add(m_queries[i].slaveId);
+            slave->latencyUs = latency_ms * 1000;
+            slave->jitterUs = jitter_ms * 1000;
+            slave->dropoutPermille = dropout;
+        }
+    }
+
+    App_init(NULL);
+    write_configure_t uart = {.baudrate = baud, .parity = 0};
+    configure_DelayTlv_t timing = {.timeoutPeriod = timeout, .delay = delay, .continuousOnTlv = continuous};
+    Host_write_attr(MODBUS_UART_CONFIGURATIONS, &uart, sizeof(uart));
+    Host_write_attr(MODBUS_DELAY_TLV_CONFIGURATIONS, &timing, 5);
+    Host_write_attr(BUS_ADMISSION_ATTR_ID, &admission, sizeof(admission));
+    Host_scheduler_run_for_ms(HOST_BOOT_TIME_MS);
+
+    for (uint8_t i = 0; i < m_query_count; i++)
+    {
+        modbus_query_data_t query;
+        memset(&query, 0xFF, sizeof(query));
+        query.queryId = i;
+        query.slaveId = m_queries[i].slaveId;
+        query.deviceDetails.deviceId = i;
+        query.deviceDetails.status = 0;
+        query.deviceDetails.attrId = MODBUS_TLV_ATTR_ID;
+        query.functionCode = m_queries[i].functionCode;
+        query.startAddr = m_queries[i].startAddr;
+        query.length = m_queries[i].length;
+        Modbus_query_set_interval_ms(&query, m_queries[i].intervalMs);
+        query.oneTime = false;
+        query.isEnable = true;
+        query.writeOps = false;
+        query.dataLength = 0;
+        memset(&m_write_res, 0, sizeof(m_write_res));
+        Host_write_attr(MODBUS_SETTINGS_ATTR_ID, &query, sizeof(query));
+        m_queries[i].refused = m_write_res.writeAttr.status != STATUS_RES_SUCCESS;
+        over_ceiling += m_write_res.overCeiling;
+    }
+
+    Host_bus_reset_stats();
+    Host_radio_reset_stats();
+    m_measuring = true;
+    uint64_t start_us = Host_clock_now_us();
+    Host_scheduler_run_for_ms(run_s * 1000);
+    double elapsed_s = (Host_clock_now_us() - start_us) / 1e6;
+
+    host_bus_stats_t bus;
+    host_radio_stats_t radio;
+    uint32_t total_polls = 0, total_missed = 0, starved = 0, refused = 0;
+    Host_bus_get_stats(&bus);
+    Host_radio_get_stats(&radio);
+
+    if (csv)
+    {
+        printf("query,slave,fct,addr,count,interval_s,polls,period_s,jitter_s,min_gap_s,max_gap_s,missed,timeouts,exceptions\n");
+    }
+    else
+    {
+        printf("%-5s %-5s %-3s %-5s %-5s %8s %8s %9s %9s %9s %9s %7s %7s %5s\n", "query", "slave", "fct", "addr",
+               "count", "interval", "polls", "period", "jitter", "min gap", "max gap", "missed", "timeout", "exc");
+    }
+    for (uint8_t i = 0; i < m_query_count; i++)
+    {
+        sim_query_t * query = &m_queries[i];
+        uint32_t gaps = query->polls > 1 ? query->polls - 1 : 0;
+        double period = gaps ? query->gapSum / gaps : 0.0;
+        double variance = gaps ? query->gapSquareSum / gaps - period * period : 0.0;
+        double jitter = variance > 0.0 ? sqrt(variance) : 0.0;
+
+        total_polls += query->polls;
+        refused += query->refused;
+        total_missed += query->missed;
+        // Never polled although several intervals elapsed
+        if (query->polls == 0 && !query->refused && elapsed_s > query->intervalMs / 1000.0)
+        {
+            starved++;
+        }
+        printf(csv ? "%u,%u,%u,%u,%u,%.3f,%u,%.3f,%.3f,%.3f,%.3f,%u,%u,%u\n"
+                   : "%-5u %-5u %-3u %-5u %-5u %8.3f %8u %9.3f %9.3f %9.3f %9.3f %7u %7u %5u\n",
+               i, query->slaveId, query->functionCode, query->startAddr, query->length, query->intervalMs / 1000.0,
+               query->polls, period, jitter, query->gapMin, query->gapMax, query->missed,
+               query->timeouts, query->exceptions);
+    }
+
+    if (!csv)
+    {
+        printf("\nsimulated time      %.0f s\n", elapsed_s);
+        printf("baudrate            %u\n", Host_bus_get_baudrate());
+        printf("polls               %u, %u late (> interval + %.0f %%), %u queries never polled\n",
+               total_polls, total_missed, m_tolerance * 100, starved);
+        printf("bus utilisation     %.2f %%\n", elapsed_s > 0 ? 100.0 * bus.busyUs / 1e6 / elapsed_s : 0.0);
+        printf("admission           %u permille after the last write, %u writes over the ceiling of %u, %u refused\n",
+               m_write_res.utilisation, over_ceiling, admission.ceiling, refused);
+        printf("unanswered          %u\n", bus.unanswered);
+        printf("uplink              %u packets, %u bytes\n", radio.packets, radio.bytes);
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+/* Host shim of the Wirepas single-MCU API used by the modbus app. */
+#ifndef API_H
+#define API_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint32_t app_addr_t;
+typedef uint32_t app_lib_time_timestamp_hp_t;
+typedef uint32_t app_lib_time_timestamp_coarse_t;
+
+#define APP_ADDR_ANYSINK    0xFFFFFFFEu
+#define APP_ADDR_BROADCAST  0xFFFFFFFFu
+
+typedef enum { APP_RES_OK = 0, APP_RES_INVALID_VALUE = 1 } app_res_e;
+
+typedef struct {
+    app_lib_time_timestamp_hp_t (*getTimestampHp)(void);
+    app_lib_time_timestamp_coarse_t (*getTimestampCoarse)(void);
+    uint32_t (*getTimeDiffUs)(app_lib_time_timestamp_hp_t a, app_lib_time_timestamp_hp_t b);
+    app_lib_time_timestamp_hp_t (*addUsToHpTimestamp)(app_lib_time_timestamp_hp_t t, uint32_t us);
+    bool (*isHpTimestampBefore)(app_lib_time_timestamp_hp_t a, app_lib_time_timestamp_hp_t b);
+    uint32_t (*getMaxHpDelay)(void);
+} app_lib_time_t;
+
+typedef struct {
+    app_res_e (*startStack)(void);
+    app_res_e (*stopStack)(void);
+} app_lib_state_t;
+
+#define APP_LIB_SETTINGS_ROLE_HEADNODE 1
+#define APP_LIB_SETTINGS_ROLE_FLAG_LL 0x10
+#define app_lib_settings_create_role(base, flags) ((uint8_t)((base) | (flags)))
+
+typedef struct {
+    app_res_e (*setNodeRole)(uint8_t role);
+    app_res_e (*setNodeAddress)(app_addr_t addr);
+} app_lib_settings_t;
+
+typedef enum {
+    APP_LIB_DATA_RECEIVE_RES_HANDLED = 0,
+    APP_LIB_DATA_RECEIVE_RES_NOT_FOR_APP = 1,
+    APP_LIB_DATA_RECEIVE_RES_NO_SPACE = 2
+} app_lib_data_receive_res_e;
+
+typedef struct {
+    const uint8_t * bytes;
+    size_t num_bytes;
+    app_addr_t src_address;
+    uint32_t delay;
+    uint8_t qos;
+    uint8_t src_endpoint;
+    uint8_t dest_endpoint;
+    uint8_t hops;
+} app_lib_data_received_t;
+
+typedef app_lib_data_receive_res_e (*app_lib_data_data_received_cb_f)(const app_lib_data_received_t * data);
+
+typedef struct {
+    app_res_e (*setDataReceivedCb)(app_lib_data_data_received_cb_f cb);
+    app_res_e (*setBcastDataReceivedCb)(app_lib_data_data_received_cb_f cb);
+} app_lib_data_t;
+
+typedef enum { APP_LIB_MEM_AREA_RES_OK = 0, APP_LIB_MEM_AREA_RES_INVALID = 1 } app_lib_mem_area_res_e;
+
+typedef struct app_global_functions app_global_functions_t;
+
+extern const app_lib_time_t * lib_time;
+extern const app_lib_state_t * lib_state;
+extern const app_lib_settings_t * lib_settings;
+extern const app_lib_data_t * lib_data;
+
+void API_Open(const app_global_functions_t * functions);
+
+void Sys_enterCriticalSection(void);
+void Sys_exitCriticalSection(void);
+
+#endif
@@ -0,0 +1,15 @@
+/* Host shim of the modbus board definition */
+#ifndef BOARD_H
+#define BOARD_H
+#include <stdint.h>
+#define BOARD_USART_RD_PIN 8
+#define NRF_GPIO_PIN_DIR_OUTPUT 1
+#define NRF_GPIO_PIN_INPUT_CONNECT 0
+#define NRF_GPIO_PIN_NOPULL 0
+#define NRF_GPIO_PIN_S0S1 0
+#define NRF_GPIO_PIN_NOSENSE 0
+void nrf_gpio_pin_set(uint32_t pin);
+void nrf_gpio_pin_clear(uint32_t pin);
+void nrf_gpio_cfg_default(uint32_t pin);
+void nrf_gpio_cfg(uint32_t pin, int dir, int input, int pull, int drive, int sense);
+#endif
@@ -0,0 +1,8 @@
+/* Host shim of the HAL api */
+#ifndef HAL_API_H
+#define HAL_API_H
+#include <stdint.h>
+#ifndef __STATIC_INLINE
+#define __STATIC_INLINE static inline
+#endif
+#endif
@@ -0,0 +1,6 @@
+/* Host shim of the node configuration helper */
+#ifndef NODE_CONFIGURATION_H
+#define NODE_CONFIGURATION_H
+#include "api.h"
+app_res_e configureNodeFromBuildParameters(void);
+#endif
@@ -0,0 +1,7 @@
+/* Host shim of the Wirepas util library */
+#ifndef UTIL_H
+#define UTIL_H
+#include <stdint.h>
+#include <stdbool.h>
+static inline bool Util_isLtUint32(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+#endif
@@ -0,0 +1,19 @@
+/* Host shim of the Wirepas app scheduler */
+#ifndef APP_SCHEDULER_H
+#define APP_SCHEDULER_H
+#include <stdint.h>
+#include <stdbool.h>
+#define APP_SCHEDULER_STOP_TASK     ((uint32_t)(-1))
+#define APP_SCHEDULER_SCHEDULE_ASAP (0)
+typedef uint32_t (*task_cb_f)(void);
+typedef enum {
+    APP_SCHEDULER_RES_OK = 0,
+    APP_SCHEDULER_RES_NO_MORE_TASK = 1,
+    APP_SCHEDULER_RES_UNKNOWN_TASK = 2,
+    APP_SCHEDULER_RES_UNINITIALIZED = 3
+} app_scheduler_res_e;
+void App_Scheduler_init(void);
+app_scheduler_res_e App_Scheduler_addTask_execTime(task_cb_f cb, uint32_t delay_ms, uint32_t exec_time_us);
+app_scheduler_res_e App_Scheduler_cancelTask(task_cb_f cb);
+#define App_Scheduler_addTask(cb, delay_ms) App_Scheduler_addTask_execTime(cb, delay_ms, 100)
+#endif
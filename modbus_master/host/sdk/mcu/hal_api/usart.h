@@ -0,0 +1,15 @@
+/* Host shim of the Wirepas USART HAL */
+#ifndef USART_H
+#define USART_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+typedef enum { UART_FLOW_CONTROL_NONE, UART_FLOW_CONTROL_HW } uart_flow_control_e;
+typedef void (*serial_rx_callback_f)(uint8_t * ch, size_t n);
+bool Usart_init(uint32_t baudrate, uart_flow_control_e flow_control);
+void Usart_setEnabled(bool enabled);
+void Usart_receiverOn(void);
+void Usart_receiverOff(void);
+bool Usart_enableReceiver(serial_rx_callback_f rx_callback);
+uint32_t Usart_sendBuffer(const void * buffer, uint32_t length);
+#endif
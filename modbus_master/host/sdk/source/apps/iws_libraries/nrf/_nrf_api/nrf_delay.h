@@ -0,0 +1,7 @@
+/* Host shim of the nrf busy-wait delays, they advance the virtual clock */
+#ifndef NRF_DELAY_H
+#define NRF_DELAY_H
+#include <stdint.h>
+void nrf_delay_ms(uint32_t ms);
+void nrf_delay_us(uint32_t us);
+#endif
@@ -0,0 +1,10 @@
+/* Host shim of the iws persistent storage */
+#ifndef IWS_STORAGE_H
+#define IWS_STORAGE_H
+#include <stdint.h>
+#define STORAGE_AREA 4096
+typedef enum { IWS_STORAGE_RES_OK = 0, IWS_STORAGE_RES_ERROR = 1 } iws_storage_res_e;
+void Iws_storage_init(void);
+iws_storage_res_e Iws_storage_read(uint8_t * buffer, uint16_t offset, uint16_t length);
+iws_storage_res_e Iws_storage_write(uint8_t * buffer, uint16_t offset, uint16_t length);
+#endif
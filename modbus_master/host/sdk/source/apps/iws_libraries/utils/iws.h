@@ -0,0 +1,86 @@
+/* Host shim of the iws utility library */
+#ifndef IWS_H
+#define IWS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "api.h"
+#include "iws_defines.h"
+
+typedef enum __attribute__((packed)) {
+    STATUS_RES_SUCCESS = 0x00,
+    STATUS_RES_UNSUCCESSFUL = 0x01,
+    STATUS_RES_ATTR_NOT_SUPPORTED = 0x86,
+} status_res_e;
+
+typedef enum {
+    TYPE_ID_BOOL = 0x10,
+    TYPE_ID_UINT8 = 0x20,
+    TYPE_ID_UINT16 = 0x21,
+    TYPE_ID_UINT32 = 0x23,
+    TYPE_ID_MODBUS_SETTINGS = 0x80,
+} type_id_e;
+
+typedef uint16_t list_attr_res_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t attrId;
+    uint8_t typeId;
+    status_res_e status;
+} read_attr_res_t;
+
+typedef struct __attribute__((packed)) {
+    read_attr_res_t readAttr;
+    bool data;
+} read_attr_boolean_res_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t attrId;
+    status_res_e status;
+} read_error_res_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t attrId;
+    status_res_e status;
+} write_attr_res_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t attrId;
+    status_res_e status;
+} config_report_res_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t attrId;
+    status_res_e status;
+    uint16_t intrvl;
+} read_configure_res_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t attrId;
+    status_res_e status;
+} enable_attr_res_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t deviceType;
+    uint16_t firmwareVer;
+    uint16_t hardwareVer;
+    uint8_t manufacturer;
+    uint16_t wpVersion;
+    uint8_t appMajor, appMinor, appMaintenance, appDevelopment;
+} node_information_header_t;
+
+bool _send_data(uint8_t * bytes, uint8_t num_bytes, app_addr_t dest, uint8_t src_ep, uint8_t dest_ep);
+bool _send_data_QOS_high(uint8_t * bytes, uint8_t num_bytes, app_addr_t dest, uint8_t src_ep, uint8_t dest_ep);
+
+
+#define DEBUG_SEND(enabled, value)                                                          \
+    do {                                                                                    \
+        if (enabled) {                                                                      \
+            _send_data((uint8_t *) &(value), sizeof(value), APP_ADDR_ANYSINK, DEBUG_EP, DEBUG_EP); \
+        }                                                                                   \
+    } while (0)
+
+#define IWS_VALIDATE(cond) ((void)(cond))
+#define IWS_LOG(...)
+
+#endif
@@ -0,0 +1,47 @@
+/* Host shim of the iws common defines */
+#ifndef IWS_DEFINES_H
+#define IWS_DEFINES_H
+
+#include <stdint.h>
+#include "../nrf/_nrf_api/nrf_delay.h"
+
+#define IWS_U16_HI8(x)              ((uint8_t)(((uint16_t)(x)) >> 8))
+#define IWS_U16_LO8(x)              ((uint8_t)((uint16_t)(x) & 0xFF))
+#define IWS_U16_CONCAT_U8(lo, hi)   ((uint16_t)(((uint16_t)(hi) << 8) | (uint8_t)(lo)))
+#define IWS_BIT_READ(value, bit)    (((value) >> (bit)) & 0x01)
+#define IWS_BIT_SET(value, bit)     ((value) |= (1UL << (bit)))
+#define IWS_BIT_CLEAR(value, bit)   ((value) &= ~(1UL << (bit)))
+#define IWS_BIT_WRITE(value, bit, bitvalue) ((bitvalue) ? IWS_BIT_SET(value, bit) : IWS_BIT_CLEAR(value, bit))
+#define DELAY_IN_MS(ms)             nrf_delay_ms(ms)
+
+/* Endpoints */
+#define INFO_EP                 10
+#define TLV_REPORTING           11
+#define MODBUS_TLV_EP           12
+#define DEBUG_EP                13
+#define MEMORY_DATA             14
+#define LIST_ATTR               20
+#define LIST_ATTR_RES           21
+#define READ_ATTR               22
+#define READ_ATTR_RES           23
+#define WRITE_ATTR              24
+#define WRITE_ATTR_RES          25
+#define CONFIGURE_REPORTING     26
+#define CONFIGURE_REPORTING_RES 27
+#define READ_REPORTING_CONFIG   28
+#define READ_REPORTING_CONFIG_RES 29
+#define ENABLE_ATTR             30
+#define ENABLE_ATTR_RES         31
+#define DISABLE_ATTR            32
+#define DISABLE_ATTR_RES        33
+#define SINK_EP_INFERRIX        40
+
+#define INFERRIX_MODBUS         0x0042
+#define FIRMWARE_VER            0x0100
+#define HARDWARE_VER            0x0100
+#define MANUFACTURER_INFERRIX   0x01
+
+uint16_t getVal_ws(uint16_t msb, uint16_t lsb);
+uint16_t reserveTwoByteData(uint16_t value);
+
+#endif
@@ -0,0 +1,13 @@
+/* Host shim of the iws attribute methods */
+#ifndef IWS_METHODS_H
+#define IWS_METHODS_H
+#include "api.h"
+void _attr_list();
+void _read_attr(const app_lib_data_received_t * data);
+void _write_attr(const app_lib_data_received_t * data);
+void _configure_reporting(const app_lib_data_received_t * data);
+void _read_configure_reporting(const app_lib_data_received_t * data);
+void _enable_particular_attr(const app_lib_data_received_t * data);
+void _disable_particular_attr(const app_lib_data_received_t * data);
+void _reboot_node(const app_lib_data_received_t * data);
+#endif
@@ -0,0 +1,43 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#include <string.h>
+#include "iws_defines.h"
+#include "host.h"
+
+static app_lib_data_receive_res_e send_attr_request(uint8_t dstEp, uint16_t attrId, const void * payload, uint8_t n)
+{
+    uint8_t bytes[3 + 255];
+
+    // Attribute id (LSB first) and type, then the value
+    bytes[0] = IWS_U16_LO8(attrId);
+    bytes[1] = IWS_U16_HI8(attrId);
+    bytes[2] = 0;
+    memcpy(&bytes[3], payload, n);
+    return Host_radio_downlink(SINK_EP_INFERRIX, dstEp, bytes, 3 + n);
+}
+
+void Host_init(uint32_t seed, const host_bus_config_t * bus)
+{
+    Host_clock_reset();
+    Host_bus_init(bus);
+    Host_slaves_reset(seed);
+    Host_radio_reset_stats();
+}
+
+void Host_boot(void)
+{
+    App_init(NULL);
+    Host_scheduler_run_for_ms(HOST_BOOT_TIME_MS);
+}
+
+app_lib_data_receive_res_e Host_write_attr(uint16_t attrId, const void * payload, uint8_t n)
+{
+    return send_attr_request(WRITE_ATTR, attrId, payload, n);
+}
+
+app_lib_data_receive_res_e Host_read_attr(uint16_t attrId, const void * payload, uint8_t n)
+{
+    return send_attr_request(READ_ATTR, attrId, payload, n);
+}
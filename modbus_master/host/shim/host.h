@@ -0,0 +1,55 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "api.h"
+#include "host_clock.h"
+#include "host_scheduler.h"
+#include "host_bus.h"
+#include "host_slaves.h"
+#include "host_radio.h"
+
+/**
+ * \brief   Virtual time after which the app is running (App_init delayed start)
+ */
+#define HOST_BOOT_TIME_MS   (61 * 1000)
+
+/**
+ * \brief   Entry point of the app (app.c)
+ */
+void App_init(const app_global_functions_t * functions);
+
+/**
+ * \brief   Resets the virtual clock, the bus and the slave farm
+ * \param   seed
+ *          Seed of the slave dropouts and jitter
+ * \param   bus
+ *          Line settings, NULL for the defaults
+ */
+void Host_init(uint32_t seed, const host_bus_config_t * bus);
+
+/**
+ * \brief   Starts the app like the stack does and runs it until its modbus part is up
+ */
+void Host_boot(void);
+
+/**
+ * \brief   Sends a write attribute request from the backend to the app
+ * \param   attrId
+ *          Attribute to write
+ * \param   payload
+ *          Attribute value, as sent over the air
+ */
+app_lib_data_receive_res_e Host_write_attr(uint16_t attrId, const void * payload, uint8_t n);
+
+/**
+ * \brief   Sends a read attribute request from the backend to the app
+ */
+app_lib_data_receive_res_e Host_read_attr(uint16_t attrId, const void * payload, uint8_t n);
+
+#endif //HOST_H
@@ -0,0 +1,221 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#include <string.h>
+#include "usart.h"
+#include "host_clock.h"
+#include "host_bus.h"
+#include "host_slaves.h"
+
+/** Bytes travelling on the bus, delivered by an event when the last one arrives */
+#define HOST_BUS_MAX_CHUNKS (16)
+
+typedef struct
+{
+    uint8_t bytes[HOST_BUS_MAX_FRAME];
+    uint16_t n;
+    bool used;
+} host_chunk_t;
+
+static host_bus_config_t m_config = {
+        .bitsPerChar = 10,
+        .rxChunk = 0,
+};
+static host_chunk_t m_chunks[HOST_BUS_MAX_CHUNKS];
+static host_bus_stats_t m_stats;
+static host_bus_monitor_f m_monitor;
+
+/** Time until which the line is driven */
+static uint64_t m_busy_until_us;
+
+static uint32_t m_baudrate = 9600;
+static bool m_enabled;
+static bool m_receiver_on;
+static serial_rx_callback_f m_rx_callback;
+
+static host_chunk_t * alloc_chunk(const uint8_t * bytes, uint16_t n)
+{
+    for (uint8_t i = 0; i < HOST_BUS_MAX_CHUNKS; i++)
+    {
+        if (!m_chunks[i].used)
+        {
+            m_chunks[i].used = true;
+            m_chunks[i].n = n;
+            memcpy(m_chunks[i].bytes, bytes, n);
+            return &m_chunks[i];
+        }
+    }
+    return NULL;
+}
+
+/** Master UART interrupt: part of a reply received */
+static void on_master_rx(void * arg)
+{
+    host_chunk_t * chunk = arg;
+    if (m_enabled && m_receiver_on && m_rx_callback != NULL)
+    {
+        m_rx_callback(chunk->bytes, chunk->n);
+    }
+    chunk->used = false;
+}
+
+static void send_reply(const uint8_t * reply, uint16_t n, uint32_t latency_us)
+{
+    uint32_t char_us = Host_bus_char_time_us();
+    uint16_t step = (m_config.rxChunk == 0) ? n : m_config.rxChunk;
+    uint64_t start_us = Host_clock_now_us() + latency_us;
+
+    if (start_us < m_busy_until_us)
+    {
+        start_us = m_busy_until_us;
+    }
+    if (m_monitor != NULL)
+    {
+        m_monitor(false, reply, n, start_us);
+    }
+    for (uint16_t offset = 0; offset < n; offset += step)
+    {
+        uint16_t length = (n - offset < step) ? (n - offset) : step;
+        host_chunk_t * chunk = alloc_chunk(&reply[offset], length);
+        if (chunk != NULL)
+        {
+            Host_clock_post(start_us + (uint64_t) (offset + length) * char_us, on_master_rx, chunk);
+        }
+    }
+    m_busy_until_us = start_us + (uint64_t) n * char_us;
+    m_stats.busyUs += (uint64_t) n * char_us;
+    m_stats.rxFrames++;
+    m_stats.rxBytes += n;
+}
+
+/** End of a request seen by the slaves (last byte + 3.5 char silence) */
+static void on_request_end(void * arg)
+{
+    host_chunk_t * chunk = arg;
+    uint8_t reply[HOST_BUS_MAX_FRAME];
+    uint16_t reply_n = 0;
+    uint32_t latency_us = 0;
+
+    if (Host_slaves_process(chunk->bytes, chunk->n, reply, &reply_n, &latency_us))
+    {
+        send_reply(reply, reply_n, latency_us);
+    }
+    else if (chunk->n > 0 && chunk->bytes[0] != 0)
+    {
+        m_stats.unanswered++;
+    }
+    chunk->used = false;
+}
+
+void Host_bus_init(const host_bus_config_t * config)
+{
+    if (config != NULL)
+    {
+        m_config = *config;
+    }
+    memset(m_chunks, 0, sizeof(m_chunks));
+    m_busy_until_us = 0;
+    Host_bus_reset_stats();
+}
+
+uint32_t Host_bus_get_baudrate(void)
+{
+    return m_baudrate;
+}
+
+uint32_t Host_bus_char_time_us(void)
+{
+    return (uint32_t) (((uint64_t) m_config.bitsPerChar * 1000000 + m_baudrate - 1) / m_baudrate);
+}
+
+uint32_t Host_bus_t35_us(void)
+{
+    if (m_baudrate > 19200)
+    {
+        return 1750;
+    }
+    return (Host_bus_char_time_us() * 7) / 2;
+}
+
+void Host_bus_set_monitor(host_bus_monitor_f monitor)
+{
+    m_monitor = monitor;
+}
+
+void Host_bus_get_stats(host_bus_stats_t * stats)
+{
+    *stats = m_stats;
+}
+
+void Host_bus_reset_stats(void)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+/* Wirepas USART HAL of the master on top of the simulated bus */
+
+bool Usart_init(uint32_t baudrate, uart_flow_control_e flow_control)
+{
+    (void) flow_control;
+    if (baudrate == 0)
+    {
+        return false;
+    }
+    m_baudrate = baudrate;
+    return true;
+}
+
+void Usart_setEnabled(bool enabled)
+{
+    m_enabled = enabled;
+}
+
+void Usart_receiverOn(void)
+{
+    m_receiver_on = true;
+}
+
+void Usart_receiverOff(void)
+{
+    m_receiver_on = false;
+}
+
+bool Usart_enableReceiver(serial_rx_callback_f rx_callback)
+{
+    m_rx_callback = rx_callback;
+    return true;
+}
+
+uint32_t Usart_sendBuffer(const void * buffer, uint32_t length)
+{
+    uint32_t char_us = Host_bus_char_time_us();
+    uint64_t start_us = Host_clock_now_us();
+    host_chunk_t * chunk;
+
+    if (!m_enabled || length == 0 || length > HOST_BUS_MAX_FRAME)
+    {
+        return 0;
+    }
+    if (start_us < m_busy_until_us)
+    {
+        // Half duplex line still driven by a slave
+        m_stats.collisions++;
+        start_us = m_busy_until_us;
+    }
+    chunk = alloc_chunk(buffer, (uint16_t) length);
+    if (chunk == NULL)
+    {
+        return 0;
+    }
+    if (m_monitor != NULL)
+    {
+        m_monitor(true, buffer, (uint16_t) length, start_us);
+    }
+    m_busy_until_us = start_us + (uint64_t) length * char_us;
+    m_stats.busyUs += (uint64_t) length * char_us;
+    m_stats.txFrames++;
+    m_stats.txBytes += length;
+    Host_clock_post(m_busy_until_us + Host_bus_t35_us(), on_request_end, chunk);
+    return length;
+}
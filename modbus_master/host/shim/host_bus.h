@@ -0,0 +1,65 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#ifndef HOST_BUS_H
+#define HOST_BUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * \brief   Largest RTU frame carried by the simulated bus
+ */
+#define HOST_BUS_MAX_FRAME (256)
+
+typedef struct
+{
+    uint8_t bitsPerChar;    /* 10 for 8N1, 11 for 8E1 / 8N2 */
+    uint8_t rxChunk;        /* bytes per rx callback, 0 for the whole frame at once */
+} host_bus_config_t;
+
+typedef struct
+{
+    uint32_t txFrames;      /* frames sent by the master */
+    uint32_t rxFrames;      /* replies sent by the slaves */
+    uint32_t txBytes;
+    uint32_t rxBytes;
+    uint32_t unanswered;    /* unicast requests without reply */
+    uint32_t collisions;    /* master sent while the bus was busy */
+    uint64_t busyUs;        /* time the line was driven */
+} host_bus_stats_t;
+
+/**
+ * \brief   Called for every frame put on the bus
+ * \param   fromMaster
+ *          True for a request, false for a slave reply
+ * \param   atUs
+ *          Virtual time of the first byte
+ */
+typedef void (*host_bus_monitor_f)(bool fromMaster, const uint8_t * bytes, uint16_t n, uint64_t atUs);
+
+/**
+ * \brief   Configures the line. The baud rate is the one set by the app with Usart_init.
+ * \param   config
+ *          Line settings, NULL for 8N1 and whole frame reception
+ */
+void Host_bus_init(const host_bus_config_t * config);
+
+uint32_t Host_bus_get_baudrate(void);
+
+/**
+ * \brief   Time on the line of one character, in us
+ */
+uint32_t Host_bus_char_time_us(void);
+
+/**
+ * \brief   RTU inter-frame silence (3.5 characters, 1750 us above 19200 baud)
+ */
+uint32_t Host_bus_t35_us(void);
+
+void Host_bus_set_monitor(host_bus_monitor_f monitor);
+void Host_bus_get_stats(host_bus_stats_t * stats);
+void Host_bus_reset_stats(void);
+
+#endif //HOST_BUS_H
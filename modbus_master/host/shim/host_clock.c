@@ -0,0 +1,159 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#include <string.h>
+#include "api.h"
+#include "host_clock.h"
+
+typedef struct
+{
+    uint64_t at_us;
+    uint32_t seq;       /* keeps posting order for events due at the same time */
+    host_event_f cb;
+    void * arg;
+} host_event_t;
+
+static host_event_t m_events[HOST_CLOCK_MAX_EVENTS];
+static uint8_t m_event_count;
+static uint32_t m_seq;
+static uint64_t m_now_us;
+static uint32_t m_critical_nesting;
+
+static int8_t get_next_event(void)
+{
+    int8_t next = -1;
+    for (uint8_t i = 0; i < m_event_count; i++)
+    {
+        if (next < 0
+            || m_events[i].at_us < m_events[next].at_us
+            || (m_events[i].at_us == m_events[next].at_us && m_events[i].seq < m_events[next].seq))
+        {
+            next = i;
+        }
+    }
+    return next;
+}
+
+/** Runs the events due at or before t_us, each at its own time */
+static void run_events(uint64_t t_us)
+{
+    int8_t next;
+    while (m_critical_nesting == 0 && (next = get_next_event()) >= 0 && m_events[next].at_us <= t_us)
+    {
+        host_event_t event = m_events[next];
+        m_events[next] = m_events[--m_event_count];
+        if (event.at_us > m_now_us)
+        {
+            m_now_us = event.at_us;
+        }
+        event.cb(event.arg);
+    }
+}
+
+void Host_clock_reset(void)
+{
+    m_event_count = 0;
+    m_seq = 0;
+    m_now_us = 0;
+    m_critical_nesting = 0;
+}
+
+uint64_t Host_clock_now_us(void)
+{
+    return m_now_us;
+}
+
+bool Host_clock_post(uint64_t at_us, host_event_f cb, void * arg)
+{
+    if (m_event_count >= HOST_CLOCK_MAX_EVENTS)
+    {
+        return false;
+    }
+    m_events[m_event_count++] = (host_event_t) {
+            .at_us = at_us,
+            .seq = m_seq++,
+            .cb = cb,
+            .arg = arg,
+    };
+    return true;
+}
+
+uint64_t Host_clock_next_event_us(void)
+{
+    int8_t next = get_next_event();
+    return next < 0 ? HOST_CLOCK_NEVER : m_events[next].at_us;
+}
+
+void Host_clock_advance_to(uint64_t t_us)
+{
+    run_events(t_us);
+    if (t_us > m_now_us)
+    {
+        m_now_us = t_us;
+    }
+}
+
+void Host_clock_advance_us(uint32_t us)
+{
+    Host_clock_advance_to(m_now_us + us);
+}
+
+void Sys_enterCriticalSection(void)
+{
+    m_critical_nesting++;
+}
+
+void Sys_exitCriticalSection(void)
+{
+    if (m_critical_nesting > 0 && --m_critical_nesting == 0)
+    {
+        // Interrupts held back by the critical section are served now
+        run_events(m_now_us);
+    }
+}
+
+/* Wirepas time library on top of the virtual clock */
+
+static app_lib_time_timestamp_hp_t get_timestamp_hp(void)
+{
+    return (app_lib_time_timestamp_hp_t) m_now_us;
+}
+
+static app_lib_time_timestamp_coarse_t get_timestamp_coarse(void)
+{
+    // 1/128 s resolution
+    return (app_lib_time_timestamp_coarse_t) ((m_now_us * 128) / 1000000);
+}
+
+static uint32_t get_time_diff_us(app_lib_time_timestamp_hp_t a, app_lib_time_timestamp_hp_t b)
+{
+    return b - a;
+}
+
+static app_lib_time_timestamp_hp_t add_us_to_hp_timestamp(app_lib_time_timestamp_hp_t t, uint32_t us)
+{
+    return t + us;
+}
+
+static bool is_hp_timestamp_before(app_lib_time_timestamp_hp_t a, app_lib_time_timestamp_hp_t b)
+{
+    return (int32_t) (a - b) < 0;
+}
+
+static uint32_t get_max_hp_delay(void)
+{
+    // Same order of magnitude as on target (~30 minutes)
+    return 30UL * 60 * 1000 * 1000;
+}
+
+static const app_lib_time_t m_lib_time = {
+        .getTimestampHp = get_timestamp_hp,
+        .getTimestampCoarse = get_timestamp_coarse,
+        .getTimeDiffUs = get_time_diff_us,
+        .addUsToHpTimestamp = add_us_to_hp_timestamp,
+        .isHpTimestampBefore = is_hp_timestamp_before,
+        .getMaxHpDelay = get_max_hp_delay,
+};
+
+const app_lib_time_t * lib_time = &m_lib_time;
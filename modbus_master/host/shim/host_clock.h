@@ -0,0 +1,53 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#ifndef HOST_CLOCK_H
+#define HOST_CLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * \brief   Maximum number of pending events (bus bytes, slave replies...)
+ */
+#define HOST_CLOCK_MAX_EVENTS (64)
+
+#define HOST_CLOCK_NEVER (UINT64_MAX)
+
+/**
+ * \brief   Event callback, runs like an interrupt handler at its due time
+ */
+typedef void (*host_event_f)(void * arg);
+
+/**
+ * \brief   Resets the virtual time to 0 and drops the pending events
+ */
+void Host_clock_reset(void);
+
+/**
+ * \brief   Current virtual time in us since reset
+ */
+uint64_t Host_clock_now_us(void);
+
+/**
+ * \brief   Posts an event
+ * \param   at_us
+ *          Virtual time of the event, events in the past run at next advance
+ * \return  False if the event table is full
+ */
+bool Host_clock_post(uint64_t at_us, host_event_f cb, void * arg);
+
+/**
+ * \brief   Virtual time of the next pending event, HOST_CLOCK_NEVER if none
+ */
+uint64_t Host_clock_next_event_us(void);
+
+/**
+ * \brief   Moves the virtual time forward, running the events due on the way.
+ *          Inside a critical section the events are held back until it is left.
+ */
+void Host_clock_advance_to(uint64_t t_us);
+void Host_clock_advance_us(uint32_t us);
+
+#endif //HOST_CLOCK_H
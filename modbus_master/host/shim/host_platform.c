@@ -0,0 +1,142 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#include <string.h>
+#include "api.h"
+#include "board.h"
+#include "node_configuration.h"
+#include "iws_defines.h"
+#include "iws_storage.h"
+#include "nrf_delay.h"
+#include "host_clock.h"
+
+/* Wirepas stack, settings and board */
+
+static bool m_stack_running;
+
+static app_res_e start_stack(void)
+{
+    m_stack_running = true;
+    return APP_RES_OK;
+}
+
+static app_res_e stop_stack(void)
+{
+    m_stack_running = false;
+    return APP_RES_OK;
+}
+
+static app_res_e set_node_role(uint8_t role)
+{
+    (void) role;
+    return APP_RES_OK;
+}
+
+static app_res_e set_node_address(app_addr_t addr)
+{
+    (void) addr;
+    return APP_RES_OK;
+}
+
+static const app_lib_state_t m_lib_state = {
+        .startStack = start_stack,
+        .stopStack = stop_stack,
+};
+
+static const app_lib_settings_t m_lib_settings = {
+        .setNodeRole = set_node_role,
+        .setNodeAddress = set_node_address,
+};
+
+const app_lib_state_t * lib_state = &m_lib_state;
+const app_lib_settings_t * lib_settings = &m_lib_settings;
+
+void API_Open(const app_global_functions_t * functions)
+{
+    (void) functions;
+}
+
+app_res_e configureNodeFromBuildParameters(void)
+{
+    return APP_RES_OK;
+}
+
+void nrf_gpio_pin_set(uint32_t pin)
+{
+    (void) pin;
+}
+
+void nrf_gpio_pin_clear(uint32_t pin)
+{
+    (void) pin;
+}
+
+void nrf_gpio_cfg_default(uint32_t pin)
+{
+    (void) pin;
+}
+
+void nrf_gpio_cfg(uint32_t pin, int dir, int input, int pull, int drive, int sense)
+{
+    (void) pin; (void) dir; (void) input; (void) pull; (void) drive; (void) sense;
+}
+
+/* Busy waits keep the cpu, only interrupts (bus events) run meanwhile */
+
+void nrf_delay_ms(uint32_t ms)
+{
+    Host_clock_advance_us(ms * 1000);
+}
+
+void nrf_delay_us(uint32_t us)
+{
+    Host_clock_advance_us(us);
+}
+
+/* iws libraries */
+
+uint16_t getVal_ws(uint16_t msb, uint16_t lsb)
+{
+    return (uint16_t) ((msb << 8) | (lsb & 0xFF));
+}
+
+uint16_t reserveTwoByteData(uint16_t value)
+{
+    return (uint16_t) ((value << 8) | (value >> 8));
+}
+
+/** Persistent area, erased flash at start */
+static uint8_t m_storage[STORAGE_AREA];
+
+void Iws_storage_init(void)
+{
+    static bool initialized = false;
+    if (!initialized)
+    {
+        memset(m_storage, 0xFF, sizeof(m_storage));
+        initialized = true;
+    }
+}
+
+iws_storage_res_e Iws_storage_read(uint8_t * buffer, uint16_t offset, uint16_t length)
+{
+    Iws_storage_init();
+    if ((uint32_t) offset + length > STORAGE_AREA)
+    {
+        return IWS_STORAGE_RES_ERROR;
+    }
+    memcpy(buffer, &m_storage[offset], length);
+    return IWS_STORAGE_RES_OK;
+}
+
+iws_storage_res_e Iws_storage_write(uint8_t * buffer, uint16_t offset, uint16_t length)
+{
+    Iws_storage_init();
+    if ((uint32_t) offset + length > STORAGE_AREA)
+    {
+        return IWS_STORAGE_RES_ERROR;
+    }
+    memcpy(&m_storage[offset], buffer, length);
+    return IWS_STORAGE_RES_OK;
+}
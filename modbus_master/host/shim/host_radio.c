@@ -0,0 +1,85 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#include <string.h>
+#include "api.h"
+#include "iws.h"
+#include "host_clock.h"
+#include "host_radio.h"
+
+static host_radio_uplink_f m_hook;
+static host_radio_stats_t m_stats;
+static app_lib_data_data_received_cb_f m_data_cb;
+static app_lib_data_data_received_cb_f m_bcast_cb;
+
+void Host_radio_set_uplink_hook(host_radio_uplink_f hook)
+{
+    m_hook = hook;
+}
+
+void Host_radio_get_stats(host_radio_stats_t * stats)
+{
+    *stats = m_stats;
+}
+
+void Host_radio_reset_stats(void)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+app_lib_data_receive_res_e Host_radio_downlink(uint8_t srcEp, uint8_t dstEp, const uint8_t * bytes, size_t n)
+{
+    app_lib_data_received_t data = {
+            .bytes = bytes,
+            .num_bytes = n,
+            .src_address = 1,
+            .delay = 0,
+            .qos = 0,
+            .src_endpoint = srcEp,
+            .dest_endpoint = dstEp,
+            .hops = 1,
+    };
+
+    if (m_data_cb == NULL)
+    {
+        return APP_LIB_DATA_RECEIVE_RES_NOT_FOR_APP;
+    }
+    return m_data_cb(&data);
+}
+
+bool _send_data(uint8_t * bytes, uint8_t num_bytes, app_addr_t dest, uint8_t src_ep, uint8_t dest_ep)
+{
+    (void) dest;
+    m_stats.packets++;
+    m_stats.bytes += num_bytes;
+    if (m_hook != NULL)
+    {
+        m_hook(bytes, num_bytes, src_ep, dest_ep, Host_clock_now_us());
+    }
+    return true;
+}
+
+bool _send_data_QOS_high(uint8_t * bytes, uint8_t num_bytes, app_addr_t dest, uint8_t src_ep, uint8_t dest_ep)
+{
+    return _send_data(bytes, num_bytes, dest, src_ep, dest_ep);
+}
+
+static app_res_e set_data_received_cb(app_lib_data_data_received_cb_f cb)
+{
+    m_data_cb = cb;
+    return APP_RES_OK;
+}
+
+static app_res_e set_bcast_data_received_cb(app_lib_data_data_received_cb_f cb)
+{
+    m_bcast_cb = cb;
+    return APP_RES_OK;
+}
+
+static const app_lib_data_t m_lib_data = {
+        .setDataReceivedCb = set_data_received_cb,
+        .setBcastDataReceivedCb = set_bcast_data_received_cb,
+};
+
+const app_lib_data_t * lib_data = &m_lib_data;
@@ -0,0 +1,37 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#ifndef HOST_RADIO_H
+#define HOST_RADIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "api.h"
+
+typedef struct
+{
+    uint32_t packets;
+    uint32_t bytes;
+} host_radio_stats_t;
+
+/**
+ * \brief   Called for every packet sent by the app to the sink
+ */
+typedef void (*host_radio_uplink_f)(const uint8_t * bytes, uint8_t n, uint8_t srcEp, uint8_t dstEp, uint64_t atUs);
+
+void Host_radio_set_uplink_hook(host_radio_uplink_f hook);
+void Host_radio_get_stats(host_radio_stats_t * stats);
+void Host_radio_reset_stats(void);
+
+/**
+ * \brief   Delivers a packet from the backend to the app data callback
+ * \param   srcEp
+ *          Source endpoint, SINK_EP_INFERRIX for the backend
+ * \param   dstEp
+ *          Destination endpoint (READ_ATTR, WRITE_ATTR...)
+ * \return  Result of the app callback, NOT_FOR_APP if none is registered
+ */
+app_lib_data_receive_res_e Host_radio_downlink(uint8_t srcEp, uint8_t dstEp, const uint8_t * bytes, size_t n);
+
+#endif //HOST_RADIO_H
@@ -0,0 +1,142 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#include <stdbool.h>
+#include <string.h>
+#include "app_scheduler.h"
+#include "host_clock.h"
+#include "host_scheduler.h"
+
+typedef struct
+{
+    task_cb_f cb;
+    uint64_t next_us;
+} host_task_t;
+
+static host_task_t m_tasks[HOST_SCHEDULER_MAX_TASKS];
+
+/** Task being executed, and whether it was added or cancelled meanwhile */
+static task_cb_f m_running;
+static bool m_running_updated;
+
+static uint32_t m_run_count;
+
+static host_task_t * find_task(task_cb_f cb)
+{
+    for (uint8_t i = 0; i < HOST_SCHEDULER_MAX_TASKS; i++)
+    {
+        if (m_tasks[i].cb == cb)
+        {
+            return &m_tasks[i];
+        }
+    }
+    return NULL;
+}
+
+static host_task_t * get_next_task(void)
+{
+    host_task_t * next = NULL;
+    for (uint8_t i = 0; i < HOST_SCHEDULER_MAX_TASKS; i++)
+    {
+        if (m_tasks[i].cb != NULL && (next == NULL || m_tasks[i].next_us < next->next_us))
+        {
+            next = &m_tasks[i];
+        }
+    }
+    return next;
+}
+
+void App_Scheduler_init(void)
+{
+    memset(m_tasks, 0, sizeof(m_tasks));
+    m_running = NULL;
+    m_running_updated = false;
+    m_run_count = 0;
+}
+
+app_scheduler_res_e App_Scheduler_addTask_execTime(task_cb_f cb, uint32_t delay_ms, uint32_t exec_time_us)
+{
+    host_task_t * task = find_task(cb);
+
+    (void) exec_time_us;
+    if (task == NULL)
+    {
+        task = find_task(NULL);
+        if (task == NULL)
+        {
+            return APP_SCHEDULER_RES_NO_MORE_TASK;
+        }
+    }
+    task->cb = cb;
+    task->next_us = Host_clock_now_us() + (uint64_t) delay_ms * 1000;
+    if (cb == m_running)
+    {
+        // Return value of the running task must not override this
+        m_running_updated = true;
+    }
+    return APP_SCHEDULER_RES_OK;
+}
+
+app_scheduler_res_e App_Scheduler_cancelTask(task_cb_f cb)
+{
+    host_task_t * task = find_task(cb);
+
+    if (cb == m_running)
+    {
+        m_running_updated = true;
+    }
+    if (task == NULL)
+    {
+        return APP_SCHEDULER_RES_UNKNOWN_TASK;
+    }
+    task->cb = NULL;
+    return APP_SCHEDULER_RES_OK;
+}
+
+void Host_scheduler_run_until(uint64_t end_us)
+{
+    while (true)
+    {
+        host_task_t * task = get_next_task();
+        uint64_t next_event_us = Host_clock_next_event_us();
+
+        if ((task == NULL || task->next_us > end_us) && next_event_us > end_us)
+        {
+            break;
+        }
+        if (task == NULL || next_event_us <= task->next_us)
+        {
+            // Interrupts first, they may add or cancel tasks
+            Host_clock_advance_to(next_event_us);
+            continue;
+        }
+
+        Host_clock_advance_to(task->next_us);
+        m_running = task->cb;
+        m_running_updated = false;
+        task->cb = NULL;
+        m_run_count++;
+
+        uint32_t next_ms = m_running();
+
+        if (!m_running_updated && next_ms != APP_SCHEDULER_STOP_TASK)
+        {
+            task_cb_f cb = m_running;
+            m_running = NULL;
+            App_Scheduler_addTask_execTime(cb, next_ms, 0);
+        }
+        m_running = NULL;
+    }
+    Host_clock_advance_to(end_us);
+}
+
+void Host_scheduler_run_for_ms(uint32_t ms)
+{
+    Host_scheduler_run_until(Host_clock_now_us() + (uint64_t) ms * 1000);
+}
+
+uint32_t Host_scheduler_get_run_count(void)
+{
+    return m_run_count;
+}
@@ -0,0 +1,35 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#ifndef HOST_SCHEDULER_H
+#define HOST_SCHEDULER_H
+
+#include <stdint.h>
+#include "app_scheduler.h"
+
+/**
+ * \brief   Maximum number of app scheduler tasks, as APP_SCHEDULER_TASKS on target
+ */
+#ifndef HOST_SCHEDULER_MAX_TASKS
+#define HOST_SCHEDULER_MAX_TASKS (10)
+#endif
+
+/**
+ * \brief   Runs the app scheduler tasks and the events until a virtual time
+ * \param   end_us
+ *          Virtual time to stop at
+ */
+void Host_scheduler_run_until(uint64_t end_us);
+
+/**
+ * \brief   Runs the app scheduler tasks and the events for a duration
+ */
+void Host_scheduler_run_for_ms(uint32_t ms);
+
+/**
+ * \brief   Number of task executions since App_Scheduler_init
+ */
+uint32_t Host_scheduler_get_run_count(void);
+
+#endif //HOST_SCHEDULER_H
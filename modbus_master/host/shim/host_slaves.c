@@ -0,0 +1,366 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#include <string.h>
+#include "host_slaves.h"
+
+#define EXC_FUNC_CODE   1
+#define EXC_ADDR_RANGE  2
+#define EXC_REGS_QUANT  3
+
+static host_slave_t m_slaves[HOST_SLAVES_MAX];
+static uint32_t m_random;
+
+static uint16_t get_u16(const uint8_t * bytes)
+{
+    return (uint16_t) ((bytes[0] << 8) | bytes[1]);
+}
+
+static void put_u16(uint8_t * bytes, uint16_t value)
+{
+    bytes[0] = (uint8_t) (value >> 8);
+    bytes[1] = (uint8_t) value;
+}
+
+static bool get_bit(const uint8_t * bits, uint16_t index)
+{
+    return (bits[index / 8] >> (index % 8)) & 1;
+}
+
+static void set_bit(uint8_t * bits, uint16_t index, bool value)
+{
+    if (value)
+    {
+        bits[index / 8] |= (uint8_t) (1 << (index % 8));
+    }
+    else
+    {
+        bits[index / 8] &= (uint8_t) ~(1 << (index % 8));
+    }
+}
+
+static bool range_ok(uint16_t addr, uint16_t count)
+{
+    return (uint32_t) addr + count <= HOST_SLAVE_MAX_REGS;
+}
+
+/**
+ * \brief   Applies a request to a slave
+ * \return  Reply length without CRC, 0 if the function is not known,
+ *          or an exception code in reply[2] with reply[1] | 0x80
+ */
+static uint16_t execute(host_slave_t * slave, const uint8_t * req, uint16_t n, uint8_t * reply)
+{
+    uint8_t fct = req[1];
+    uint16_t addr = get_u16(&req[2]);
+    uint16_t count = get_u16(&req[4]);
+    uint16_t max_regs = slave->maxRegsPerRead ? slave->maxRegsPerRead : 125;
+    uint8_t exception = 0;
+    uint16_t length = 0;
+
+    reply[0] = slave->address;
+    reply[1] = fct;
+
+    switch (fct)
+    {
+        case 1:
+        case 2:
+        {
+            const uint8_t * bits = (fct == 1) ? slave->coils : slave->discrete;
+            if (count == 0 || count > 2000)
+            {
+                exception = EXC_REGS_QUANT;
+                break;
+            }
+            if (!range_ok(addr, count))
+            {
+                exception = EXC_ADDR_RANGE;
+                break;
+            }
+            reply[2] = (uint8_t) ((count + 7) / 8);
+            memset(&reply[3], 0, reply[2]);
+            for (uint16_t i = 0; i < count; i++)
+            {
+                if (get_bit(bits, addr + i))
+                {
+                    reply[3 + i / 8] |= (uint8_t) (1 << (i % 8));
+                }
+            }
+            length = 3 + reply[2];
+        }
+        break;
+
+        case 3:
+        case 4:
+        {
+            const uint16_t * regs = (fct == 3) ? slave->holding : slave->input;
+            if (count == 0 || count > max_regs)
+            {
+                exception = EXC_REGS_QUANT;
+                break;
+            }
+            if (!range_ok(addr, count))
+            {
+                exception = EXC_ADDR_RANGE;
+                break;
+            }
+            reply[2] = (uint8_t) (count * 2);
+            for (uint16_t i = 0; i < count; i++)
+            {
+                put_u16(&reply[3 + i * 2], regs[addr + i]);
+            }
+            length = 3 + reply[2];
+        }
+        break;
+
+        case 5:
+            if (!range_ok(addr, 1))
+            {
+                exception = EXC_ADDR_RANGE;
+                break;
+            }
+            if (count != 0xFF00 && count != 0x0000)
+            {
+                exception = EXC_REGS_QUANT;
+                break;
+            }
+            set_bit(slave->coils, addr, count == 0xFF00);
+            memcpy(&reply[2], &req[2], 4);
+            length = 6;
+            break;
+
+        case 6:
+            if (!range_ok(addr, 1))
+            {
+                exception = EXC_ADDR_RANGE;
+                break;
+            }
+            slave->holding[addr] = count;
+            memcpy(&reply[2], &req[2], 4);
+            length = 6;
+            break;
+
+        case 15:
+            if (count == 0 || count > 1968 || n < 7 || req[6] != (count + 7) / 8)
+            {
+                exception = EXC_REGS_QUANT;
+                break;
+            }
+            if (!range_ok(addr, count))
+            {
+                exception = EXC_ADDR_RANGE;
+                break;
+            }
+            for (uint16_t i = 0; i < count; i++)
+            {
+                set_bit(slave->coils, addr + i, get_bit(&req[7], i));
+            }
+            memcpy(&reply[2], &req[2], 4);
+            length = 6;
+            break;
+
+        case 16:
+            if (count == 0 || count > 123 || n < 7 || req[6] != count * 2)
+            {
+                exception = EXC_REGS_QUANT;
+                break;
+            }
+            if (!range_ok(addr, count))
+            {
+                exception = EXC_ADDR_RANGE;
+                break;
+            }
+            for (uint16_t i = 0; i < count; i++)
+            {
+                slave->holding[addr + i] = get_u16(&req[7 + i * 2]);
+            }
+            memcpy(&reply[2], &req[2], 4);
+            length = 6;
+            break;
+
+        case 22:
+            if (!range_ok(addr, 1) || n < 8)
+            {
+                exception = EXC_ADDR_RANGE;
+                break;
+            }
+            // (register AND and) OR (or AND NOT and)
+            slave->holding[addr] = (uint16_t) ((slave->holding[addr] & count) | (get_u16(&req[6]) & ~count));
+            memcpy(&reply[2], &req[2], 6);
+            length = 8;
+            break;
+
+        case 23:
+        {
+            // Write first, then read: the read sees the written values
+            uint16_t write_addr = get_u16(&req[6]);
+            uint16_t write_count = get_u16(&req[8]);
+            if (count == 0 || count > max_regs || write_count == 0 || write_count > 121
+                || n < 11 || req[10] != write_count * 2)
+            {
+                exception = EXC_REGS_QUANT;
+                break;
+            }
+            if (!range_ok(addr, count) || !range_ok(write_addr, write_count))
+            {
+                exception = EXC_ADDR_RANGE;
+                break;
+            }
+            for (uint16_t i = 0; i < write_count; i++)
+            {
+                slave->holding[write_addr + i] = get_u16(&req[11 + i * 2]);
+            }
+            reply[2] = (uint8_t) (count * 2);
+            for (uint16_t i = 0; i < count; i++)
+            {
+                put_u16(&reply[3 + i * 2], slave->holding[addr + i]);
+            }
+            length = 3 + reply[2];
+        }
+        break;
+
+        default:
+            exception = EXC_FUNC_CODE;
+            break;
+    }
+
+    if (exception != 0)
+    {
+        reply[1] = fct | 0x80;
+        reply[2] = exception;
+        length = 3;
+        slave->stats.exceptions++;
+    }
+    return length;
+}
+
+void Host_slaves_reset(uint32_t seed)
+{
+    memset(m_slaves, 0, sizeof(m_slaves));
+    m_random = seed ? seed : 1;
+}
+
+host_slave_t * Host_slaves_add(uint8_t address)
+{
+    host_slave_t * slave = NULL;
+
+    if (address == 0 || address > 247 || Host_slaves_get(address) != NULL)
+    {
+        return NULL;
+    }
+    for (uint8_t i = 0; i < HOST_SLAVES_MAX; i++)
+    {
+        if (m_slaves[i].address == 0)
+        {
+            slave = &m_slaves[i];
+            break;
+        }
+    }
+    if (slave != NULL)
+    {
+        memset(slave, 0, sizeof(host_slave_t));
+        slave->address = address;
+        slave->latencyUs = 5000;
+        for (uint16_t i = 0; i < HOST_SLAVE_MAX_REGS; i++)
+        {
+            slave->holding[i] = i;
+            slave->input[i] = i;
+        }
+    }
+    return slave;
+}
+
+host_slave_t * Host_slaves_get(uint8_t address)
+{
+    for (uint8_t i = 0; i < HOST_SLAVES_MAX; i++)
+    {
+        if (address != 0 && m_slaves[i].address == address)
+        {
+            return &m_slaves[i];
+        }
+    }
+    return NULL;
+}
+
+bool Host_slaves_process(const uint8_t * request, uint16_t n, uint8_t * reply, uint16_t * reply_n, uint32_t * latency_us)
+{
+    host_slave_t * slave;
+    uint16_t length;
+
+    // Shortest request is address, function, 2 data bytes and CRC
+    if (n < 6 || Host_slaves_crc(request, n - 2) != (uint16_t) (request[n - 2] | (request[n - 1] << 8)))
+    {
+        return false;
+    }
+
+    if (request[0] == 0)
+    {
+        // Broadcast: every slave applies it, none answers
+        for (uint8_t i = 0; i < HOST_SLAVES_MAX; i++)
+        {
+            if (m_slaves[i].address != 0)
+            {
+                m_slaves[i].stats.requests++;
+                execute(&m_slaves[i], request, n, reply);
+            }
+        }
+        return false;
+    }
+
+    slave = Host_slaves_get(request[0]);
+    if (slave == NULL)
+    {
+        return false;
+    }
+    slave->stats.requests++;
+    if (slave->dropoutPermille != 0 && (Host_slaves_random() % 1000) < slave->dropoutPermille)
+    {
+        slave->stats.dropped++;
+        return false;
+    }
+
+    if (slave->forcedException != 0)
+    {
+        reply[0] = slave->address;
+        reply[1] = request[1] | 0x80;
+        reply[2] = slave->forcedException;
+        length = 3;
+        slave->stats.exceptions++;
+    }
+    else
+    {
+        length = execute(slave, request, n, reply);
+    }
+
+    uint16_t crc = Host_slaves_crc(reply, length);
+    reply[length++] = (uint8_t) crc;
+    reply[length++] = (uint8_t) (crc >> 8);
+    *reply_n = length;
+    *latency_us = slave->latencyUs + (slave->jitterUs ? Host_slaves_random() % (slave->jitterUs + 1) : 0);
+    slave->stats.replies++;
+    return true;
+}
+
+uint16_t Host_slaves_crc(const uint8_t * bytes, uint16_t n)
+{
+    uint16_t crc = 0xFFFF;
+    for (uint16_t i = 0; i < n; i++)
+    {
+        crc ^= bytes[i];
+        for (uint8_t j = 0; j < 8; j++)
+        {
+            crc = (crc & 1) ? (uint16_t) ((crc >> 1) ^ 0xA001) : (uint16_t) (crc >> 1);
+        }
+    }
+    return crc;
+}
+
+uint32_t Host_slaves_random(void)
+{
+    // xorshift32, same sequence for the same seed
+    m_random ^= m_random << 13;
+    m_random ^= m_random >> 17;
+    m_random ^= m_random << 5;
+    return m_random;
+}
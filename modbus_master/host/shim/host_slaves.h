@@ -0,0 +1,76 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#ifndef HOST_SLAVES_H
+#define HOST_SLAVES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HOST_SLAVES_MAX         (32)
+/** Register and bit addresses served by each slave: 0 .. HOST_SLAVE_MAX_REGS - 1 */
+#define HOST_SLAVE_MAX_REGS     (256)
+
+typedef struct
+{
+    uint32_t requests;
+    uint32_t replies;
+    uint32_t dropped;       /* no reply on purpose (dropout) */
+    uint32_t exceptions;
+} host_slave_stats_t;
+
+/**
+ * \brief   Simulated slave. Fields can be changed by the harness at any time.
+ */
+typedef struct
+{
+    uint8_t address;                            /* 1..247, 0 when the entry is free */
+    uint16_t holding[HOST_SLAVE_MAX_REGS];      /* FC3, FC6, FC16, FC22, FC23 */
+    uint16_t input[HOST_SLAVE_MAX_REGS];        /* FC4 */
+    uint8_t coils[HOST_SLAVE_MAX_REGS / 8];     /* FC1, FC5, FC15 */
+    uint8_t discrete[HOST_SLAVE_MAX_REGS / 8];  /* FC2 */
+    uint16_t maxRegsPerRead;                    /* larger reads get exception 3, 0 for 125 */
+    uint32_t latencyUs;                         /* turnaround before the reply */
+    uint32_t jitterUs;                          /* random extra turnaround, 0..jitterUs */
+    uint16_t dropoutPermille;                   /* requests left unanswered */
+    uint8_t forcedException;                    /* answer every request with it, 0 for none */
+    host_slave_stats_t stats;
+} host_slave_t;
+
+/**
+ * \brief   Removes all the slaves and seeds the random generator
+ */
+void Host_slaves_reset(uint32_t seed);
+
+/**
+ * \brief   Adds a slave with 5 ms of latency and register i holding i
+ * \return  The slave, NULL if the farm is full or the address is used
+ */
+host_slave_t * Host_slaves_add(uint8_t address);
+
+host_slave_t * Host_slaves_get(uint8_t address);
+
+/**
+ * \brief   Serves a request received from the bus
+ * \param   request
+ *          RTU frame with CRC
+ * \param   reply
+ *          RTU frame with CRC, HOST_BUS_MAX_FRAME bytes
+ * \param   latency_us
+ *          Turnaround of the answering slave
+ * \return  True if a reply has to be sent
+ */
+bool Host_slaves_process(const uint8_t * request, uint16_t n, uint8_t * reply, uint16_t * reply_n, uint32_t * latency_us);
+
+/**
+ * \brief   Modbus CRC16, low byte first on the line
+ */
+uint16_t Host_slaves_crc(const uint8_t * bytes, uint16_t n);
+
+/**
+ * \brief   Deterministic pseudo random value
+ */
+uint32_t Host_slaves_random(void);
+
+#endif //HOST_SLAVES_H
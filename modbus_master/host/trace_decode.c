@@ -0,0 +1,152 @@
+//
+// Created by Maverick on 18/10/26.
+//
+// Turns a dump of the transaction trace into a timeline.
+// Input: one MEMORY_DATA_TRACE response per line, in hex, as written by modbus_host -T
+// or copied from the backend. Pages may overlap or repeat, records are kept once by
+// sequence number.
+//
+//   trace_decode [file]
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "modbus_lib.h"
+#include "modbus_trace.h"
+
+#define MAX_RECORDS 65536
+
+static modbus_trace_record_t m_records[MAX_RECORDS];
+static bool m_present[MAX_RECORDS];
+
+static const char * result_name(int8_t result)
+{
+    switch (result)
+    {
+        case ERR_OK: return "ok";
+        case ERR_NOT_MASTER: return "not master";
+        case ERR_POLLING: return "busy";
+        case ERR_BUFF_OVERFLOW: return "overflow";
+        case ERR_BAD_CRC: return "bad crc";
+        case ERR_EXCEPTION: return "exception";
+        case ERR_BAD_SIZE: return "bad size";
+        case ERR_BAD_ADDRESS: return "bad address";
+        case ERR_TIME_OUT: return "timeout";
+        case ERR_BAD_SLAVE_ID: return "bad slave id";
+        case NO_REPLY: return "no reply";
+        case EXC_FUNC_CODE: return "bad function";
+        case MODBUS_TRACE_PENDING: return "pending";
+        default: return "?";
+    }
+}
+
+static void print_delay(uint16_t delay)
+{
+    if (delay == MODBUS_TRACE_NONE)
+    {
+        printf(" %9s", "-");
+    }
+    else
+    {
+        printf(" %9.1f", delay * MODBUS_TRACE_UNIT_US / 1000.0);
+    }
+}
+
+/** Hex line to bytes, spaces allowed */
+static int parse_hex(const char * line, uint8_t * bytes, int size)
+{
+    int n = 0;
+    int nibble = -1;
+
+    for (; *line && n < size; line++)
+    {
+        int value;
+        if (isspace((unsigned char) *line))
+        {
+            continue;
+        }
+        if (!isxdigit((unsigned char) *line))
+        {
+            return -1;
+        }
+        value = isdigit((unsigned char) *line) ? *line - '0' : (tolower((unsigned char) *line) - 'a' + 10);
+        if (nibble < 0)
+        {
+            nibble = value;
+        }
+        else
+        {
+            bytes[n++] = (uint8_t) (nibble << 4 | value);
+            nibble = -1;
+        }
+    }
+    return n;
+}
+
+int main(int argc, char * argv[])
+{
+    FILE * file = stdin;
+    char line[512];
+    uint8_t bytes[128];
+    uint32_t lowest = MAX_RECORDS, highest = 0;
+
+    if (argc > 1 && (file = fopen(argv[1], "r")) == NULL)
+    {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), file))
+    {
+        int n = parse_hex(line, bytes, sizeof(bytes));
+        modbus_trace_page_t header;
+
+        if (n < (int) sizeof(header))
+        {
+            continue;
+        }
+        memcpy(&header, bytes, sizeof(header));
+        if (header.type != MEMORY_DATA_TRACE
+            || n < (int) (sizeof(header) + header.count * sizeof(modbus_trace_record_t)))
+        {
+            fprintf(stderr, "skipped: not a trace page\n");
+            continue;
+        }
+        for (uint8_t i = 0; i < header.count; i++)
+        {
+            uint16_t seq = (uint16_t) (header.firstSeq + i);
+            memcpy(&m_records[seq], &bytes[sizeof(header) + i * sizeof(modbus_trace_record_t)],
+                   sizeof(modbus_trace_record_t));
+            m_present[seq] = true;
+            lowest = seq < lowest ? seq : lowest;
+            highest = seq > highest ? seq : highest;
+        }
+    }
+
+    if (lowest == MAX_RECORDS)
+    {
+        fprintf(stderr, "no trace record\n");
+        return 1;
+    }
+
+    // Times are in ms: post time since boot, then tx start from post, reply delays from tx start
+    printf("%6s %11s %5s %5s %3s %9s %9s %9s %4s %4s  %s\n",
+           "seq", "posted s", "query", "slave", "fct", "tx ms", "rx1 ms", "end ms", "txB", "rxB", "result");
+    for (uint32_t seq = lowest; seq <= highest; seq++)
+    {
+        const modbus_trace_record_t * record = &m_records[seq];
+        if (!m_present[seq])
+        {
+            continue;
+        }
+        printf("%6u %11.3f %5u %5u %3u", seq, record->timestamp / 128.0, record->queryId, record->slave, record->fct);
+        print_delay(record->txStart);
+        print_delay(record->rxFirst);
+        print_delay(record->rxEnd);
+        printf(" %4u %4u  %s (%d)\n", record->txBytes, record->rxBytes, result_name(record->result), record->result);
+    }
+    return 0;
+}
@@ -5,13 +5,25 @@
 #include "init.h"
 #include "../query_scheduler/query_scheduler.h"
 #include "../settings/settings.h"
+#include "../iws/uplink_budget/uplink_budget.h"
+#include "../log/modbus_log.h"
 #include "../../iws_libraries/utils/iws_defines.h"
 #include "../../../../libraries/scheduler/app_scheduler.h"
+#ifdef MODBUS_BENCH
+#include "../bench/bench.h"
+#endif
 
 uint32_t Init_modbus_app()
 {
     Init_settings();
     DELAY_IN_MS(5);
+    Uplink_budget_init();
+    Modbus_log_init();
+#ifdef MODBUS_BENCH
+    // Benchmark image: no polling, the bus stays quiet while cycles are counted
+    App_Scheduler_addTask_execTime(Bench_target_task, APP_SCHEDULER_SCHEDULE_ASAP, 500);
+#else
     Query_Scheduler_init();
+#endif
     return APP_SCHEDULER_STOP_TASK;
 }
\ No newline at end of file
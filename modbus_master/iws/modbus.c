@@ -11,11 +11,16 @@
 #include "../settings/reporting_intervals/reporting_intervals.h"
 #include "../../../../libraries/scheduler/app_scheduler.h"
 #include "../query_scheduler/query_scheduler.h"
+#include "../query_scheduler/query_stats.h"
+#include "../query_scheduler/query_scan.h"
 #include "../driver/modbus_lib.h"
 #include "iws_methods.h"
 #include "iws_app_specific.h"
 #include "../../iws_libraries/utils/iws_defines.h"
 #include "iws_reporting/reporting.h"
+#include "uplink_budget/uplink_budget.h"
+#include "../rules/rule_engine.h"
+#include "../log/modbus_log.h"
 #include "../../iws_libraries/nrf/_nrf_api/nrf_delay.h"
 
 
@@ -30,7 +35,9 @@ typedef struct {
  *  brief/         List Attribute Response
  */
 void _attr_list() {
-    list_attr_res_t attrList[] = { NODE_ATTR_ID, TLV_ATTR_ID, DEBUG_SINK_MESSAGE, MODBUS_SETTINGS_ATTR_ID };
+    list_attr_res_t attrList[] = { NODE_ATTR_ID, TLV_ATTR_ID, DEBUG_SINK_MESSAGE, MODBUS_SETTINGS_ATTR_ID, UPLINK_BUDGET_ATTR_ID,
+                                   MODBUS_RULES_ATTR_ID, QUERY_STATS_ATTR_ID, BUS_ADMISSION_ATTR_ID, MASK_WRITE_ATTR_ID,
+                                   WRITE_COMBINING_ATTR_ID, BUS_SCAN_ATTR_ID, BLOCK_LIMIT_ATTR_ID };
     _send_data((uint8_t *) attrList, sizeof(attrList), APP_ADDR_ANYSINK, LIST_ATTR, LIST_ATTR_RES);
 }
 
@@ -46,6 +53,93 @@ static void Iws_read_debug_send()
     _send_data_QOS_high((uint8_t *)&debugSinkResponse, sizeof(read_attr_boolean_res_t), APP_ADDR_ANYSINK, READ_ATTR, READ_ATTR_RES);
 }
 
+static void Iws_read_uplink_budget()
+{
+    read_attr_uplink_budget_t budgetResponse;
+    budgetResponse.readAttr.attrId = UPLINK_BUDGET_ATTR_ID;
+    budgetResponse.readAttr.status = STATUS_RES_SUCCESS;
+    budgetResponse.readAttr.typeId = TYPE_ID_MODBUS_SETTINGS;
+    Uplink_budget_get_status(&budgetResponse.budget);
+
+    _send_data_QOS_high((uint8_t *)&budgetResponse, sizeof(read_attr_uplink_budget_t), APP_ADDR_ANYSINK, READ_ATTR, READ_ATTR_RES);
+}
+
+static void Iws_read_modbus_rule(uint8_t ruleId)
+{
+    modbus_rule_t *rules = Get_Modbus_rules();
+    read_attr_modbus_rule_t ruleResponse;
+    ruleResponse.readAttr.attrId = MODBUS_RULES_ATTR_ID;
+    ruleResponse.readAttr.typeId = TYPE_ID_MODBUS_SETTINGS;
+    ruleResponse.readAttr.status = STATUS_RES_UNSUCCESSFUL;
+    memset(&ruleResponse.rule, 0xFF, sizeof(modbus_rule_t));
+    for (uint8_t index = 0; index < MODBUS_MAX_RULES; index++) {
+        if (rules[index].ruleId == ruleId) {
+            ruleResponse.rule = rules[index];
+            ruleResponse.readAttr.status = STATUS_RES_SUCCESS;
+            break;
+        }
+    }
+
+    _send_data_QOS_high((uint8_t *)&ruleResponse, sizeof(read_attr_modbus_rule_t), APP_ADDR_ANYSINK, READ_ATTR, READ_ATTR_RES);
+}
+
+static void Iws_read_query_stats(uint8_t kind, uint8_t page)
+{
+    read_attr_query_stats_t statsResponse;
+    statsResponse.readAttr.attrId = QUERY_STATS_ATTR_ID;
+    statsResponse.readAttr.typeId = TYPE_ID_MODBUS_SETTINGS;
+    statsResponse.readAttr.status = STATUS_RES_SUCCESS;
+    uint8_t length = Query_stats_read_page(kind, page, &statsResponse);
+
+    _send_data_QOS_high((uint8_t *)&statsResponse, length, APP_ADDR_ANYSINK, READ_ATTR, READ_ATTR_RES);
+}
+
+static void Iws_read_bus_admission()
+{
+    read_attr_modbus_admission_t admissionResponse;
+    uint32_t utilisation = Query_Scheduler_getUtilisation();
+    admissionResponse.readAttr.attrId = BUS_ADMISSION_ATTR_ID;
+    admissionResponse.readAttr.typeId = TYPE_ID_MODBUS_SETTINGS;
+    admissionResponse.readAttr.status = STATUS_RES_SUCCESS;
+    admissionResponse.admission = Get_Modbus_admission();
+    admissionResponse.utilisation = (uint16_t) ((utilisation > UINT16_MAX) ? UINT16_MAX : utilisation);
+
+    _send_data_QOS_high((uint8_t *)&admissionResponse, sizeof(read_attr_modbus_admission_t), APP_ADDR_ANYSINK, READ_ATTR, READ_ATTR_RES);
+}
+
+static void Iws_read_write_window()
+{
+    read_attr_write_window_t windowResponse;
+    windowResponse.readAttr.attrId = WRITE_COMBINING_ATTR_ID;
+    windowResponse.readAttr.typeId = TYPE_ID_MODBUS_SETTINGS;
+    windowResponse.readAttr.status = STATUS_RES_SUCCESS;
+    windowResponse.windowMs = Get_Modbus_write_window();
+
+    _send_data_QOS_high((uint8_t *)&windowResponse, sizeof(read_attr_write_window_t), APP_ADDR_ANYSINK, READ_ATTR, READ_ATTR_RES);
+}
+
+static void Iws_read_bus_scan(uint8_t page)
+{
+    read_attr_query_scan_t scanResponse;
+    scanResponse.readAttr.attrId = BUS_SCAN_ATTR_ID;
+    scanResponse.readAttr.typeId = TYPE_ID_MODBUS_SETTINGS;
+    scanResponse.readAttr.status = STATUS_RES_SUCCESS;
+    uint8_t length = Query_scan_read_page(page, &scanResponse);
+
+    _send_data_QOS_high((uint8_t *)&scanResponse, length, APP_ADDR_ANYSINK, READ_ATTR, READ_ATTR_RES);
+}
+
+static void Iws_read_block_limits()
+{
+    read_attr_block_limits_t limitsResponse;
+    limitsResponse.readAttr.attrId = BLOCK_LIMIT_ATTR_ID;
+    limitsResponse.readAttr.typeId = TYPE_ID_MODBUS_SETTINGS;
+    limitsResponse.readAttr.status = STATUS_RES_SUCCESS;
+    memcpy(limitsResponse.limits, Get_Modbus_block_limits(), sizeof(limitsResponse.limits));
+
+    _send_data_QOS_high((uint8_t *)&limitsResponse, sizeof(read_attr_block_limits_t), APP_ADDR_ANYSINK, READ_ATTR, READ_ATTR_RES);
+}
+
 //static void Iws_read_modbus_settings() {// uncommented by ram
 //    modbus_query_data_t *modSettingsData = Get_Modbus_settings();//modbus_settings_data_t and Get_mod_settings replaced by ram.
 //    read_attr_modbus_settings_t modbusSettings;
@@ -82,24 +176,38 @@ void _read_attr(const app_lib_data_received_t *data) {
     query_read_t var;
     if (attributeId == DEBUG_SINK_MESSAGE) {
         Iws_read_debug_send();
+    } else if (attributeId == UPLINK_BUDGET_ATTR_ID) {
+        Iws_read_uplink_budget();
+    } else if (attributeId == MODBUS_RULES_ATTR_ID && data->num_bytes > 3) {
+        Iws_read_modbus_rule(*(data->bytes + 3));
+    } else if (attributeId == QUERY_STATS_ATTR_ID) {
+        // [kind, page], first page of the queries by default
+        Iws_read_query_stats((data->num_bytes > 3) ? *(data->bytes + 3) : QUERY_STATS_QUERIES,
+                             (data->num_bytes > 4) ? *(data->bytes + 4) : 0);
+    } else if (attributeId == BUS_ADMISSION_ATTR_ID) {
+        Iws_read_bus_admission();
+    } else if (attributeId == WRITE_COMBINING_ATTR_ID) {
+        Iws_read_write_window();
+    } else if (attributeId == BUS_SCAN_ATTR_ID) {
+        // [page], the bitmap and the first responders by default
+        Iws_read_bus_scan((data->num_bytes > 3) ? *(data->bytes + 3) : 0);
+    } else if (attributeId == BLOCK_LIMIT_ATTR_ID) {
+        Iws_read_block_limits();
     } else if (attributeId == MODBUS_SETTINGS_ATTR_ID) {//uncommented by ram
         memcpy(&var, data->bytes + 3, data->num_bytes - 3);
         read_attr_modbus_query_t readResponse;
-
-        modbus_query_data_t *modbusQueryData = Get_Modbus_settings();
+        MODBUS_MASTER_QUERY masterQuery;
 
         if(var.read_rmv == 1) {// to read the content of the query.
             uint8_t index;
             readResponse.readAttr.attrId = attributeId;
             readResponse.readAttr.typeId = TYPE_ID_MODBUS_SETTINGS;
             for (index = 0; index < QUERY_SCHEDULER_MAX_TASKS; index++) {
-                if (modbusQueryData[index].queryId == var.queryID) {
-                    //memcpy(&readResponse.modSettings, modbusQueryData, sizeof(modbus_query_data_t));
-                    readResponse.modSettings = modbusQueryData[index]; //check if this works.
+                if (Query_Scheduler_getQuery(index, &masterQuery) && masterQuery.queryId == var.queryID) {
+                    Modbus_query_from_master(&masterQuery, &readResponse.modSettings);
                     readResponse.readAttr.status = STATUS_RES_SUCCESS;
                     break;
                 }
-                //modbusQueryData += sizeof(modbus_query_data_t);
             }
 
             _send_data_QOS_high((uint8_t * ) & readResponse, sizeof(readResponse), APP_ADDR_ANYSINK,
@@ -113,6 +221,40 @@ void _read_attr(const app_lib_data_received_t *data) {
 }
 
 
+/**
+ *  brief/         Write data of the function codes that carry more than register values
+ */
+static bool isWriteDataValid(const modbus_query_data_t *query) {
+    switch (query->functionCode) {
+        case MB_FC_READ_WRITE_MULTIPLE_REGISTERS:
+            // write address, then one value at least
+            return query->writeOps && (query->dataLength >= 4) && (query->dataLength <= MAX_WRITE_DATA_BUFFER)
+                   && ((query->dataLength & 1) == 0);
+        case MB_FC_MASK_WRITE_REGISTER:
+            // AND mask, OR mask
+            return query->writeOps && (query->dataLength == 4);
+        default:
+            return true;
+    }
+}
+
+/**
+ *  brief/         Read replies must fit the register image of the scheduler and one TLV
+ */
+static bool isReadLengthValid(const modbus_query_data_t *query) {
+    switch (query->functionCode) {
+        case MB_FC_READ_COILS:
+        case MB_FC_READ_DISCRETE_INPUT:
+            return (((query->length + 15) / 16) <= MODBUS_MAX_REGISTER_SIZE) && (((query->length + 7) / 8) <= MODBUS_TLV_DATA_SIZE);
+        case MB_FC_READ_HOLDING_REGISTER:
+        case MB_FC_READ_INPUT_REGISTER:
+        case MB_FC_READ_WRITE_MULTIPLE_REGISTERS:
+            return (query->length <= MODBUS_MAX_REGISTER_SIZE) && (query->length <= MODBUS_TLV_MAX_REGS);
+        default:
+            return true;
+    }
+}
+
 /**
  *  brief/         Write Attribute Response
  */
@@ -120,6 +262,9 @@ void _write_attr(const app_lib_data_received_t *data) {
     write_attr_res_t writeRes = {
             .status = STATUS_RES_SUCCESS
     };
+    // Query writes are answered with the bus load, the other writes with writeRes only
+    write_attr_query_res_t queryRes;
+    uint8_t resLength = sizeof(writeRes);
 
     writeRes.attrId = getVal_ws((uint16_t) *(data->bytes + 1), (uint16_t) *(data->bytes));
     if (writeRes.attrId == DEBUG_SINK_MESSAGE) {
@@ -127,39 +272,55 @@ void _write_attr(const app_lib_data_received_t *data) {
     } else if (writeRes.attrId == MODBUS_SETTINGS_ATTR_ID) {
         query_scheduler_res_e res;
         modbus_query_data_t modbusSettings;
-        memcpy(&modbusSettings, &data->bytes[3] , data->num_bytes-3);
-        DEBUG_SEND(Is_debug(), modbusSettings);
-        MODBUS_MASTER_QUERY query = {
-                .queryId = modbusSettings.queryId,
-                .u8id = modbusSettings.slaveId,
-                .deviceDetail = {modbusSettings.deviceDetails.deviceId,modbusSettings.deviceDetails.status,modbusSettings.deviceDetails.attrId},
-                //.deviceDetail.deviceId = modbusSettings.deviceDetails.deviceId,
-                //.deviceDetail.attrId = modbusSettings.deviceDetails.attrId,
-                .u8fct = modbusSettings.functionCode,
-                .u16RegAdd = modbusSettings.startAddr,
-                .u16CoilsNo = modbusSettings.length,
-                .interval = modbusSettings.interval,
-                .oneTime = modbusSettings.oneTime,
-                //.dataType = modbusSettings.dataType,
-                .writeOps = modbusSettings.writeOps,
-                .dataLength = modbusSettings.dataLength,
-        };
-        memcpy(&query.writeData, &modbusSettings.writeData, modbusSettings.dataLength);
-        if((modbusSettings.oneTime == 0) && (modbusSettings.interval == 0) && (modbusSettings.isEnable == 1)) {
-            DEBUG_SEND(Is_debug(), "interval is zero");
+        uint8_t length = data->num_bytes - 3;
+        if (length > sizeof(modbusSettings)) {
+            length = sizeof(modbusSettings);
+        }
+        // Fields not sent by older backends (extension record) keep their default
+        memset(&modbusSettings, 0xFF, sizeof(modbusSettings));
+        memcpy(&modbusSettings, &data->bytes[3], length);
+        MODBUS_LOG_DEBUG(LOG_SETTINGS_QUERY, modbusSettings.queryId, modbusSettings.slaveId);
+        MODBUS_MASTER_QUERY query;
+        Modbus_query_to_master(&modbusSettings, &query);
+        if (modbusSettings.queryId >= QUERY_ID_INTERNAL_FIRST) {
+            // reserved for the writes queued by the local rules
+            writeRes.status = STATUS_RES_UNSUCCESSFUL;
+        }
+        else if (!MODBUS_FC_SUPPORTED(modbusSettings.functionCode)) {
+            MODBUS_LOG_WARN(LOG_SETTINGS_BAD_FCT, modbusSettings.queryId, modbusSettings.functionCode);
+            writeRes.status = STATUS_RES_UNSUCCESSFUL;
+        }
+        else if (modbusSettings.isEnable && (modbusSettings.slaveId == MODBUS_BROADCAST_ADDRESS)
+                 && !MODBUS_BROADCAST_FC(modbusSettings.functionCode)) {
+            // no slave would answer
+            MODBUS_LOG_WARN(LOG_SETTINGS_BAD_BROADCAST, modbusSettings.queryId, modbusSettings.functionCode);
+            writeRes.status = STATUS_RES_UNSUCCESSFUL;
+        }
+        else if (modbusSettings.isEnable && !isReadLengthValid(&modbusSettings)) {
+            MODBUS_LOG_WARN(LOG_SETTINGS_BAD_LENGTH, modbusSettings.queryId, modbusSettings.length);
+            writeRes.status = STATUS_RES_UNSUCCESSFUL;
+        }
+        else if (modbusSettings.isEnable && !isWriteDataValid(&modbusSettings)) {
+            MODBUS_LOG_WARN(LOG_SETTINGS_BAD_WRITE, modbusSettings.queryId, modbusSettings.dataLength);
+            writeRes.status = STATUS_RES_UNSUCCESSFUL;
+        }
+        else if((modbusSettings.oneTime == 0) && (query.intervalMs < MODBUS_MIN_INTERVAL_MS) && (modbusSettings.isEnable == 1)) {
+            MODBUS_LOG_WARN(LOG_SETTINGS_NO_INTERVAL, modbusSettings.queryId, modbusSettings.functionCode);
             writeRes.status = STATUS_RES_UNSUCCESSFUL;
          }
         else {
+             uint32_t utilisation;
              if (modbusSettings.isEnable)
              {
-                 DEBUG_SEND(Is_debug(), "Add task");
                 // Add_Modbus_query(modbusSettings);
+                 utilisation = Query_Scheduler_getAdmissionLoad(&query);
                  res = Query_Scheduler_addTask(query);
+                 MODBUS_LOG_INFO(LOG_TASK_ADDED, modbusSettings.queryId, res);
 
              } else {
-                 DEBUG_SEND(Is_debug(), "Remove task");
-                 Remove_Modbus_query(modbusSettings.queryId);
                  res = Query_Scheduler_cancelTask(query);
+                 utilisation = Query_Scheduler_getUtilisation();
+                 MODBUS_LOG_INFO(LOG_TASK_REMOVED, modbusSettings.queryId, res);
              }
 
              if (res != QUERY_SCHEDULER_RES_OK) {
@@ -167,7 +328,32 @@ void _write_attr(const app_lib_data_received_t *data) {
              }
              else
                  writeRes.status = STATUS_RES_SUCCESS;
+             queryRes.utilisation = (uint16_t) ((utilisation > UINT16_MAX) ? UINT16_MAX : utilisation);
+             queryRes.overCeiling = utilisation > Get_Modbus_admission().ceiling;
+             resLength = sizeof(queryRes);
         }
+    } else if (writeRes.attrId == MODBUS_RULES_ATTR_ID) {
+        write_rule_t ruleSettings;
+        settings_e res;
+        uint8_t length = data->num_bytes - 3;
+        if (length > sizeof(ruleSettings)) {
+            length = sizeof(ruleSettings);
+        }
+        memset(&ruleSettings, 0, sizeof(ruleSettings));
+        memcpy(&ruleSettings, &data->bytes[3], length);
+        // a changed rule is evaluated again from the next reply
+        Rule_engine_reset(ruleSettings.rule.ruleId);
+        if (!ruleSettings.isEnable) {
+            res = Remove_Modbus_rule(ruleSettings.rule.ruleId);
+        } else if (Rule_engine_is_valid(&ruleSettings.rule)) {
+            res = Add_Modbus_rule(ruleSettings.rule);
+        } else {
+            res = SETTINGS_SAVE_ERROR;
+        }
+        if (res == SETTINGS_OK)
+            writeRes.status = STATUS_RES_SUCCESS;
+        else
+            writeRes.status = STATUS_RES_UNSUCCESSFUL;
     } else if(writeRes.attrId == MODBUS_QUERY_REMOVE) {
         settings_e res;
         res = remove_AllQueries();
@@ -211,6 +397,96 @@ void _write_attr(const app_lib_data_received_t *data) {
         else
             writeRes.status = STATUS_RES_UNSUCCESSFUL;
     }
+    else if (writeRes.attrId == BUS_ADMISSION_ATTR_ID) {
+        modbus_admission_t admission;
+        memset(&admission, 0xFF, sizeof(admission));
+        memcpy(&admission, &data->bytes[3], (data->num_bytes - 3 < sizeof(admission)) ? data->num_bytes - 3 : sizeof(admission));
+        if (Set_Modbus_admission(admission) == SETTINGS_OK)
+            writeRes.status = STATUS_RES_SUCCESS;
+        else
+            writeRes.status = STATUS_RES_UNSUCCESSFUL;
+    }
+    else if (writeRes.attrId == WRITE_COMBINING_ATTR_ID) {
+        uint16_t windowMs = 0xFFFF;
+        if (data->num_bytes - 3 >= sizeof(windowMs))
+            memcpy(&windowMs, &data->bytes[3], sizeof(windowMs));
+        // Refused out of range, 0 turns the window off
+        if (Set_Modbus_write_window(windowMs) == SETTINGS_OK)
+            writeRes.status = STATUS_RES_SUCCESS;
+        else
+            writeRes.status = STATUS_RES_UNSUCCESSFUL;
+    }
+    else if (writeRes.attrId == UPLINK_BUDGET_ATTR_ID) {
+        modbus_uplink_budget_t budget;
+        // [bytesPerSec, packetsPerSec], a rate of 0 turns its bucket off
+        memset(&budget, 0xFF, sizeof(budget));
+        if (data->num_bytes - 3 >= sizeof(budget))
+            memcpy(&budget, &data->bytes[3], sizeof(budget));
+        if (Set_Modbus_uplink_budget(budget) == SETTINGS_OK) {
+            Uplink_budget_set_rates(budget.bytesPerSec, budget.packetsPerSec);
+            writeRes.status = STATUS_RES_SUCCESS;
+        }
+        else
+            writeRes.status = STATUS_RES_UNSUCCESSFUL;
+    }
+    else if (writeRes.attrId == BUS_SCAN_ATTR_ID) {
+        query_scan_request_t scan;
+        // Fields not sent take their default, an empty write scans 1..247
+        memset(&scan, 0xFF, sizeof(scan));
+        if (data->num_bytes > 3)
+            memcpy(&scan, &data->bytes[3], (data->num_bytes - 3 < sizeof(scan)) ? data->num_bytes - 3 : sizeof(scan));
+        if (Query_Scheduler_startScan(&scan))
+            writeRes.status = STATUS_RES_SUCCESS;
+        else
+            writeRes.status = STATUS_RES_UNSUCCESSFUL;
+    }
+    else if (writeRes.attrId == BLOCK_LIMIT_ATTR_ID) {
+        modbus_block_limit_t limit;
+        // [slave, maxRegs], 0 registers removes the limit, probed again at the next boot
+        if (data->num_bytes - 3 < 2) {
+            writeRes.status = STATUS_RES_UNSUCCESSFUL;
+        } else {
+            limit.slaveId = data->bytes[3];
+            limit.maxRegs = data->bytes[4];
+            limit.flags = MODBUS_BLOCK_SET;
+            if (Set_Modbus_block_limit(limit) == SETTINGS_OK)
+                writeRes.status = STATUS_RES_SUCCESS;
+            else
+                writeRes.status = STATUS_RES_UNSUCCESSFUL;
+        }
+    }
+    else if (writeRes.attrId == MASK_WRITE_ATTR_ID) {
+        write_mask_t mask;
+        modbus_query_data_t modbusSettings;
+        MODBUS_MASTER_QUERY query;
+        if ((data->num_bytes - 3 < sizeof(mask)) || !MODBUS_FC_SUPPORTED(MB_FC_MASK_WRITE_REGISTER)) {
+            writeRes.status = STATUS_RES_UNSUCCESSFUL;
+        } else {
+            memcpy(&mask, &data->bytes[3], sizeof(mask));
+            // One time write query, acknowledged like the other writes
+            memset(&modbusSettings, 0xFF, sizeof(modbusSettings));
+            modbusSettings.queryId = mask.queryId;
+            modbusSettings.slaveId = mask.slaveId;
+            modbusSettings.deviceDetails.deviceId = mask.deviceId;
+            modbusSettings.deviceDetails.status = 0;
+            modbusSettings.deviceDetails.attrId = MODBUS_TLV_ATTR_ID;
+            modbusSettings.functionCode = MB_FC_MASK_WRITE_REGISTER;
+            modbusSettings.startAddr = mask.regAddr;
+            modbusSettings.length = 1;
+            modbusSettings.interval = 0;
+            modbusSettings.oneTime = true;
+            modbusSettings.isEnable = true;
+            modbusSettings.writeOps = true;
+            modbusSettings.dataLength = sizeof(mask.andMask) + sizeof(mask.orMask);
+            memcpy(modbusSettings.writeData, &mask.andMask, sizeof(mask.andMask));
+            memcpy(&modbusSettings.writeData[sizeof(mask.andMask)], &mask.orMask, sizeof(mask.orMask));
+            Modbus_query_to_master(&modbusSettings, &query);
+            if ((mask.queryId < QUERY_ID_INTERNAL_FIRST) && (Query_Scheduler_addTask(query) == QUERY_SCHEDULER_RES_OK))
+                writeRes.status = STATUS_RES_SUCCESS;
+            else
+                writeRes.status = STATUS_RES_UNSUCCESSFUL;
+        }
+    }
     else if (writeRes.attrId == FACTORY_RESET_ATTR_ID) {
         Factory_reset();
         writeRes.status = STATUS_RES_SUCCESS;
@@ -219,8 +495,9 @@ void _write_attr(const app_lib_data_received_t *data) {
         writeRes.status = STATUS_RES_ATTR_NOT_SUPPORTED;
     }
 
+    queryRes.writeAttr = writeRes;
     if (data->src_endpoint == SINK_EP_INFERRIX)
-        _send_data((uint8_t *) &writeRes, sizeof(writeRes), APP_ADDR_ANYSINK, WRITE_ATTR, WRITE_ATTR_RES);
+        _send_data((uint8_t *) &queryRes, resLength, APP_ADDR_ANYSINK, WRITE_ATTR, WRITE_ATTR_RES);
 }
 
 
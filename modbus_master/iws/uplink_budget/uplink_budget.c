@@ -0,0 +1,234 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#include "uplink_budget.h"
+#include "api.h"
+#include "../../settings/modbus_settings/modbus_settings.h"
+
+/** Tokens are accounted in milli-units so that short refill periods are not lost */
+#define TOKEN_SCALE             (1000)
+#define COARSE_TICKS_PER_SEC    (128)
+
+typedef struct {
+    int32_t byteTokens;                             /* Can go negative down to -capacity */
+    int32_t packetTokens;
+    int32_t byteCapacity;                           /* 0 when the bucket is off */
+    int32_t packetCapacity;
+    uint16_t bytesPerSec;
+    uint16_t packetsPerSec;
+    app_lib_time_timestamp_coarse_t lastRefill;
+    uint16_t throttleEvents;
+    uint16_t stretchedPolls;
+    uint32_t bytesSent;
+    uint16_t packetsSent;
+} uplink_budget_t;
+
+static uplink_budget_t m_budget;
+
+/**
+ * \brief   Adds the tokens earned since the last refill
+ * \note    Must be called under critical section
+ */
+static void refill_locked(void)
+{
+    app_lib_time_timestamp_coarse_t now = lib_time->getTimestampCoarse();
+    uint32_t elapsed = now - m_budget.lastRefill;
+
+    if (elapsed >= (uint32_t) UPLINK_BUDGET_BURST_SEC * COARSE_TICKS_PER_SEC)
+    {
+        // Idle long enough to refill the whole bucket
+        m_budget.byteTokens = m_budget.byteCapacity;
+        m_budget.packetTokens = m_budget.packetCapacity;
+    }
+    else
+    {
+        // rate * elapsed fits on 32 bits as elapsed is bounded by the burst,
+        // 1000 / 128 is applied as * 125 / 16
+        m_budget.byteTokens += (int32_t) (((uint32_t) m_budget.bytesPerSec * elapsed / 16) * 125);
+        m_budget.packetTokens += (int32_t) (((uint32_t) m_budget.packetsPerSec * elapsed / 16) * 125);
+
+        if (m_budget.byteTokens > m_budget.byteCapacity)
+        {
+            m_budget.byteTokens = m_budget.byteCapacity;
+        }
+        if (m_budget.packetTokens > m_budget.packetCapacity)
+        {
+            m_budget.packetTokens = m_budget.packetCapacity;
+        }
+        // Only move the reference by the ticks really accounted
+        now = m_budget.lastRefill + (elapsed / 16) * 16;
+    }
+    m_budget.lastRefill = now;
+}
+
+/**
+ * \brief   Get the pressure level of one bucket
+ */
+static uplink_pressure_e bucket_pressure(int32_t tokens, int32_t capacity)
+{
+    if (capacity == 0)
+    {
+        return UPLINK_PRESSURE_NONE;
+    }
+    else if (tokens <= 0)
+    {
+        return UPLINK_PRESSURE_FULL;
+    }
+    else if (tokens < capacity / 4)
+    {
+        return UPLINK_PRESSURE_HIGH;
+    }
+    else if (tokens < capacity / 2)
+    {
+        return UPLINK_PRESSURE_LOW;
+    }
+    return UPLINK_PRESSURE_NONE;
+}
+
+/**
+ * \brief   Get the used part of a bucket in percent
+ */
+static uint8_t bucket_usage(int32_t tokens, int32_t capacity)
+{
+    if (capacity == 0)
+    {
+        return 0;
+    }
+    else if (tokens <= 0)
+    {
+        return 100;
+    }
+    return (uint8_t) (100 - (tokens / (capacity / 100)));
+}
+
+void Uplink_budget_init(void)
+{
+    modbus_uplink_budget_t rates = Get_Modbus_uplink_budget();
+
+    Sys_enterCriticalSection();
+    m_budget.throttleEvents = 0;
+    m_budget.stretchedPolls = 0;
+    m_budget.bytesSent = 0;
+    m_budget.packetsSent = 0;
+    Sys_exitCriticalSection();
+
+    Uplink_budget_set_rates(rates.bytesPerSec, rates.packetsPerSec);
+}
+
+void Uplink_budget_set_rates(uint16_t bytesPerSec, uint16_t packetsPerSec)
+{
+    Sys_enterCriticalSection();
+    m_budget.bytesPerSec = bytesPerSec;
+    m_budget.packetsPerSec = packetsPerSec;
+    // A full bucket plus one refill fits on 32 bits for any 16 bit rate and a
+    // burst up to 16 s
+    m_budget.byteCapacity = (int32_t) bytesPerSec * UPLINK_BUDGET_BURST_SEC * TOKEN_SCALE;
+    m_budget.packetCapacity = (int32_t) packetsPerSec * UPLINK_BUDGET_BURST_SEC * TOKEN_SCALE;
+    m_budget.byteTokens = m_budget.byteCapacity;
+    m_budget.packetTokens = m_budget.packetCapacity;
+    m_budget.lastRefill = lib_time->getTimestampCoarse();
+    Sys_exitCriticalSection();
+}
+
+bool Uplink_budget_send(uint8_t *bytes, uint8_t num_bytes, app_addr_t dest, uint8_t src_ep, uint8_t dest_ep)
+{
+    Sys_enterCriticalSection();
+    refill_locked();
+    // A bucket that is off has no capacity and is left empty
+    if ((m_budget.byteCapacity != 0 && m_budget.byteTokens < (int32_t) num_bytes * TOKEN_SCALE)
+        || (m_budget.packetCapacity != 0 && m_budget.packetTokens < TOKEN_SCALE))
+    {
+        m_budget.throttleEvents++;
+    }
+    m_budget.byteTokens -= (int32_t) num_bytes * TOKEN_SCALE;
+    m_budget.packetTokens -= TOKEN_SCALE;
+    // Overdraft is bounded to one bucket so that the node recovers in a known time
+    if (m_budget.byteTokens < -m_budget.byteCapacity)
+    {
+        m_budget.byteTokens = -m_budget.byteCapacity;
+    }
+    if (m_budget.packetTokens < -m_budget.packetCapacity)
+    {
+        m_budget.packetTokens = -m_budget.packetCapacity;
+    }
+    m_budget.bytesSent += num_bytes;
+    m_budget.packetsSent++;
+    Sys_exitCriticalSection();
+
+    return _send_data(bytes, num_bytes, dest, src_ep, dest_ep);
+}
+
+uplink_pressure_e Uplink_budget_get_pressure(void)
+{
+    uplink_pressure_e bytes, packets;
+
+    Sys_enterCriticalSection();
+    refill_locked();
+    bytes = bucket_pressure(m_budget.byteTokens, m_budget.byteCapacity);
+    packets = bucket_pressure(m_budget.packetTokens, m_budget.packetCapacity);
+    Sys_exitCriticalSection();
+
+    return (bytes > packets) ? bytes : packets;
+}
+
+uint32_t Uplink_budget_stretch_interval(uint32_t interval_ms, uint8_t weight)
+{
+    uplink_pressure_e pressure = Uplink_budget_get_pressure();
+    uint32_t factor, quarters, extra;
+
+    if (pressure == UPLINK_PRESSURE_NONE || weight == 0)
+    {
+        return interval_ms;
+    }
+
+    // interval * (1 + (2^level - 1) * weight / 4), the extra part is taken by
+    // quarters of the interval so that it stays on 32 bits
+    factor = ((1U << pressure) - 1) * weight;
+    quarters = interval_ms / UPLINK_STRETCH_WEIGHT_FULL;
+    // Saturate instead of wrapping for very long intervals
+    if (quarters > (UINT32_MAX - 1) / factor)
+    {
+        return UINT32_MAX - 1;
+    }
+    extra = quarters * factor + (interval_ms % UPLINK_STRETCH_WEIGHT_FULL) * factor / UPLINK_STRETCH_WEIGHT_FULL;
+    return (extra >= UINT32_MAX - interval_ms) ? UINT32_MAX - 1 : interval_ms + extra;
+}
+
+uint32_t Uplink_budget_hold_ms(uint32_t interval_ms, uint8_t weight, uint32_t period_ms, uint32_t held_ms)
+{
+    uint32_t stretched = Uplink_budget_stretch_interval(interval_ms, weight);
+    uint32_t since_ms = (held_ms > UINT32_MAX - period_ms) ? UINT32_MAX : period_ms + held_ms;
+    uint32_t hold_ms;
+
+    if (since_ms >= stretched)
+    {
+        return 0;
+    }
+    hold_ms = stretched - since_ms;
+    if (held_ms == 0)
+    {
+        // First hold of this poll
+        Sys_enterCriticalSection();
+        m_budget.stretchedPolls++;
+        Sys_exitCriticalSection();
+    }
+    return (hold_ms > UPLINK_BUDGET_RECHECK_MS) ? UPLINK_BUDGET_RECHECK_MS : hold_ms;
+}
+
+void Uplink_budget_get_status(uplink_budget_status_t *status)
+{
+    Sys_enterCriticalSection();
+    refill_locked();
+    status->bytesPerSec = m_budget.bytesPerSec;
+    status->packetsPerSec = m_budget.packetsPerSec;
+    status->bytesUsage = bucket_usage(m_budget.byteTokens, m_budget.byteCapacity);
+    status->packetsUsage = bucket_usage(m_budget.packetTokens, m_budget.packetCapacity);
+    status->throttleEvents = m_budget.throttleEvents;
+    status->stretchedPolls = m_budget.stretchedPolls;
+    status->bytesSent = m_budget.bytesSent;
+    status->packetsSent = m_budget.packetsSent;
+    Sys_exitCriticalSection();
+
+    status->pressure = Uplink_budget_get_pressure();
+}
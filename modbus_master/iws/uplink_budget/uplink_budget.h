@@ -0,0 +1,134 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#ifndef UPLINK_BUDGET_H
+#define UPLINK_BUDGET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "api.h"
+#include "../../../iws_libraries/utils/iws.h"
+
+/**
+ * \brief   Default uplink budget, used until rates are written through
+ *          UPLINK_BUDGET_ATTR_ID. 0 turns a bucket off so that the nodes are
+ *          not throttled unless configured. Can be overridden from the
+ *          makefile with CFLAGS += -DUPLINK_BUDGET_BYTES_PER_SEC=... etc.
+ */
+#ifndef UPLINK_BUDGET_BYTES_PER_SEC
+#define UPLINK_BUDGET_BYTES_PER_SEC     (0)
+#endif
+
+#ifndef UPLINK_BUDGET_PACKETS_PER_SEC
+#define UPLINK_BUDGET_PACKETS_PER_SEC   (0)
+#endif
+
+/**
+ * \brief   Depth of the bucket in seconds of refill, i.e. the burst that can
+ *          be sent at once after an idle period.
+ */
+#ifndef UPLINK_BUDGET_BURST_SEC
+#define UPLINK_BUDGET_BURST_SEC         (10)
+#endif
+
+/**
+ * \brief   Longest hold of a periodic poll before the backpressure is read
+ *          again, a quarter of the bucket refills in about this time.
+ */
+#ifndef UPLINK_BUDGET_RECHECK_MS
+#define UPLINK_BUDGET_RECHECK_MS        (UPLINK_BUDGET_BURST_SEC * 1000 / 4)
+#endif
+
+/**
+ * \brief   Weight of a low priority query in the stretch, in quarters.
+ *          High and normal priority queries are stretched by 1/4 and 2/4
+ *          of the stretch of the low ones.
+ */
+#define UPLINK_STRETCH_WEIGHT_FULL      (4)
+
+/**
+ * \brief   Backpressure level seen by the query scheduler.
+ *          Periodic intervals of low priority are stretched by 2^level.
+ */
+typedef enum {
+    UPLINK_PRESSURE_NONE = 0,   /* More than half of the budget available */
+    UPLINK_PRESSURE_LOW  = 1,   /* Less than half of the budget available */
+    UPLINK_PRESSURE_HIGH = 2,   /* Less than a quarter of the budget available */
+    UPLINK_PRESSURE_FULL = 3    /* Budget exhausted, sends are overdrawing */
+} uplink_pressure_e;
+
+typedef struct __attribute__ ((packed)) {
+    uint16_t bytesPerSec;       /* Configured byte rate */
+    uint16_t packetsPerSec;     /* Configured packet rate */
+    uint8_t bytesUsage;         /* Used part of the byte bucket in % */
+    uint8_t packetsUsage;       /* Used part of the packet bucket in % */
+    uint8_t pressure;           /* Current uplink_pressure_e */
+    uint16_t throttleEvents;    /* Sends done without enough tokens */
+    uint16_t stretchedPolls;    /* Poll intervals stretched due to backpressure */
+    uint32_t bytesSent;         /* Bytes sent through the budget since boot */
+    uint16_t packetsSent;       /* Packets sent through the budget since boot */
+} uplink_budget_status_t;
+
+typedef struct __attribute__ ((packed)) {
+    read_attr_res_t readAttr;
+    uplink_budget_status_t budget;
+} read_attr_uplink_budget_t;
+
+/**
+ * @brief Initializes the uplink budget with the saved rates and full buckets.
+ */
+void Uplink_budget_init(void);
+
+/**
+ * @brief
+ * Applies new rates, the buckets start full.
+ * @param  bytesPerSec byte rate, 0 turns the byte bucket off.
+ * @param  packetsPerSec packet rate, 0 turns the packet bucket off.
+ */
+void Uplink_budget_set_rates(uint16_t bytesPerSec, uint16_t packetsPerSec);
+
+/**
+ * @brief
+ * Sends data through the radio and charges it to the uplink budget.
+ * Data is never dropped, an exhausted budget only raises the backpressure.
+ * @param  Same as _send_data().
+ * @return _send_data() status.
+ */
+bool Uplink_budget_send(uint8_t *bytes, uint8_t num_bytes, app_addr_t dest, uint8_t src_ep, uint8_t dest_ep);
+
+/**
+ * @brief Returns the current backpressure level.
+ */
+uplink_pressure_e Uplink_budget_get_pressure(void);
+
+/**
+ * @brief
+ * Stretches a periodic poll interval according to the current backpressure.
+ * @param  interval_ms configured interval.
+ * @param  weight share of the stretch of the query priority, in quarters
+ *         (UPLINK_STRETCH_WEIGHT_FULL for the whole stretch).
+ * @return interval to use between the polls at the current backpressure.
+ */
+uint32_t Uplink_budget_stretch_interval(uint32_t interval_ms, uint8_t weight);
+
+/**
+ * @brief
+ * Hold of a due periodic poll. The backpressure is read at each call, the
+ * poll is held by steps of UPLINK_BUDGET_RECHECK_MS at most so that it is
+ * sent as soon as the budget recovered.
+ * @param  interval_ms configured interval.
+ * @param  weight share of the stretch of the query priority, in quarters.
+ * @param  period_ms period the poll was planned with, the stretch is a bound
+ *         on it, they don't add up.
+ * @param  held_ms time the poll was held already.
+ * @return time to hold the poll before asking again, 0 to send it now.
+ */
+uint32_t Uplink_budget_hold_ms(uint32_t interval_ms, uint8_t weight, uint32_t period_ms, uint32_t held_ms);
+
+/**
+ * @brief Fills the status as reported by the read attribute.
+ */
+void Uplink_budget_get_status(uplink_budget_status_t *status);
+
+#endif //UPLINK_BUDGET_H
@@ -0,0 +1,88 @@
+//
+// Created by Maverick on 18/10/26.
+//
+// Deferred binary log: messages are pushed to a RAM ring wherever they happen and sent
+// from an app scheduler task, never from the UART callback nor the transmit path.
+//
+
+#include <string.h>
+#include "api.h"
+#include "modbus_log.h"
+#include "../settings/settings.h"
+#include "../iws/uplink_budget/uplink_budget.h"
+#include "../../iws_libraries/utils/iws_defines.h"
+#include "../../../../libraries/scheduler/app_scheduler.h"
+
+#define RECORDS_PER_PACKET  ((96 - sizeof(modbus_log_packet_t)) / sizeof(modbus_log_record_t))
+
+static modbus_log_record_t m_ring[MODBUS_LOG_SIZE];
+static uint8_t m_head;      /* Next record to send */
+static uint8_t m_count;
+static uint8_t m_dropped;
+
+void Modbus_log_push(uint8_t level, uint8_t id, uint16_t arg0, uint16_t arg1)
+{
+    Sys_enterCriticalSection();
+    if (m_count < MODBUS_LOG_SIZE)
+    {
+        modbus_log_record_t * record = &m_ring[(m_head + m_count) % MODBUS_LOG_SIZE];
+        record->timestamp = lib_time->getTimestampCoarse();
+        record->level = level;
+        record->id = id;
+        record->args[0] = arg0;
+        record->args[1] = arg1;
+        m_count++;
+    }
+    else if (m_dropped < 0xFF)
+    {
+        m_dropped++;
+    }
+    Sys_exitCriticalSection();
+}
+
+static uint32_t drain_task(void)
+{
+    uint8_t buffer[sizeof(modbus_log_packet_t) + RECORDS_PER_PACKET * sizeof(modbus_log_record_t)];
+    modbus_log_packet_t * header = (modbus_log_packet_t *) buffer;
+    uint8_t records = 0;
+    bool debug = Is_debug();
+
+    Sys_enterCriticalSection();
+    while (m_count > 0 && records < RECORDS_PER_PACKET)
+    {
+        if (debug)
+        {
+            memcpy(&buffer[sizeof(modbus_log_packet_t) + records * sizeof(modbus_log_record_t)],
+                   &m_ring[m_head], sizeof(modbus_log_record_t));
+            records++;
+        }
+        else if (m_dropped < 0xFF)
+        {
+            // Nobody listens, the messages are only counted
+            m_dropped++;
+        }
+        m_head = (m_head + 1) % MODBUS_LOG_SIZE;
+        m_count--;
+    }
+    header->version = MODBUS_LOG_VERSION;
+    header->dropped = m_dropped;
+    if (records > 0)
+    {
+        m_dropped = 0;
+    }
+    Sys_exitCriticalSection();
+
+    if (records > 0)
+    {
+        Uplink_budget_send(buffer, (uint8_t) (sizeof(modbus_log_packet_t) + records * sizeof(modbus_log_record_t)),
+                           APP_ADDR_ANYSINK, DEBUG_EP, DEBUG_EP);
+    }
+    return MODBUS_LOG_DRAIN_PERIOD_MS;
+}
+
+void Modbus_log_init(void)
+{
+#if MODBUS_LOG_LEVEL > MODBUS_LOG_LEVEL_NONE
+    App_Scheduler_addTask_execTime(drain_task, MODBUS_LOG_DRAIN_PERIOD_MS, 500);
+#endif
+}
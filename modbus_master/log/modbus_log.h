@@ -0,0 +1,136 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#ifndef MODBUS_LOG_H
+#define MODBUS_LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * \brief   Log levels. Messages above MODBUS_LOG_LEVEL are compiled out,
+ *          their arguments are not evaluated.
+ */
+#define MODBUS_LOG_LEVEL_NONE   (0)
+#define MODBUS_LOG_LEVEL_ERROR  (1)
+#define MODBUS_LOG_LEVEL_WARN   (2)
+#define MODBUS_LOG_LEVEL_INFO   (3)
+#define MODBUS_LOG_LEVEL_DEBUG  (4)
+
+#ifndef MODBUS_LOG_LEVEL
+#define MODBUS_LOG_LEVEL MODBUS_LOG_LEVEL_WARN
+#endif
+
+/**
+ * \brief   Records kept until the drain task sends them, the newest ones are dropped when full
+ */
+#define MODBUS_LOG_SIZE (32)
+
+/**
+ * \brief   Period of the drain task
+ */
+#define MODBUS_LOG_DRAIN_PERIOD_MS (2000)
+
+/**
+ * \brief   Messages: id and format of their two arguments. Only the id goes over the air,
+ *          the formats are for the tools decoding the DEBUG_EP packets.
+ */
+#define MODBUS_LOG_MESSAGES(X)                                                  \
+    X(LOG_INIT_UART,        "uart baudrate index %u, parity %u")                \
+    X(LOG_INIT_TIMING,      "reply timeout %u ms, delay between queries %u ms") \
+    X(LOG_INIT_BAD_BAUD,    "unknown baudrate index %u, keeping %u00 baud")     \
+    X(LOG_INIT_TLV,         "TLV sent on every reply %u")                       \
+    X(LOG_QUERY_POSTED,     "query %u posted to slave %u")                      \
+    X(LOG_QUERY_BUSY,       "query %u not posted, driver busy with %u")         \
+    X(LOG_REPLY_TIMEOUT,    "no reply from slave %u to function %u")            \
+    X(LOG_REPLY_BAD_CRC,    "bad CRC from slave %u, function %u")               \
+    X(LOG_REPLY_EXCEPTION,  "exception reply from slave %u, function %u")       \
+    X(LOG_REPLY_BAD_FCT,    "unsupported function %u from slave %u")            \
+    X(LOG_TX_FAILED,        "usart refused query %u for slave %u")              \
+    X(LOG_SETTINGS_QUERY,   "query %u for slave %u received")                   \
+    X(LOG_SETTINGS_NO_INTERVAL, "query %u refused, interval too short, fct %u") \
+    X(LOG_SETTINGS_BAD_FCT, "query %u refused, function %u not built in")      \
+    X(LOG_SETTINGS_BAD_WRITE, "query %u refused, %u bytes of write data")      \
+    X(LOG_SETTINGS_BAD_BROADCAST, "query %u refused, function %u not broadcast") \
+    X(LOG_SETTINGS_BAD_LENGTH, "query %u refused, %u registers to read")      \
+    X(LOG_TASK_ADDED,       "query %u added, result %u")                        \
+    X(LOG_TASK_REMOVED,     "query %u removed, result %u")                      \
+    X(LOG_QUERY_NOT_SAVED,  "query %u for slave %u not saved, storage full")    \
+    X(LOG_PLAN_OVERLOAD,    "bus load %u permille, %u periods stretched")       \
+    X(LOG_ADMISSION_REFUSED, "query %u refused, bus load %u permille")         \
+    X(LOG_CYCLIC_SCHEDULE,  "cyclic schedule, minor frame %u ms, %u frames")    \
+    X(LOG_CYCLIC_OVERRUN,   "cyclic frame overrun, %u dropped, frame %u ms")   \
+    X(LOG_WRITES_COMBINED,  "%u writes to slave %u in one frame")               \
+    X(LOG_SCAN_DONE,        "bus scan done, %u slaves answered in %u ms")       \
+    X(LOG_BLOCK_LIMIT,      "slave %u reads up to %u registers per frame")      \
+    X(LOG_BLOCK_PROBE_FAILED, "read size probe of slave %u failed at register %u")
+
+#define MODBUS_LOG_ID(id, format) id,
+typedef enum
+{
+    MODBUS_LOG_MESSAGES(MODBUS_LOG_ID)
+    LOG_MESSAGE_COUNT
+} modbus_log_id_e;
+#undef MODBUS_LOG_ID
+
+/**
+ * \brief   One message as stored and sent
+ */
+typedef struct __attribute__ ((packed))
+{
+    uint32_t timestamp;     /* Coarse time (1/128 s) */
+    uint8_t level;
+    uint8_t id;             /* modbus_log_id_e */
+    uint16_t args[2];
+} modbus_log_record_t;
+
+/**
+ * \brief   Header of a DEBUG_EP log packet, followed by the records
+ */
+typedef struct __attribute__ ((packed))
+{
+    uint8_t version;        /* MODBUS_LOG_VERSION */
+    uint8_t dropped;        /* Records lost since the previous packet, ring full or debug sink off */
+} modbus_log_packet_t;
+
+#define MODBUS_LOG_VERSION (1)
+
+/**
+ * \brief   Stores a message in the ring, a few stores. Safe from the UART callback.
+ *          Use the MODBUS_LOG_xxx macros instead.
+ */
+void Modbus_log_push(uint8_t level, uint8_t id, uint16_t arg0, uint16_t arg1);
+
+/**
+ * \brief   Starts the task sending the messages on DEBUG_EP, when the debug sink is enabled
+ */
+void Modbus_log_init(void);
+
+#define MODBUS_LOG_NOTHING(id, a0, a1) do { } while (0)
+
+#if MODBUS_LOG_LEVEL >= MODBUS_LOG_LEVEL_ERROR
+#define MODBUS_LOG_ERROR(id, a0, a1) Modbus_log_push(MODBUS_LOG_LEVEL_ERROR, id, (uint16_t) (a0), (uint16_t) (a1))
+#else
+#define MODBUS_LOG_ERROR MODBUS_LOG_NOTHING
+#endif
+
+#if MODBUS_LOG_LEVEL >= MODBUS_LOG_LEVEL_WARN
+#define MODBUS_LOG_WARN(id, a0, a1) Modbus_log_push(MODBUS_LOG_LEVEL_WARN, id, (uint16_t) (a0), (uint16_t) (a1))
+#else
+#define MODBUS_LOG_WARN MODBUS_LOG_NOTHING
+#endif
+
+#if MODBUS_LOG_LEVEL >= MODBUS_LOG_LEVEL_INFO
+#define MODBUS_LOG_INFO(id, a0, a1) Modbus_log_push(MODBUS_LOG_LEVEL_INFO, id, (uint16_t) (a0), (uint16_t) (a1))
+#else
+#define MODBUS_LOG_INFO MODBUS_LOG_NOTHING
+#endif
+
+#if MODBUS_LOG_LEVEL >= MODBUS_LOG_LEVEL_DEBUG
+#define MODBUS_LOG_DEBUG(id, a0, a1) Modbus_log_push(MODBUS_LOG_LEVEL_DEBUG, id, (uint16_t) (a0), (uint16_t) (a1))
+#else
+#define MODBUS_LOG_DEBUG MODBUS_LOG_NOTHING
+#endif
+
+#endif //MODBUS_LOG_H
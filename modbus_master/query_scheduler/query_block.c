@@ -0,0 +1,247 @@
+//
+// Created by Maverick on 18/10/26.
+//
+// Read size probes of the slaves: a queue of slaves to probe and the binary
+// search on the read size of the one at its head.
+//
+
+#include <string.h>
+#include "query_block.h"
+#include "query_cost.h"
+#include "query_stats.h"
+#include "query_scan.h"
+#include "../../../../libraries/scheduler/app_scheduler.h"
+#include "../settings/settings.h"
+#include "../settings/modbus_settings/modbus_settings.h"
+#include "../log/modbus_log.h"
+
+/** Probes of a size left without reply before it counts as refused */
+#define PROBE_TRIES 2
+
+typedef struct
+{
+    uint8_t slaveId;    /* 0 when free */
+    uint8_t fct;
+    uint16_t regAddr;
+} pending_t;
+
+static pending_t m_pending[QUERY_BLOCK_MAX_PENDING];
+static uint8_t m_pending_count;
+
+/** Search on the slave at the head of the queue: largest size accepted, smallest refused */
+static bool m_searching;
+static uint8_t m_accepted;
+static uint8_t m_refused;
+/** Size of the next probe */
+static uint8_t m_size;
+static uint8_t m_tries;
+static uint8_t m_flags;
+
+/** Result of the last search, saved from the application context */
+static modbus_block_limit_t m_result;
+static uint16_t m_result_addr;
+
+/** Slaves whose probes failed since boot, bit n for address n */
+static uint8_t m_failed[32];
+
+static bool is_answering(uint8_t slaveId, uint32_t * latencyUs)
+{
+    uint16_t timeoutPermille;
+
+    return Query_stats_get_slave_latency(slaveId, latencyUs, &timeoutPermille);
+}
+
+/**
+ * \brief   Start the search on the first queued slave known to answer, moved
+ *          to the head of the queue
+ * \note    Must be called under critical section
+ */
+static bool start_search_locked(void)
+{
+    uint32_t latencyUs;
+
+    for (uint8_t i = 0; i < m_pending_count; i++)
+    {
+        if (is_answering(m_pending[i].slaveId, &latencyUs))
+        {
+            pending_t head = m_pending[i];
+            m_pending[i] = m_pending[0];
+            m_pending[0] = head;
+
+            m_searching = true;
+            m_accepted = 0;
+            m_refused = QUERY_BLOCK_MAX_REGS + 1;
+            // Most slaves take the whole block, one probe then
+            m_size = QUERY_BLOCK_MAX_REGS;
+            m_tries = 0;
+            m_flags = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * \brief   Save the result of a search from the application context, the
+ *          last probe ends in the UART callback
+ */
+static uint32_t save_result(void)
+{
+    if (m_result.maxRegs == 0)
+    {
+        MODBUS_LOG_WARN(LOG_BLOCK_PROBE_FAILED, m_result.slaveId, m_result_addr);
+    }
+    else if (Set_Modbus_block_limit(m_result) == SETTINGS_OK)
+    {
+        MODBUS_LOG_INFO(LOG_BLOCK_LIMIT, m_result.slaveId, m_result.maxRegs);
+    }
+    return APP_SCHEDULER_STOP_TASK;
+}
+
+/**
+ * \brief   Search over, the slave leaves the queue
+ * \note    Must be called under critical section
+ */
+static void end_search_locked(void)
+{
+    uint8_t slaveId = m_pending[0].slaveId;
+
+    m_result.slaveId = slaveId;
+    m_result.maxRegs = m_accepted;
+    m_result.flags = m_flags;
+    m_result_addr = m_pending[0].regAddr;
+    if (m_accepted == 0)
+    {
+        // Not even one register, the slave is probed again at the next boot
+        m_failed[slaveId / 8] |= (uint8_t) (1 << (slaveId % 8));
+    }
+    App_Scheduler_addTask_execTime(save_result, APP_SCHEDULER_SCHEDULE_ASAP, 500);
+
+    m_searching = false;
+    m_pending_count--;
+    memmove(&m_pending[0], &m_pending[1], m_pending_count * sizeof(pending_t));
+    m_pending[m_pending_count].slaveId = 0;
+}
+
+void Query_block_learn(uint8_t slaveId, uint8_t fct, uint16_t regAddr)
+{
+    if (slaveId == MODBUS_BROADCAST_ADDRESS || slaveId > 247
+        || (fct != MB_FC_READ_HOLDING_REGISTER && fct != MB_FC_READ_INPUT_REGISTER)
+        || Query_block_get_limit(slaveId) != 0 || (m_failed[slaveId / 8] & (1 << (slaveId % 8))))
+    {
+        return;
+    }
+
+    Sys_enterCriticalSection();
+    for (uint8_t i = 0; i < m_pending_count; i++)
+    {
+        if (m_pending[i].slaveId == slaveId)
+        {
+            Sys_exitCriticalSection();
+            return;
+        }
+    }
+    if (m_pending_count < QUERY_BLOCK_MAX_PENDING)
+    {
+        m_pending[m_pending_count].slaveId = slaveId;
+        m_pending[m_pending_count].fct = fct;
+        m_pending[m_pending_count].regAddr = regAddr;
+        m_pending_count++;
+    }
+    Sys_exitCriticalSection();
+}
+
+bool Query_block_isPending(void)
+{
+    bool pending;
+
+    Sys_enterCriticalSection();
+    pending = m_searching || start_search_locked();
+    Sys_exitCriticalSection();
+    return pending;
+}
+
+bool Query_block_next(MODBUS_MASTER_QUERY * probe)
+{
+    if (!Query_block_isPending())
+    {
+        return false;
+    }
+
+    memset(probe, 0, sizeof(MODBUS_MASTER_QUERY));
+    probe->queryId = QUERY_BLOCK_PROBE_ID;
+    probe->u8id = m_pending[0].slaveId;
+    probe->u8fct = m_pending[0].fct;
+    probe->u16RegAdd = m_pending[0].regAddr;
+    probe->u16CoilsNo = m_size;
+    probe->oneTime = true;
+    return true;
+}
+
+uint32_t Query_block_timeout_ms(void)
+{
+    uint32_t latencyUs = 0;
+    uint32_t timeoutMs;
+
+    if (!m_searching || !is_answering(m_pending[0].slaveId, &latencyUs))
+    {
+        return timeoutDelayTlv.timeoutPeriod;
+    }
+    // Twice the usual latency, plus the whole reply on top of the usual one
+    timeoutMs = (2 * latencyUs + Query_cost_frame_us((uint8_t) (5 + m_size * 2)) + 999) / 1000
+                + QUERY_SCAN_DEFAULT_SLACK_MS;
+    return (timeoutMs < timeoutDelayTlv.timeoutPeriod) ? timeoutMs : timeoutDelayTlv.timeoutPeriod;
+}
+
+void Query_block_result(int8_t result, uint8_t exception)
+{
+    if (!m_searching)
+    {
+        return;
+    }
+
+    if (result == ERR_OK)
+    {
+        m_accepted = m_size;
+    }
+    else if ((result == NO_REPLY || result == ERR_TIME_OUT) && ++m_tries < PROBE_TRIES)
+    {
+        // Same size again, a slave may drop a request now and then
+        return;
+    }
+    else
+    {
+        // Refused: too many registers, past the end of the map, or no reply
+        if (result == ERR_EXCEPTION && exception == EXC_ADDR_RANGE)
+        {
+            m_flags |= MODBUS_BLOCK_ADDR_GAP;
+        }
+        m_refused = m_size;
+    }
+
+    m_tries = 0;
+    if (m_refused - m_accepted <= 1)
+    {
+        Sys_enterCriticalSection();
+        end_search_locked();
+        Sys_exitCriticalSection();
+    }
+    else
+    {
+        m_size = (uint8_t) ((m_accepted + m_refused) / 2);
+    }
+}
+
+uint8_t Query_block_get_limit(uint8_t slaveId)
+{
+    const modbus_block_limit_t * limits = Get_Modbus_block_limits();
+
+    for (uint8_t i = 0; i < MODBUS_MAX_BLOCK_LIMITS; i++)
+    {
+        if (limits[i].slaveId == slaveId)
+        {
+            return limits[i].maxRegs;
+        }
+    }
+    return 0;
+}
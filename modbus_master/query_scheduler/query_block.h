@@ -0,0 +1,87 @@
+//
+// Created by Maverick on 18/10/26.
+//
+// Largest register read accepted by each slave. A slave gets a few probes
+// once its first FC3/FC4 query is added and answered: one read of the largest
+// block the node takes, then a binary search on the size if it is refused.
+// The limit is saved with the settings, larger reads of the slave are sent in
+// several frames by the driver and planned as such.
+//
+
+#ifndef QUERY_BLOCK_H
+#define QUERY_BLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../driver/modbus_lib.h"
+#include "query_scheduler.h"
+
+/**
+ * \brief   Query id of the probes, the driver sends no TLV for them
+ */
+#define QUERY_BLOCK_PROBE_ID (0xFD)
+
+/**
+ * \brief   Largest read in one frame, the reply fills the driver buffer and
+ *          the register image
+ */
+#define QUERY_BLOCK_FRAME_REGS ((MAX_SIZE_COMMS_BUFFER - 5) / 2)
+#define QUERY_BLOCK_MAX_REGS ((QUERY_BLOCK_FRAME_REGS < MODBUS_MAX_REGISTER_SIZE) \
+                              ? QUERY_BLOCK_FRAME_REGS : MODBUS_MAX_REGISTER_SIZE)
+
+/**
+ * \brief   Slaves waiting for their probes, the following ones are probed
+ *          at the next boot
+ */
+#define QUERY_BLOCK_MAX_PENDING (8)
+
+/**
+ * \brief   A read query of a slave was added, probe the slave if its limit
+ *          is not known yet
+ * \param   slaveId
+ *          Slave address
+ * \param   fct
+ *          FC3 or FC4, the function probed
+ * \param   regAddr
+ *          First register of the query, the one probed
+ */
+void Query_block_learn(uint8_t slaveId, uint8_t fct, uint16_t regAddr);
+
+/**
+ * \brief   Is a probe waiting for the bus, slaves that did not answer a
+ *          query yet are left in the queue
+ */
+bool Query_block_isPending(void);
+
+/**
+ * \brief   Next probe
+ * \param   probe
+ *          Query to fill, au16reg excepted
+ * \return  False when no probe is pending
+ */
+bool Query_block_next(MODBUS_MASTER_QUERY * probe);
+
+/**
+ * \brief   Reply timeout of the next probe, from the latency measured for
+ *          the slave and the reply length, the configured timeout at most
+ */
+uint32_t Query_block_timeout_ms(void);
+
+/**
+ * \brief   Outcome of the probe on the line, called by the driver
+ * \param   result
+ *          i8lastError of the driver
+ * \param   exception
+ *          Exception code of an exception reply
+ */
+void Query_block_result(int8_t result, uint8_t exception);
+
+/**
+ * \brief   Registers per read frame of a slave
+ * \param   slaveId
+ *          Slave address
+ * \return  0 when not known, reads are sent in one frame
+ */
+uint8_t Query_block_get_limit(uint8_t slaveId);
+
+#endif //QUERY_BLOCK_H
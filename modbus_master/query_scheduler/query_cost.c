@@ -0,0 +1,107 @@
+//
+// Created by Maverick on 18/10/26.
+//
+// Bus time model of the queries, used to plan the periodic load of the line.
+//
+
+#include "query_cost.h"
+#include "query_stats.h"
+#include "query_block.h"
+
+uint8_t Query_cost_request_bytes(const query_hot_t * query)
+{
+    switch (query->u8fct)
+    {
+        case MB_FC_WRITE_MULTIPLE_COILS:
+            return (uint8_t) (9 + (query->u16CoilsNo + 7) / 8);
+        case MB_FC_WRITE_MULTIPLE_REGISTERS:
+            return (uint8_t) (9 + query->u16CoilsNo * 2);
+        case MB_FC_READ_WRITE_MULTIPLE_REGISTERS:
+            // Written values are in the cold part, counted at their largest
+            return (uint8_t) (13 + MAX_WRITE_DATA_BUFFER - 2);
+        default:
+            // id, fct, address, count or value, crc
+            return 8;
+    }
+}
+
+uint8_t Query_cost_reply_bytes(const query_hot_t * query)
+{
+    switch (query->u8fct)
+    {
+        case MB_FC_READ_COILS:
+        case MB_FC_READ_DISCRETE_INPUT:
+            return (uint8_t) (5 + (query->u16CoilsNo + 7) / 8);
+        case MB_FC_READ_HOLDING_REGISTER:
+        case MB_FC_READ_INPUT_REGISTER:
+        case MB_FC_READ_WRITE_MULTIPLE_REGISTERS:
+            return (uint8_t) (5 + query->u16CoilsNo * 2);
+        default:
+            // Writes are echoed: id, fct, address, count or value, crc
+            return 8;
+    }
+}
+
+uint32_t Query_cost_frame_us(uint8_t bytes)
+{
+    uint32_t baudrate = getModbusMasterBaudrate();
+
+    if (baudrate == 0)
+    {
+        return 0;
+    }
+    return ((uint32_t) bytes * QUERY_COST_BITS_PER_BYTE * 1000000UL + baudrate - 1) / baudrate;
+}
+
+/**
+ * \brief   Frames of a read, above the limit of the slave it is split
+ */
+static uint16_t get_frames(const query_hot_t * query)
+{
+    uint8_t limit;
+
+    if (query->u8fct != MB_FC_READ_HOLDING_REGISTER && query->u8fct != MB_FC_READ_INPUT_REGISTER)
+    {
+        return 1;
+    }
+    limit = Query_block_get_limit(query->u8id);
+    return (limit == 0 || query->u16CoilsNo <= limit) ? 1 : (uint16_t) ((query->u16CoilsNo + limit - 1) / limit);
+}
+
+uint32_t Query_cost_us(const query_hot_t * query)
+{
+    uint16_t frames = get_frames(query);
+    uint32_t latencyUs;
+    uint16_t timeoutPermille;
+    uint32_t timeoutUs = (uint32_t) timeoutDelayTlv.timeoutPeriod * 1000;
+    // Silent interval before the next request, 3.5 characters rounded up, 1750 us above 19200 baud
+    uint32_t silentUs = Query_cost_frame_us(4);
+
+    if (silentUs < 1750)
+    {
+        silentUs = 1750;
+    }
+
+    if (query->u8id == MODBUS_BROADCAST_ADDRESS)
+    {
+        // Request and turnaround delay, no reply nor timeout
+        latencyUs = Query_cost_frame_us(Query_cost_request_bytes(query)) + (uint32_t) MODBUS_BROADCAST_TURNAROUND_MS * 1000;
+        timeoutPermille = 0;
+    }
+    else if (!Query_stats_get_slave_latency(query->u8id, &latencyUs, &timeoutPermille))
+    {
+        // A split read as frames of the same size with the bus idle time between
+        // them, the latency measured for it spans all its frames
+        query_hot_t frame = *query;
+        frame.u16CoilsNo = (uint16_t) ((query->u16CoilsNo + frames - 1) / frames);
+        latencyUs = (Query_cost_frame_us(Query_cost_request_bytes(&frame)) + QUERY_COST_TURNAROUND_US
+                     + Query_cost_frame_us(Query_cost_reply_bytes(&frame))) * frames
+                    + (frames - 1) * (QUERY_COST_TX_ENABLE_US + silentUs + (uint32_t) timeoutDelayTlv.delay * 1000);
+        timeoutPermille = 0;
+    }
+    // Expected line time: answered requests take the latency, the others the full timeout
+    latencyUs = (uint32_t) (((uint64_t) latencyUs * (1000 - timeoutPermille)
+                             + (uint64_t) timeoutUs * timeoutPermille) / 1000);
+
+    return QUERY_COST_TX_ENABLE_US + latencyUs + silentUs + (uint32_t) timeoutDelayTlv.delay * 1000;
+}
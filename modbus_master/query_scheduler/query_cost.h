@@ -0,0 +1,60 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#ifndef QUERY_COST_H
+#define QUERY_COST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "query_scheduler.h"
+
+/**
+ * \brief   Transceiver enable time waited by the driver before each request
+ */
+#define QUERY_COST_TX_ENABLE_US (25000)
+
+/**
+ * \brief   Slave turnaround assumed until a latency is measured for the slave
+ */
+#define QUERY_COST_TURNAROUND_US (5000)
+
+/**
+ * \brief   Bits on the line per byte: start, 8 data, parity or second stop, stop
+ */
+#define QUERY_COST_BITS_PER_BYTE (11)
+
+/**
+ * \brief   Length of the request frame of a query, CRC included
+ */
+uint8_t Query_cost_request_bytes(const query_hot_t * query);
+
+/**
+ * \brief   Length of the normal reply frame of a query, CRC included
+ */
+uint8_t Query_cost_reply_bytes(const query_hot_t * query);
+
+/**
+ * \brief   Time on the line of a frame at the current baudrate
+ * \param   bytes
+ *          Frame length
+ * \return  Time in us
+ */
+uint32_t Query_cost_frame_us(uint8_t bytes);
+
+/**
+ * \brief   Bus time taken by one transaction of a query
+ *
+ * Transceiver enable, request, slave latency and reply, silent interval and
+ * configured bus idle time. The latency measured for the slave replaces the
+ * modelled request, turnaround and reply once known, and the timeout is
+ * weighted by the share of unanswered requests of the slave. A read above
+ * the limit of the slave (query_block.h) is modelled frame by frame.
+ *
+ * \param   query
+ *          The query
+ * \return  Time in us
+ */
+uint32_t Query_cost_us(const query_hot_t * query);
+
+#endif //QUERY_COST_H
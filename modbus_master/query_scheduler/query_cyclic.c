@@ -0,0 +1,231 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#include <string.h>
+#include "query_cyclic.h"
+#include "query_scheduler.h"
+
+typedef struct
+{
+    uint32_t period_ms;     /* 0 when the slot is not in the set */
+    uint32_t cost_us;
+    uint8_t period_frames;
+    uint8_t offset;         /* First frame of the query */
+} cyclic_query_t;
+
+static cyclic_query_t m_queries[QUERY_SCHEDULER_MAX_TASKS];
+
+/** Slots by increasing period, the order of the entries in a frame */
+static uint8_t m_order[QUERY_SCHEDULER_MAX_TASKS];
+static uint8_t m_count;
+
+static uint8_t m_table[QUERY_CYCLIC_MAX_ENTRIES];
+static uint8_t m_frames;
+
+/** Bus time of the frames, while building */
+static uint32_t m_load_us[QUERY_CYCLIC_MAX_FRAMES];
+
+/** Position in the schedule */
+static uint16_t m_cursor;
+static uint8_t m_frame;
+static uint32_t m_cycle;
+
+void Query_cyclic_clear(void)
+{
+    memset(m_queries, 0, sizeof(m_queries));
+    m_frames = 0;
+}
+
+void Query_cyclic_add(uint8_t slot, uint32_t period_ms, uint32_t cost_us)
+{
+    if (slot < QUERY_SCHEDULER_MAX_TASKS)
+    {
+        m_queries[slot].period_ms = period_ms;
+        m_queries[slot].cost_us = cost_us;
+    }
+}
+
+/**
+ * \brief   Sort the slots of the set by increasing period
+ * \return  Number of slots in the set
+ */
+static uint8_t sort_by_period(void)
+{
+    uint8_t count = 0;
+
+    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++)
+    {
+        if (m_queries[i].period_ms == 0)
+        {
+            continue;
+        }
+        // Insertion, equal periods keep the slot order
+        uint8_t j = count++;
+        while (j > 0 && m_queries[m_order[j - 1]].period_ms > m_queries[i].period_ms)
+        {
+            m_order[j] = m_order[j - 1];
+            j--;
+        }
+        m_order[j] = (uint8_t) i;
+    }
+    return count;
+}
+
+/**
+ * \brief   Frame offset of a query giving the lowest peak load
+ * \return  Peak load of the frames of the query once added
+ */
+static uint32_t place(cyclic_query_t * query)
+{
+    uint32_t best_peak = UINT32_MAX;
+
+    for (uint8_t offset = 0; offset < query->period_frames; offset++)
+    {
+        uint32_t peak = 0;
+        for (uint8_t frame = offset; frame < m_frames; frame += query->period_frames)
+        {
+            if (m_load_us[frame] > peak)
+            {
+                peak = m_load_us[frame];
+            }
+        }
+        if (peak < best_peak)
+        {
+            best_peak = peak;
+            query->offset = offset;
+        }
+    }
+    for (uint8_t frame = query->offset; frame < m_frames; frame += query->period_frames)
+    {
+        m_load_us[frame] += query->cost_us;
+    }
+    return best_peak + query->cost_us;
+}
+
+uint32_t Query_cyclic_build(uint16_t budget_permille)
+{
+    uint32_t minor_ms, major_ms;
+    uint32_t budget_us;
+    uint16_t entries;
+
+    m_frames = 0;
+    m_count = sort_by_period();
+    if (m_count == 0)
+    {
+        return 0;
+    }
+    minor_ms = m_queries[m_order[0]].period_ms;
+    major_ms = m_queries[m_order[m_count - 1]].period_ms;
+
+    // Harmonic: each period divides the next longer one
+    for (uint8_t i = 1; i < m_count; i++)
+    {
+        if (m_queries[m_order[i]].period_ms % m_queries[m_order[i - 1]].period_ms != 0)
+        {
+            return 0;
+        }
+    }
+    if (major_ms / minor_ms > QUERY_CYCLIC_MAX_FRAMES)
+    {
+        return 0;
+    }
+    m_frames = (uint8_t) (major_ms / minor_ms);
+
+    entries = m_frames;
+    for (uint8_t i = 0; i < m_count; i++)
+    {
+        cyclic_query_t * query = &m_queries[m_order[i]];
+        query->period_frames = (uint8_t) (query->period_ms / minor_ms);
+        entries += m_frames / query->period_frames;
+    }
+    if (entries > QUERY_CYCLIC_MAX_ENTRIES)
+    {
+        m_frames = 0;
+        return 0;
+    }
+
+    // Shortest periods first, they have the fewest offsets to choose from
+    budget_us = (minor_ms > UINT32_MAX / budget_permille) ? UINT32_MAX : minor_ms * budget_permille;
+    memset(m_load_us, 0, sizeof(m_load_us));
+    for (uint8_t i = 0; i < m_count; i++)
+    {
+        if (place(&m_queries[m_order[i]]) > budget_us)
+        {
+            m_frames = 0;
+            return 0;
+        }
+    }
+
+    entries = 0;
+    for (uint8_t frame = 0; frame < m_frames; frame++)
+    {
+        for (uint8_t i = 0; i < m_count; i++)
+        {
+            const cyclic_query_t * query = &m_queries[m_order[i]];
+            if (frame % query->period_frames == query->offset)
+            {
+                m_table[entries++] = m_order[i];
+            }
+        }
+        m_table[entries++] = QUERY_CYCLIC_END_OF_FRAME;
+    }
+    return minor_ms;
+}
+
+uint8_t Query_cyclic_get_frame_count(void)
+{
+    return m_frames;
+}
+
+void Query_cyclic_start(void)
+{
+    m_cursor = 0;
+    m_frame = 0;
+    m_cycle = 0;
+}
+
+uint8_t Query_cyclic_next_frame(void)
+{
+    uint8_t dropped = 0;
+
+    if (m_frames == 0)
+    {
+        return 0;
+    }
+    while (m_table[m_cursor] != QUERY_CYCLIC_END_OF_FRAME)
+    {
+        m_cursor++;
+        dropped++;
+    }
+    m_cursor++;
+    if (++m_frame == m_frames)
+    {
+        m_frame = 0;
+        m_cursor = 0;
+        m_cycle++;
+    }
+    return dropped;
+}
+
+uint8_t Query_cyclic_peek(void)
+{
+    return (m_frames == 0) ? QUERY_CYCLIC_END_OF_FRAME : m_table[m_cursor];
+}
+
+void Query_cyclic_advance(void)
+{
+    if (m_frames != 0 && m_table[m_cursor] != QUERY_CYCLIC_END_OF_FRAME)
+    {
+        m_cursor++;
+    }
+}
+
+uint32_t Query_cyclic_get_occurrence(uint8_t slot)
+{
+    if (slot >= QUERY_SCHEDULER_MAX_TASKS || m_queries[slot].period_frames == 0)
+    {
+        return 0;
+    }
+    return (m_cycle * m_frames + m_frame) / m_queries[slot].period_frames;
+}
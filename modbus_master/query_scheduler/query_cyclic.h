@@ -0,0 +1,93 @@
+//
+// Created by Maverick on 18/10/26.
+//
+// Static cyclic schedule of a harmonic periodic query set (build option
+// query_cyclic=yes). The shortest period is the minor frame, the longest one
+// the major frame. Each query gets a frame offset when the set changes, so at
+// run time a frame is a run of table entries sent one after the other.
+//
+
+#ifndef QUERY_CYCLIC_H
+#define QUERY_CYCLIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * \brief   Largest major frame, in minor frames (1 s and 120 s periods)
+ */
+#define QUERY_CYCLIC_MAX_FRAMES (120)
+
+/**
+ * \brief   Table size: one entry per execution in the major frame, plus one
+ *          end marker per minor frame
+ */
+#define QUERY_CYCLIC_MAX_ENTRIES (512)
+
+/**
+ * \brief   Table entry closing a minor frame
+ */
+#define QUERY_CYCLIC_END_OF_FRAME (0xFF)
+
+/**
+ * \brief   Empty the query set
+ */
+void Query_cyclic_clear(void);
+
+/**
+ * \brief   Add a periodic query to the set
+ * \param   slot
+ *          Index in the task table, entry value of the table
+ * \param   period_ms
+ *          Period
+ * \param   cost_us
+ *          Bus time of one execution
+ */
+void Query_cyclic_add(uint8_t slot, uint32_t period_ms, uint32_t cost_us);
+
+/**
+ * \brief   Lay the query set out in frames
+ * \param   budget_permille
+ *          Part of a minor frame the queries of the frame may take
+ * \return  Minor frame in ms, 0 when the set can't be scheduled statically:
+ *          periods not harmonic, major frame or table too large, or a frame
+ *          over the budget
+ */
+uint32_t Query_cyclic_build(uint16_t budget_permille);
+
+/**
+ * \brief   Number of minor frames in the major frame of the last build
+ */
+uint8_t Query_cyclic_get_frame_count(void);
+
+/**
+ * \brief   Start the schedule on its first frame
+ */
+void Query_cyclic_start(void);
+
+/**
+ * \brief   Move to the next minor frame
+ * \return  Entries of the previous frame not sent, they are dropped
+ */
+uint8_t Query_cyclic_next_frame(void);
+
+/**
+ * \brief   Entry to send next in the current frame
+ * \return  Slot, or QUERY_CYCLIC_END_OF_FRAME when the frame is done
+ */
+uint8_t Query_cyclic_peek(void);
+
+/**
+ * \brief   Consume the entry returned by Query_cyclic_peek
+ */
+void Query_cyclic_advance(void);
+
+/**
+ * \brief   Index of the current execution of a query since the start of the
+ *          schedule, to thin out its executions
+ * \param   slot
+ *          Slot of the query
+ */
+uint32_t Query_cyclic_get_occurrence(uint8_t slot);
+
+#endif //QUERY_CYCLIC_H
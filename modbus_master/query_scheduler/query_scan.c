@@ -0,0 +1,159 @@
+//
+// Created by Maverick on 18/10/26.
+//
+// Bus scan state: the range being probed, the bitmap of the addresses that
+// answered and the latency and exception code of the first responders.
+//
+
+#include <stddef.h>
+#include <string.h>
+#include "query_scan.h"
+#include "query_cost.h"
+#include "query_stats.h"
+#include "../log/modbus_log.h"
+
+/** Probe request and normal reply of a one register FC3 read, CRC included */
+#define PROBE_REQUEST_BYTES 8
+#define PROBE_REPLY_BYTES 7
+
+static uint8_t m_state = QUERY_SCAN_IDLE;
+static uint8_t m_first;
+static uint8_t m_last;
+/** Next address to probe, m_last + 1 once all are posted */
+static uint16_t m_next;
+static uint16_t m_reg_addr;
+static uint8_t m_slack_ms;
+static app_lib_time_timestamp_hp_t m_start_ts;
+static uint32_t m_duration_ms;
+static uint8_t m_responders[32];
+static query_scan_entry_t m_entries[QUERY_SCAN_MAX_ENTRIES];
+static uint8_t m_entry_count;
+static uint8_t m_responder_count;
+
+static uint32_t get_elapsed_ms(void)
+{
+    return lib_time->getTimeDiffUs(m_start_ts, lib_time->getTimestampHp()) / 1000;
+}
+
+/** Something was received: a wrong register or function is still a slave */
+static bool is_answer(int8_t result)
+{
+    switch (result)
+    {
+        case ERR_OK:
+        case ERR_EXCEPTION:
+        case ERR_BAD_CRC:
+        case ERR_BAD_SIZE:
+        case EXC_FUNC_CODE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool Query_scan_start(const query_scan_request_t * request)
+{
+    uint8_t first = (request->first == 0xFF) ? QUERY_SCAN_FIRST_ADDRESS : request->first;
+    uint8_t last = (request->last == 0xFF) ? QUERY_SCAN_LAST_ADDRESS : request->last;
+
+    if (first == 0 || last > QUERY_SCAN_LAST_ADDRESS || first > last)
+    {
+        return false;
+    }
+
+    Sys_enterCriticalSection();
+    m_first = first;
+    m_last = last;
+    m_next = first;
+    m_reg_addr = (request->regAddr == 0xFFFF) ? 0 : request->regAddr;
+    m_slack_ms = (request->slackMs == 0xFF) ? QUERY_SCAN_DEFAULT_SLACK_MS : request->slackMs;
+    memset(m_responders, 0, sizeof(m_responders));
+    m_entry_count = 0;
+    m_responder_count = 0;
+    m_duration_ms = 0;
+    m_start_ts = lib_time->getTimestampHp();
+    m_state = QUERY_SCAN_RUNNING;
+    Sys_exitCriticalSection();
+    return true;
+}
+
+bool Query_scan_isRunning(void)
+{
+    return (m_state == QUERY_SCAN_RUNNING) && (m_next <= m_last);
+}
+
+bool Query_scan_next(MODBUS_MASTER_QUERY * probe)
+{
+    if (!Query_scan_isRunning())
+    {
+        return false;
+    }
+
+    memset(probe, 0, sizeof(MODBUS_MASTER_QUERY));
+    probe->queryId = QUERY_SCAN_PROBE_ID;
+    probe->u8id = (uint8_t) m_next++;
+    probe->u8fct = MB_FC_READ_HOLDING_REGISTER;
+    probe->u16RegAdd = m_reg_addr;
+    probe->u16CoilsNo = 1;
+    probe->oneTime = true;
+    return true;
+}
+
+uint32_t Query_scan_timeout_ms(void)
+{
+    uint32_t frames_us = Query_cost_frame_us(PROBE_REQUEST_BYTES) + Query_cost_frame_us(PROBE_REPLY_BYTES);
+
+    return (frames_us + 999) / 1000 + m_slack_ms;
+}
+
+void Query_scan_result(uint8_t address, int8_t result, uint8_t exception, uint32_t latencyUs)
+{
+    if (m_state != QUERY_SCAN_RUNNING)
+    {
+        return;
+    }
+
+    if (is_answer(result))
+    {
+        m_responders[address / 8] |= (uint8_t) (1 << (address % 8));
+        m_responder_count++;
+        if (m_entry_count < QUERY_SCAN_MAX_ENTRIES)
+        {
+            uint32_t units = latencyUs / QUERY_STATS_LATENCY_UNIT_US;
+            query_scan_entry_t * entry = &m_entries[m_entry_count++];
+            entry->address = address;
+            entry->exception = (result == ERR_OK) ? 0 : (result == ERR_EXCEPTION) ? exception : QUERY_SCAN_BAD_REPLY;
+            entry->latency = (units > 0xFFFF) ? 0xFFFF : (uint16_t) units;
+        }
+    }
+
+    if (address >= m_last)
+    {
+        m_duration_ms = get_elapsed_ms();
+        m_state = QUERY_SCAN_DONE;
+        MODBUS_LOG_WARN(LOG_SCAN_DONE, m_responder_count, m_duration_ms);
+    }
+}
+
+uint8_t Query_scan_read_page(uint8_t page, read_attr_query_scan_t * response)
+{
+    uint16_t first = (uint16_t) page * QUERY_SCAN_ENTRIES_PER_PAGE;
+
+    Sys_enterCriticalSection();
+    response->state = m_state;
+    response->first = m_first;
+    response->last = m_last;
+    response->next = (m_next > m_last) ? m_last : (uint8_t) m_next;
+    response->durationMs = (m_state == QUERY_SCAN_RUNNING) ? get_elapsed_ms() : m_duration_ms;
+    memcpy(response->responders, m_responders, sizeof(m_responders));
+    response->page = page;
+    response->pages = (uint8_t) ((m_entry_count + QUERY_SCAN_ENTRIES_PER_PAGE - 1) / QUERY_SCAN_ENTRIES_PER_PAGE);
+    response->count = 0;
+    for (uint16_t i = first; i < m_entry_count && response->count < QUERY_SCAN_ENTRIES_PER_PAGE; i++)
+    {
+        response->entries[response->count++] = m_entries[i];
+    }
+    Sys_exitCriticalSection();
+
+    return (uint8_t) (offsetof(read_attr_query_scan_t, entries) + response->count * sizeof(query_scan_entry_t));
+}
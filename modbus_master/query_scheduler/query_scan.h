@@ -0,0 +1,147 @@
+//
+// Created by Maverick on 18/10/26.
+//
+// Bus scan: a range of slave addresses probed one after the other with a one
+// register FC3 read, in the gaps of the scheduled queries. The reply timeout
+// of a probe is derived from the baudrate, an absent slave costs a few tens
+// of ms instead of the configured reply timeout.
+//
+
+#ifndef QUERY_SCAN_H
+#define QUERY_SCAN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "api.h"
+#include "../../iws_libraries/utils/iws.h"
+#include "../driver/modbus_lib.h"
+
+/**
+ * \brief   Query id of the probes, out of the operator and internal ranges.
+ *          The driver sends no TLV for them.
+ */
+#define QUERY_SCAN_PROBE_ID (0xFE)
+
+/**
+ * \brief   Addresses scanned by default, the unicast range
+ */
+#define QUERY_SCAN_FIRST_ADDRESS (1)
+#define QUERY_SCAN_LAST_ADDRESS (247)
+
+/**
+ * \brief   Slave turnaround allowed on top of the probe and reply frames
+ */
+#define QUERY_SCAN_DEFAULT_SLACK_MS (20)
+
+/**
+ * \brief   Responders whose latency and exception code are kept, the
+ *          following ones only appear in the bitmap
+ */
+#define QUERY_SCAN_MAX_ENTRIES (48)
+
+/**
+ * \brief   Responders per read attribute response
+ */
+#define QUERY_SCAN_ENTRIES_PER_PAGE (12)
+
+/**
+ * \brief   Exception code of a responder whose reply was not a valid frame
+ *          (bad CRC or size): something answered at the address
+ */
+#define QUERY_SCAN_BAD_REPLY (0xFF)
+
+typedef enum
+{
+    QUERY_SCAN_IDLE = 0,        /* No scan since boot */
+    QUERY_SCAN_RUNNING = 1,
+    QUERY_SCAN_DONE = 2
+} query_scan_state_e;
+
+/**
+ * \brief   BUS_SCAN_ATTR_ID write, a scan is started. Fields left to 0xFF
+ *          (or not sent) take their default.
+ */
+typedef struct __attribute__ ((packed))
+{
+    uint8_t first;          /* First address, QUERY_SCAN_FIRST_ADDRESS */
+    uint8_t last;           /* Last address, QUERY_SCAN_LAST_ADDRESS */
+    uint16_t regAddr;       /* Holding register read by the probes, 0 */
+    uint8_t slackMs;        /* QUERY_SCAN_DEFAULT_SLACK_MS */
+} query_scan_request_t;
+
+/**
+ * \brief   A responding address
+ */
+typedef struct __attribute__ ((packed))
+{
+    uint8_t address;
+    uint8_t exception;      /* 0 for a normal reply, the exception code or QUERY_SCAN_BAD_REPLY */
+    uint16_t latency;       /* In QUERY_STATS_LATENCY_UNIT_US */
+} query_scan_entry_t;
+
+typedef struct __attribute__ ((packed))
+{
+    read_attr_res_t readAttr;
+    uint8_t state;          /* query_scan_state_e */
+    uint8_t first;
+    uint8_t last;
+    uint8_t next;           /* Next address probed while running */
+    uint32_t durationMs;    /* Of the scan so far */
+    uint8_t responders[32]; /* Bit n (byte n / 8, bit n % 8) set when address n answered */
+    uint8_t page;
+    uint8_t pages;          /* Pages of responders available */
+    uint8_t count;          /* Responders in this page */
+    query_scan_entry_t entries[QUERY_SCAN_ENTRIES_PER_PAGE];
+} read_attr_query_scan_t;
+
+/**
+ * \brief   Start a scan, a running one is restarted
+ * \param   request
+ *          Range and probe
+ * \return  False if the range is not valid
+ */
+bool Query_scan_start(const query_scan_request_t * request);
+
+/**
+ * \brief   Is a scan running, the scheduler posts its probes when the bus
+ *          is idle and no query is due
+ */
+bool Query_scan_isRunning(void);
+
+/**
+ * \brief   Probe of the next address
+ * \param   probe
+ *          Query to fill, au16reg excepted
+ * \return  False when no scan is running
+ */
+bool Query_scan_next(MODBUS_MASTER_QUERY * probe);
+
+/**
+ * \brief   Reply timeout of a probe at the current baudrate
+ */
+uint32_t Query_scan_timeout_ms(void);
+
+/**
+ * \brief   Outcome of the probe on the line, called by the driver
+ * \param   address
+ *          Address probed
+ * \param   result
+ *          i8lastError of the driver
+ * \param   exception
+ *          Exception code of an exception reply
+ * \param   latencyUs
+ *          From the request on the line to the reply processed
+ */
+void Query_scan_result(uint8_t address, int8_t result, uint8_t exception, uint32_t latencyUs);
+
+/**
+ * \brief   Fills a page of the BUS_SCAN_ATTR_ID read response
+ * \param   page
+ *          Page of responders requested, the bitmap is in every page
+ * \param   response
+ *          Response to fill, readAttr excepted
+ * \return  Bytes of response to send
+ */
+uint8_t Query_scan_read_page(uint8_t page, read_attr_query_scan_t * response);
+
+#endif //QUERY_SCAN_H
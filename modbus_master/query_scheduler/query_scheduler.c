@@ -9,12 +9,33 @@
 #include "../driver/modbus_lib.h"
 #include "../settings/modbus_settings/modbus_settings.h"
 #include <string.h>
+#include <stddef.h>
 #include "../../iws_libraries/utils/iws_defines.h"
 #include "../settings/settings.h"
-#include "../../iws_libraries/nrf/_nrf_api/nrf_delay.h"
+#include "../iws/uplink_budget/uplink_budget.h"
+#include "../driver/modbus_edge.h"
+#include "query_stats.h"
+#include "query_cost.h"
+#include "query_scan.h"
+#include "query_block.h"
+#ifdef QUERY_SCHEDULER_CYCLIC
+#include "query_cyclic.h"
+#endif
+#include "../log/modbus_log.h"
 
-#define TIMEOUT_ADDITION_BETWEEN_QUERY 1500
 #define EXEC_TIME 500
+
+/**
+ * Bus utilisation of the periodic queries above which their periods are
+ * stretched, in permille. The remainder is left to the one time queries.
+ */
+#define PLAN_MAX_PERMILLE 950
+/** Unit of the stretch factors, the configured period */
+#define STRETCH_UNIT 256
+/** Largest extra stretch for a weight of 1, a high priority period can become 64 times longer */
+#define STRETCH_MAX_K (63 * STRETCH_UNIT)
+/** Transactions between two updates of the plan with the measured latencies */
+#define PLAN_REFRESH_TRANSACTIONS 32
 #define ADD_ADDITIONAL_DELAY 10
 
 uint8_t count;
@@ -46,18 +67,66 @@ typedef struct
     bool is_hp;
 } timestamp_t;
 
-/** Structure of a task */
+/** Structure of a task, the hot part of the query table */
 typedef struct
 {
-    MODBUS_MASTER_QUERY                 modbus_query; /* Modbus Query of this task */
+    query_hot_t                         modbus_query; /* Modbus Query of this task */
     timestamp_t                         next_ts;/* When is the next execution */
+    timestamp_t                         deadline_ts; /* Next execution must start before */
+    uint32_t                            cost_us; /* Bus time of one execution */
+    uint32_t                            uplink_held_ms; /* Time the due poll was held by the uplink budget */
+    uint16_t                            stretch; /* Period stretch on overload, in STRETCH_UNIT */
+    uint8_t                             lane;   /* query_lane_e */
     bool                                updated; /* Updated in IRQ context? */
     bool                                removed; /* Task removed, to be released */
 } task_t;
 
-/**  List of tasks */
+/** Query fields read when the query is posted or saved, the cold part of the query table */
+typedef struct
+{
+    device_detail_t                     deviceDetail;
+    modbus_decode_t                     decode;
+    uint32_t                            registerMask;
+    uint8_t                             lastReport[MODBUS_TLV_DATA_SIZE]; /* Last reported reply */
+    uint8_t                             lastReportLength; /* 0 for none */
+    uint8_t                             debounce;
+    uint8_t                             payload; /* Index in m_payloads, NO_PAYLOAD for none */
+} task_cold_t;
+
+/** Data of a write query, few queries write */
+typedef struct
+{
+    uint8_t                             slot; /* Task using the payload, NO_PAYLOAD when free */
+    uint8_t                             dataLength;
+    uint8_t                             writeData[MAX_WRITE_DATA_BUFFER];
+} write_payload_t;
+
+#define NO_PAYLOAD 0xFF
+
+/** Write of a combined frame, acknowledged on its own */
+typedef struct
+{
+    device_detail_t                     deviceDetail;
+    uint8_t                             u8fct;  /* FC5 or FC6 */
+    uint16_t                            u16RegAdd;
+    uint16_t                            value;
+} combined_write_t;
+
+/**  List of tasks, the query table. The settings are saved from it. */
 static task_t m_tasks[QUERY_SCHEDULER_MAX_TASKS];
 
+/** Cold part of the tasks, same index */
+static task_cold_t m_cold[QUERY_SCHEDULER_MAX_TASKS];
+
+/** Data of the write tasks */
+static write_payload_t m_payloads[QUERY_SCHEDULER_MAX_WRITE_PAYLOADS];
+
+/** Writes of the frame in flight when it is a combined one */
+static combined_write_t m_combined[QUERY_SCHEDULER_MAX_COMBINED_WRITES];
+
+/** Writes in m_combined, 0 when the frame in flight is not combined */
+static uint8_t m_combined_count;
+
 /** Next task to be executed */
 static task_t * m_next_task_p;
 
@@ -65,8 +134,164 @@ static task_t * m_next_task_p;
  *  (task added or removed) */
 static bool m_force_reschedule;
 
+/** End of the bus idle time after the last transaction */
+static timestamp_t m_bus_free_ts;
+
+/** Periods to be planned again (task added or removed, latencies updated) */
+static bool m_replan;
+
+/** Bus utilisation of the periodic tasks at their configured period, in ppm */
+static uint32_t m_utilisation_ppm;
+
+/** Tasks with a stretched period */
+static uint8_t m_degraded;
+
+/** Transactions since the last plan */
+static uint8_t m_transactions;
+
+/** Periodic task set changed since the last plan */
+static bool m_set_changed;
+
+#ifdef QUERY_SCHEDULER_CYCLIC
+/** Periodic tasks run from the static schedule */
+static bool m_cyclic_active;
+
+/** Minor frame of the static schedule */
+static uint32_t m_cyclic_minor_ms;
+
+/** Start of the next minor frame */
+static timestamp_t m_frame_ts;
+#endif
+
 /** Forward declaration */
 static uint32_t periodic_work(void);
+static query_scheduler_res_e add_task(MODBUS_MASTER_QUERY query, bool admit);
+
+/**
+ * \brief   Give a task the write payload its query needs, before it is set
+ * \param   slot
+ *          Index of the task
+ * \param   query
+ *          The query
+ * \return  false if the query writes and no payload is free
+ * \note    Must be called from critical section
+ */
+static bool set_task_payload_locked(uint8_t slot, const MODBUS_MASTER_QUERY * query)
+{
+    task_cold_t * cold = &m_cold[slot];
+    bool used = m_tasks[slot].modbus_query.queryId != 0xFF && cold->payload != NO_PAYLOAD;
+
+    if (!query->writeOps)
+    {
+        if (used)
+        {
+            m_payloads[cold->payload].slot = NO_PAYLOAD;
+        }
+        cold->payload = NO_PAYLOAD;
+        return true;
+    }
+    if (used)
+    {
+        return true;
+    }
+    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_WRITE_PAYLOADS; i++)
+    {
+        if (m_payloads[i].slot == NO_PAYLOAD)
+        {
+            m_payloads[i].slot = slot;
+            cold->payload = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * \brief   Release a task of the table
+ * \param   slot
+ *          Index of the task
+ * \note    Must be called from critical section
+ */
+static void release_task_locked(uint8_t slot)
+{
+    if (m_tasks[slot].modbus_query.queryId != 0xFF && m_cold[slot].payload != NO_PAYLOAD)
+    {
+        m_payloads[m_cold[slot].payload].slot = NO_PAYLOAD;
+        m_cold[slot].payload = NO_PAYLOAD;
+    }
+    memset(&m_tasks[slot].modbus_query, 0xFF, sizeof(query_hot_t));
+}
+
+/**
+ * \brief   Split a query in the hot and cold parts of a task
+ * \param   hot
+ *          Hot part to fill
+ * \param   cold
+ *          Cold part to fill, NULL when not needed. Its payload is set
+ *          already for a write query.
+ * \param   query
+ *          The query
+ */
+static void set_task_query(query_hot_t * hot, task_cold_t * cold, const MODBUS_MASTER_QUERY * query)
+{
+    hot->queryId = query->queryId;
+    hot->u8id = query->u8id;
+    hot->u8fct = query->u8fct;
+    hot->priority = query->priority;
+    hot->u16RegAdd = query->u16RegAdd;
+    hot->u16CoilsNo = query->u16CoilsNo;
+    hot->intervalMs = query->intervalMs;
+    hot->oneTime = query->oneTime;
+    hot->writeOps = query->writeOps;
+    if (cold != NULL)
+    {
+        cold->deviceDetail = query->deviceDetail;
+        cold->decode = query->decode;
+        cold->registerMask = query->registerMask;
+        cold->debounce = query->debounce;
+        if (cold->payload != NO_PAYLOAD)
+        {
+            write_payload_t * payload = &m_payloads[cold->payload];
+            payload->dataLength = (query->dataLength > MAX_WRITE_DATA_BUFFER) ? MAX_WRITE_DATA_BUFFER : query->dataLength;
+            memcpy(payload->writeData, query->writeData, payload->dataLength);
+        }
+        // Settings may have changed, next reply is reported
+        cold->lastReportLength = 0;
+    }
+}
+
+/**
+ * \brief   Join the hot and cold parts of a task in a query
+ * \param   slot
+ *          Index of the task
+ * \param   query
+ *          Query to fill
+ */
+static void get_task_query(uint8_t slot, MODBUS_MASTER_QUERY * query)
+{
+    const query_hot_t * hot = &m_tasks[slot].modbus_query;
+    const task_cold_t * cold = &m_cold[slot];
+
+    memset(query, 0, sizeof(MODBUS_MASTER_QUERY));
+    query->queryId = hot->queryId;
+    query->u8id = hot->u8id;
+    query->u8fct = hot->u8fct;
+    query->priority = hot->priority;
+    query->u16RegAdd = hot->u16RegAdd;
+    query->u16CoilsNo = hot->u16CoilsNo;
+    query->intervalMs = hot->intervalMs;
+    query->oneTime = hot->oneTime;
+    query->writeOps = hot->writeOps;
+    query->deviceDetail = cold->deviceDetail;
+    query->decode = cold->decode;
+    query->registerMask = cold->registerMask;
+    query->debounce = cold->debounce;
+    if (hot->writeOps && cold->payload != NO_PAYLOAD)
+    {
+        query->dataLength = m_payloads[cold->payload].dataLength;
+        memcpy(query->writeData, m_payloads[cold->payload].writeData, query->dataLength);
+    }
+}
 
 
 /**
@@ -127,17 +352,46 @@ static void get_timestamp(timestamp_t * ts_p, uint32_t ms)
 }
 
 /**
- * \brief   Get the delay in us relative to now for a timestamp
+ * \brief   Move the timestamp of a periodic task to its next period
+ * \param   ts_p
+ *          Pointer to the timestamp of the execution just done, updated
+ * \param   ms
+ *          Period in ms
+ * \note    Next execution is relative to the previous due time, so the time
+ *          spent waiting for the bus does not add up on short periods. A task
+ *          already late by a full period starts again from now.
+ */
+static void get_next_period_timestamp(timestamp_t * ts_p, uint32_t ms)
+{
+    if (ts_p->is_hp && ms < m_max_time_ms)
+    {
+        app_lib_time_timestamp_hp_t next_hp = lib_time->addUsToHpTimestamp(ts_p->hp, ms * 1000);
+        if (!lib_time->isHpTimestampBefore(next_hp, lib_time->getTimestampHp()))
+        {
+            ts_p->hp = next_hp;
+            return;
+        }
+    }
+    get_timestamp(ts_p, ms);
+}
+
+/**
+ * \brief   Get the delay in us relative to a given now for a timestamp
  * \param   ts_p
  *          Pointer to timestamp to evaluate
+ * \param   now_hp
+ *          Current hp timestamp
+ * \param   now_coarse
+ *          Current coarse timestamp
  * \return  Delay from now to the timestamp in us, or 0 if timestamp
  *          is in the past already
  */
-static uint32_t get_delay_from_now_us(timestamp_t * ts_p)
+static uint32_t get_delay_us(timestamp_t * ts_p,
+                             app_lib_time_timestamp_hp_t now_hp,
+                             app_lib_time_timestamp_coarse_t now_coarse)
 {
     if (ts_p->is_hp)
     {
-        app_lib_time_timestamp_hp_t now_hp = lib_time->getTimestampHp();
         if (lib_time->isHpTimestampBefore(ts_p->hp, now_hp))
         {
             //Timestamp is already in the past, so 0 delay
@@ -148,7 +402,6 @@ static uint32_t get_delay_from_now_us(timestamp_t * ts_p)
     }
     else
     {
-        app_lib_time_timestamp_coarse_t now_coarse = lib_time->getTimestampCoarse();
         if (Util_isLtUint32(ts_p->coarse, now_coarse))
         {
             // Coarse timestamp is already in the past, so 0 delay
@@ -158,47 +411,612 @@ static uint32_t get_delay_from_now_us(timestamp_t * ts_p)
         // Check for overflow
         uint32_t delta_coarse = ts_p->coarse - now_coarse;
 
-        // on 32 bits, max delay in us is 2^32 * 128 / 1000 / 1000 = 549755 coarse
-        if (delta_coarse > 549755)
-        {
-            // No need to compute, it is far enough in future and cannot be represented
-            // on a 32 bits counter in us without overflow.
-            // Anyway the scheduler itself will be scheduled at least every
-            // m_max_time_ms so we just need to Know that it is far in future
-            return (uint32_t)(-1);
-        }
-        else
+        // on 32 bits, max delay in us is 2^32 * 128 / 1000 / 1000 = 549755 coarse
+        if (delta_coarse > 549755)
+        {
+            // No need to compute, it is far enough in future and cannot be represented
+            // on a 32 bits counter in us without overflow.
+            // Anyway the scheduler itself will be scheduled at least every
+            // m_max_time_ms so we just need to Know that it is far in future
+            return (uint32_t)(-1);
+        }
+        else
+        {
+            return (((ts_p->coarse - now_coarse) * 1000) / 128) * 1000;
+        }
+    }
+}
+
+/**
+ * \brief   Get the delay in us relative to now for a timestamp
+ * \param   ts_p
+ *          Pointer to timestamp to evaluate
+ * \return  Delay from now to the timestamp in us, or 0 if timestamp
+ *          is in the past already
+ */
+static uint32_t get_delay_from_now_us(timestamp_t * ts_p)
+{
+    if (ts_p->is_hp)
+    {
+        return get_delay_us(ts_p, lib_time->getTimestampHp(), 0);
+    }
+    return get_delay_us(ts_p, 0, lib_time->getTimestampCoarse());
+}
+
+/**
+ * \brief   Get the time elapsed since a timestamp
+ * \param   ts_p
+ *          Pointer to timestamp to evaluate
+ * \return  Time since the timestamp in us, or 0 if it is still in the future
+ */
+static uint32_t get_time_since_us(timestamp_t * ts_p)
+{
+    if (ts_p->is_hp)
+    {
+        app_lib_time_timestamp_hp_t now_hp = lib_time->getTimestampHp();
+        if (lib_time->isHpTimestampBefore(now_hp, ts_p->hp))
+        {
+            return 0;
+        }
+        return lib_time->getTimeDiffUs(ts_p->hp, now_hp);
+    }
+    else
+    {
+        app_lib_time_timestamp_coarse_t now_coarse = lib_time->getTimestampCoarse();
+        if (Util_isLtUint32(now_coarse, ts_p->coarse))
+        {
+            return 0;
+        }
+        // Saturated as in get_delay_us
+        if (now_coarse - ts_p->coarse > 549755)
+        {
+            return (uint32_t)(-1);
+        }
+        return (((now_coarse - ts_p->coarse) * 1000) / 128) * 1000;
+    }
+}
+
+/**
+ * \brief   Get the priority lane of a query
+ */
+static uint8_t get_lane(const query_hot_t * query)
+{
+    if (!query->oneTime)
+    {
+        return QUERY_LANE_PERIODIC;
+    }
+    return query->writeOps ? QUERY_LANE_URGENT : QUERY_LANE_ON_DEMAND;
+}
+
+/**
+ * \brief   Check if a timestamp is before another one
+ * \param   ts1_p
+ *          Pointer to first timestamp
+ * \param   ts2_p
+ *          Pointer to second timestamp
+ * \return  True if ts1 is before ts2
+ */
+static bool is_timestamp_before(timestamp_t * ts1_p, timestamp_t * ts2_p)
+{
+    if (ts1_p->is_hp && ts2_p->is_hp)
+    {
+        // Both timestamps are hp
+        return lib_time->isHpTimestampBefore(ts1_p->hp, ts2_p->hp);
+    }
+    else if (!ts1_p->is_hp && !ts2_p->is_hp)
+    {
+        // Both timestamps are coarse
+        return Util_isLtUint32(ts1_p->coarse, ts2_p->coarse);
+    }
+    else
+    {
+        // To compare a coarse and hp timestamp, we must compute the delay
+        // relative to now for both and compare it
+        return get_delay_from_now_us(ts1_p) < get_delay_from_now_us(ts2_p);
+    }
+}
+
+/**
+ * \brief   Check if a timestamp is before another one, with the current
+ *          time already read
+ * \param   ts1_p
+ *          Pointer to first timestamp
+ * \param   ts2_p
+ *          Pointer to second timestamp
+ * \param   now_hp
+ *          Current hp timestamp
+ * \param   now_coarse
+ *          Current coarse timestamp
+ * \return  True if ts1 is before ts2
+ */
+static bool is_timestamp_before_at(timestamp_t * ts1_p, timestamp_t * ts2_p,
+                                   app_lib_time_timestamp_hp_t now_hp,
+                                   app_lib_time_timestamp_coarse_t now_coarse)
+{
+    if (ts1_p->is_hp == ts2_p->is_hp)
+    {
+        return is_timestamp_before(ts1_p, ts2_p);
+    }
+    // A ms period task against an hour period one
+    return get_delay_us(ts1_p, now_hp, now_coarse) < get_delay_us(ts2_p, now_hp, now_coarse);
+}
+
+/**
+ * \brief   Set the deadline of a task, the end of its period
+ * \param   task
+ *          Task with its next execution time set
+ * \param   period_ms
+ *          Period, 0 for one time tasks
+ */
+static void set_deadline(task_t * task, uint32_t period_ms)
+{
+    uint32_t release_ms = get_delay_from_now_us(&task->next_ts) / 1000;
+
+    if (period_ms > UINT32_MAX - 1 - release_ms)
+    {
+        period_ms = UINT32_MAX - 1 - release_ms;
+    }
+    get_timestamp(&task->deadline_ts, release_ms + period_ms);
+}
+
+/**
+ * \brief   Is the task planned, a periodic one in use
+ */
+static bool is_planned(const task_t * task)
+{
+    return task->modbus_query.queryId != 0xFF && !task->removed
+           && !task->modbus_query.oneTime && task->modbus_query.intervalMs != 0;
+}
+
+/**
+ * \brief   Stretch weight of the priority of a task, the bus and uplink
+ *          stretches share it
+ */
+static uint8_t get_weight(const task_t * task)
+{
+    switch (task->modbus_query.priority)
+    {
+        case QUERY_PRIORITY_HIGH:
+            return 1;
+        case QUERY_PRIORITY_LOW:
+            return UPLINK_STRETCH_WEIGHT_FULL;
+        default:
+            return 2;
+    }
+}
+
+/**
+ * \brief   Stretch factor of a task
+ * \param   task
+ *          Periodic task
+ * \param   k
+ *          Extra stretch for a weight of 1, in STRETCH_UNIT
+ * \return  Stretch factor in STRETCH_UNIT
+ */
+static uint32_t get_stretch(const task_t * task, uint32_t k)
+{
+    uint32_t stretch = STRETCH_UNIT + k * get_weight(task);
+
+    return (stretch > UINT16_MAX) ? UINT16_MAX : stretch;
+}
+
+/**
+ * \brief   Bus share of a periodic query
+ * \param   cost_us
+ *          Bus time of one execution
+ * \param   interval_ms
+ *          Period, not 0
+ * \return  Share in ppm, bounded so that a stretched share fits 32 bits
+ */
+static uint32_t get_load_ppm(uint32_t cost_us, uint32_t interval_ms)
+{
+    uint32_t ppm;
+
+    if (cost_us > 4000000)
+    {
+        cost_us = 4000000;
+    }
+    ppm = cost_us * 1000 / interval_ms;
+    return (ppm > 16000000) ? 16000000 : ppm;
+}
+
+/**
+ * \brief   Bus utilisation of the periodic tasks
+ * \param   k
+ *          Extra stretch for a weight of 1, in STRETCH_UNIT
+ * \return  Utilisation in ppm
+ * \note    Must be called under critical section
+ */
+static uint32_t get_utilisation_ppm_locked(uint32_t k)
+{
+    uint32_t total = 0;
+
+    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++)
+    {
+        if (is_planned(&m_tasks[i]))
+        {
+            uint32_t ppm = get_load_ppm(m_tasks[i].cost_us, m_tasks[i].modbus_query.intervalMs);
+            ppm = ppm * STRETCH_UNIT / get_stretch(&m_tasks[i], k);
+            total = (total > UINT32_MAX - ppm) ? UINT32_MAX : total + ppm;
+        }
+    }
+    return total;
+}
+
+/**
+ * \brief   Bus utilisation of the periodic tasks with a task added, or
+ *          replacing the one of the same query id
+ * \param   task
+ *          Task with its cost set
+ * \return  Utilisation in ppm at the configured periods
+ * \note    Must be called under critical section
+ */
+static uint32_t get_admission_ppm_locked(const task_t * task)
+{
+    uint32_t total = is_planned(task) ? get_load_ppm(task->cost_us, task->modbus_query.intervalMs) : 0;
+
+    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++)
+    {
+        if (is_planned(&m_tasks[i]) && m_tasks[i].modbus_query.queryId != task->modbus_query.queryId)
+        {
+            uint32_t ppm = get_load_ppm(m_tasks[i].cost_us, m_tasks[i].modbus_query.intervalMs);
+            total = (total > UINT32_MAX - ppm) ? UINT32_MAX : total + ppm;
+        }
+    }
+    return total;
+}
+
+/**
+ * \brief   Plan the periods of the periodic tasks
+ *
+ * The bus time of each task is estimated with the cost model. When the
+ * periodic load is above PLAN_MAX_PERMILLE, periods are stretched in
+ * proportion to the weight of their priority, by the smallest amount
+ * bringing the load under the limit.
+ *
+ * \note    Must be called under critical section
+ */
+static void plan_tasks_locked(void)
+{
+    uint32_t limit_ppm = (uint32_t) PLAN_MAX_PERMILLE * 1000;
+    uint32_t k = 0;
+    uint8_t degraded = 0;
+
+    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++)
+    {
+        if (is_planned(&m_tasks[i]))
+        {
+            m_tasks[i].cost_us = Query_cost_us(&m_tasks[i].modbus_query);
+        }
+    }
+
+    m_utilisation_ppm = get_utilisation_ppm_locked(0);
+    if (m_utilisation_ppm > limit_ppm)
+    {
+        // Smallest k under the limit, the largest one if none is
+        uint32_t low = 0;
+        k = STRETCH_MAX_K;
+        while (low < k)
+        {
+            uint32_t middle = (low + k) / 2;
+            if (get_utilisation_ppm_locked(middle) <= limit_ppm)
+            {
+                k = middle;
+            }
+            else
+            {
+                low = middle + 1;
+            }
+        }
+    }
+
+    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++)
+    {
+        m_tasks[i].stretch = is_planned(&m_tasks[i]) ? (uint16_t) get_stretch(&m_tasks[i], k) : STRETCH_UNIT;
+        if (m_tasks[i].stretch != STRETCH_UNIT)
+        {
+            degraded++;
+        }
+    }
+
+    if (degraded != m_degraded)
+    {
+        uint32_t permille = m_utilisation_ppm / 1000;
+        MODBUS_LOG_WARN(LOG_PLAN_OVERLOAD, (uint16_t) ((permille > UINT16_MAX) ? UINT16_MAX : permille), degraded);
+        m_degraded = degraded;
+    }
+}
+
+/**
+ * \brief   Period of a task after overload stretching
+ */
+static uint32_t get_planned_period_ms(const task_t * task)
+{
+    uint32_t interval_ms = task->modbus_query.intervalMs;
+    uint32_t high = (interval_ms / STRETCH_UNIT) * task->stretch;
+
+    if (task->stretch > STRETCH_UNIT && high / task->stretch != interval_ms / STRETCH_UNIT)
+    {
+        // Overflow, as far as a period can go
+        return UINT32_MAX - 1;
+    }
+    return high + (interval_ms % STRETCH_UNIT) * task->stretch / STRETCH_UNIT;
+}
+
+/**
+ * \brief   Can the query of a task join a combined write
+ * \note    One time single register or coil writes, when the block write is
+ *          built in. Coils only with the values FC5 knows.
+ */
+static bool is_combinable(const task_t * task)
+{
+    const query_hot_t * hot = &task->modbus_query;
+    const write_payload_t * payload;
+    uint16_t value;
+
+    if (hot->queryId == 0xFF || task->removed || !hot->oneTime || !hot->writeOps
+        || m_cold[task - m_tasks].payload == NO_PAYLOAD)
+    {
+        return false;
+    }
+    payload = &m_payloads[m_cold[task - m_tasks].payload];
+    if (payload->dataLength < sizeof(value))
+    {
+        return false;
+    }
+    memcpy(&value, payload->writeData, sizeof(value));
+    switch (hot->u8fct)
+    {
+        case MB_FC_WRITE_REGISTER:
+            return MODBUS_FC_SUPPORTED(MB_FC_WRITE_MULTIPLE_REGISTERS);
+        case MB_FC_WRITE_COIL:
+            return MODBUS_FC_SUPPORTED(MB_FC_WRITE_MULTIPLE_COILS) && (value == 0xFF00 || value == 0x0000);
+        default:
+            return false;
+    }
+}
+
+/**
+ * \brief   Merge the pending one time writes of a slave next to the one of a
+ *          task in one FC15/FC16 frame
+ * \param   task
+ *          Task to send
+ * \param   query
+ *          Query of the task, its register image set. Turned into the block
+ *          write when other writes join.
+ * \param   members
+ *          Filled with the slots of the writes of the frame
+ * \param   writes
+ *          Filled with the writes of the frame, to acknowledge
+ * \return  Writes of the frame, 0 when it is not combined
+ * \note    Writes to the same target keep the value of the one added last.
+ *          Nothing is changed in the tasks until the frame is posted
+ *          (commit_combined_locked).
+ * \note    Must be called under critical section
+ */
+static uint8_t combine_writes_locked(task_t * task, MODBUS_MASTER_QUERY * query, uint8_t * members,
+                                     combined_write_t * writes)
+{
+    uint8_t latest[QUERY_SCHEDULER_MAX_COMBINED_WRITES];
+    uint8_t count = 1;
+    uint16_t first = task->modbus_query.u16RegAdd;
+    uint16_t last = first;
+    bool grown = true;
+
+    if (!is_combinable(task))
+    {
+        return 0;
+    }
+    members[0] = (uint8_t) (task - m_tasks);
+    // Grow the block until no pending write is next to it, a block spans
+    // at most one target per write
+    while (grown && count < QUERY_SCHEDULER_MAX_COMBINED_WRITES)
+    {
+        grown = false;
+        for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS && count < QUERY_SCHEDULER_MAX_COMBINED_WRITES; i++)
+        {
+            const query_hot_t * hot = &m_tasks[i].modbus_query;
+            bool member = false;
+
+            if (!is_combinable(&m_tasks[i]) || hot->u8id != task->modbus_query.u8id
+                || hot->u8fct != task->modbus_query.u8fct
+                || (uint32_t) hot->u16RegAdd + 1 < first || hot->u16RegAdd > (uint32_t) last + 1)
+            {
+                continue;
+            }
+            for (uint8_t m = 0; m < count && !member; m++)
+            {
+                member = members[m] == i;
+            }
+            if (member || (hot->u16RegAdd < first && last - hot->u16RegAdd >= QUERY_SCHEDULER_MAX_COMBINED_WRITES)
+                || (hot->u16RegAdd > last && hot->u16RegAdd - first >= QUERY_SCHEDULER_MAX_COMBINED_WRITES))
+            {
+                continue;
+            }
+            members[count++] = i;
+            first = (hot->u16RegAdd < first) ? hot->u16RegAdd : first;
+            last = (hot->u16RegAdd > last) ? hot->u16RegAdd : last;
+            grown = true;
+        }
+    }
+    if (count == 1)
+    {
+        return 0;
+    }
+
+    // Last write added to each target, its timestamp is the latest
+    memset(latest, NO_PAYLOAD, sizeof(latest));
+    for (uint8_t m = 0; m < count; m++)
+    {
+        uint8_t target = (uint8_t) (m_tasks[members[m]].modbus_query.u16RegAdd - first);
+        if (latest[target] == NO_PAYLOAD
+            || !is_timestamp_before(&m_tasks[members[m]].next_ts, &m_tasks[latest[target]].next_ts))
+        {
+            latest[target] = members[m];
+        }
+    }
+
+    memset(query->au16reg, 0, ((last - first) / 16 + 1) * sizeof(uint16_t));
+    for (uint8_t m = 0; m < count; m++)
+    {
+        uint8_t slot = members[m];
+        combined_write_t * write = &writes[m];
+        uint16_t target = m_tasks[slot].modbus_query.u16RegAdd - first;
+
+        write->deviceDetail = m_cold[slot].deviceDetail;
+        write->u8fct = m_tasks[slot].modbus_query.u8fct;
+        write->u16RegAdd = m_tasks[slot].modbus_query.u16RegAdd;
+        memcpy(&write->value, m_payloads[m_cold[slot].payload].writeData, sizeof(write->value));
+        if (latest[target] == slot)
+        {
+            if (write->u8fct == MB_FC_WRITE_REGISTER)
+            {
+                query->au16reg[target] = write->value;
+            }
+            else if (write->value != 0)
+            {
+                // Coil n is bit n % 8 of byte n / 8, the bytes are sent high first
+                query->au16reg[target / 16] |= (uint16_t) (1U << ((target % 8) + (((target / 8) % 2) ? 0 : 8)));
+            }
+        }
+    }
+
+    query->u8fct = (query->u8fct == MB_FC_WRITE_REGISTER) ? MB_FC_WRITE_MULTIPLE_REGISTERS : MB_FC_WRITE_MULTIPLE_COILS;
+    query->u16RegAdd = first;
+    query->u16CoilsNo = (uint16_t) (last - first + 1);
+    query->dataLength = 0;
+    return count;
+}
+
+/**
+ * \brief   The combined frame is on the line: release the joined tasks, the
+ *          acknowledges are fanned out when the frame ends
+ *          (Query_Scheduler_fanOutAck)
+ * \param   members
+ *          Slots of the writes of the frame, the task sent first
+ * \param   writes
+ *          Writes of the frame
+ * \param   count
+ *          Writes of the frame, 0 when it is not combined
+ * \note    Must be called under critical section
+ */
+static void commit_combined_locked(const uint8_t * members, const combined_write_t * writes, uint8_t count)
+{
+    for (uint8_t m = 1; m < count; m++)
+    {
+        // Sent now, released on the next selection
+        m_tasks[members[m]].updated = true;
+        m_tasks[members[m]].removed = true;
+    }
+    memcpy(m_combined, writes, count * sizeof(combined_write_t));
+    m_combined_count = count;
+}
+
+/**
+ * \brief   Put the query of a task on the line
+ * \param   task
+ *          Task to send
+ * \param   wait_us
+ *          Time the task waited since it was due
+ */
+static void post_task(task_t * task, uint32_t wait_us)
+{
+    MODBUS_MASTER_QUERY query;
+    uint8_t members[QUERY_SCHEDULER_MAX_COMBINED_WRITES];
+    combined_write_t writes[QUERY_SCHEDULER_MAX_COMBINED_WRITES];
+    uint8_t combined;
+
+    get_task_query((uint8_t) (task - m_tasks), &query);
+    query.au16reg = ModbusDataRegArray;
+    query.maxRegsPerFrame = Query_block_get_limit(query.u8id);
+
+    if (query.writeOps) {
+        memcpy(query.au16reg, &query.writeData, query.dataLength);
+    }
+    Sys_enterCriticalSection();
+    combined = combine_writes_locked(task, &query, members, writes);
+    Sys_exitCriticalSection();
+    if (postModbusMasterQuery(&query)) {
+        // Not sent before RunModbusMasterTask, the acknowledges cannot come first
+        Sys_enterCriticalSection();
+        commit_combined_locked(members, writes, combined);
+        Sys_exitCriticalSection();
+        if (combined != 0) {
+            MODBUS_LOG_INFO(LOG_WRITES_COMBINED, combined, query.u8id);
+        }
+        MODBUS_LOG_DEBUG(LOG_QUERY_POSTED, task->modbus_query.queryId, task->modbus_query.u8id);
+        Query_stats_lane(task->lane, wait_us);
+        Query_stats_poll((uint8_t) (task - m_tasks), &task->modbus_query,
+                         task->modbus_query.oneTime ? 0 : task->modbus_query.intervalMs);
+        RunModbusMasterTask();
+    }
+}
+
+/**
+ * \brief   Can a read size or bus scan probe go on the line before the next
+ *          task is due, or the next minor frame of the static schedule
+ * \note    Must be called under critical section
+ */
+static bool is_probe_gap_locked(void)
+{
+    uint32_t probe_us;
+    uint32_t gap_us = UINT32_MAX;
+    uint32_t timeout_ms = Query_block_isPending() ? Query_block_timeout_ms() : Query_scan_timeout_ms();
+
+    if (!(Query_block_isPending() || Query_scan_isRunning()) || isModbusMasterBusy())
+    {
+        return false;
+    }
+    if (m_next_task_p != NULL)
+    {
+        gap_us = get_delay_from_now_us(&m_next_task_p->next_ts);
+    }
+#ifdef QUERY_SCHEDULER_CYCLIC
+    if (m_cyclic_active)
+    {
+        uint32_t frame_us = get_delay_from_now_us(&m_frame_ts);
+
+        if (Query_cyclic_peek() != QUERY_CYCLIC_END_OF_FRAME)
         {
-            return (((ts_p->coarse - now_coarse) * 1000) / 128) * 1000;
+            // Entries of the current frame still to be sent
+            return false;
         }
+        gap_us = (frame_us < gap_us) ? frame_us : gap_us;
+    }
+#endif
+    if (gap_us == UINT32_MAX)
+    {
+        return true;
     }
+    probe_us = get_delay_from_now_us(&m_bus_free_ts) + QUERY_COST_TX_ENABLE_US + timeout_ms * 1000;
+    return gap_us >= probe_us;
 }
 
 /**
- * \brief   Check if a timestamp is before another one
- * \param   ts1_p
- *          Pointer to first timestamp
- * \param   ts2_p
- *          Pointer to second timestamp
- * \return  True if ts1 is before ts2
+ * \brief   Put the next probe on the line, read size probes first
  */
-static bool is_timestamp_before(timestamp_t * ts1_p, timestamp_t * ts2_p)
+static void post_probe(void)
 {
-    if (ts1_p->is_hp && ts2_p->is_hp)
+    MODBUS_MASTER_QUERY probe;
+    bool block = Query_block_next(&probe);
+
+    if (!block && !Query_scan_next(&probe))
     {
-        // Both timestamps are hp
-        return lib_time->isHpTimestampBefore(ts1_p->hp, ts2_p->hp);
+        return;
     }
-    else if (!ts1_p->is_hp && !ts2_p->is_hp)
+    probe.au16reg = ModbusDataRegArray;
+    if (postModbusMasterQuery(&probe))
     {
-        // Both timestamps are coarse
-        return Util_isLtUint32(ts1_p->coarse, ts2_p->coarse);
+        RunModbusMasterTask();
+    }
+    else if (block)
+    {
+        Query_block_result(NO_REPLY, 0);
     }
     else
     {
-        // To compare a coarse and hp timestamp, we must compute the delay
-        // relative to now for both and compare it
-        return get_delay_from_now_us(ts1_p) < get_delay_from_now_us(ts2_p);
+        // Not on the line, the address is skipped
+        Query_scan_result(probe.u8id, NO_REPLY, 0, 0);
     }
 }
 
@@ -207,7 +1025,6 @@ static bool is_timestamp_before(timestamp_t * ts1_p, timestamp_t * ts2_p)
  */
 static void perform_query(task_t * task)
 {
-    bool status = false;
     uint32_t next = QUERY_SCHEDULER_STOP_TASK;
 
     if (task == NULL)
@@ -219,21 +1036,32 @@ static void perform_query(task_t * task)
     {
         return;
     }
-    // Execute the task selected
-    task->modbus_query.au16reg = ModbusDataRegArray;
-
-    if (task->modbus_query.writeOps) {
-        memcpy(task->modbus_query.au16reg, &task->modbus_query.writeData, task->modbus_query.dataLength);
-    }
-    DEBUG_SEND(Is_debug(), "Query");
-    DEBUG_SEND(Is_debug(), task->modbus_query);
-    status = postModbusMasterQuery(&task->modbus_query);
-    if (status) {
-        RunModbusMasterTask();
+    if (!task->modbus_query.oneTime && !task->modbus_query.writeOps)
+    {
+        // Periodic reads are the low priority traffic, hold them instead of
+        // overrunning the radio uplink budget. The hold goes by short steps
+        // so that the poll is sent once the budget recovers.
+        uint32_t hold_ms = Uplink_budget_hold_ms(task->modbus_query.intervalMs, get_weight(task),
+                                                 get_planned_period_ms(task), task->uplink_held_ms);
+        if (hold_ms != 0)
+        {
+            Sys_enterCriticalSection();
+            if (!task->updated && !task->removed)
+            {
+                task->uplink_held_ms += hold_ms;
+                get_timestamp(&task->next_ts, hold_ms);
+                set_deadline(task, get_planned_period_ms(task));
+            }
+            Sys_exitCriticalSection();
+            return;
+        }
     }
 
+    // Execute the task selected
+    post_task(task, get_time_since_us(&task->next_ts));
+
     if (!task->modbus_query.oneTime) {
-        next = (uint32_t) task->modbus_query.interval * 1000;
+        next = get_planned_period_ms(task);
     }
 
     // Update its next execution time under critical section
@@ -247,12 +1075,14 @@ static void perform_query(task_t * task)
         {
             // Task doesn't have to be executed again
             // so safe to release it
-            memset(&task->modbus_query, 0xFF, sizeof(MODBUS_MASTER_QUERY));
+            release_task_locked((uint8_t) (task - m_tasks));
         }
         else
         {
             // Compute next execution time
-            get_timestamp(&task->next_ts, next);
+            get_next_period_timestamp(&task->next_ts, next);
+            set_deadline(task, next);
+            task->uplink_held_ms = 0;
         }
     }
     Sys_exitCriticalSection();
@@ -261,10 +1091,19 @@ static void perform_query(task_t * task)
 /**
  * \brief   Get the next task for execution
  * \note    Must be called under critical section
+ * \note    Among the due tasks, the one of the highest priority lane is
+ *          selected, the one with the earliest deadline inside a lane. When
+ *          none is due, the earliest task is selected.
+ * \note    Time is read once for the whole table, hp (ms periods) and
+ *          coarse (hour periods) timestamps are compared against it
  */
 static task_t * get_next_task_locked()
 {
     task_t * next = NULL;
+    bool next_due = false;
+    app_lib_time_timestamp_hp_t now_hp = lib_time->getTimestampHp();
+    app_lib_time_timestamp_coarse_t now_coarse = lib_time->getTimestampCoarse();
+
     for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++)
     {
         if (m_tasks[i].modbus_query.queryId != 0xFF)
@@ -272,13 +1111,45 @@ static task_t * get_next_task_locked()
             if (m_tasks[i].removed)
             {
                 // Time to clear the task
-                memset(&m_tasks[i].modbus_query, 0xFF, sizeof(MODBUS_MASTER_QUERY));
+                release_task_locked(i);
+                continue;
+            }
+#ifdef QUERY_SCHEDULER_CYCLIC
+            if (m_cyclic_active && is_planned(&m_tasks[i]))
+            {
+                // Run from the static schedule
                 continue;
             }
-            if (next == NULL || is_timestamp_before(&m_tasks[i].next_ts, &next->next_ts))
+#endif
+            bool due = get_delay_us(&m_tasks[i].next_ts, now_hp, now_coarse) == 0;
+            bool selected;
+            if (next == NULL)
+            {
+                // First task found
+                selected = true;
+            }
+            else if (due != next_due)
+            {
+                selected = due;
+            }
+            else if (due && m_tasks[i].lane != next->lane)
+            {
+                selected = m_tasks[i].lane < next->lane;
+            }
+            else if (due)
+            {
+                // Earliest deadline first
+                selected = is_timestamp_before_at(&m_tasks[i].deadline_ts, &next->deadline_ts, now_hp, now_coarse);
+            }
+            else
+            {
+                // Task is before the selected one
+                selected = is_timestamp_before_at(&m_tasks[i].next_ts, &next->next_ts, now_hp, now_coarse);
+            }
+            if (selected)
             {
-                // First task found or task is before the selected one
                 next = &m_tasks[i];
+                next_due = due;
             }
         }
     }
@@ -286,12 +1157,12 @@ static task_t * get_next_task_locked()
 }
 
 /**
- * \brief   Schedule the next selected task
- * \param   task
- *          Selected task
+ * \brief   Schedule the periodic work for the next selected task
+ * \param   ts_p
+ *          Execution time of the selected task
  * \note    Handle the case where task is too far in future
  */
-static void schedule_task(task_t * task)
+static void schedule_task(timestamp_t * ts_p)
 {
     timestamp_t next;
     uint32_t delay_ms;
@@ -299,27 +1170,136 @@ static void schedule_task(task_t * task)
     // periodic work
     get_timestamp(&next, m_max_time_ms);
 
-    if (is_timestamp_before(&task->next_ts, &next))
+    if (is_timestamp_before(ts_p, &next))
     {
         // Next task is in allowed range
-        next = task->next_ts;
+        next = *ts_p;
     }
 
+    // Rounded up, a task due in less than 1 ms would spin otherwise
     delay_ms = get_delay_from_now_us(&next);
-    delay_ms = delay_ms / 1000;
+    delay_ms = delay_ms / 1000 + ((delay_ms % 1000) ? 1 : 0);
 
     // Schedule the task for the query.
     App_Scheduler_addTask_execTime(periodic_work, delay_ms, EXEC_TIME);
 }
 
+#ifdef QUERY_SCHEDULER_CYCLIC
+/**
+ * \brief   Compile the static schedule of the periodic tasks
+ *
+ * Used when the periods are harmonic, the major frame and the table fit and
+ * no period is stretched. Otherwise the periodic tasks are scheduled
+ * dynamically, from their next execution time.
+ *
+ * \note    Must be called under critical section, after the plan
+ */
+static void compile_cyclic_locked(void)
+{
+    bool was_active = m_cyclic_active;
+
+    Query_cyclic_clear();
+    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++)
+    {
+        if (is_planned(&m_tasks[i]))
+        {
+            Query_cyclic_add(i, m_tasks[i].modbus_query.intervalMs, m_tasks[i].cost_us);
+        }
+    }
+    m_cyclic_minor_ms = (m_degraded == 0) ? Query_cyclic_build(PLAN_MAX_PERMILLE) : 0;
+    m_cyclic_active = (m_cyclic_minor_ms != 0);
+
+    if (m_cyclic_active)
+    {
+        // First frame starts now
+        Query_cyclic_start();
+        get_timestamp(&m_frame_ts, m_cyclic_minor_ms);
+    }
+    else if (was_active)
+    {
+        // Back to dynamic scheduling, from now
+        for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++)
+        {
+            if (is_planned(&m_tasks[i]))
+            {
+                get_timestamp(&m_tasks[i].next_ts, 0);
+                set_deadline(&m_tasks[i], m_tasks[i].modbus_query.intervalMs);
+            }
+        }
+    }
+    MODBUS_LOG_INFO(LOG_CYCLIC_SCHEDULE,
+                    (uint16_t) ((m_cyclic_minor_ms > UINT16_MAX) ? UINT16_MAX : m_cyclic_minor_ms),
+                    Query_cyclic_get_frame_count());
+}
+
+/**
+ * \brief   Next periodic task of the static schedule
+ * \return  Task of the current minor frame still to be sent, NULL when the
+ *          frame is done
+ * \note    Moves to the next frame when its start is reached, the entries
+ *          the previous frame could not send are dropped. Periodic reads are
+ *          thinned out as their period would be stretched by the uplink budget.
+ */
+static task_t * get_cyclic_task(void)
+{
+    uint8_t slot;
+
+    if (get_delay_from_now_us(&m_frame_ts) == 0)
+    {
+        uint8_t dropped = Query_cyclic_next_frame();
+        if (dropped != 0)
+        {
+            MODBUS_LOG_WARN(LOG_CYCLIC_OVERRUN, dropped,
+                            (uint16_t) ((m_cyclic_minor_ms > UINT16_MAX) ? UINT16_MAX : m_cyclic_minor_ms));
+        }
+        get_next_period_timestamp(&m_frame_ts, m_cyclic_minor_ms);
+    }
+
+    while ((slot = Query_cyclic_peek()) != QUERY_CYCLIC_END_OF_FRAME)
+    {
+        task_t * task = &m_tasks[slot];
+        if (is_planned(task))
+        {
+            uint32_t interval_ms = task->modbus_query.intervalMs;
+            uint32_t stretch = task->modbus_query.writeOps
+                               ? 1 : Uplink_budget_stretch_interval(interval_ms, get_weight(task)) / interval_ms;
+            if (stretch <= 1 || Query_cyclic_get_occurrence(slot) % stretch == 0)
+            {
+                return task;
+            }
+        }
+        Query_cyclic_advance();
+    }
+    return NULL;
+}
+#endif
+
 /**
  * \brief   Periodic work called by the stack
  */
 static uint32_t periodic_work(void)
 {
+    task_t * task = NULL;
+    timestamp_t * next_ts_p = NULL;
+
     // If we enter here just to reschedule, let's do not execute task
     // even if ready
 
+    if (m_replan)
+    {
+        Sys_enterCriticalSection();
+        m_replan = false;
+        plan_tasks_locked();
+#ifdef QUERY_SCHEDULER_CYCLIC
+        if (m_set_changed)
+        {
+            compile_cyclic_locked();
+        }
+#endif
+        m_set_changed = false;
+        Sys_exitCriticalSection();
+    }
+
     if (!m_force_reschedule)
     {
         if (m_next_task_p != NULL
@@ -327,11 +1307,55 @@ static uint32_t periodic_work(void)
             && !m_next_task_p->removed)
         {
             // The last selected task is ready
-            perform_query(m_next_task_p);
+            task = m_next_task_p;
+        }
+#ifdef QUERY_SCHEDULER_CYCLIC
+        else if (m_cyclic_active)
+        {
+            task = get_cyclic_task();
+        }
+#endif
+        if (task != NULL)
+        {
+            if (isModbusMasterBusy())
+            {
+                // Previous query still on the line, we are called again
+                // from Query_Scheduler_busReleased when it ends
+                return APP_SCHEDULER_STOP_TASK;
+            }
+            uint32_t idle_us = get_delay_from_now_us(&m_bus_free_ts);
+            if (idle_us != 0)
+            {
+                // Bus idle time not elapsed yet
+                App_Scheduler_addTask_execTime(periodic_work, (idle_us + 999) / 1000, EXEC_TIME);
+                return APP_SCHEDULER_STOP_TASK;
+            }
+            if (task == m_next_task_p)
+            {
+                perform_query(task);
+            }
+#ifdef QUERY_SCHEDULER_CYCLIC
+            else
+            {
+                // Static schedule: the table gives the next execution
+                uint32_t frame_us = (m_cyclic_minor_ms > UINT32_MAX / 1000) ? UINT32_MAX : m_cyclic_minor_ms * 1000;
+                uint32_t left_us = get_delay_from_now_us(&m_frame_ts);
+                post_task(task, (left_us < frame_us) ? frame_us - left_us : 0);
+                Query_cyclic_advance();
+            }
+#endif
+        }
+        else
+        {
+            // Probes, the lowest priority traffic
+            Sys_enterCriticalSection();
+            bool probe = is_probe_gap_locked() && get_delay_from_now_us(&m_bus_free_ts) == 0;
+            Sys_exitCriticalSection();
+            if (probe)
+            {
+                post_probe();
+            }
         }
-    }
-    if(!m_force_reschedule) {
-        nrf_delay_ms(timeoutDelayTlv.delay);
     }
 
     // Enter critical section to protect m_next_task_p
@@ -340,12 +1364,38 @@ static uint32_t periodic_work(void)
     m_next_task_p = get_next_task_locked();
     if (m_next_task_p != NULL)
     {
-        // Update periodic work according to next task
-
-        schedule_task(m_next_task_p);
+        next_ts_p = &m_next_task_p->next_ts;
         // Reset updated state of task
         m_next_task_p->updated = false;
     }
+#ifdef QUERY_SCHEDULER_CYCLIC
+    timestamp_t now_ts;
+    if (m_cyclic_active)
+    {
+        // Rest of the frame right away, next frame at its start
+        timestamp_t * cyclic_ts_p = &m_frame_ts;
+        if (Query_cyclic_peek() != QUERY_CYCLIC_END_OF_FRAME)
+        {
+            get_timestamp(&now_ts, 0);
+            cyclic_ts_p = &now_ts;
+        }
+        if (next_ts_p == NULL || get_delay_from_now_us(cyclic_ts_p) < get_delay_from_now_us(next_ts_p))
+        {
+            next_ts_p = cyclic_ts_p;
+        }
+    }
+#endif
+    if (is_probe_gap_locked() && (next_ts_p == NULL || is_timestamp_before(&m_bus_free_ts, next_ts_p)))
+    {
+        // Next probe once the bus is idle, the following ones from
+        // Query_Scheduler_busReleased
+        next_ts_p = &m_bus_free_ts;
+    }
+    if (next_ts_p != NULL)
+    {
+        // Update periodic work according to next task
+        schedule_task(next_ts_p);
+    }
     m_force_reschedule = false;
 
     Sys_exitCriticalSection();
@@ -357,37 +1407,18 @@ static uint32_t periodic_work(void)
  * \brief   Add task to task table
  * \param   task_p
  *          task to add
+ * \param   query
+ *          Query of the task, for the cold part
  * \return  true if task was correctly added
  * \note    Must be called from critical section
  */
-static bool add_task_to_table_locked(task_t * task_p)
+static bool add_task_to_table_locked(task_t * task_p, const MODBUS_MASTER_QUERY * query)
 {
     bool res = false;
     task_t * first_free = NULL;
 
     // Under critical section to avoid writing the same task
     Sys_enterCriticalSection();
-    // Save modbus query to the memory.
-
-    if (!task_p->modbus_query.oneTime)
-    {
-        modbus_query_data_t query = {
-                .queryId = task_p->modbus_query.queryId,
-                .slaveId = task_p->modbus_query.u8id,
-                .deviceDetails = {task_p->modbus_query.deviceDetail.deviceId,task_p->modbus_query.deviceDetail.status,task_p->modbus_query.deviceDetail.attrId},
-                .functionCode = task_p->modbus_query.u8fct,
-                .startAddr = task_p->modbus_query.u16RegAdd,
-                .length = task_p->modbus_query.u16CoilsNo,
-                .interval = task_p->modbus_query.interval,
-                .oneTime = task_p->modbus_query.oneTime,
-                .isEnable = true,
-                //.dataType = task_p->modbus_query.dataType,
-                .writeOps = task_p->modbus_query.writeOps,
-                .dataLength = task_p->modbus_query.dataLength,
-        };
-        memcpy(&query.writeData, &task_p->modbus_query.writeData, task_p->modbus_query.dataLength);
-        Add_Modbus_query(query);
-    }
 
     for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++)
     {
@@ -395,10 +1426,21 @@ static bool add_task_to_table_locked(task_t * task_p)
         if (m_tasks[i].modbus_query.queryId == task_p->modbus_query.queryId)
         {
             // Task found, just update the next timestamp and exit
+            if (!set_task_payload_locked(i, query))
+            {
+                break;
+            }
+            m_set_changed |= !m_tasks[i].modbus_query.oneTime || !task_p->modbus_query.oneTime;
             m_tasks[i].modbus_query = task_p->modbus_query;
             m_tasks[i].next_ts = task_p->next_ts;
+            m_tasks[i].deadline_ts = task_p->deadline_ts;
+            m_tasks[i].lane = task_p->lane;
+            m_tasks[i].cost_us = task_p->cost_us;
+            m_tasks[i].stretch = STRETCH_UNIT;
+            m_tasks[i].uplink_held_ms = 0;
             m_tasks[i].updated = true;
             m_tasks[i].removed = false;
+            set_task_query(&m_tasks[i].modbus_query, &m_cold[i], query);
             res = true;
             break;
         }
@@ -410,11 +1452,15 @@ static bool add_task_to_table_locked(task_t * task_p)
         }
     }
 
-    if (!res && first_free != NULL)
+    if (!res && first_free != NULL
+        && set_task_payload_locked((uint8_t) (first_free - m_tasks), query))
     {
         memcpy(first_free, task_p, sizeof(task_t));
+        set_task_query(&first_free->modbus_query, &m_cold[first_free - m_tasks], query);
+        m_set_changed |= !task_p->modbus_query.oneTime;
         res = true;
     }
+    m_replan = true;
 
     Sys_exitCriticalSection();
     return res;
@@ -432,8 +1478,6 @@ static task_t * remove_task_from_table_locked(MODBUS_MASTER_QUERY query)
     task_t * removed_task = NULL;
 
     Sys_enterCriticalSection();
-    // Remove modbus query from memory.
-    Remove_Modbus_query(query.queryId);
 
     for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++)
     {
@@ -443,6 +1487,9 @@ static task_t * remove_task_from_table_locked(MODBUS_MASTER_QUERY query)
             m_tasks[i].updated = true;
             m_tasks[i].removed = true;
             removed_task = &m_tasks[i];
+            Query_stats_clear(i);
+            m_set_changed |= !m_tasks[i].modbus_query.oneTime;
+            m_replan = true;
             break;
         }
     }
@@ -463,31 +1510,19 @@ static void modbus_init() {
 
 static void query_task_init()
 {
-    modbus_query_data_t* modbusQueryData = Get_Modbus_settings();
-    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++)
-    {
-        if (modbusQueryData[i].queryId != 0xFF)
-        {
-            MODBUS_MASTER_QUERY masterQuery = {
-                    .queryId = modbusQueryData[i].queryId,
-                    .u8id = modbusQueryData[i].slaveId,
-                    .deviceDetail = {modbusQueryData[i].deviceDetails.deviceId,modbusQueryData[i].deviceDetails.status,modbusQueryData[i].deviceDetails.attrId},
-                    //.deviceDetail.deviceId = modbusQueryData[i].deviceDetails.deviceId,
-                    //.deviceDetail.attrId = modbusQueryData[i].deviceDetails.attrId,
-                    .u8fct = modbusQueryData[i].functionCode,
-                    .u16RegAdd = modbusQueryData[i].startAddr,
-                    .u16CoilsNo = modbusQueryData[i].length,
-                    .interval = modbusQueryData[i].interval,
-                    .oneTime = modbusQueryData[i].oneTime,
-                    //.dataType = modbusQueryData[i].dataType,
-                    .writeOps = modbusQueryData[i].writeOps,
-                    .dataLength = modbusQueryData[i].dataLength,
-
-            };
+    modbus_query_data_t record;
+    uint16_t cursor = 0;
 
-            memcpy(&masterQuery.writeData, &modbusQueryData[i].writeData, modbusQueryData[i].dataLength);
-            Query_Scheduler_addTask(masterQuery);
-        }
+    while (Read_Modbus_query(&cursor, &record))
+    {
+        MODBUS_MASTER_QUERY masterQuery;
+        Modbus_query_to_master(&record, &masterQuery);
+        add_task(masterQuery, false);
+    }
+    if (Modbus_query_upgrade_pending())
+    {
+        // Saved again in the current layout
+        Save_Modbus_queries();
     }
 }
 
@@ -508,41 +1543,80 @@ void Query_Scheduler_init()
     m_max_time_ms = lib_time->getMaxHpDelay() / 1000;
     m_next_task_p = NULL;
     m_force_reschedule = false;
+    get_timestamp(&m_bus_free_ts, 0);
     modbus_init();
     for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++)
     {
-        memset(&m_tasks[i].modbus_query, 0xFF, sizeof(MODBUS_MASTER_QUERY));
+        memset(&m_tasks[i].modbus_query, 0xFF, sizeof(query_hot_t));
+        m_cold[i].payload = NO_PAYLOAD;
+    }
+    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_WRITE_PAYLOADS; i++)
+    {
+        m_payloads[i].slot = NO_PAYLOAD;
     }
 
+    m_replan = true;
+#ifdef QUERY_SCHEDULER_CYCLIC
+    m_cyclic_active = false;
+#endif
     m_initialized = true;
     query_task_init();
 }
 
-query_scheduler_res_e Query_Scheduler_addTask(MODBUS_MASTER_QUERY query)
+/**
+ * \brief   Add a task, or update the one of the same query id
+ * \param   query
+ *          Query of the task
+ * \param   admit
+ *          Apply the admission ceiling and save the periodic query, false
+ *          for the queries already accepted (restored from the settings)
+ */
+static query_scheduler_res_e add_task(MODBUS_MASTER_QUERY query, bool admit)
 {
     task_t new_task = {
-            .modbus_query = query,
+            .stretch = STRETCH_UNIT,
             .updated = false,
             .removed = false,
     };
     //adjust_time_delay(&new_task);
+    set_task_query(&new_task.modbus_query, NULL, &query);
+    new_task.lane = get_lane(&new_task.modbus_query);
 
     query_scheduler_res_e res;
-    get_timestamp(&new_task.next_ts, (uint32_t) (query.interval * 1000));
+    modbus_admission_t admission = Get_Modbus_admission();
+    uint32_t load_ppm;
+    uint32_t delay_ms = query.intervalMs;
+    if (query.oneTime && query.writeOps
+        && (query.u8fct == MB_FC_WRITE_REGISTER || query.u8fct == MB_FC_WRITE_COIL))
+    {
+        // Held for the window, the writes following it go in the same frame
+        uint16_t window_ms = Get_Modbus_write_window();
+        delay_ms = (delay_ms < window_ms) ? window_ms : delay_ms;
+    }
+    get_timestamp(&new_task.next_ts, delay_ms);
+    set_deadline(&new_task, query.oneTime ? 0 : query.intervalMs);
 
     if (!m_initialized)
     {
         return QUERY_SCHEDULER_RES_UNINITIALIZED;
     }
+    new_task.cost_us = is_planned(&new_task) ? Query_cost_us(&new_task.modbus_query) : 0;
     Sys_enterCriticalSection();
-    if (!add_task_to_table_locked(&new_task))
+    load_ppm = get_admission_ppm_locked(&new_task);
+    if (admit && admission.mode == QUERY_ADMISSION_REJECT && load_ppm > (uint32_t) admission.ceiling * 1000)
+    {
+        res = QUERY_SCHEDULER_RES_OVERLOAD;
+    }
+    else if (!add_task_to_table_locked(&new_task, &query))
     {
         res = QUERY_SCHEDULER_RES_NO_MORE_TASK;
     }
     else
     {
+        m_utilisation_ppm = load_ppm;
         if (m_next_task_p == NULL
             || m_next_task_p->modbus_query.queryId == query.queryId
+            || new_task.lane < m_next_task_p->lane
             || is_timestamp_before(&new_task.next_ts, &m_next_task_p->next_ts))
         {
             m_force_reschedule = true;
@@ -551,12 +1625,36 @@ query_scheduler_res_e Query_Scheduler_addTask(MODBUS_MASTER_QUERY query)
         res = QUERY_SCHEDULER_RES_OK;
     }
     Sys_exitCriticalSection();
+
+    if (res == QUERY_SCHEDULER_RES_OK)
+    {
+        // Settings may have changed, next reply is a new baseline
+        Modbus_edge_reset(query.queryId);
+        // Probed in the gaps once it answered
+        Query_block_learn(query.u8id, query.u8fct, query.u16RegAdd);
+        if (admit && !query.oneTime && Save_Modbus_queries() != SETTINGS_OK)
+        {
+            // Runs until the next reboot
+            MODBUS_LOG_WARN(LOG_QUERY_NOT_SAVED, query.queryId, query.u8id);
+        }
+    }
+    else if (res == QUERY_SCHEDULER_RES_OVERLOAD)
+    {
+        uint32_t permille = load_ppm / 1000;
+        MODBUS_LOG_WARN(LOG_ADMISSION_REFUSED, query.queryId, (uint16_t) ((permille > UINT16_MAX) ? UINT16_MAX : permille));
+    }
     return res;
 }
 
+query_scheduler_res_e Query_Scheduler_addTask(MODBUS_MASTER_QUERY query)
+{
+    return add_task(query, true);
+}
+
 query_scheduler_res_e Query_Scheduler_cancelTask(MODBUS_MASTER_QUERY query)
 {
     query_scheduler_res_e res;
+    bool saved = false;
 
     if (!m_initialized)
     {
@@ -567,6 +1665,9 @@ query_scheduler_res_e Query_Scheduler_cancelTask(MODBUS_MASTER_QUERY query)
     task_t * removed_task = remove_task_from_table_locked(query);
     if (removed_task != NULL)
     {
+        saved = !removed_task->modbus_query.oneTime;
+        Modbus_edge_reset(query.queryId);
+        m_utilisation_ppm = get_utilisation_ppm_locked(0);
         // Force our task to be reschedule asap to do the cleanup of the task
         // and potentially change the next task to be schedule
         m_force_reschedule = true;
@@ -579,9 +1680,159 @@ query_scheduler_res_e Query_Scheduler_cancelTask(MODBUS_MASTER_QUERY query)
         res = QUERY_SCHEDULER_RES_UNKNOWN_TASK;
     }
     Sys_exitCriticalSection();
+
+    if (saved)
+    {
+        Save_Modbus_queries();
+    }
+    return res;
+}
+
+void Query_Scheduler_busReleased(uint32_t hold_us)
+{
+    uint32_t idle_ms = timeoutDelayTlv.delay + (hold_us + 999) / 1000;
+
+    if (!m_initialized)
+    {
+        return;
+    }
+    Sys_enterCriticalSection();
+    if (++m_transactions >= PLAN_REFRESH_TRANSACTIONS)
+    {
+        // Slave latencies measured meanwhile
+        m_transactions = 0;
+        m_replan = true;
+    }
+    get_timestamp(&m_bus_free_ts, idle_ms);
+    // A task may have been held back while the bus was busy
+    App_Scheduler_addTask_execTime(periodic_work, idle_ms, EXEC_TIME);
+    Sys_exitCriticalSection();
+}
+
+bool Query_Scheduler_startScan(const query_scan_request_t * request)
+{
+    if (!m_initialized || !Query_scan_start(request))
+    {
+        return false;
+    }
+    // First probe as soon as the bus is free
+    App_Scheduler_addTask_execTime(periodic_work, 0, EXEC_TIME);
+    return true;
+}
+
+bool Query_Scheduler_getPlan(uint8_t slot, query_scheduler_plan_t * plan)
+{
+    bool res = false;
+
+    if (!m_initialized || slot >= QUERY_SCHEDULER_MAX_TASKS)
+    {
+        return false;
+    }
+    Sys_enterCriticalSection();
+    if (is_planned(&m_tasks[slot]))
+    {
+        plan->queryId = m_tasks[slot].modbus_query.queryId;
+        plan->slaveId = m_tasks[slot].modbus_query.u8id;
+        plan->costUs = m_tasks[slot].cost_us;
+        plan->configuredMs = m_tasks[slot].modbus_query.intervalMs;
+        plan->plannedMs = get_planned_period_ms(&m_tasks[slot]);
+        res = true;
+    }
+    Sys_exitCriticalSection();
+    return res;
+}
+
+uint32_t Query_Scheduler_getUtilisation(void)
+{
+    return m_utilisation_ppm / 1000;
+}
+
+uint32_t Query_Scheduler_getAdmissionLoad(const MODBUS_MASTER_QUERY * query)
+{
+    task_t task = {
+            .removed = false,
+    };
+    uint32_t load_ppm;
+
+    set_task_query(&task.modbus_query, NULL, query);
+    task.cost_us = is_planned(&task) ? Query_cost_us(&task.modbus_query) : 0;
+    Sys_enterCriticalSection();
+    load_ppm = get_admission_ppm_locked(&task);
+    Sys_exitCriticalSection();
+    return load_ppm / 1000;
+}
+
+bool Query_Scheduler_getQuery(uint8_t slot, MODBUS_MASTER_QUERY * query)
+{
+    bool res = false;
+
+    if (!m_initialized || slot >= QUERY_SCHEDULER_MAX_TASKS)
+    {
+        return false;
+    }
+    Sys_enterCriticalSection();
+    if (m_tasks[slot].modbus_query.queryId != 0xFF && !m_tasks[slot].removed
+        && !m_tasks[slot].modbus_query.oneTime)
+    {
+        get_task_query(slot, query);
+        res = true;
+    }
+    Sys_exitCriticalSection();
     return res;
 }
 
+bool Query_Scheduler_isReportRepeated(uint8_t queryId, const uint8_t * data, uint8_t length)
+{
+    bool repeated = false;
+
+    if (length > MODBUS_TLV_DATA_SIZE)
+    {
+        length = MODBUS_TLV_DATA_SIZE;
+    }
+
+    Sys_enterCriticalSection();
+    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++)
+    {
+        if (m_tasks[i].modbus_query.queryId == queryId && !m_tasks[i].removed)
+        {
+            repeated = (m_cold[i].lastReportLength == length) && (memcmp(m_cold[i].lastReport, data, length) == 0);
+            memcpy(m_cold[i].lastReport, data, length);
+            m_cold[i].lastReportLength = length;
+            break;
+        }
+    }
+    Sys_exitCriticalSection();
+    return repeated;
+}
+
+bool Query_Scheduler_fanOutAck(const Modbus_TLV_Data_t * ack, uint8_t length)
+{
+    combined_write_t writes[QUERY_SCHEDULER_MAX_COMBINED_WRITES];
+    uint8_t count;
+
+    Sys_enterCriticalSection();
+    count = m_combined_count;
+    memcpy(writes, m_combined, count * sizeof(combined_write_t));
+    m_combined_count = 0;
+    Sys_exitCriticalSection();
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        Modbus_TLV_Data_t single = *ack;
+        // Echo of the single write: id, fct, address, value as 16 bit words
+        uint16_t echo[4] = {ack->slaveID, writes[i].u8fct, writes[i].u16RegAdd, writes[i].value};
+
+        single.detail.deviceId = writes[i].deviceDetail.deviceId;
+        single.detail.attrId = writes[i].deviceDetail.attrId;
+        if (length > offsetof(Modbus_TLV_Data_t, arrData))
+        {
+            memcpy(single.arrData, echo, (single.byte_No < sizeof(echo)) ? single.byte_No : sizeof(echo));
+        }
+        Uplink_budget_send((uint8_t *) &single, length, APP_ADDR_ANYSINK, MODBUS_TLV_EP, MODBUS_TLV_EP);
+    }
+    return count != 0;
+}
+
 ///**
 // * @brief
 // * This method removes the running task based on it's query number.
@@ -10,6 +10,7 @@
 #include "api.h"
 #include "../driver/modbus_lib.h"
 #include "../../iws_libraries/utils/iws.h"
+#include "query_scan.h"
 
 /**
  * \brief   Value to return from task to remove it
@@ -21,8 +22,149 @@
  */
 #define APP_SCHEDULER_SCHEDULE_ASAP (0)
 
+/**
+ * \brief   Size of the query table, build option query_max_tasks. An entry
+ *          takes about 110 bytes of RAM in the host build (task, cold part,
+ *          statistics), a plain read query 10 or 11 bytes of the 2400
+ *          bytes of query storage.
+ *          Slots are 8 bit with 0xFF for none, so the table is limited to
+ *          250 entries.
+ */
+#ifndef QUERY_SCHEDULER_MAX_TASKS
 #define QUERY_SCHEDULER_MAX_TASKS (60)
+#endif
+#if QUERY_SCHEDULER_MAX_TASKS > 250
+#error "QUERY_SCHEDULER_MAX_TASKS above 250"
+#endif
+
+/**
+ * \brief   Write queries at the same time, their data is kept apart from the
+ *          table
+ */
+#ifndef QUERY_SCHEDULER_MAX_WRITE_PAYLOADS
+#define QUERY_SCHEDULER_MAX_WRITE_PAYLOADS (16)
+#endif
+/**
+ * \brief   Size of the register image of the replies in registers, the
+ *          largest read query, build option query_max_registers
+ */
+#ifndef MODBUS_MAX_REGISTER_SIZE
 #define MODBUS_MAX_REGISTER_SIZE (56)
+#endif
+
+/**
+ * \brief   Query ids from this value are reserved for queries created on the node
+ *          itself (rule actions...). They are not accepted from the backend.
+ */
+#define QUERY_ID_INTERNAL_FIRST (0xE0)
+
+/**
+ * \brief   Longest write combining window (WRITE_COMBINING_ATTR_ID). One time
+ *          FC5/FC6 writes wait for it before they are sent, the pending ones
+ *          of a slave to adjacent targets go out in one FC15/FC16 frame.
+ */
+#define QUERY_WRITE_WINDOW_MAX_MS (1000)
+
+/**
+ * \brief   Writes in a combined frame, each one is acknowledged on its own
+ */
+#define QUERY_SCHEDULER_MAX_COMBINED_WRITES (16)
+
+/**
+ * \brief   Priority lanes. A due task of a lane is put on the line before
+ *          the due tasks of the following lanes, at the next bus idle point.
+ */
+typedef enum
+{
+    /** One time writes: operator commands and rule actions */
+    QUERY_LANE_URGENT = 0,
+    /** One time reads */
+    QUERY_LANE_ON_DEMAND = 1,
+    /** Periodic reads and writes */
+    QUERY_LANE_PERIODIC = 2,
+    QUERY_LANE_COUNT
+} query_lane_e;
+
+/**
+ * \brief   Priority of a periodic query. When the periodic load does not fit
+ *          on the bus, periods are stretched in proportion to the weight of
+ *          their priority: low ones four times as much as high ones.
+ *          Erased (0xFF) means normal.
+ */
+typedef enum
+{
+    QUERY_PRIORITY_HIGH = 0,
+    QUERY_PRIORITY_NORMAL = 1,
+    QUERY_PRIORITY_LOW = 2
+} query_priority_e;
+
+/**
+ * \brief   Query fields read on every scheduling pass, the hot part of a
+ *          query table entry. The device details, decoding and write payload
+ *          are in the cold part, read when the query is posted.
+ */
+typedef struct
+{
+    uint8_t queryId;        /* 0xFF when the entry is free */
+    uint8_t u8id;
+    uint8_t u8fct;
+    uint8_t priority;       /* query_priority_e */
+    uint16_t u16RegAdd;
+    uint16_t u16CoilsNo;
+    uint32_t intervalMs;
+    bool oneTime;
+    bool writeOps;
+} query_hot_t;
+
+/**
+ * \brief   Latency targets of the lanes, from the time a task is due to its
+ *          request on the line. Waits above the target are counted in the
+ *          lane counters (QUERY_STATS_ATTR_ID).
+ */
+#define QUERY_LANE_URGENT_TARGET_MS     (1500)  /* One transaction at the default timeout */
+#define QUERY_LANE_ON_DEMAND_TARGET_MS  (3000)
+#define QUERY_LANE_PERIODIC_TARGET_MS   (5000)
+
+/**
+ * \brief   What to do with a periodic query taking the bus load above the
+ *          admission ceiling (BUS_ADMISSION_ATTR_ID)
+ */
+typedef enum
+{
+    /** The query is refused */
+    QUERY_ADMISSION_REJECT = 0,
+    /** The query is accepted, the write response is flagged */
+    QUERY_ADMISSION_FLAG = 1
+} query_admission_mode_e;
+
+/**
+ * \brief   Default admission ceiling, in permille of the bus time. Above it
+ *          the periods are stretched anyway.
+ */
+#define QUERY_ADMISSION_DEFAULT_CEILING (950)
+
+/**
+ * \brief   Write response of MODBUS_SETTINGS_ATTR_ID, with the bus load of
+ *          the periodic queries for capacity planning
+ */
+typedef struct __attribute__ ((packed))
+{
+    write_attr_res_t writeAttr;
+    uint16_t utilisation;   /* Load in permille at the configured periods, the refused set included */
+    bool overCeiling;       /* Load above the admission ceiling */
+} write_attr_query_res_t;
+
+/**
+ * \brief   Planned period of a periodic query
+ */
+typedef struct
+{
+    uint8_t queryId;
+    uint8_t slaveId;
+    uint32_t costUs;        /* Bus time of one execution */
+    uint32_t configuredMs;
+    uint32_t plannedMs;     /* Above configuredMs when stretched on overload */
+} query_scheduler_plan_t;
 
 /**
  * \brief   List of return code
@@ -36,7 +178,9 @@ typedef enum
     /** Trying to cancel a task that doesn't exist */
     QUERY_SCHEDULER_RES_UNKNOWN_TASK = 2,
     /** Using the library without previous initialization */
-    QUERY_SCHEDULER_RES_UNINITIALIZED = 3
+    QUERY_SCHEDULER_RES_UNINITIALIZED = 3,
+    /** Refused, the bus load would be above the admission ceiling */
+    QUERY_SCHEDULER_RES_OVERLOAD = 4
 } query_scheduler_res_e;
 
 /**
@@ -99,6 +243,8 @@ void Query_Scheduler_init(void);
  * \param   exec_time_us
  *          Maximum execution time required for the task to be executed
  * \return  True if able to add, false otherwise
+ * \note    A periodic query taking the bus load above the admission ceiling
+ *          is refused with QUERY_SCHEDULER_RES_OVERLOAD in reject mode
  */
 query_scheduler_res_e Query_Scheduler_addTask(MODBUS_MASTER_QUERY query);
 
@@ -109,6 +255,90 @@ query_scheduler_res_e Query_Scheduler_addTask(MODBUS_MASTER_QUERY query);
  * \return  True if able to cancel, false otherwise (not existing)
  */
 query_scheduler_res_e Query_Scheduler_cancelTask(MODBUS_MASTER_QUERY query);
+
+/**
+ * \brief   Tell the scheduler that the transaction on the bus has ended
+ *          (reply, error or timeout). Next query is posted once the
+ *          configured bus idle time has elapsed.
+ * \param   hold_us
+ *          Extra silence before the next query, the frame time and
+ *          turnaround delay of a broadcast, 0 otherwise
+ * \note    Can be called from the UART interrupt
+ */
+void Query_Scheduler_busReleased(uint32_t hold_us);
+
+/**
+ * \brief   Start a bus scan. Its probes are posted in the gaps of the
+ *          queries: bus idle and no task due before the probe would end.
+ * \param   request
+ *          Range and probe, see query_scan_request_t
+ * \return  False if the request is not valid
+ */
+bool Query_Scheduler_startScan(const query_scan_request_t * request);
+
+/**
+ * \brief   Get the planned period of a task
+ * \param   slot
+ *          Index in the task table
+ * \param   plan
+ *          Filled when the slot holds a periodic task
+ * \return  True if the slot holds a periodic task
+ */
+bool Query_Scheduler_getPlan(uint8_t slot, query_scheduler_plan_t * plan);
+
+/**
+ * \brief   Bus utilisation of the periodic tasks at their configured
+ *          period, as of the last plan or change of the task table
+ * \return  Utilisation in permille, above 1000 when overloaded
+ */
+uint32_t Query_Scheduler_getUtilisation(void);
+
+/**
+ * \brief   Bus utilisation the periodic tasks would have with a query
+ *          added, or replacing the one of the same id
+ * \param   query
+ *          Query to evaluate, one time queries add no load
+ * \return  Utilisation in permille at the configured periods
+ */
+uint32_t Query_Scheduler_getAdmissionLoad(const MODBUS_MASTER_QUERY * query);
+
+/**
+ * \brief   Periodic query of a task table entry, the source of the saved
+ *          query settings
+ * \param   slot
+ *          Entry in the task table, 0 to QUERY_SCHEDULER_MAX_TASKS - 1
+ * \param   query
+ *          Filled with the query
+ * \return  False when the entry is free, removed or a one time query
+ */
+bool Query_Scheduler_getQuery(uint8_t slot, MODBUS_MASTER_QUERY * query);
+
+/**
+ * \brief   Check a reply payload against the last one reported for a
+ *          periodic query, and remember it
+ * \param   queryId
+ *          Query of the reply
+ * \param   data
+ *          Payload to report
+ * \param   length
+ *          Payload length
+ * \return  True when the payload is the same as the last reported one
+ * \note    The payload is kept in the cold part of the query
+ */
+bool Query_Scheduler_isReportRepeated(uint8_t queryId, const uint8_t * data, uint8_t length);
+
+/**
+ * \brief   Acknowledge the writes of a combined frame one by one
+ * \param   ack
+ *          TLV of the frame, status set
+ * \param   length
+ *          TLV length, the header alone or with the echo data
+ * \return  False when the frame in flight is not a combined one, the TLV is
+ *          to be sent as is
+ * \note    Each write gets the TLV with its own device details and, as data,
+ *          the echo its single FC5/FC6 frame would have had
+ */
+bool Query_Scheduler_fanOutAck(const Modbus_TLV_Data_t * ack, uint8_t length);
 // /**
 //  * Function to remove a query from m_tasks[] array.
 //  */
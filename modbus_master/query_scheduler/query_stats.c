@@ -0,0 +1,391 @@
+//
+// Created by Maverick on 18/10/26.
+//
+// Counters of the queries, stored by scheduler slot next to the task table, and of the slaves.
+//
+
+#include <stddef.h>
+#include <string.h>
+#include "query_scheduler.h"
+#include "query_stats.h"
+
+typedef struct
+{
+    query_stats_counters_t counters;    /* latencyAvg unused, computed from latencySum */
+    uint32_t latencySum;
+    uint16_t replies;                   /* Latencies summed */
+} counters_t;
+
+typedef struct
+{
+    uint8_t queryId;                    /* 0xFF when the slot has no counters */
+    uint8_t slaveId;
+    uint32_t configuredMs;
+    app_lib_time_timestamp_coarse_t firstPoll;
+    app_lib_time_timestamp_coarse_t lastPoll;
+    counters_t counters;
+} query_entry_t;
+
+typedef struct
+{
+    uint8_t slaveId;                    /* 0 when free */
+    counters_t counters;
+} slave_entry_t;
+
+typedef struct
+{
+    uint16_t served;
+    uint16_t overTarget;
+    uint16_t waitMinMs;
+    uint16_t waitMaxMs;
+    uint32_t waitSumMs;
+} lane_entry_t;
+
+static const uint16_t m_lane_targets_ms[QUERY_LANE_COUNT] = {
+        QUERY_LANE_URGENT_TARGET_MS,
+        QUERY_LANE_ON_DEMAND_TARGET_MS,
+        QUERY_LANE_PERIODIC_TARGET_MS,
+};
+
+static query_entry_t m_queries[QUERY_SCHEDULER_MAX_TASKS];
+static slave_entry_t m_slaves[QUERY_STATS_MAX_SLAVES];
+static lane_entry_t m_lanes[QUERY_LANE_COUNT];
+static bool m_initialized = false;
+
+/** Entries of the query on the line, NULL when none */
+static query_entry_t * m_current_query_p;
+static slave_entry_t * m_current_slave_p;
+
+static void init(void)
+{
+    memset(m_queries, 0, sizeof(m_queries));
+    memset(m_slaves, 0, sizeof(m_slaves));
+    memset(m_lanes, 0, sizeof(m_lanes));
+    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++)
+    {
+        m_queries[i].queryId = 0xFF;
+    }
+    m_initialized = true;
+}
+
+static slave_entry_t * get_slave(uint8_t slaveId)
+{
+    if (slaveId == MODBUS_BROADCAST_ADDRESS)
+    {
+        // No slave answers, 0 marks the free entries
+        return NULL;
+    }
+    for (uint8_t i = 0; i < QUERY_STATS_MAX_SLAVES; i++)
+    {
+        if (m_slaves[i].slaveId == slaveId)
+        {
+            return &m_slaves[i];
+        }
+        if (m_slaves[i].slaveId == 0)
+        {
+            m_slaves[i].slaveId = slaveId;
+            return &m_slaves[i];
+        }
+    }
+    return NULL;
+}
+
+static void count_result(counters_t * c, int8_t result, uint16_t latency)
+{
+    bool replied = true;
+
+    switch (result)
+    {
+        case ERR_OK:
+            c->counters.ok++;
+            break;
+        case NO_REPLY:
+        case ERR_TIME_OUT:
+            c->counters.timeouts++;
+            replied = false;
+            break;
+        case ERR_BAD_CRC:
+            c->counters.crcErrors++;
+            break;
+        case ERR_EXCEPTION:
+        case EXC_FUNC_CODE:
+            // An exception reply fails the function code check as well
+            c->counters.exceptions++;
+            break;
+        case ERR_BAD_SIZE:
+            c->counters.badSizes++;
+            break;
+        default:
+            c->counters.otherErrors++;
+            replied = false;
+            break;
+    }
+
+    if (replied)
+    {
+        if (c->replies == 0 || latency < c->counters.latencyMin)
+        {
+            c->counters.latencyMin = latency;
+        }
+        if (latency > c->counters.latencyMax)
+        {
+            c->counters.latencyMax = latency;
+        }
+        if (c->replies == UINT16_MAX)
+        {
+            // Keep the average when the count saturates
+            c->latencySum /= 2;
+            c->replies /= 2;
+        }
+        c->latencySum += latency;
+        c->replies++;
+    }
+}
+
+static void get_counters(const counters_t * c, query_stats_counters_t * out)
+{
+    *out = c->counters;
+    out->latencyAvg = c->replies ? (uint16_t) (c->latencySum / c->replies) : 0;
+}
+
+void Query_stats_poll(uint8_t slot, const query_hot_t * query, uint32_t configuredMs)
+{
+    query_entry_t * entry;
+    app_lib_time_timestamp_coarse_t now = lib_time->getTimestampCoarse();
+
+    if (!m_initialized)
+    {
+        init();
+    }
+    if (slot >= QUERY_SCHEDULER_MAX_TASKS)
+    {
+        return;
+    }
+
+    entry = &m_queries[slot];
+    if (entry->queryId != query->queryId || entry->slaveId != query->u8id)
+    {
+        // Slot reused by another query
+        memset(entry, 0, sizeof(query_entry_t));
+        entry->queryId = query->queryId;
+        entry->slaveId = query->u8id;
+        entry->firstPoll = now;
+    }
+    entry->configuredMs = configuredMs;
+    entry->lastPoll = now;
+    entry->counters.counters.polls++;
+
+    m_current_query_p = entry;
+    m_current_slave_p = get_slave(query->u8id);
+    if (m_current_slave_p != NULL)
+    {
+        m_current_slave_p->counters.counters.polls++;
+    }
+}
+
+void Query_stats_lane(uint8_t lane, uint32_t waitUs)
+{
+    uint32_t ms = waitUs / 1000;
+    uint16_t wait = (ms > 0xFFFF) ? 0xFFFF : (uint16_t) ms;
+    lane_entry_t * entry;
+
+    if (!m_initialized)
+    {
+        init();
+    }
+    if (lane >= QUERY_LANE_COUNT)
+    {
+        return;
+    }
+
+    entry = &m_lanes[lane];
+    if (entry->served == 0 || wait < entry->waitMinMs)
+    {
+        entry->waitMinMs = wait;
+    }
+    if (wait > entry->waitMaxMs)
+    {
+        entry->waitMaxMs = wait;
+    }
+    if (wait > m_lane_targets_ms[lane])
+    {
+        entry->overTarget++;
+    }
+    entry->waitSumMs += wait;
+    entry->served++;
+}
+
+void Query_stats_result(int8_t result, uint32_t latencyUs)
+{
+    uint32_t units = latencyUs / QUERY_STATS_LATENCY_UNIT_US;
+    uint16_t latency = (units > 0xFFFF) ? 0xFFFF : (uint16_t) units;
+
+    if (m_current_query_p != NULL)
+    {
+        count_result(&m_current_query_p->counters, result, latency);
+        m_current_query_p = NULL;
+    }
+    if (m_current_slave_p != NULL)
+    {
+        count_result(&m_current_slave_p->counters, result, latency);
+        m_current_slave_p = NULL;
+    }
+}
+
+bool Query_stats_get_slave_latency(uint8_t slaveId, uint32_t * latencyUs, uint16_t * timeoutPermille)
+{
+    if (!m_initialized)
+    {
+        return false;
+    }
+    for (uint8_t i = 0; i < QUERY_STATS_MAX_SLAVES && m_slaves[i].slaveId != 0; i++)
+    {
+        const counters_t * c = &m_slaves[i].counters;
+        if (m_slaves[i].slaveId != slaveId)
+        {
+            continue;
+        }
+        if (c->replies == 0)
+        {
+            return false;
+        }
+        *latencyUs = (c->latencySum / c->replies) * QUERY_STATS_LATENCY_UNIT_US;
+        // Counters wrap independently, no ratio then
+        *timeoutPermille = (c->counters.polls == 0 || c->counters.timeouts > c->counters.polls)
+                ? 0
+                : (uint16_t) ((uint32_t) c->counters.timeouts * 1000 / c->counters.polls);
+        return true;
+    }
+    return false;
+}
+
+void Query_stats_clear(uint8_t slot)
+{
+    if (!m_initialized || slot >= QUERY_SCHEDULER_MAX_TASKS)
+    {
+        return;
+    }
+    if (m_current_query_p == &m_queries[slot])
+    {
+        m_current_query_p = NULL;
+    }
+    memset(&m_queries[slot], 0, sizeof(query_entry_t));
+    m_queries[slot].queryId = 0xFF;
+}
+
+uint8_t Query_stats_read_page(uint8_t kind, uint8_t page, read_attr_query_stats_t * response)
+{
+    uint8_t perPage = QUERY_STATS_QUERIES_PER_PAGE;
+    uint8_t recordSize = sizeof(query_stats_query_t);
+    uint16_t first;
+    uint16_t available = 0;
+
+    if (!m_initialized)
+    {
+        init();
+    }
+
+    if (kind == QUERY_STATS_SLAVES)
+    {
+        perPage = QUERY_STATS_SLAVES_PER_PAGE;
+        recordSize = sizeof(query_stats_slave_t);
+    }
+    else if (kind == QUERY_STATS_LANES)
+    {
+        perPage = QUERY_STATS_LANES_PER_PAGE;
+        recordSize = sizeof(query_stats_lane_t);
+    }
+    else if (kind == QUERY_STATS_DEGRADED)
+    {
+        perPage = QUERY_STATS_PLANS_PER_PAGE;
+        recordSize = sizeof(query_stats_plan_t);
+    }
+
+    first = (uint16_t) page * perPage;
+    response->kind = kind;
+    response->page = page;
+    response->count = 0;
+
+    // Records are listed in table order, free entries skipped
+    Sys_enterCriticalSection();
+    if (kind == QUERY_STATS_SLAVES)
+    {
+        for (uint8_t i = 0; i < QUERY_STATS_MAX_SLAVES && m_slaves[i].slaveId != 0; i++, available++)
+        {
+            if (available >= first && response->count < perPage)
+            {
+                query_stats_slave_t * record = &response->slaves[response->count++];
+                record->slaveId = m_slaves[i].slaveId;
+                get_counters(&m_slaves[i].counters, &record->counters);
+            }
+        }
+    }
+    else if (kind == QUERY_STATS_LANES)
+    {
+        for (uint8_t i = 0; i < QUERY_LANE_COUNT; i++, available++)
+        {
+            if (available >= first && response->count < perPage)
+            {
+                query_stats_lane_t * record = &response->lanes[response->count++];
+                const lane_entry_t * entry = &m_lanes[i];
+                record->lane = i;
+                record->served = entry->served;
+                record->overTarget = entry->overTarget;
+                record->targetMs = m_lane_targets_ms[i];
+                record->waitMinMs = entry->waitMinMs;
+                record->waitAvgMs = entry->served ? (uint16_t) (entry->waitSumMs / entry->served) : 0;
+                record->waitMaxMs = entry->waitMaxMs;
+            }
+        }
+    }
+    else if (kind == QUERY_STATS_DEGRADED)
+    {
+        for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++)
+        {
+            query_scheduler_plan_t plan;
+            if (!Query_Scheduler_getPlan(i, &plan) || plan.plannedMs == plan.configuredMs)
+            {
+                continue;
+            }
+            if (available >= first && response->count < perPage)
+            {
+                query_stats_plan_t * record = &response->plans[response->count++];
+                uint32_t cost = plan.costUs / QUERY_STATS_LATENCY_UNIT_US;
+                record->queryId = plan.queryId;
+                record->slaveId = plan.slaveId;
+                record->cost = (cost > 0xFFFF) ? 0xFFFF : (uint16_t) cost;
+                record->configuredMs = plan.configuredMs;
+                record->plannedMs = plan.plannedMs;
+            }
+            available++;
+        }
+    }
+    else
+    {
+        for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++)
+        {
+            const query_entry_t * entry = &m_queries[i];
+            if (entry->queryId == 0xFF)
+            {
+                continue;
+            }
+            if (available >= first && response->count < perPage)
+            {
+                query_stats_query_t * record = &response->queries[response->count++];
+                uint16_t polls = entry->counters.counters.polls;
+                record->queryId = entry->queryId;
+                record->slaveId = entry->slaveId;
+                get_counters(&entry->counters, &record->counters);
+                record->configuredMs = entry->configuredMs;
+                record->achievedMs = (polls > 1)
+                        ? (uint32_t) (((uint64_t) (entry->lastPoll - entry->firstPoll) * 1000) / 128 / (polls - 1))
+                        : 0;
+            }
+            available++;
+        }
+    }
+    Sys_exitCriticalSection();
+
+    response->pages = (uint8_t) ((available + perPage - 1) / perPage);
+    return (uint8_t) (offsetof(read_attr_query_stats_t, queries) + response->count * recordSize);
+}
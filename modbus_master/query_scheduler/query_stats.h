@@ -0,0 +1,174 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#ifndef QUERY_STATS_H
+#define QUERY_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "api.h"
+#include "../../iws_libraries/utils/iws.h"
+#include "query_scheduler.h"
+
+/**
+ * \brief   Slaves tracked, the following ones are not counted
+ */
+#define QUERY_STATS_MAX_SLAVES (16)
+
+/**
+ * \brief   Unit of the latencies, from the request on the line to the reply processed
+ */
+#define QUERY_STATS_LATENCY_UNIT_US (100)
+
+/**
+ * \brief   Records per read attribute response
+ */
+#define QUERY_STATS_QUERIES_PER_PAGE (3)
+#define QUERY_STATS_SLAVES_PER_PAGE (4)
+#define QUERY_STATS_LANES_PER_PAGE (3)
+#define QUERY_STATS_PLANS_PER_PAGE (6)
+
+/**
+ * \brief   What a QUERY_STATS_ATTR_ID read returns
+ */
+typedef enum
+{
+    QUERY_STATS_QUERIES = 0,
+    QUERY_STATS_SLAVES = 1,
+    QUERY_STATS_LANES = 2,
+    QUERY_STATS_DEGRADED = 3    /* Periodic queries stretched on an overloaded bus */
+} query_stats_kind_e;
+
+/**
+ * \brief   Counters of a query or a slave since boot or since the query was added
+ */
+typedef struct __attribute__ ((packed))
+{
+    uint16_t polls;         /* Queries put on the line */
+    uint16_t ok;
+    uint16_t timeouts;      /* No reply or incomplete reply */
+    uint16_t crcErrors;
+    uint16_t exceptions;    /* Exception replies */
+    uint16_t badSizes;      /* Replies shorter than a valid frame */
+    uint16_t otherErrors;   /* Query refused by the driver */
+    uint16_t latencyMin;    /* In QUERY_STATS_LATENCY_UNIT_US, replies only */
+    uint16_t latencyAvg;
+    uint16_t latencyMax;
+} query_stats_counters_t;
+
+typedef struct __attribute__ ((packed))
+{
+    uint8_t queryId;
+    uint8_t slaveId;
+    query_stats_counters_t counters;
+    uint32_t configuredMs;  /* Interval of the query, 0 for one time queries */
+    uint32_t achievedMs;    /* Average time between two polls, 0 before the second one */
+} query_stats_query_t;
+
+typedef struct __attribute__ ((packed))
+{
+    uint8_t slaveId;
+    query_stats_counters_t counters;
+} query_stats_slave_t;
+
+/**
+ * \brief   Wait of the tasks of a priority lane, from due to request on the line
+ */
+typedef struct __attribute__ ((packed))
+{
+    uint8_t lane;           /* query_lane_e */
+    uint16_t served;        /* Tasks put on the line */
+    uint16_t overTarget;    /* Waits longer than targetMs */
+    uint16_t targetMs;
+    uint16_t waitMinMs;
+    uint16_t waitAvgMs;
+    uint16_t waitMaxMs;
+} query_stats_lane_t;
+
+/**
+ * \brief   Periodic query whose period is stretched
+ */
+typedef struct __attribute__ ((packed))
+{
+    uint8_t queryId;
+    uint8_t slaveId;
+    uint16_t cost;          /* Bus time of one execution in QUERY_STATS_LATENCY_UNIT_US */
+    uint32_t configuredMs;
+    uint32_t plannedMs;
+} query_stats_plan_t;
+
+typedef struct __attribute__ ((packed))
+{
+    read_attr_res_t readAttr;
+    uint8_t kind;           /* query_stats_kind_e */
+    uint8_t page;
+    uint8_t pages;          /* Pages available */
+    uint8_t count;          /* Records in this page */
+    union {
+        query_stats_query_t queries[QUERY_STATS_QUERIES_PER_PAGE];
+        query_stats_slave_t slaves[QUERY_STATS_SLAVES_PER_PAGE];
+        query_stats_lane_t lanes[QUERY_STATS_LANES_PER_PAGE];
+        query_stats_plan_t plans[QUERY_STATS_PLANS_PER_PAGE];
+    };
+} read_attr_query_stats_t;
+
+/**
+ * \brief   A query of the scheduler table went on the line
+ * \param   slot
+ *          Index of the task in the scheduler table
+ * \param   query
+ *          The query
+ * \param   configuredMs
+ *          Interval of the query, 0 for one time queries
+ */
+void Query_stats_poll(uint8_t slot, const query_hot_t * query, uint32_t configuredMs);
+
+/**
+ * \brief   A task of a priority lane went on the line
+ * \param   lane
+ *          query_lane_e of the task
+ * \param   waitUs
+ *          Time from the task being due to its request
+ */
+void Query_stats_lane(uint8_t lane, uint32_t waitUs);
+
+/**
+ * \brief   Outcome of the last query polled, called by the driver
+ * \param   result
+ *          i8lastError of the driver
+ * \param   latencyUs
+ *          From the request on the line to the reply processed
+ */
+void Query_stats_result(int8_t result, uint32_t latencyUs);
+
+/**
+ * \brief   Average latency measured for a slave
+ * \param   slaveId
+ *          Slave address
+ * \param   latencyUs
+ *          Average latency of the replies, from the request on the line to the reply processed
+ * \param   timeoutPermille
+ *          Share of the requests to the slave left without reply
+ * \return  False if no reply was received from the slave yet
+ */
+bool Query_stats_get_slave_latency(uint8_t slaveId, uint32_t * latencyUs, uint16_t * timeoutPermille);
+
+/**
+ * \brief   Forgets the counters of a slot, when its query is removed
+ */
+void Query_stats_clear(uint8_t slot);
+
+/**
+ * \brief   Fills a page of the QUERY_STATS_ATTR_ID read response
+ * \param   kind
+ *          query_stats_kind_e
+ * \param   page
+ *          Page requested
+ * \param   response
+ *          Response to fill, readAttr excepted
+ * \return  Bytes of response to send
+ */
+uint8_t Query_stats_read_page(uint8_t kind, uint8_t page, read_attr_query_stats_t * response);
+
+#endif //QUERY_STATS_H
@@ -0,0 +1,126 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#include <string.h>
+#include "rule_engine.h"
+#include "api.h"
+#include "../config/config.h"
+#include "../driver/modbus_lib.h"
+#include "../query_scheduler/query_scheduler.h"
+
+/** Rules whose condition is currently true, by slot. Writes are only
+ *  triggered when the condition becomes true */
+static uint32_t m_active;
+
+static bool condition_is_true(const modbus_rule_t * rule, uint16_t raw, bool active)
+{
+    int32_t value = (rule->op & RULE_OP_SIGNED) ? (int16_t) raw : raw;
+    int32_t threshold = (rule->op & RULE_OP_SIGNED) ? (int16_t) rule->threshold : rule->threshold;
+
+    switch (rule->op & ~RULE_OP_SIGNED)
+    {
+        case RULE_OP_GT:
+            // Once active, stay active until below the hysteresis band
+            return active ? (value > threshold - rule->hysteresis) : (value > threshold);
+        case RULE_OP_LT:
+            return active ? (value < threshold + rule->hysteresis) : (value < threshold);
+        case RULE_OP_EQ:
+            return value == threshold;
+        case RULE_OP_NE:
+            return value != threshold;
+        default:
+            return false;
+    }
+}
+
+static void queue_action(uint8_t slot, const modbus_rule_t * rule)
+{
+    MODBUS_MASTER_QUERY query;
+
+    memset(&query, 0, sizeof(query));
+    query.queryId = RULE_QUERY_ID_FIRST + slot;
+    query.u8id = rule->slaveId;
+    // The write acknowledge tells the backend which rule fired
+    query.deviceDetail.deviceId = rule->ruleId;
+    query.deviceDetail.attrId = MODBUS_RULES_ATTR_ID;
+    query.u8fct = rule->functionCode;
+    query.u16RegAdd = rule->regAddr;
+    query.u16CoilsNo = (rule->functionCode == MB_FC_WRITE_MULTIPLE_REGISTERS) ? rule->count : 1;
+    query.intervalMs = 0;
+    query.oneTime = true;
+    query.writeOps = true;
+    query.dataLength = (uint8_t) (query.u16CoilsNo * sizeof(uint16_t));
+    memcpy(query.writeData, rule->value, query.dataLength);
+    memset(&query.decode, 0xFF, sizeof(query.decode));
+    query.registerMask = 0xFFFFFFFF;
+    query.debounce = 0xFF;
+    query.priority = QUERY_PRIORITY_HIGH;
+
+    Query_Scheduler_addTask(query);
+}
+
+bool Rule_engine_is_valid(const modbus_rule_t * rule)
+{
+    uint8_t op = rule->op & ~RULE_OP_SIGNED;
+
+    if (rule->ruleId == 0xFF || op < RULE_OP_GT || op > RULE_OP_NE)
+    {
+        return false;
+    }
+    if (rule->slaveId == 0 || rule->slaveId > 247)
+    {
+        return false;
+    }
+    if (rule->functionCode == MB_FC_WRITE_MULTIPLE_REGISTERS)
+    {
+        return rule->count == 1 || rule->count == 2;
+    }
+    return rule->functionCode == MB_FC_WRITE_COIL || rule->functionCode == MB_FC_WRITE_REGISTER;
+}
+
+void Rule_engine_evaluate(uint8_t queryId, uint8_t fct, const uint16_t * regs, uint16_t count)
+{
+    modbus_rule_t * rules = Get_Modbus_rules();
+    bool isBit = (fct == MB_FC_READ_COILS) || (fct == MB_FC_READ_DISCRETE_INPUT);
+
+    for (uint8_t i = 0; i < MODBUS_MAX_RULES; i++)
+    {
+        const modbus_rule_t * rule = &rules[i];
+        if (rule->ruleId == 0xFF || rule->queryId != queryId || rule->regIndex >= count)
+        {
+            continue;
+        }
+
+        uint16_t raw = isBit ? ((regs[rule->regIndex / 16] >> (rule->regIndex % 16)) & 1)
+                             : regs[rule->regIndex];
+        bool active = (m_active & (1UL << i)) != 0;
+        bool now = condition_is_true(rule, raw, active);
+
+        if (now && !active)
+        {
+            queue_action(i, rule);
+        }
+        if (now)
+        {
+            m_active |= (1UL << i);
+        }
+        else
+        {
+            m_active &= ~(1UL << i);
+        }
+    }
+}
+
+void Rule_engine_reset(uint8_t ruleId)
+{
+    modbus_rule_t * rules = Get_Modbus_rules();
+
+    for (uint8_t i = 0; i < MODBUS_MAX_RULES; i++)
+    {
+        if (rules[i].ruleId == ruleId)
+        {
+            m_active &= ~(1UL << i);
+        }
+    }
+}
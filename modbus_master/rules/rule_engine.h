@@ -0,0 +1,47 @@
+//
+// Created by Maverick on 18/10/26.
+//
+
+#ifndef RULE_ENGINE_H
+#define RULE_ENGINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../settings/modbus_settings/modbus_settings.h"
+
+/**
+ * \brief   Query ids used for the writes triggered by rules (one per rule slot)
+ */
+#define RULE_QUERY_ID_FIRST     (QUERY_ID_INTERNAL_FIRST)
+
+/**
+ * \brief   Checks that a rule received from the backend can be executed
+ * \param   rule
+ *          Rule to check
+ * \return  True if the rule is valid
+ */
+bool Rule_engine_is_valid(const modbus_rule_t * rule);
+
+/**
+ * \brief   Evaluates the rules attached to a query on a fresh reply
+ *          and queues the write of the rules whose condition became true.
+ * \param   queryId
+ *          Query that was answered
+ * \param   fct
+ *          Function code of the query
+ * \param   regs
+ *          Registers (FC3/FC4) or packed inputs (FC1/FC2) of the reply
+ * \param   count
+ *          Number of registers or inputs in the reply
+ * \note    Called from the modbus driver right after the reply is decoded
+ */
+void Rule_engine_evaluate(uint8_t queryId, uint8_t fct, const uint16_t * regs, uint16_t count);
+
+/**
+ * \brief   Forgets the condition state of a rule, after it was changed
+ * \param   ruleId
+ *          Rule to reset
+ */
+void Rule_engine_reset(uint8_t ruleId);
+
+#endif //RULE_ENGINE_H
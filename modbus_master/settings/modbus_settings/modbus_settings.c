@@ -8,95 +8,413 @@
 #include "../../../iws_libraries/storage/iws_storage.h"
 #include "app_scheduler.h"
 #include "../../../iws_libraries/utils/iws_defines.h"
+#include "../../config/config.h"
 #include <string.h>
 #include <stdio.h>
 
-// Todo: Improve on the storage and read methods. Currently we are having duplicity in both scheduler and here.
-// Todo: Ideally we should have one array and store the same in the memory. Currently there are two arrays.
-// Todo: This c file needs to be re-written to take care of that aspect. And we should have one array in query_scheduler
-// Todo: which stores the modbus query with their schedules.
+/*
+ * Layout 2 query record, variable length. The fixed fields are followed by the
+ * optional ones present in flags, in the order of the flags. Erased (0xFF)
+ * fields of the query record are left out. A plain read query takes 10 or 11
+ * bytes, instead of 40 in the fixed size query and extension records.
+ *
+ *  size  queryId  slaveId  functionCode  flags  startAddr(2)  length
+ *  interval (7 bits per byte, low bits first, bit 7 set when more follow)
+ *  deviceId  [status  attrId(2)]  [decode]  [registerMask(4)]  [debounce]
+ *  [priority]  [dataLength  writeData]
+ */
+#define QUERY_RECORD_INTERVAL_MS    0x01 // interval in ms, in seconds otherwise.
+#define QUERY_RECORD_DEVICE         0x02 // device status and attribute, 0 and MODBUS_TLV_ATTR_ID otherwise.
+#define QUERY_RECORD_DECODE         0x04
+#define QUERY_RECORD_MASK           0x08
+#define QUERY_RECORD_DEBOUNCE       0x10
+#define QUERY_RECORD_PRIORITY       0x20
+#define QUERY_RECORD_WRITE          0x40 // write query, with its data.
+#define QUERY_RECORD_MIN_SIZE       10
+#define QUERY_RECORD_MAX_SIZE       (QUERY_RECORD_MIN_SIZE + 2 + 3 + sizeof(modbus_decode_t) + 4 + 1 + 1 + 1 \
+                                     + MAX_WRITE_DATA_BUFFER)
 
-static modbus_query_data_t modbus_query_list[QUERY_SCHEDULER_MAX_TASKS];
-write_configure_t configuration;
-static settings_e Save_Modbus_settings(void) {
+/*
+ * The records follow each other in the extension area, then in the query area.
+ * The rest of an area is erased. Extension area first: a node downgraded to a
+ * layout 1 firmware with up to ~90 queries finds an erased query area instead
+ * of records it can't read.
+ */
+static const struct {
+    uint16_t start;
+    uint16_t size;
+} query_areas[] = {
+        {MODBUS_QUERY_EXT_STORAGE_START, MODBUS_QUERY_EXT_AREA_SIZE},
+        {MODBUS_SETTINGS_STORAGE_START_ADD, MODBUS_QUERY_STORAGE_SIZE},
+};
+#define QUERY_AREAS (sizeof(query_areas) / sizeof(query_areas[0]))
 
-    iws_storage_res_e res;
-    uint8_t buffer[MODBUS_QUERY_STORAGE_SIZE] = {'\0'};
+static modbus_rule_t modbus_rule_list[MODBUS_MAX_RULES];
+static modbus_admission_t modbus_admission;
+static uint16_t modbus_write_window;
+static modbus_block_limit_t modbus_block_limits[MODBUS_MAX_BLOCK_LIMITS];
+static modbus_uplink_budget_t modbus_uplink_budget;
+static uint8_t query_layout;
+write_configure_t configuration;
 
-    uint16_t idx = 0;
-    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++) {
-        if (idx < MODBUS_QUERY_STORAGE_SIZE) {
-            memcpy(&buffer[idx], &modbus_query_list[i], sizeof(modbus_query_data_t));
+static bool Is_erased(const void *field, uint8_t size) {
+    const uint8_t *bytes = field;
+    for (uint8_t i = 0; i < size; i++) {
+        if (bytes[i] != 0xFF) {
+            return false;
         }
-        idx = idx + sizeof(modbus_query_data_t);
     }
+    return true;
+}
 
-    res = Iws_storage_write(buffer, MODBUS_SETTINGS_STORAGE_START_ADD, MODBUS_QUERY_STORAGE_SIZE);
+static uint8_t Encode_Modbus_query(const modbus_query_data_t *query, uint8_t *record) {
+    uint8_t size = 8;
+    uint8_t flags = 0;
+    uint16_t interval = query->interval;
 
-    if (res != IWS_STORAGE_RES_OK) {
-        return SETTINGS_SAVE_ERROR;
+    record[1] = query->queryId;
+    record[2] = query->slaveId;
+    record[3] = query->functionCode;
+    record[5] = (uint8_t) query->startAddr;
+    record[6] = (uint8_t) (query->startAddr >> 8);
+    record[7] = query->length;
+    if (query->ext.intervalUnit == MODBUS_INTERVAL_UNIT_MS) {
+        flags |= QUERY_RECORD_INTERVAL_MS;
     }
-    return SETTINGS_OK;
+    do {
+        record[size] = interval & 0x7F;
+        interval >>= 7;
+        if (interval != 0) {
+            record[size] |= 0x80;
+        }
+        size++;
+    } while (interval != 0);
+    record[size++] = query->deviceDetails.deviceId;
+    if (query->deviceDetails.status != 0 || query->deviceDetails.attrId != MODBUS_TLV_ATTR_ID) {
+        flags |= QUERY_RECORD_DEVICE;
+        record[size++] = (uint8_t) query->deviceDetails.status;
+        memcpy(&record[size], &query->deviceDetails.attrId, 2);
+        size += 2;
+    }
+    if (!Is_erased(&query->ext.decode, sizeof(modbus_decode_t))) {
+        flags |= QUERY_RECORD_DECODE;
+        memcpy(&record[size], &query->ext.decode, sizeof(modbus_decode_t));
+        size += sizeof(modbus_decode_t);
+    }
+    if (query->ext.registerMask != 0xFFFFFFFF) {
+        flags |= QUERY_RECORD_MASK;
+        memcpy(&record[size], &query->ext.registerMask, 4);
+        size += 4;
+    }
+    if (query->ext.debounce != 0xFF) {
+        flags |= QUERY_RECORD_DEBOUNCE;
+        record[size++] = query->ext.debounce;
+    }
+    if (query->ext.priority != 0xFF) {
+        flags |= QUERY_RECORD_PRIORITY;
+        record[size++] = query->ext.priority;
+    }
+    if (query->writeOps) {
+        uint8_t length = (query->dataLength > MAX_WRITE_DATA_BUFFER) ? MAX_WRITE_DATA_BUFFER : query->dataLength;
+        flags |= QUERY_RECORD_WRITE;
+        record[size++] = length;
+        memcpy(&record[size], query->writeData, length);
+        size += length;
+    }
+    record[0] = size;
+    record[4] = flags;
+    return size;
 }
 
-static settings_e Read_Modbus_settings() {
-    iws_storage_res_e res;
-    uint8_t buffer[MODBUS_QUERY_STORAGE_SIZE] = {'\0'};
+static bool Decode_Modbus_query(const uint8_t *record, modbus_query_data_t *query) {
+    uint8_t size = record[0];
+    uint8_t flags = record[4];
+    uint8_t idx = 8;
+    uint8_t shift = 0;
+    uint32_t interval = 0;
 
-    res = Iws_storage_read(buffer, MODBUS_SETTINGS_STORAGE_START_ADD, MODBUS_QUERY_STORAGE_SIZE);
-
-    if (res != IWS_STORAGE_RES_OK) {
-        return SETTINGS_READ_ERROR;
+    memset(query, 0xFF, sizeof(modbus_query_data_t));
+    query->queryId = record[1];
+    query->slaveId = record[2];
+    query->functionCode = record[3];
+    query->startAddr = (uint16_t) (record[5] | (record[6] << 8));
+    query->length = record[7];
+    query->oneTime = false;
+    query->isEnable = true;
+    query->writeOps = (flags & QUERY_RECORD_WRITE) != 0;
+    query->dataLength = 0;
+    do {
+        if (idx >= size || shift > 14) {
+            return false;
+        }
+        interval |= (uint32_t) (record[idx] & 0x7F) << shift;
+        shift += 7;
+    } while (record[idx++] & 0x80);
+    query->interval = (uint16_t) interval;
+    query->ext.intervalUnit = (flags & QUERY_RECORD_INTERVAL_MS) ? MODBUS_INTERVAL_UNIT_MS : MODBUS_INTERVAL_UNIT_S;
+    query->deviceDetails.deviceId = record[idx++];
+    query->deviceDetails.status = 0;
+    query->deviceDetails.attrId = MODBUS_TLV_ATTR_ID;
+    if (flags & QUERY_RECORD_DEVICE) {
+        query->deviceDetails.status = (int8_t) record[idx++];
+        memcpy(&query->deviceDetails.attrId, &record[idx], 2);
+        idx += 2;
     }
+    if (flags & QUERY_RECORD_DECODE) {
+        memcpy(&query->ext.decode, &record[idx], sizeof(modbus_decode_t));
+        idx += sizeof(modbus_decode_t);
+    }
+    if (flags & QUERY_RECORD_MASK) {
+        memcpy(&query->ext.registerMask, &record[idx], 4);
+        idx += 4;
+    }
+    if (flags & QUERY_RECORD_DEBOUNCE) {
+        query->ext.debounce = record[idx++];
+    }
+    if (flags & QUERY_RECORD_PRIORITY) {
+        query->ext.priority = record[idx++];
+    }
+    if (flags & QUERY_RECORD_WRITE) {
+        if (idx >= size || record[idx] > MAX_WRITE_DATA_BUFFER) {
+            return false;
+        }
+        query->dataLength = record[idx++];
+        memcpy(query->writeData, &record[idx], query->dataLength);
+        idx += query->dataLength;
+    }
+    if (query->slaveId > 247 || !MODBUS_FC_SUPPORTED(query->functionCode) || query->interval == 0) {
+        return false;
+    }
+    if (query_layout == MODBUS_SETTINGS_LAYOUT_MIGRATING) {
+        // An interrupted migration may have left records of the previous layout
+        return idx == size;
+    }
+    // Fields added after the record was written are ignored
+    return idx <= size;
+}
+
+/**
+ * Next periodic query of the scheduler table from slot, encoded.
+ * Returns the record size, 0 when no query is left.
+ */
+static uint8_t Next_Modbus_record(uint8_t *slot, uint8_t *record) {
+    MODBUS_MASTER_QUERY masterQuery;
+    modbus_query_data_t query;
 
-    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++) {
-        memset(&modbus_query_list[i], 0xFF, sizeof(modbus_query_data_t));
+    while (*slot < QUERY_SCHEDULER_MAX_TASKS) {
+        if (Query_Scheduler_getQuery((*slot)++, &masterQuery)) {
+            Modbus_query_from_master(&masterQuery, &query);
+            return Encode_Modbus_query(&query, record);
+        }
     }
+    return 0;
+}
+
+/**
+ * Writes the part of an area that differs from the stored content only, adding
+ * or removing a query leaves the records before it untouched.
+ */
+static iws_storage_res_e Write_Modbus_area(uint8_t *buffer, uint16_t start, uint16_t size) {
+    uint8_t stored[32];
+    uint16_t first = size;
+    uint16_t last = 0;
 
-    uint16_t idx = 0;
-    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++) {
-        if (idx < MODBUS_QUERY_STORAGE_SIZE) {
-            memcpy(&modbus_query_list[i], &buffer[idx], sizeof(modbus_query_data_t));
-            idx = idx + sizeof(modbus_query_data_t);
+    for (uint16_t offset = 0; offset < size; offset += sizeof(stored)) {
+        uint16_t length = (size - offset < sizeof(stored)) ? size - offset : sizeof(stored);
+        if (Iws_storage_read(stored, start + offset, length) != IWS_STORAGE_RES_OK) {
+            // Unknown content, written in full
+            return Iws_storage_write(buffer, start, size);
         }
+        for (uint16_t i = 0; i < length; i++) {
+            if (stored[i] != buffer[offset + i]) {
+                if (first == size) {
+                    first = offset + i;
+                }
+                last = offset + i;
+            }
+        }
+    }
+    if (first == size) {
+        return IWS_STORAGE_RES_OK;
     }
+    return Iws_storage_write(&buffer[first], start + first, last + 1 - first);
+}
 
-    return SETTINGS_OK;
+// The queries are kept in the scheduler task table only, they are saved from there.
+settings_e Save_Modbus_queries(void) {
+    // Large enough for each area
+    uint8_t buffer[MODBUS_QUERY_STORAGE_SIZE];
+    uint8_t record[QUERY_RECORD_MAX_SIZE];
+    uint8_t slot = 0;
+    uint8_t size = Next_Modbus_record(&slot, record);
+    uint8_t layout = MODBUS_SETTINGS_LAYOUT_MIGRATING;
+
+    if (query_layout != MODBUS_SETTINGS_LAYOUT_VERSION) {
+        // Marked first, the areas are not read in the previous layout after a reset in between
+        if (Iws_storage_write(&layout, MODBUS_SETTINGS_LAYOUT_START, sizeof(layout)) != IWS_STORAGE_RES_OK) {
+            return SETTINGS_SAVE_ERROR;
+        }
+        query_layout = layout;
+    }
+    for (uint8_t area = 0; area < QUERY_AREAS; area++) {
+        uint16_t used = 0;
+        memset(buffer, 0xFF, query_areas[area].size);
+        while (size != 0 && used + size <= query_areas[area].size) {
+            memcpy(&buffer[used], record, size);
+            used += size;
+            size = Next_Modbus_record(&slot, record);
+        }
+        if (Write_Modbus_area(buffer, query_areas[area].start, query_areas[area].size) != IWS_STORAGE_RES_OK) {
+            return SETTINGS_SAVE_ERROR;
+        }
+    }
+    if (query_layout != MODBUS_SETTINGS_LAYOUT_VERSION) {
+        layout = MODBUS_SETTINGS_LAYOUT_VERSION;
+        if (Iws_storage_write(&layout, MODBUS_SETTINGS_LAYOUT_START, sizeof(layout)) != IWS_STORAGE_RES_OK) {
+            return SETTINGS_SAVE_ERROR;
+        }
+        query_layout = layout;
+    }
+    // Queries left over don't fit the areas
+    return (size == 0) ? SETTINGS_OK : SETTINGS_SAVE_ERROR;
 }
 
-void Add_Modbus_query(modbus_query_data_t query) {
-    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++) {
-        if (modbus_query_list[i].queryId == query.queryId || modbus_query_list[i].queryId == 0xFF) {
-            memcpy(&modbus_query_list[i], &query, sizeof(modbus_query_data_t));
-            break;
+/**
+ * Layouts 0 and 1: fixed size records, the cursor is the record index.
+ * Layout 0 (not versioned) has intervals in seconds and no unit field.
+ */
+static bool Read_Modbus_fixed_query(uint16_t *cursor, modbus_query_data_t *query) {
+    while (*cursor < MODBUS_LEGACY_QUERY_RECORDS) {
+        uint16_t index = (*cursor)++;
+        memset(query, 0xFF, sizeof(modbus_query_data_t));
+        if (Iws_storage_read((uint8_t *) query, MODBUS_SETTINGS_STORAGE_START_ADD + index * MODBUS_SETTINGS_STORAGE_SIZE,
+                             MODBUS_SETTINGS_STORAGE_SIZE) != IWS_STORAGE_RES_OK) {
+            return false;
+        }
+        if (query->queryId == 0xFF) {
+            continue;
         }
+        // Missing extension area (first boot after update) leaves the defaults
+        Iws_storage_read((uint8_t *) &query->ext, MODBUS_QUERY_EXT_STORAGE_START + index * MODBUS_QUERY_EXT_STORAGE_SIZE,
+                         MODBUS_QUERY_EXT_STORAGE_SIZE);
+        if (query_layout == 0xFF) {
+            query->ext.intervalUnit = MODBUS_INTERVAL_UNIT_S;
+        }
+        return true;
     }
-    Save_Modbus_settings();
+    return false;
 }
 
-void Remove_Modbus_query(uint8_t queryId) {
-    for (uint8_t i = 0; i < QUERY_SCHEDULER_MAX_TASKS; i++) {
-        if (modbus_query_list[i].queryId == queryId) {
-            memset(&modbus_query_list[i], 0xFF, sizeof(modbus_query_data_t));
+bool Read_Modbus_query(uint16_t *cursor, modbus_query_data_t *query) {
+    uint8_t record[QUERY_RECORD_MAX_SIZE];
+    uint16_t first = 0;
+
+    if (query_layout < 2 || query_layout == 0xFF) {
+        return Read_Modbus_fixed_query(cursor, query);
+    }
+    // The cursor is the position in the areas put end to end
+    for (uint8_t area = 0; area < QUERY_AREAS; area++) {
+        while (*cursor >= first && *cursor < first + query_areas[area].size) {
+            uint16_t offset = *cursor - first;
+            uint8_t size = 0xFF;
+            Iws_storage_read(&size, query_areas[area].start + offset, 1);
+            if (size < QUERY_RECORD_MIN_SIZE || size > QUERY_RECORD_MAX_SIZE
+                || offset + size > query_areas[area].size) {
+                // End of the records of this area
+                *cursor = first + query_areas[area].size;
+                break;
+            }
+            *cursor += size;
+            if (Iws_storage_read(record, query_areas[area].start + offset, size) == IWS_STORAGE_RES_OK
+                && Decode_Modbus_query(record, query)) {
+                return true;
+            }
         }
+        first += query_areas[area].size;
+    }
+    return false;
+}
+
+bool Modbus_query_upgrade_pending(void) {
+    return query_layout != MODBUS_SETTINGS_LAYOUT_VERSION;
+}
+
+uint32_t Modbus_query_interval_ms(const modbus_query_data_t *query) {
+    if (query->ext.intervalUnit == MODBUS_INTERVAL_UNIT_MS) {
+        return query->interval;
+    }
+    return (uint32_t) query->interval * 1000;
+}
+
+void Modbus_query_set_interval_ms(modbus_query_data_t *query, uint32_t intervalMs) {
+    if ((intervalMs % 1000) != 0 && intervalMs <= 0xFFFF) {
+        query->interval = (uint16_t) intervalMs;
+        query->ext.intervalUnit = MODBUS_INTERVAL_UNIT_MS;
+    } else {
+        query->interval = (uint16_t) (intervalMs / 1000);
+        query->ext.intervalUnit = MODBUS_INTERVAL_UNIT_S;
     }
-    Save_Modbus_settings();
+}
+
+void Modbus_query_to_master(const modbus_query_data_t *query, MODBUS_MASTER_QUERY *masterQuery) {
+    memset(masterQuery, 0, sizeof(MODBUS_MASTER_QUERY));
+    masterQuery->queryId = query->queryId;
+    masterQuery->u8id = query->slaveId;
+    masterQuery->deviceDetail.deviceId = query->deviceDetails.deviceId;
+    masterQuery->deviceDetail.status = query->deviceDetails.status;
+    masterQuery->deviceDetail.attrId = query->deviceDetails.attrId;
+    masterQuery->u8fct = query->functionCode;
+    masterQuery->u16RegAdd = query->startAddr;
+    masterQuery->u16CoilsNo = query->length;
+    masterQuery->intervalMs = Modbus_query_interval_ms(query);
+    masterQuery->oneTime = query->oneTime;
+    masterQuery->decode = query->ext.decode;
+    masterQuery->registerMask = query->ext.registerMask;
+    masterQuery->debounce = query->ext.debounce;
+    masterQuery->priority = query->ext.priority;
+    masterQuery->writeOps = query->writeOps;
+    masterQuery->dataLength = (query->dataLength > MAX_WRITE_DATA_BUFFER) ? MAX_WRITE_DATA_BUFFER : query->dataLength;
+    memcpy(masterQuery->writeData, query->writeData, masterQuery->dataLength);
+}
+
+void Modbus_query_from_master(const MODBUS_MASTER_QUERY *masterQuery, modbus_query_data_t *query) {
+    memset(query, 0xFF, sizeof(modbus_query_data_t));
+    query->queryId = masterQuery->queryId;
+    query->slaveId = masterQuery->u8id;
+    query->deviceDetails.deviceId = masterQuery->deviceDetail.deviceId;
+    query->deviceDetails.status = masterQuery->deviceDetail.status;
+    query->deviceDetails.attrId = masterQuery->deviceDetail.attrId;
+    query->functionCode = masterQuery->u8fct;
+    query->startAddr = masterQuery->u16RegAdd;
+    query->length = (uint8_t) masterQuery->u16CoilsNo;
+    query->oneTime = masterQuery->oneTime;
+    query->isEnable = true;
+    query->writeOps = masterQuery->writeOps;
+    query->dataLength = masterQuery->dataLength;
+    memcpy(query->writeData, masterQuery->writeData, masterQuery->dataLength);
+    query->ext.decode = masterQuery->decode;
+    query->ext.registerMask = masterQuery->registerMask;
+    query->ext.debounce = masterQuery->debounce;
+    query->ext.priority = masterQuery->priority;
+    Modbus_query_set_interval_ms(query, masterQuery->intervalMs);
 }
 
 settings_e remove_AllQueries(void) {
-    settings_e res;
-    for(uint8_t index = 0;index<QUERY_SCHEDULER_MAX_TASKS;index++) {
-        memset(&modbus_query_list[index],0xFF, sizeof(modbus_query_data_t));
+    uint8_t buffer[MODBUS_QUERY_STORAGE_SIZE];
+
+    memset(buffer, 0xFF, sizeof(buffer));
+    if (Iws_storage_write(buffer, MODBUS_SETTINGS_STORAGE_START_ADD, MODBUS_QUERY_STORAGE_SIZE) != IWS_STORAGE_RES_OK
+        || Iws_storage_write(buffer, MODBUS_QUERY_EXT_STORAGE_START, MODBUS_QUERY_EXT_AREA_SIZE) != IWS_STORAGE_RES_OK) {
+        return SETTINGS_SAVE_ERROR;
     }
-    res = Save_Modbus_settings();
-    return res;
+    return SETTINGS_OK;
 }
 
 settings_e configure_Modbus(write_configure_t config) {
     iws_storage_res_e res;
     uint8_t buffer[UART_CONFIGURATIOIN_STORAGE_SIZE] = {'\0'};
-    memcpy(&buffer,&config, sizeof(buffer));
-    res = Iws_storage_write((uint8_t *) &configuration, UART_CONFIGURATION_STORAGE_START, UART_CONFIGURATIOIN_STORAGE_SIZE);
+    memcpy(&buffer,&config, sizeof(config));
+    res = Iws_storage_write((uint8_t *) &buffer, UART_CONFIGURATION_STORAGE_START, UART_CONFIGURATIOIN_STORAGE_SIZE);
     if(res != IWS_STORAGE_RES_OK) {
         return SETTINGS_SAVE_ERROR;
     }
@@ -106,17 +424,189 @@ settings_e configure_Modbus(write_configure_t config) {
 write_configure_t getConfiguration(void) {
     uint8_t buffer[UART_CONFIGURATIOIN_STORAGE_SIZE] = {'\0'};
     Iws_storage_read((uint8_t *) &buffer, UART_CONFIGURATION_STORAGE_START, UART_CONFIGURATIOIN_STORAGE_SIZE);
-    memcpy(&configuration, buffer, sizeof(buffer));
+    memcpy(&configuration, buffer, sizeof(configuration));
     return configuration;
 }
 
-void Init_Modbus_settings() {
-    Read_Modbus_settings();
-    getConfigureTimeoutDelayTlv();
+static settings_e Save_Modbus_rules(void) {
+    iws_storage_res_e res;
+
+    res = Iws_storage_write((uint8_t *) modbus_rule_list, MODBUS_RULES_STORAGE_START, sizeof(modbus_rule_list));
+    if (res != IWS_STORAGE_RES_OK) {
+        return SETTINGS_SAVE_ERROR;
+    }
+    return SETTINGS_OK;
+}
+
+static settings_e Read_Modbus_rules(void) {
+    iws_storage_res_e res;
+
+    res = Iws_storage_read((uint8_t *) modbus_rule_list, MODBUS_RULES_STORAGE_START, sizeof(modbus_rule_list));
+    if (res != IWS_STORAGE_RES_OK) {
+        memset(modbus_rule_list, 0xFF, sizeof(modbus_rule_list));
+        return SETTINGS_READ_ERROR;
+    }
+    return SETTINGS_OK;
+}
+
+settings_e Add_Modbus_rule(modbus_rule_t rule) {
+    modbus_rule_t *slot = NULL;
+    for (uint8_t i = 0; i < MODBUS_MAX_RULES; i++) {
+        if (modbus_rule_list[i].ruleId == rule.ruleId) {
+            slot = &modbus_rule_list[i];
+            break;
+        }
+        if (slot == NULL && modbus_rule_list[i].ruleId == 0xFF) {
+            slot = &modbus_rule_list[i];
+        }
+    }
+    if (slot == NULL) {
+        return SETTINGS_SAVE_ERROR;
+    }
+    *slot = rule;
+    return Save_Modbus_rules();
+}
+
+settings_e Remove_Modbus_rule(uint8_t ruleId) {
+    for (uint8_t i = 0; i < MODBUS_MAX_RULES; i++) {
+        if (modbus_rule_list[i].ruleId == ruleId) {
+            memset(&modbus_rule_list[i], 0xFF, sizeof(modbus_rule_t));
+        }
+    }
+    return Save_Modbus_rules();
+}
+
+modbus_rule_t* Get_Modbus_rules() {
+    return modbus_rule_list;
+}
+
+static void Read_Modbus_admission(void) {
+    if (Iws_storage_read((uint8_t *) &modbus_admission, MODBUS_ADMISSION_STORAGE_START,
+                         MODBUS_ADMISSION_STORAGE_SIZE) != IWS_STORAGE_RES_OK) {
+        memset(&modbus_admission, 0xFF, sizeof(modbus_admission));
+    }
+}
+
+settings_e Set_Modbus_admission(modbus_admission_t admission) {
+    if (admission.ceiling == 0 || admission.ceiling > 1000
+        || (admission.mode != QUERY_ADMISSION_REJECT && admission.mode != QUERY_ADMISSION_FLAG)) {
+        return SETTINGS_SAVE_ERROR;
+    }
+    if (Iws_storage_write((uint8_t *) &admission, MODBUS_ADMISSION_STORAGE_START,
+                          MODBUS_ADMISSION_STORAGE_SIZE) != IWS_STORAGE_RES_OK) {
+        return SETTINGS_SAVE_ERROR;
+    }
+    modbus_admission = admission;
+    return SETTINGS_OK;
+}
+
+modbus_admission_t Get_Modbus_admission(void) {
+    modbus_admission_t admission = modbus_admission;
+    if (admission.ceiling == 0xFFFF) {
+        admission.ceiling = QUERY_ADMISSION_DEFAULT_CEILING;
+    }
+    if (admission.mode == 0xFF) {
+        admission.mode = QUERY_ADMISSION_FLAG;
+    }
+    return admission;
+}
+
+settings_e Set_Modbus_write_window(uint16_t windowMs) {
+    if (windowMs > QUERY_WRITE_WINDOW_MAX_MS) {
+        return SETTINGS_SAVE_ERROR;
+    }
+    if (Iws_storage_write((uint8_t *) &windowMs, MODBUS_WRITE_WINDOW_STORAGE_START,
+                          MODBUS_WRITE_WINDOW_STORAGE_SIZE) != IWS_STORAGE_RES_OK) {
+        return SETTINGS_SAVE_ERROR;
+    }
+    modbus_write_window = windowMs;
+    return SETTINGS_OK;
+}
+
+uint16_t Get_Modbus_write_window(void) {
+    return (modbus_write_window == 0xFFFF) ? 0 : modbus_write_window;
+}
+
+settings_e Set_Modbus_block_limit(modbus_block_limit_t limit) {
+    modbus_block_limit_t *slot = NULL;
+    if (limit.slaveId == 0 || limit.slaveId > 247) {
+        return SETTINGS_SAVE_ERROR;
+    }
+    for (uint8_t i = 0; i < MODBUS_MAX_BLOCK_LIMITS; i++) {
+        if (modbus_block_limits[i].slaveId == limit.slaveId) {
+            slot = &modbus_block_limits[i];
+            break;
+        }
+        if (slot == NULL && modbus_block_limits[i].slaveId == 0xFF) {
+            slot = &modbus_block_limits[i];
+        }
+    }
+    if (limit.maxRegs == 0) {
+        if (slot == NULL || slot->slaveId != limit.slaveId) {
+            return SETTINGS_OK;
+        }
+        memset(slot, 0xFF, sizeof(modbus_block_limit_t));
+    } else if (slot == NULL) {
+        return SETTINGS_SAVE_ERROR;
+    } else {
+        *slot = limit;
+    }
+    if (Iws_storage_write((uint8_t *) modbus_block_limits, MODBUS_BLOCK_LIMITS_STORAGE_START,
+                          sizeof(modbus_block_limits)) != IWS_STORAGE_RES_OK) {
+        return SETTINGS_SAVE_ERROR;
+    }
+    return SETTINGS_OK;
+}
+
+const modbus_block_limit_t* Get_Modbus_block_limits(void) {
+    return modbus_block_limits;
 }
 
-modbus_query_data_t* Get_Modbus_settings() {
-    return modbus_query_list;
+settings_e Set_Modbus_uplink_budget(modbus_uplink_budget_t budget) {
+    // 0xFFFF would read back as the default
+    if (budget.bytesPerSec == 0xFFFF || budget.packetsPerSec == 0xFFFF) {
+        return SETTINGS_SAVE_ERROR;
+    }
+    if (Iws_storage_write((uint8_t *) &budget, MODBUS_UPLINK_BUDGET_STORAGE_START,
+                          MODBUS_UPLINK_BUDGET_STORAGE_SIZE) != IWS_STORAGE_RES_OK) {
+        return SETTINGS_SAVE_ERROR;
+    }
+    modbus_uplink_budget = budget;
+    return SETTINGS_OK;
+}
+
+modbus_uplink_budget_t Get_Modbus_uplink_budget(void) {
+    modbus_uplink_budget_t budget = modbus_uplink_budget;
+    if (budget.bytesPerSec == 0xFFFF) {
+        budget.bytesPerSec = UPLINK_BUDGET_BYTES_PER_SEC;
+    }
+    if (budget.packetsPerSec == 0xFFFF) {
+        budget.packetsPerSec = UPLINK_BUDGET_PACKETS_PER_SEC;
+    }
+    return budget;
+}
+
+void Init_Modbus_settings() {
+    // Queries saved by an older layout are read as such, then saved again in
+    // the current layout once in the scheduler (Modbus_query_upgrade_pending)
+    if (Iws_storage_read(&query_layout, MODBUS_SETTINGS_LAYOUT_START, sizeof(query_layout)) != IWS_STORAGE_RES_OK) {
+        query_layout = 0xFF;
+    }
+    Read_Modbus_rules();
+    Read_Modbus_admission();
+    if (Iws_storage_read((uint8_t *) &modbus_write_window, MODBUS_WRITE_WINDOW_STORAGE_START,
+                         MODBUS_WRITE_WINDOW_STORAGE_SIZE) != IWS_STORAGE_RES_OK) {
+        modbus_write_window = 0xFFFF;
+    }
+    if (Iws_storage_read((uint8_t *) modbus_block_limits, MODBUS_BLOCK_LIMITS_STORAGE_START,
+                         sizeof(modbus_block_limits)) != IWS_STORAGE_RES_OK) {
+        memset(modbus_block_limits, 0xFF, sizeof(modbus_block_limits));
+    }
+    if (Iws_storage_read((uint8_t *) &modbus_uplink_budget, MODBUS_UPLINK_BUDGET_STORAGE_START,
+                         MODBUS_UPLINK_BUDGET_STORAGE_SIZE) != IWS_STORAGE_RES_OK) {
+        memset(&modbus_uplink_budget, 0xFF, sizeof(modbus_uplink_budget));
+    }
+    getConfigureTimeoutDelayTlv();
 }
 
 settings_e configureTimeoutDelayTlv(configure_DelayTlv_t data) {
@@ -138,12 +628,18 @@ settings_e getConfigureTimeoutDelayTlv(void) {
     if(buffer[0] == 0xFF && buffer[1] == 0xFF) {
         timeoutDelayTlv.continuousOnTlv = 0;
         timeoutDelayTlv.timeoutPeriod = 1000;
-        timeoutDelayTlv.delay = 400;
+        timeoutDelayTlv.delay = 0;
         configureTimeoutDelayTlv(timeoutDelayTlv);
 
         return SETTINGS_READ_ERROR;
     }
     
-    memcpy((uint8_t *) &timeoutDelayTlv, buffer, sizeof(configure_DelayTlv_t));
+    memcpy((uint8_t *) &timeoutDelayTlv, buffer, sizeof(buffer));
+    // The delay is now the bus idle time between queries, the old default
+    // saved by layout 0 nodes would still hold the bus after every query
+    if (query_layout == 0xFF && timeoutDelayTlv.delay == TLV_LEGACY_DELAY) {
+        timeoutDelayTlv.delay = 0;
+        configureTimeoutDelayTlv(timeoutDelayTlv);
+    }
     return SETTINGS_OK;
 }
\ No newline at end of file
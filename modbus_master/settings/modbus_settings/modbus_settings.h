@@ -8,8 +8,10 @@
 #include "../settings_common.h"
 #include "../../../iws_libraries/utils/iws.h"
 #include "../../query_scheduler/query_scheduler.h"
+#include "../../iws/uplink_budget/uplink_budget.h"
 
-#define MODBUS_QUERY_STORAGE_SIZE (QUERY_SCHEDULER_MAX_TASKS * MODBUS_SETTINGS_STORAGE_SIZE)
+#define MODBUS_QUERY_STORAGE_SIZE (MODBUS_LEGACY_QUERY_RECORDS * MODBUS_SETTINGS_STORAGE_SIZE)
+#define MODBUS_QUERY_EXT_AREA_SIZE (MODBUS_LEGACY_QUERY_RECORDS * MODBUS_QUERY_EXT_STORAGE_SIZE)
 #define MAX_WRITE_DATA_BUFFER 8
 
 typedef struct __attribute__ ((packed)) {
@@ -18,6 +20,31 @@ typedef struct __attribute__ ((packed)) {
     uint16_t attrId;
 } device_details_t;
 
+/**
+ * Unit of the interval of a query record. Records saved before the unit existed
+ * have the field erased and are in seconds.
+ */
+typedef enum {
+    MODBUS_INTERVAL_UNIT_MS = 0x01,     // interval is in ms, up to 65535.
+    MODBUS_INTERVAL_UNIT_S = 0xFF,      // interval is in seconds.
+} modbus_interval_unit_e;
+
+#define MODBUS_MIN_INTERVAL_MS 50 // shortest polling interval accepted.
+
+/**
+ * Query settings that do not fit in the original 24 byte record.
+ * They are persisted in their own area so existing records keep their layout.
+ * Erased (0xFF) fields mean default behaviour.
+ */
+typedef struct __attribute__ ((packed)) {
+    modbus_decode_t decode;
+    uint32_t registerMask;      // registers of the read range to report, bit 0 is the first one.
+    uint8_t debounce;           // FC1/FC2: report input edges debounced over this many polls.
+    uint8_t intervalUnit;       // modbus_interval_unit_e of the interval field.
+    uint8_t priority;           // query_priority_e, periods are stretched by priority on an overloaded bus.
+    uint8_t reserved[1];
+} modbus_query_ext_t;
+
 typedef struct __attribute__ ((packed)) {
     uint8_t queryId;
     uint8_t slaveId;
@@ -31,6 +58,7 @@ typedef struct __attribute__ ((packed)) {
     bool writeOps;
     uint8_t dataLength;
     uint8_t writeData[MAX_WRITE_DATA_BUFFER];
+    modbus_query_ext_t ext;
 } modbus_query_data_t;
 
 typedef struct __attribute__ ((packed)) {
@@ -43,13 +71,257 @@ typedef struct {
     uint8_t read_rmv; // 1 for read and 0 for delete 2 for read all available query numbers.
 } query_read_t;
 
+typedef enum {
+    RULE_OP_GT = 1, // register > threshold
+    RULE_OP_LT = 2, // register < threshold
+    RULE_OP_EQ = 3, // register == threshold
+    RULE_OP_NE = 4, // register != threshold
+} rule_op_e;
+
+#define RULE_OP_SIGNED 0x80 // or'ed with the operator to compare registers as int16.
+
+/**
+ * Local rule: when the condition on a register of a query reply becomes true,
+ * a write is queued to the target without going through the backend.
+ */
+typedef struct __attribute__ ((packed)) {
+    uint8_t ruleId;         // 0xFF when the slot is free.
+    uint8_t queryId;        // query whose replies are evaluated.
+    uint8_t regIndex;       // register (FC3/FC4) or input (FC1/FC2) index in the read range.
+    uint8_t op;             // rule_op_e, with RULE_OP_SIGNED if needed.
+    uint16_t threshold;
+    uint16_t hysteresis;    // GT/LT only: condition is released at threshold -/+ hysteresis.
+    uint8_t slaveId;        // write target.
+    uint8_t functionCode;   // 5, 6 or 16.
+    uint16_t regAddr;
+    uint8_t count;          // FC16: number of registers written (1 or 2).
+    uint16_t value[2];      // FC5: 0xFF00 for on, 0x0000 for off.
+} modbus_rule_t;
+
+typedef struct __attribute__ ((packed)) {
+    modbus_rule_t rule;
+    bool isEnable;          // 0 removes the rule.
+} write_rule_t;
+
+typedef struct __attribute__ ((packed)) {
+    read_attr_res_t readAttr;
+    modbus_rule_t rule;
+} read_attr_modbus_rule_t;
+
+/**
+ * One time FC22 mask write, sent as a write query on the urgent lane. The slave
+ * sets its register to (register AND andMask) OR (orMask AND NOT andMask).
+ */
+typedef struct __attribute__ ((packed)) {
+    uint8_t queryId;        // below QUERY_ID_INTERNAL_FIRST, identifies the acknowledge like a query.
+    uint8_t slaveId;
+    uint8_t deviceId;
+    uint16_t regAddr;
+    uint16_t andMask;
+    uint16_t orMask;
+} write_mask_t;
+
+/**
+ * Admission control of the periodic queries. A query whose bus time, added to
+ * the one of the others, goes above the ceiling is refused or flagged.
+ * Erased (0xFF) fields mean default behaviour.
+ */
+typedef struct __attribute__ ((packed)) {
+    uint16_t ceiling;       // permille of the bus time, 1 to 1000, QUERY_ADMISSION_DEFAULT_CEILING by default.
+    uint8_t mode;           // query_admission_mode_e, flag by default.
+} modbus_admission_t;
+
+typedef struct __attribute__ ((packed)) {
+    read_attr_res_t readAttr;
+    modbus_admission_t admission;
+    uint16_t utilisation;   // current load of the periodic queries in permille.
+} read_attr_modbus_admission_t;
+
+typedef struct __attribute__ ((packed)) {
+    read_attr_res_t readAttr;
+    uint16_t windowMs;      // time a one time FC5/FC6 write waits for others to join, 0 when off.
+} read_attr_write_window_t;
+
+#define MODBUS_BLOCK_ADDR_GAP   0x01 // an address exception ended the probe, the limit may be the end of the register map.
+#define MODBUS_BLOCK_SET        0x02 // set by the backend, not probed.
+
+/**
+ * Largest FC3/FC4 read a slave accepts, probed by the node or set by the
+ * backend. Larger reads of the slave are sent in several frames.
+ */
+typedef struct __attribute__ ((packed)) {
+    uint8_t slaveId;        // 0xFF when the slot is free.
+    uint8_t maxRegs;        // registers per read frame, 0 in a write removes the limit (probed again).
+    uint8_t flags;          // MODBUS_BLOCK_xxx.
+} modbus_block_limit_t;
+
+typedef struct __attribute__ ((packed)) {
+    read_attr_res_t readAttr;
+    modbus_block_limit_t limits[MODBUS_MAX_BLOCK_LIMITS];
+} read_attr_block_limits_t;
+
+/**
+ * Rates of the radio uplink budget. A rate of 0 turns its bucket off, the
+ * sends are counted but never raise the backpressure.
+ * Erased (0xFF) fields mean the build defaults (UPLINK_BUDGET_xxx_PER_SEC).
+ */
+typedef struct __attribute__ ((packed)) {
+    uint16_t bytesPerSec;   // 0 to 65534.
+    uint16_t packetsPerSec; // 0 to 65534.
+} modbus_uplink_budget_t;
+
+
+
+/**
+ * @brief
+ * This method returns the polling interval of a query record in ms.
+ * @param  query record.
+ * @return interval in ms.
+ */
+uint32_t Modbus_query_interval_ms(const modbus_query_data_t *query);
+
+/**
+ * @brief
+ * This method sets the interval of a query record, in ms when it has a fraction
+ * of a second and fits 16 bits, in seconds otherwise.
+ * @param  query record.
+ * @param  intervalMs interval in ms.
+ */
+void Modbus_query_set_interval_ms(modbus_query_data_t *query, uint32_t intervalMs);
+
+/**
+ * @brief
+ * This method converts a query record to the scheduler query.
+ * @param  query record.
+ * @param  masterQuery scheduler query to fill.
+ */
+void Modbus_query_to_master(const modbus_query_data_t *query, MODBUS_MASTER_QUERY *masterQuery);
+
+/**
+ * @brief
+ * This method converts a scheduler query to a query record.
+ * @param  masterQuery scheduler query.
+ * @param  query record to fill.
+ */
+void Modbus_query_from_master(const MODBUS_MASTER_QUERY *masterQuery, modbus_query_data_t *query);
+
+/**
+ * @brief
+ * This method saves the periodic queries of the scheduler task table, the only
+ * copy of the queries in RAM, in variable length records.
+ * @param  None.
+ * @return settings_e status, SETTINGS_SAVE_ERROR if the queries don't all fit.
+ */
+settings_e Save_Modbus_queries(void);
+
+/**
+ * @brief
+ * This method reads the next saved query, used at boot to fill the task table.
+ * @param  cursor position in the saved queries, 0 for the first one.
+ * @param  query record to fill.
+ * @return false when there is no query left.
+ */
+bool Read_Modbus_query(uint16_t *cursor, modbus_query_data_t *query);
 
+/**
+ * @brief
+ * This method tells if the queries were read from an older layout, they have
+ * to be saved again once restored.
+ * @param  None.
+ * @return true if the queries have to be saved again.
+ */
+bool Modbus_query_upgrade_pending(void);
 
-void Add_Modbus_query(modbus_query_data_t query);
-void Remove_Modbus_query(uint8_t queryId);
 settings_e remove_AllQueries(void);
 void Init_Modbus_settings();
-modbus_query_data_t* Get_Modbus_settings();
+
+/**
+ * @brief
+ * This method adds or replaces a local rule and saves the rule table.
+ * @param  modbus_rule_t rule.
+ * @return settings_e status, SETTINGS_SAVE_ERROR if the table is full.
+ */
+settings_e Add_Modbus_rule(modbus_rule_t rule);
+
+/**
+ * @brief
+ * This method removes a local rule and saves the rule table.
+ * @param  ruleId rule to remove.
+ * @return settings_e status.
+ */
+settings_e Remove_Modbus_rule(uint8_t ruleId);
+
+/**
+ * @brief
+ * This method returns the local rule table (MODBUS_MAX_RULES entries).
+ * @param  None.
+ * @return rule table.
+ */
+modbus_rule_t* Get_Modbus_rules();
+
+/**
+ * @brief
+ * This method validates and saves the admission settings.
+ * @param  modbus_admission_t admission settings.
+ * @return settings_e status, SETTINGS_SAVE_ERROR if out of range.
+ */
+settings_e Set_Modbus_admission(modbus_admission_t admission);
+
+/**
+ * @brief
+ * This method returns the admission settings, defaults applied.
+ * @param  None.
+ * @return modbus_admission_t admission settings.
+ */
+modbus_admission_t Get_Modbus_admission(void);
+
+/**
+ * @brief
+ * This method validates and saves the write combining window.
+ * @param  windowMs time in ms, 0 to QUERY_WRITE_WINDOW_MAX_MS, 0 turns the window off.
+ * @return settings_e status, SETTINGS_SAVE_ERROR if out of range.
+ */
+settings_e Set_Modbus_write_window(uint16_t windowMs);
+
+/**
+ * @brief
+ * This method returns the write combining window in ms, 0 (off) by default.
+ * @param  None.
+ * @return uint16_t window.
+ */
+uint16_t Get_Modbus_write_window(void);
+
+/**
+ * @brief
+ * This method adds or replaces the read limit of a slave and saves the limit table.
+ * @param  modbus_block_limit_t limit, maxRegs 0 removes the limit of the slave.
+ * @return settings_e status, SETTINGS_SAVE_ERROR if the table is full.
+ */
+settings_e Set_Modbus_block_limit(modbus_block_limit_t limit);
+
+/**
+ * @brief
+ * This method returns the read limit table (MODBUS_MAX_BLOCK_LIMITS entries).
+ * @param  None.
+ * @return limit table.
+ */
+const modbus_block_limit_t* Get_Modbus_block_limits(void);
+
+/**
+ * @brief
+ * This method validates and saves the uplink budget rates.
+ * @param  modbus_uplink_budget_t rates, 0 turns a bucket off.
+ * @return settings_e status, SETTINGS_SAVE_ERROR if out of range.
+ */
+settings_e Set_Modbus_uplink_budget(modbus_uplink_budget_t budget);
+
+/**
+ * @brief
+ * This method returns the uplink budget rates, defaults applied.
+ * @param  None.
+ * @return modbus_uplink_budget_t rates.
+ */
+modbus_uplink_budget_t Get_Modbus_uplink_budget(void);
 /**
  * @brief
  * This method configures the modbus master as per slave requirement.
@@ -9,10 +9,29 @@
 #define NODE_INFO_INTERVAL_START_ADD              2
 #define MODBUS_SETTINGS_STORAGE_START_ADD         4
 #define MODBUS_SETTINGS_STORAGE_SIZE              24 // it's the size of Modbus_query_data_t changed from 23 to 24.
+#define MODBUS_LEGACY_QUERY_RECORDS               60 // layouts 0 and 1: fixed size query and extension records.
 #define UART_CONFIGURATION_STORAGE_START          1444
 #define UART_CONFIGURATIOIN_STORAGE_SIZE          3
 #define TLV_TIMEOUT_DELAY_STORAGE_START           1447
 #define TLV_TIMEOUT_DELAY_STORAGE_SIZE            5
+#define TLV_LEGACY_DELAY                          400 // layout 0: fixed delay after every query, saved as default on first boot.
+#define MODBUS_QUERY_EXT_STORAGE_START            1452 // per query extension records, same slot order as the queries.
+#define MODBUS_QUERY_EXT_STORAGE_SIZE             16 // it's the size of modbus_query_ext_t.
+#define MODBUS_RULES_STORAGE_START                2412 // after the 60 query extension records.
+#define MODBUS_RULE_STORAGE_SIZE                  17 // it's the size of modbus_rule_t.
+#define MODBUS_MAX_RULES                          16
+#define MODBUS_SETTINGS_LAYOUT_START              2684 // after the rule table, erased on nodes saved before the layout was versioned.
+#define MODBUS_SETTINGS_LAYOUT_VERSION            2 // 2: variable length query records in the query and extension areas.
+#define MODBUS_SETTINGS_LAYOUT_MIGRATING          0xFE // areas being rewritten in the current layout, each record is checked.
+#define MODBUS_ADMISSION_STORAGE_START            2685 // bus load ceiling of the periodic queries, after the layout version.
+#define MODBUS_ADMISSION_STORAGE_SIZE             3 // it's the size of modbus_admission_t.
+#define MODBUS_WRITE_WINDOW_STORAGE_START         2688 // write combining window in ms, after the admission settings.
+#define MODBUS_WRITE_WINDOW_STORAGE_SIZE          2
+#define MODBUS_BLOCK_LIMITS_STORAGE_START         2690 // largest read of the slaves, after the write combining window.
+#define MODBUS_BLOCK_LIMIT_STORAGE_SIZE           3 // it's the size of modbus_block_limit_t.
+#define MODBUS_MAX_BLOCK_LIMITS                   16
+#define MODBUS_UPLINK_BUDGET_STORAGE_START        2738 // radio uplink rates, after the 16 block limits.
+#define MODBUS_UPLINK_BUDGET_STORAGE_SIZE         4 // it's the size of modbus_uplink_budget_t.
 #define NODE_ROLE_LL_HEADNODE                   app_lib_settings_create_role(APP_LIB_SETTINGS_ROLE_HEADNODE, APP_LIB_SETTINGS_ROLE_FLAG_LL)
 
 typedef enum {